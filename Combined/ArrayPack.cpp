@@ -4,26 +4,33 @@
 void ArrayPack::check() const {
   assert( topo.width()==ksat.         width() && \
     topo.height()==ksat.         height() );
-  assert( topo.width()==land_mask.    width() && \
-    topo.height()==land_mask.    height() );
+  assert( topo.width()==land.         width() && \
+    topo.height()==land.         height() );
   assert( topo.width()==wtd.          width() && \
     topo.height()==wtd.          height() );
   assert( topo.width()==fdepth.       width() && \
     topo.height()==fdepth.       height() );
-  assert( topo.width()==temp.         width() && \
-    topo.height()==temp.         height() );
-  assert( topo.width()==slope.        width() && \
-    topo.height()==slope.        height() );
   assert( topo.width()==precip.       width() && \
     topo.height()==precip.       height() );
   assert( topo.width()==fdepth.       width() && \
     topo.height()==fdepth.       height() );
-  assert( topo.width()==temp.         width() && \
-    topo.height()==temp.         height() );
   assert( topo.width()==starting_evap.width() && \
     topo.height()==starting_evap.height() );
-  assert( topo.width()==relhum.       width() && \
-    topo.height()==relhum.       height() );
+  if(quantized){
+    assert( topo.width()==q_temp.       width() && \
+      topo.height()==q_temp.       height() );
+    assert( topo.width()==q_slope.      width() && \
+      topo.height()==q_slope.      height() );
+    assert( topo.width()==q_relhum.     width() && \
+      topo.height()==q_relhum.     height() );
+  } else {
+    assert( topo.width()==temp.         width() && \
+      topo.height()==temp.         height() );
+    assert( topo.width()==slope.        width() && \
+      topo.height()==slope.        height() );
+    assert( topo.width()==relhum.       width() && \
+      topo.height()==relhum.       height() );
+  }
   assert( topo.width()==head.         width() && \
     topo.height()==head.         height() );
   assert( topo.width()==kcell.        width() && \
@@ -44,8 +51,8 @@ void ArrayPack::check() const {
       topo.height()==fdepth_end.   height()   );
     assert( topo.width()==topo_end.  width()  && \
       topo.height()==topo_end.     height()   );
-    assert( topo.width()==temp_end.  width()  && \
-      topo.height()==temp_end.     height()   );
+    assert( topo.width()==(quantized ? q_temp_end.width()  : temp_end.width())  && \
+      topo.height()==(quantized ? q_temp_end.height() : temp_end.height())   );
     assert( topo.width()==precip_end.width()  && \
       topo.height()==precip_end.   height()   );
   }
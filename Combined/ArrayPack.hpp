@@ -1,11 +1,16 @@
 #ifndef _array_pack_
 #define _array_pack_
 
+#include "column_wrap.hpp"
+#include "hot_state.hpp"
+#include "land_mask.hpp"
+#include "quantized_grid.hpp"
 #include <richdem/common/Array2D.hpp>
 
 namespace rd = richdem;
 
 typedef richdem::Array2D<float>  f2d;
+typedef richdem::Array2D<uint8_t> u82d;
 typedef std::vector<double> dvec;
 typedef int32_t dh_label_t;
 
@@ -45,10 +50,25 @@ class ArrayPack {
   f2d starting_evap;
   f2d relhum;
   f2d slope;
-  f2d land_mask;
 
-  f2d wtd_old;
-  f2d wtd_mid;
+  //16-bit copies of slope and the climate inputs. When quantized is set, 
+  //these replace the float arrays of the same name, which are released.
+  bool quantized = false;
+  QuantizedGrid q_slope;
+  QuantizedGrid q_relhum;
+  QuantizedGrid q_relhum_start;
+  QuantizedGrid q_relhum_end;
+  QuantizedGrid q_temp;
+  QuantizedGrid q_temp_start;
+  QuantizedGrid q_temp_end;
+  QuantizedGrid q_ground_temp;
+  QuantizedGrid q_wind_speed;
+
+  u82d land_mask;  //1 on land, 0 in the ocean. Released once packed into land
+  LandMask land;
+  ColumnWrap wrap_x;  //Columns of neighbours across the east and west edges
+
+  f2d wtd_mid;  //wtd after groundwater, if abs_diagnostics is set
   f2d rech;
   f2d runoff;
   f2d head;
@@ -58,6 +78,7 @@ class ArrayPack {
   f2d e_a;
   f2d surface_evap;
   f2d wtd_change_total;
+  HotState hot;  //Only used when groundwater_layout is interleaved
 
   dh_label_t flowdir_t;
 
@@ -77,13 +77,44 @@ class DisjointDenseIntSet {
   //due to the use of ranks, as explained below), subsequent calls to any set in
   //the chain will take `O(1)` time. This technique is known as "path
   //compression".
-  unsigned int findSet(unsigned int n){
+  unsigned int findSetRecursive(unsigned int n){
     if(parent[n]==n){                  //Am I my own parent?
       return n;                        //Yes: I represent the set in question.
     } else {                           //No.
       //Who is my parent's ultimate parent? Make them my parent.
-      return parent[n] = findSet(parent[n]); 
+      return parent[n] = findSetRecursive(parent[n]); 
+    }
+  }
+
+  //Finds the representative id of a set, as `findSetRecursive()` does, but
+  //with a loop rather than recursion. As it walks up the chain of parents, each
+  //set is made to point to its grandparent, halving the length of the chain.
+  //This is known as "path halving". It keeps the same bounds as full path
+  //compression, but needs a single pass and no stack: chains built by
+  //`mergeAintoB()` can be as long as the depression hierarchy is deep, which is
+  //enough to overflow the stack when recursing.
+  unsigned int findSetHalving(unsigned int n){
+    while(parent[n]!=n){
+      parent[n] = parent[parent[n]];   //Skip my parent
+      n         = parent[n];           //and carry on from my old grandparent
     }
+    return n;
+  }
+
+  //Returns the representative id of a set. Both methods return the same id,
+  //since neither changes which set is at the top of a chain, so which is used
+  //does not change the depression hierarchy. bench_djset compares them: on
+  //hierarchies of 10^4 to 10^6 depressions they are within a few percent of
+  //each other while the hierarchy is built, and full path compression is
+  //faster for repeated queries, so it is the default. Define
+  //DJSET_PATH_HALVING to use path halving, e.g. if a very deep hierarchy
+  //overflows the stack.
+  unsigned int findSet(unsigned int n){
+  #ifdef DJSET_PATH_HALVING
+    return findSetHalving(n);
+  #else
+    return findSetRecursive(n);
+  #endif
   }
 
   //Join two sets into a single set. Note that we "cannot" predict the `id` of
@@ -1,17 +1,50 @@
 #include "irf.cpp"
 
-void initialise(Parameters &params, ArrayPack &arp){
-  ofstream textfile;
-  textfile.open (params.textfilename, std::ios_base::app);  
+#ifdef TWSM_USE_MPI
+#include "distributed_dephier.hpp"
+#include "distributed_fill_spill_merge.hpp"
+#include <memory>
+#include <mpi.h>
+
+//Set by main(), when the model runs under MPI, to how the domain is split
+//into strips of rows between the ranks. Each rank then holds only its strip
+//(see initialise_strip()).
+static std::unique_ptr<RowDecomposition> strips;
+#endif
+
+///Opens the text log, the file of per-cycle records, and the profile. Under
+///MPI only the root rank writes them.
+void open_outputs(const Parameters &params){
   //Text file to save outputs of how much is changing and 
-  //min and max wtd at various times
+  //min and max wtd at various times, and optionally a file of per-cycle 
+  //records. Both stay open for the whole run.
+  TheLogger().open(params.textfilename, \
+    params.log_records==UNINIT_STR ? "" : params.log_records, \
+    ParseLogLevel(params.log_level));
+
+  //Per-phase times and counts of work, written each cycle
+  if(params.profile_file!=UNINIT_STR)
+    TheProfiler().enable(params.profile_file);
+}
+
+
+
+///Reads the inputs and sets up the arrays of the run
+void initialise_arrays(Parameters &params, ArrayPack &arp){
+  ProfilePhase phase("initialise");
+
+  //Both run types stop after total_cycles; without it there would be nothing
+  //to do, and transient runs would have nothing to interpolate their inputs
+  //over
+  if(params.total_cycles<=0)
+    throw std::runtime_error("total_cycles must be set to a number of cycles greater than zero!");
 
   if(params.run_type=="transient"){
-    textfile<<"Initialise transient"<<std::endl;
+    Log()<<"Initialise transient"<<'\n';
     InitialiseTransient(params,arp);
   }
   else if(params.run_type == "equilibrium"){
-    textfile<<"Initialise equilibrium"<<std::endl;
+    Log()<<"Initialise equilibrium"<<'\n';
     InitialiseEquilibrium(params,arp);
   }
   else{
@@ -22,14 +55,138 @@ void initialise(Parameters &params, ArrayPack &arp){
   //compute changing cell size and distances between cells as 
   //these change with latitude:
   cell_size_area(params,arp);
-  textfile<<"computed distances, areas, and latitudes"<<std::endl;
+  Log()<<"computed distances, areas, and latitudes"<<'\n';
 
   //finalise some setup for runoff, labels, etc that is the 
   //same for both run types.
   InitialiseBoth(params,arp);
 
+  if(params.quantize_inputs){
+    QuantizeInputs(params,arp);
+    Log()<<"quantized slope and climate inputs"<<'\n';
+  }
+
   arp.check();
-  textfile.close();
+}
+
+
+
+void initialise(Parameters &params, ArrayPack &arp){
+  open_outputs(params);
+  initialise_arrays(params,arp);
+}
+
+
+
+#ifdef TWSM_USE_MPI
+///Collective. Splits the domain between the ranks into strips of rows holding
+///about the same amount of land, and reads only this rank's strip of the
+///inputs, with its halo rows, into `arp` (see domain_decomposition.hpp). The
+///ranks each read an equal share of the rows of the land mask to find the
+///strips.
+void initialise_strip(Parameters &params, ArrayPack &arp){
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  const std::string grid_file = WindowGridFile(params);
+  int grid_width, grid_height;
+  GridSize(grid_file, grid_width, grid_height);
+  const auto window = RequestedWindow(params).resolve(grid_width, grid_height, grid_file);
+
+  //Each strip moves southern_edge north by the rows below it (see
+  //InputWindow())
+  if(ranks>1 && LatitudeDecreasesByRow(grid_file))
+    throw std::runtime_error("Latitude decreases down the rows of '" + grid_file + \
+    "', so the domain can't be split into strips of rows!");
+
+  const std::string mask_file = params.surfdatadir + params.region + \
+  (params.run_type=="transient" ? params.time_end : params.time_start) + \
+  "_mask." + params.input_format;
+
+  std::vector<int> share_rows(ranks), share_y0(ranks);
+  for(int r=0;r<ranks;r++){
+    share_y0[r]   = static_cast<int64_t>(window.height)*r/ranks;
+    share_rows[r] = static_cast<int64_t>(window.height)*(r+1)/ranks - share_y0[r];
+  }
+
+  std::vector<uint64_t> my_cost(share_rows[rank], 1);
+  if(share_rows[rank]>0){
+    GridWindow share = window;
+    share.y0     = window.y0+share_y0[rank];
+    share.height = share_rows[rank];
+    const auto mask = LoadData<uint8_t>(mask_file, "value", share);
+    for(int y=0;y<mask.height();y++)
+    for(int x=0;x<mask.width();x++)
+      if(mask(x,y)!=0)
+        my_cost[y]++;
+  }
+
+  std::vector<uint64_t> row_cost(window.height);
+  MPI_Allgatherv(my_cost.data(), share_rows[rank], MPI_UINT64_T, row_cost.data(), \
+    share_rows.data(), share_y0.data(), MPI_UINT64_T, MPI_COMM_WORLD);
+  strips.reset(new RowDecomposition(MPI_COMM_WORLD, window.width, row_cost));
+
+  if(ranks>1){
+    const auto &strip = strips->mine();
+    params.window_x0     = window.x0;
+    params.window_y0     = window.y0+strip.halo_y0;
+    params.window_width  = window.width;
+    params.window_height = strip.height();
+    params.window_south  = params.window_north = std::numeric_limits<double>::quiet_NaN();
+    params.window_west   = params.window_east  = std::numeric_limits<double>::quiet_NaN();
+    params.strip_suffix  = ".strip" + std::to_string(rank+1) + "of" + std::to_string(ranks);
+    Log()<<"the domain is split into "<<ranks<<" strips of rows"<<'\n';
+  }
+
+  initialise_arrays(params,arp);
+}
+
+
+
+///Key of the dephier cache for the whole domain, from those of every strip
+static uint64_t domain_dephier_key(const ArrayPack &arp){
+  std::vector<uint64_t> key(1, DepressionHierarchyKey<float>(arp));
+  std::vector<int> counts;
+  const auto keys = strips->gatherItems(key, 0, counts);
+  if(strips->isRoot())
+    key[0] = HashBytes(keys.data(), keys.size()*sizeof(uint64_t), 0xCBF29CE484222325ULL);
+  strips->broadcast(key, 0);
+  return key[0];
+}
+#endif
+
+
+
+///Saves the water table of the whole domain. Under MPI the strips are
+///gathered onto the root rank, which writes the file.
+static void save_wtd(const ArrayPack &arp, const std::string &filename){
+#ifdef TWSM_USE_MPI
+  if(strips){
+    rd::Array2D<float> wtd;
+    if(strips->isRoot())
+      wtd = rd::Array2D<float>(strips->width(), strips->height());
+    strips->gather(arp.wtd, wtd);
+    if(strips->isRoot())
+      SaveAsNetCDF(wtd,filename,"value");
+    return;
+  }
+#endif
+  SaveAsNetCDF(arp.wtd,filename,"value");
+}
+
+
+
+///Finds the depression hierarchy, over the strips of all of the ranks under
+///MPI
+static dh::DepressionHierarchy<float> depression_hierarchy(ArrayPack &arp){
+#ifdef TWSM_USE_MPI
+  if(strips)
+    return dh::GetDepressionHierarchy<float,rd::Topology::D8>\
+    (arp, arp.label, arp.final_label, arp.flowdirs, *strips);
+#endif
+  return dh::GetDepressionHierarchy<float,rd::Topology::D8>\
+  (arp, arp.label, arp.final_label, arp.flowdirs);
 }
 
 
@@ -38,74 +195,183 @@ template<class elev_t>
 void update(Parameters &params, ArrayPack &arp, \
   richdem::dephier::DepressionHierarchy<elev_t>   &deps){
 
-  ofstream textfile;
-  textfile.open (params.textfilename, std::ios_base::app);  
+  //Every stage may add fields to this cycle's record
+  const int cycle = params.cycles_done;
+  TheProfiler().beginCycle();
+  TheLogger().beginRecord(cycle);
+  ProfilePhase phase_update("update");
 
   if(params.run_type == "transient"){
-    UpdateTransientArrays(params,arp);  
+    {
+      ProfilePhase phase("update_transient_arrays");
+      UpdateTransientArrays(params,arp);  
+    }
     //linear interpolation of input data from start to end times. 
-    auto deps = dh::GetDepressionHierarchy<float,rd::Topology::D8>\
-    (arp, arp.label, arp.final_label, arp.flowdirs);    
+    auto deps = depression_hierarchy(arp);    
     //with transient runs, we have to redo the depression hierarchy every time, 
     //since the topography is changing. 
   }
 
-  textfile<<"Cycles done: "<<params.cycles_done<<std::endl;
+  Log()<<"Cycles done: "<<params.cycles_done<<'\n';
 
 //TODO: How should equilibrium know when to exit?
 
   if((params.cycles_done % 100) == 0){
-    textfile<<"saving partway result"<<std::endl;  
+    ProfilePhase phase("save_partway");
+    Log()<<"saving partway result"<<'\n';  
     string cycles_str = to_string(params.cycles_done);
-    SaveAsNetCDF(arp.wtd,params.outfilename + cycles_str +".nc","value");  
+    save_wtd(arp,params.outfilename + cycles_str +".nc");  
     //Save the output every 100 iterations, under a new filename 
     //so we can compare how the water table has changed through time. 
   }
 
-  arp.wtd_old = arp.wtd;  //These are used to see how much change occurs 
-  arp.wtd_mid = arp.wtd;  //in FSM vs in the groundwater portion. 
+  //PrintValues measures the change in the water table from the volume it 
+  //held at the end of the previous cycle. 
+  if(std::isnan(params.wtd_volume)){
+    ProfilePhase phase("wtd_volume");
+#ifdef TWSM_USE_MPI
+    if(strips)
+      params.wtd_volume = WtdVolume(arp,*strips);
+    else
+#endif
+    params.wtd_volume = WtdVolume(arp);
+  }
 
-  for(int y=1;y<params.ncells_y-1;y++)
-  for(int x=1;x<params.ncells_x-1; x++){
-    if(arp.land_mask(x,y) == 0)          //skip ocean cells
-      continue;
-    arp.wtd(x,y) += arp.rech(x,y);
-    //add the recharge to the water table. 
+  //add the recharge to the water table, on land only. 
+  {
+    ProfilePhase phase("recharge");
+    for(int y=1;y<params.ncells_y-1;y++)
+      arp.land.forEachActiveCell(y, arp.wrap_x.periodic(), [&](const int x, const int cy){
+        arp.wtd(x,cy) += arp.rech(x,cy);
+      });
   }
 
  //Run the groundwater code to move water
-  groundwater(params,arp);
-   arp.wtd_mid = arp.wtd;
+  {
+    ProfilePhase phase("groundwater");
+#ifdef TWSM_USE_MPI
+    if(strips)
+      groundwater(params,arp,*strips);
+    else
+#endif
+    groundwater(params,arp);
+  }
 
   //Move surface water
+#ifdef TWSM_USE_MPI
+  if(strips)
+    dh::FillSpillMerge(params,deps,arp,*strips);
+  else
+#endif
   dh::FillSpillMerge(params,deps,arp);
 
+  //Print values about the change in water table depth to the text file. 
+  //This must come before evaporation_update, which replaces the recharge 
+  //used in this cycle. 
+  {
+    ProfilePhase phase("print_values");
+#ifdef TWSM_USE_MPI
+    if(strips)
+      PrintValues(params,arp,*strips);
+    else
+#endif
+    PrintValues(params,arp);
+  }
+
   //check to see where there is surface water, and adjust how evaporation works 
   //at these locations. 
-  evaporation_update(params,arp);
-
-  //Print values about the change in water table depth to the text file. 
-  PrintValues(params,arp);
+  {
+    ProfilePhase phase("evaporation");
+    evaporation_update(params,arp);
+  }
   
-  arp.wtd_old = arp.wtd;
   params.cycles_done += 1;
+
+  if(params.checkpoint_interval>0 && \
+    (params.cycles_done % params.checkpoint_interval) == 0){
+    ProfilePhase phase("checkpoint");
+    Log()<<"writing checkpoint"<<'\n';
+    //Transient runs recompute the depression hierarchy every cycle, so there 
+    //is no point in storing it. 
+    const bool store_deps = params.checkpoint_dephier && \
+      params.run_type == "equilibrium";
+    SaveCheckpoint(params,arp,store_deps ? &deps : nullptr);
+  }
+
+  phase_update.stop();
+  TheProfiler().endCycle(cycle);
+  TheLogger().endRecord();
 }
 
 
 
 void run(Parameters &params, ArrayPack &arp){
+  dh::DepressionHierarchy<float> deps;
+  bool have_deps = false;
+
+  //Pick up where a previous run left off. If the checkpoint contains the 
+  //depression hierarchy we don't need to compute it again. 
+  //Under MPI each rank restarts from the checkpoint of its own strip.
+  if(params.restart_from!=UNINIT_STR){
+    have_deps = LoadCheckpoint(params.restart_from+params.strip_suffix,params,arp,deps);
+#ifdef TWSM_USE_MPI
+    if(strips)
+      have_deps = strips->all(have_deps);
+#endif
+    if(!have_deps && params.run_type=="equilibrium")
+      Log(LogLevel::Warning)<<"checkpoint has no depression hierarchy, so it "\
+      "will be recomputed"<<std::endl;
+  }
+
+  //The hierarchy depends only on topo and land_mask, so an earlier run over 
+  //the same domain may already have computed it. 
+  const bool use_cache = params.dephier_cache!=UNINIT_STR;
+  if(use_cache)
+    PrepareDepressionHierarchyCacheDir(params);
+#ifdef TWSM_USE_MPI
+  //Each rank caches its own strip, under a key for the whole domain
+  const uint64_t cache_key = (use_cache && strips) ? domain_dephier_key(arp) : 0;
+#endif
+  if(!have_deps && use_cache){
+#ifdef TWSM_USE_MPI
+    if(strips)
+      have_deps = strips->all(LoadDepressionHierarchyCache(params,arp,deps,cache_key));
+    else
+#endif
+    have_deps = LoadDepressionHierarchyCache(params,arp,deps);
+    if(!have_deps)
+      Log()<<"no cached depression hierarchy for this domain"<<'\n';
+  }
+
   //Set the initial depression hierarchy. 
   //For equilibrium runs, this is the only time this needs to be done. 
-  auto deps = dh::GetDepressionHierarchy<float,rd::Topology::D8>\
-  (arp, arp.label, arp.final_label, arp.flowdirs);
+  if(!have_deps){
+#ifdef TWSM_USE_MPI
+    //Some ranks may have loaded their strips' labels when others could not
+    if(strips){
+      for(unsigned int i=0;i<arp.label.size();i++){
+        const auto label    = arp.land.isLand(i) ? dh::NO_DEP : dh::OCEAN;
+        arp.label(i)        = label;
+        arp.final_label(i)  = label;
+        arp.flowdirs(i)     = rd::NO_FLOW;
+      }
+    }
+#endif
+    deps = depression_hierarchy(arp);
+#ifdef TWSM_USE_MPI
+    if(use_cache && strips)
+      SaveDepressionHierarchyCache(params,arp,deps,cache_key);
+    else
+#endif
+    if(use_cache)
+      SaveDepressionHierarchyCache(params,arp,deps);
+  }
 
-  while(true){
+  //For transient - user set param that I am setting for now 
+  //at 50 to get 500 years total. The test comes before each cycle, since a
+  //run restarted from its final checkpoint has no cycles left to do.
+  while(params.cycles_done < params.total_cycles)
     update(params,arp,deps);
-    //For transient - user set param that I am setting for now 
-    //at 50 to get 500 years total. 
-    if(params.cycles_done == params.total_cycles)  
-      break;
-  }
 }
 
 
@@ -114,18 +380,58 @@ void run(Parameters &params, ArrayPack &arp){
 //we need to do. 
 void finalise(Parameters &params, ArrayPack &arp){
 
-  ofstream textfile;
-  textfile.open (params.textfilename, std::ios_base::app);  
-
-  textfile<<"done with processing"<<std::endl;  
-  SaveAsNetCDF(arp.wtd,params.outfilename,"value");  
+  Log()<<"done with processing"<<'\n';  
+  save_wtd(arp,params.outfilename);  
   //save the final answer for water table depth. 
 
-  textfile.close();
+  TheProfiler().printSummary(std::cerr,"update");
+  TheProfiler().printSummary(Log(),"update");
+  TheLogger().close();
 }
 
 
 
+//Programs which drive the model themselves, such as bench_scaling, define
+//TWSM_NO_MAIN before including this file
+#ifndef TWSM_NO_MAIN
+#ifdef TWSM_USE_MPI
+//Run with e.g. `mpirun -n 4 ./TWSM_mpi <Configuration File>`. Each rank reads
+//and holds only its strip of the domain, and every step of the cycle is split
+//between the ranks (see initialise_strip()). The root rank writes the logs and
+//the outputs, and each rank its own checkpoints and dephier cache files.
+int main(int argc, char **argv){
+  MPI_Init(&argc, &argv);
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  if(argc!=2){
+    if(rank==0)
+      std::cerr<<"Syntax: "<<argv[0]<<" <Configuration File>"<<std::endl;
+    MPI_Finalize();
+    return -1;
+  }
+
+  try {
+    ArrayPack arp;
+    Parameters params(argv[1]);
+
+    if(rank==0)
+      open_outputs(params);
+    initialise_strip(params,arp);
+    run(params,arp);
+    finalise(params, arp);
+    strips.reset();
+  } catch (const std::exception &e) {
+    //The other ranks may be waiting on this one, so they are stopped too
+    std::cerr<<"E "<<e.what()<<std::endl;
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
+#else
 int main(int argc, char **argv){
 
   if(argc!=2){    
@@ -143,4 +449,6 @@ int main(int argc, char **argv){
   finalise(params, arp);
 
   return 0;
-}
\ No newline at end of file
+}
+#endif
+#endif
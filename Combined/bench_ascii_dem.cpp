@@ -0,0 +1,95 @@
+//Benchmarks LoadDEM() against the original iostream-based loader,
+//LoadDEMReference(), and checks that they agree.
+//
+//Usage: bench_ascii_dem <FILE.dem>
+//   or: bench_ascii_dem <WIDTH> <HEIGHT>
+//
+//With a width and height, a synthetic grid of that size is written to a
+//temporary file first.
+#include "../common/ascii_grid.hpp"
+#include <richdem/common/timer.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace rd = richdem;
+
+static std::string WriteSyntheticDEM(const int width, const int height){
+  const std::string filename = "/tmp/bench_ascii_dem_" + std::to_string(width) + "x" + std::to_string(height) + ".dem";
+
+  FILE *fp = std::fopen(filename.c_str(), "w");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to create '" + filename + "'!");
+
+  //The reference loader reads the header into integers, so the header written
+  //here must hold integers for it to be usable.
+  std::fprintf(fp, "ncols %d\nnrows %d\nxllcorner -120\nyllcorner 30\ncellsize 1\nNODATA_value -9999\n", width, height);
+  for(int y=0;y<height;y++){
+    for(int x=0;x<width;x++){
+      const double elev = 500*std::sin(0.01*x)*std::cos(0.013*y) + 0.001*((x*7919+y*104729)%1000);
+      //Sprinkle in some NoData cells, as found in real coastlines
+      if((x+y)%97==0)
+        std::fprintf(fp, "-9999 ");
+      else
+        std::fprintf(fp, "%.3f ", elev);
+    }
+    std::fprintf(fp, "\n");
+  }
+  std::fclose(fp);
+
+  return filename;
+}
+
+
+
+int main(int argc, char **argv){
+  if(argc!=2 && argc!=3){
+    std::cerr<<"Syntax: "<<argv[0]<<" <FILE.dem>"<<std::endl;
+    std::cerr<<"Syntax: "<<argv[0]<<" <WIDTH> <HEIGHT>"<<std::endl;
+    return -1;
+  }
+
+  try {
+    std::string filename;
+    if(argc==3){
+      rd::Timer timer_write;
+      timer_write.start();
+      filename = WriteSyntheticDEM(std::stoi(argv[1]), std::stoi(argv[2]));
+      std::cerr<<"t Write synthetic grid = "<<timer_write.stop()<<" s"<<std::endl;
+    } else {
+      filename = argv[1];
+    }
+
+    rd::Timer timer_fast;
+    timer_fast.start();
+    const auto fast = LoadDEM<float>(filename);
+    const double fast_time = timer_fast.stop();
+    std::cerr<<"t LoadDEM          = "<<fast_time<<" s"<<std::endl;
+
+    rd::Timer timer_ref;
+    timer_ref.start();
+    const auto ref = LoadDEMReference<float>(filename);
+    const double ref_time = timer_ref.stop();
+    std::cerr<<"t LoadDEMReference = "<<ref_time<<" s"<<std::endl;
+
+    std::cerr<<"m Cells   = "<<fast.size()<<std::endl;
+    std::cerr<<"m Speedup = "<<(ref_time/fast_time)<<"x"<<std::endl;
+
+    if(fast.width()!=ref.width() || fast.height()!=ref.height())
+      throw std::runtime_error("Loaders disagree on the size of the grid!");
+    for(unsigned int i=0;i<fast.size();i++)
+      if(fast(i)!=ref(i))
+        throw std::runtime_error("Loaders disagree at cell " + std::to_string(i) + "!");
+    std::cerr<<"Loaders agree."<<std::endl;
+
+    if(argc==3)
+      std::remove(filename.c_str());
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
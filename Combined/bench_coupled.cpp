@@ -0,0 +1,208 @@
+//Benchmarks the kernels of the coupled model on synthetic domains (see
+//synthetic_terrain.hpp), so that performance can be tracked without real
+//input data.
+//
+//Usage: bench_coupled <TERRAIN> <WIDTH> <HEIGHT> [STEPS] [SEED] [RESULTS.csv]
+//
+//TERRAIN is one of fractal, nested_pits, flats, or ocean_heavy, or "all" to
+//run each in turn. STEPS is the number of times each kernel is run (3 by
+//default) and SEED picks the domain (1 by default). Each kernel is timed
+//separately:
+//
+//  * GetDepressionHierarchy()
+//  * FillSpillMerge(), with half a metre of water added to every land cell
+//  * groundwater()
+//  * evaporation_update()
+//
+//and for each the mean time per step, the land cells processed per second,
+//and the peak memory use of the process while it ran are printed. If a
+//results file is given, a row per kernel is appended to it, so that runs can
+//be compared over time.
+#include "irf.cpp"
+#include "synthetic_terrain.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+
+//Peak resident memory of the process in MB. Where it is possible, the peak
+//is reset by ResetPeakMemory(), so this is the peak since then.
+static double PeakMemoryMB(){
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(std::getline(status, line))
+    if(line.compare(0, 6, "VmHWM:")==0)
+      return std::stod(line.substr(6))/1024;
+  //Not Linux: fall back to the peak over the life of the process
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss/1024.0;
+}
+
+//Resets the peak resident memory to the current resident memory. Only Linux
+//supports this; elsewhere the peak is over the life of the process.
+static void ResetPeakMemory(){
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if(clear_refs.good())
+    clear_refs<<"5"<<std::flush;
+}
+
+
+
+struct KernelResult {
+  std::string kernel;
+  double      seconds;
+  double      peak_mb;
+  uint64_t    land_cells;
+
+  double cellsPerSecond() const { return land_cells/seconds; }
+};
+
+//Runs `kernel` `steps` times, calling `reset` untimed before each run so every
+//step does the same work, and returns the mean time per step
+template<class R, class F>
+static KernelResult TimeKernel(const std::string &name, const int steps, const uint64_t land_cells, R reset, F kernel){
+  double total = 0;
+  ResetPeakMemory();
+  for(int i=0;i<steps;i++){
+    reset();
+    rd::Timer timer;
+    timer.start();
+    kernel();
+    total += timer.stop();
+  }
+  return KernelResult{name, total/steps, PeakMemoryMB(), land_cells};
+}
+
+
+
+static std::vector<KernelResult> BenchmarkTerrain(
+  const std::string &terrain,
+  const int          width,
+  const int          height,
+  const int          steps,
+  const uint32_t     seed
+){
+  //There is no configuration file; every parameter the kernels use is set
+  //by MakeSyntheticDomain()
+  Parameters params("/dev/null");
+  ArrayPack  arp;
+  params.abs_diagnostics = false;
+
+  MakeSyntheticDomain(params, arp, terrain, width, height, seed);
+  cell_size_area(params, arp);
+  InitialiseBoth(params, arp);
+  arp.check();
+
+  const auto land_cells = arp.land.landCells();
+  std::cerr<<"m Terrain    = "<<terrain<<" (seed "<<seed<<")"<<std::endl;
+  std::cerr<<"m Cells      = "<<arp.topo.size()<<std::endl;
+  std::cerr<<"m Land cells = "<<land_cells<<" ("<<(100.0*land_cells/arp.topo.size())<<"%)"<<std::endl;
+
+  //State the kernels change, restored before each step
+  const auto label0       = arp.label;
+  const auto final_label0 = arp.final_label;
+  const auto flowdirs0    = arp.flowdirs;
+  const f2d  wtd0         = arp.wtd;
+
+  std::vector<KernelResult> results;
+
+  dh::DepressionHierarchy<float> deps;
+  results.push_back(TimeKernel("dephier", steps, land_cells,
+    [&](){
+      arp.label       = label0;
+      arp.final_label = final_label0;
+      arp.flowdirs    = flowdirs0;
+    },
+    [&](){
+      deps = dh::GetDepressionHierarchy<float,rd::Topology::D8>(arp, arp.label, arp.final_label, arp.flowdirs);
+    }
+  ));
+  std::cerr<<"m Depressions = "<<deps.size()<<std::endl;
+
+  //Half a metre of rain on every land cell gives FillSpillMerge surface water
+  //to route, lakes to fill, and depressions to overflow
+  f2d wtd_wet = wtd0;
+  for(int y=0;y<arp.land.height();y++)
+  for(auto s=arp.land.rowBegin(y);s!=arp.land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++)
+    wtd_wet(x,y) += 0.5f;
+
+  results.push_back(TimeKernel("fsm", steps, land_cells,
+    [&](){ arp.wtd = wtd_wet; },
+    [&](){ dh::FillSpillMerge(params, deps, arp); }
+  ));
+
+  results.push_back(TimeKernel("groundwater", steps, land_cells,
+    [&](){ arp.wtd = wtd0; },
+    [&](){ groundwater(params, arp); }
+  ));
+
+  results.push_back(TimeKernel("evaporation", steps, land_cells,
+    [&](){ arp.wtd = wtd0; },
+    [&](){ evaporation_update(params, arp); }
+  ));
+
+  for(const auto &r: results){
+    std::cerr<<"t "<<terrain<<" "<<r.kernel<<" = "<<r.seconds<<" s"<<std::endl;
+    std::cerr<<"m "<<terrain<<" "<<r.kernel<<" = "<<(r.cellsPerSecond()/1e6)<<" Mcells/s, peak "
+             <<r.peak_mb<<" MB"<<std::endl;
+  }
+
+  return results;
+}
+
+
+
+int main(int argc, char **argv){
+  if(argc<4 || argc>7){
+    std::cerr<<"Syntax: "<<argv[0]<<" <TERRAIN> <WIDTH> <HEIGHT> [STEPS] [SEED] [RESULTS.csv]"<<std::endl;
+    std::cerr<<"TERRAIN is one of all";
+    for(const auto &t: synthetic::TERRAINS)
+      std::cerr<<", "<<t;
+    std::cerr<<std::endl;
+    return -1;
+  }
+
+  try {
+    const std::string terrain = argv[1];
+    const int         width   = std::stoi(argv[2]);
+    const int         height  = std::stoi(argv[3]);
+    const int         steps   = argc>4 ? std::stoi(argv[4]) : 3;
+    const uint32_t    seed    = argc>5 ? std::stoul(argv[5]) : 1;
+    const std::string outfile = argc>6 ? argv[6] : "";
+
+    std::vector<std::string> terrains;
+    if(terrain=="all")
+      terrains = synthetic::TERRAINS;
+    else if(std::find(synthetic::TERRAINS.begin(), synthetic::TERRAINS.end(), terrain)!=synthetic::TERRAINS.end())
+      terrains = {terrain};
+    else
+      throw std::runtime_error("Unrecognised terrain '" + terrain + "'!");
+
+    std::ofstream results;
+    if(!outfile.empty()){
+      results.open(outfile, std::ios_base::app);
+      if(!results.good())
+        throw std::runtime_error("Failed to open results file '" + outfile + "'!");
+      if(results.tellp()==0)
+        results<<"terrain,width,height,seed,steps,kernel,seconds,land_cells_per_second,peak_mb\n";
+    }
+
+    for(const auto &t: terrains){
+      const auto r = BenchmarkTerrain(t, width, height, steps, seed);
+      if(results.is_open()){
+        for(const auto &k: r)
+          results<<t<<","<<width<<","<<height<<","<<seed<<","<<steps<<","<<k.kernel<<","
+                 <<k.seconds<<","<<k.cellsPerSecond()<<","<<k.peak_mb<<"\n";
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+//Micro-benchmarks of the union-find and outlet-sorting steps with which
+//GetDepressionHierarchy() builds the hierarchy from its outlets, run on
+//synthetic outlets for realistic numbers of depressions.
+//
+//Usage: bench_djset [MIN_TIME] [DEPRESSIONS...]
+//
+//Each benchmark is repeated until it has run for at least MIN_TIME seconds
+//(0.5 by default), once for each number of depressions given (10000, 100000,
+//and 1000000 by default). The benchmarks are:
+//
+//  * OutletSort:     sorting the outlets by elevation
+//  * HierarchyMerge: visiting the sorted outlets and merging depressions, as
+//                    GetDepressionHierarchy() does, with each way of finding a
+//                    set's representative
+//  * FindSet:        looking up random sets in the finished, uncompressed
+//                    forest, with each way of finding a set's representative
+//
+//The results are printed as a table in the style of Google Benchmark.
+#include "ArrayPack.hpp"
+#include "parameters.hpp"
+#include "dephier.hpp"
+#include "DisjointDenseIntSet.hpp"
+#include "synthetic_terrain.hpp"
+#include <richdem/common/timer.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace rd = richdem;
+namespace dh = richdem::dephier;
+
+typedef dh::Outlet<float> outlet_t;
+
+//Outlets of `n` depressions laid out on a square lattice, as in a landscape:
+//each depression has an outlet to its neighbours to the east and south, and
+//those on the edge of the lattice also have an outlet to the ocean. Outlet
+//elevations are random but reproducible.
+static std::vector<outlet_t> MakeOutlets(const int n){
+  const int side = std::ceil(std::sqrt(n));
+  std::vector<outlet_t> outlets;
+  outlets.reserve(3*n);
+  for(int i=0;i<n;i++){
+    const int x     = i%side;
+    const int y     = i/side;
+    const int label = i+1;          //0 is the ocean
+    auto elev = [&](const int k){ return static_cast<float>(1000*synthetic::Hash(i, k, 42)); };
+    if(x+1<side && i+1<n)
+      outlets.emplace_back(label, label+1,    i, elev(0));
+    if(i+side<n)
+      outlets.emplace_back(label, label+side, i, elev(1));
+    if(x==0 || y==0 || x==side-1 || i+side>=n)
+      outlets.emplace_back(label, dh::OCEAN,  i, elev(2));
+  }
+  return outlets;
+}
+
+static void SortOutlets(std::vector<outlet_t> &outlets){
+  std::sort(outlets.begin(), outlets.end(), [](const outlet_t &a, const outlet_t &b){
+    return a.out_elev<b.out_elev;
+  });
+}
+
+//The union-find part of GetDepressionHierarchy()'s outlet loop: each outlet
+//joining two distinct meta-depressions either drains one into the ocean or
+//makes a new meta-depression of the two. Returns the number of depressions,
+//including meta-depressions, so the work cannot be optimised away.
+template<bool halving>
+static uint64_t MergeOutlets(const std::vector<outlet_t> &outlets, const int n, DisjointDenseIntSet &djset){
+  auto find = [&](const unsigned int x){
+    return halving ? djset.findSetHalving(x) : djset.findSetRecursive(x);
+  };
+
+  unsigned int next_label = n+1;
+  for(const auto &outlet: outlets){
+    const auto depa_set = find(outlet.depa);
+    const auto depb_set = find(outlet.depb);
+    if(depa_set==depb_set)
+      continue;
+    if(depa_set==dh::OCEAN)
+      djset.mergeAintoB(depb_set, dh::OCEAN);
+    else if(depb_set==dh::OCEAN)
+      djset.mergeAintoB(depa_set, dh::OCEAN);
+    else {
+      djset.mergeAintoB(depa_set, next_label);
+      djset.mergeAintoB(depb_set, next_label);
+      next_label++;
+    }
+  }
+  return next_label;
+}
+
+
+
+//Runs `body` repeatedly until it has run for at least `min_time` seconds,
+//calling `setup` untimed before each run, and prints the mean time per run
+//and per operation
+template<class S, class B>
+static void Run(const std::string &name, const double min_time, const uint64_t ops, S setup, B body){
+  double   total      = 0;
+  uint64_t iterations = 0;
+  volatile uint64_t sink = 0;
+  while(total<min_time || iterations<3){
+    setup();
+    rd::Timer timer;
+    timer.start();
+    sink = sink + body();
+    total += timer.stop();
+    iterations++;
+  }
+  std::printf("%-36s %12.3f ms %12.2f ns/op %10llu\n", name.c_str(), 1e3*total/iterations,
+    1e9*total/iterations/ops, static_cast<unsigned long long>(iterations));
+}
+
+
+
+int main(int argc, char **argv){
+  const double min_time = argc>1 ? std::stod(argv[1]) : 0.5;
+  std::vector<int> sizes;
+  for(int i=2;i<argc;i++)
+    sizes.push_back(std::stoi(argv[i]));
+  if(sizes.empty())
+    sizes = {10000, 100000, 1000000};
+
+  std::printf("%-36s %15s %15s %10s\n", "Benchmark", "Time", "Per op", "Iterations");
+  std::printf("%s\n", std::string(79,'-').c_str());
+
+  for(const int n: sizes){
+    const auto unsorted = MakeOutlets(n);
+    auto       sorted   = unsorted;
+    SortOutlets(sorted);
+
+    const std::string suffix = "/" + std::to_string(n);
+
+    std::vector<outlet_t> outlets;
+    Run("OutletSort" + suffix, min_time, unsorted.size(),
+      [&](){ outlets = unsorted; },
+      [&](){ SortOutlets(outlets); return outlets.size(); }
+    );
+
+    //GetDepressionHierarchy() presizes the set to the number of leaf
+    //depressions and lets it grow as meta-depressions are added
+    Run("HierarchyMerge/Recursive" + suffix, min_time, sorted.size(),
+      [&](){},
+      [&](){ DisjointDenseIntSet djset(n+1); return MergeOutlets<false>(sorted, n, djset); }
+    );
+    Run("HierarchyMerge/Halving" + suffix, min_time, sorted.size(),
+      [&](){},
+      [&](){ DisjointDenseIntSet djset(n+1); return MergeOutlets<true>(sorted, n, djset); }
+    );
+
+    //The finished forest, without any path compression: every set still
+    //points to the meta-depression it was merged into
+    DisjointDenseIntSet forest(n+1);
+    {
+      unsigned int next_label = n+1;
+      DisjointDenseIntSet lookup(n+1);
+      for(const auto &outlet: sorted){
+        const auto a = lookup.findSetHalving(outlet.depa);
+        const auto b = lookup.findSetHalving(outlet.depb);
+        if(a==b)
+          continue;
+        if(a==dh::OCEAN || b==dh::OCEAN){
+          const auto other = (a==dh::OCEAN) ? b : a;
+          lookup.mergeAintoB(other, dh::OCEAN);
+          forest.mergeAintoB(other, dh::OCEAN);
+        } else {
+          lookup.mergeAintoB(a, next_label);
+          lookup.mergeAintoB(b, next_label);
+          forest.mergeAintoB(a, next_label);
+          forest.mergeAintoB(b, next_label);
+          next_label++;
+        }
+      }
+    }
+
+    std::vector<unsigned int> queries(n);
+    for(int i=0;i<n;i++)
+      queries[i] = 1 + static_cast<unsigned int>(n*synthetic::Hash(i, 0, 7));
+
+    DisjointDenseIntSet copy;
+    Run("FindSet/Recursive" + suffix, min_time, queries.size(),
+      [&](){ copy = forest; },
+      [&](){ uint64_t s=0; for(const auto q: queries) s += copy.findSetRecursive(q); return s; }
+    );
+    Run("FindSet/Halving" + suffix, min_time, queries.size(),
+      [&](){ copy = forest; },
+      [&](){ uint64_t s=0; for(const auto q: queries) s += copy.findSetHalving(q); return s; }
+    );
+  }
+
+  return 0;
+}
@@ -0,0 +1,274 @@
+//Benchmarks the groundwater and evaporation kernels on a synthetic domain, and
+//compares the two layouts of the groundwater state (see hot_state.hpp).
+//
+//Usage: bench_groundwater <WIDTH> <HEIGHT> [LAND_FRACTION] [STEPS] [LAYOUT]
+//
+//LAND_FRACTION is the proportion of the domain which is land (0.35 by
+//default, similar to our coastal domains), and STEPS is the number of times
+//each kernel is run (10 by default). LAYOUT is "both" (the default),
+//"separate", or "interleaved".
+//
+//With both layouts, the two are run side by side on the same domain, the
+//water tables they produce are checked to be identical, and for each one the
+//time, cells and bytes per second, and the cache references and misses of a
+//step are printed. The interleaved layout's first step, which copies all of
+//its state, is timed separately from the steps after it, which only refresh
+//the water table. The cache counters are read with perf_event_open(); where
+//the kernel doesn't allow that (see /proc/sys/kernel/perf_event_paranoid)
+//they are reported as unavailable, and a single layout can be run under a
+//tool such as `perf stat -e cache-references,cache-misses` instead.
+#include "transient_groundwater.hpp"
+#include "evaporation.hpp"
+#include <richdem/common/timer.hpp>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace rd = richdem;
+
+//Fills `arp` with a smooth synthetic domain. Land is wherever a smooth
+//pattern exceeds a threshold chosen to give roughly `land_fraction` of land.
+static void MakeDomain(Parameters &params, ArrayPack &arp, const int width, const int height, const double land_fraction){
+  params.ncells_x            = width;
+  params.ncells_y            = height;
+  params.deltat              = 315360000;
+  params.cellsize_n_s_metres = 1000;
+
+  arp.topo          = f2d(width, height, 0);
+  arp.wtd           = f2d(width, height, 0);
+  arp.fdepth        = f2d(width, height, 0);
+  arp.ksat          = f2d(width, height, 0);
+  arp.ground_temp   = f2d(width, height, 0);
+  arp.temp          = f2d(width, height, 0);
+  arp.relhum        = f2d(width, height, 0);
+  arp.wind_speed    = f2d(width, height, 0);
+  arp.precip        = f2d(width, height, 0);
+  arp.starting_evap = f2d(width, height, 0);
+  arp.e_sat         = f2d(width, height, 0);
+  arp.e_a           = f2d(width, height, 0);
+  arp.surface_evap  = f2d(width, height, 0);
+  arp.rech          = f2d(width, height, 0);
+  arp.wtd_change_total = f2d(width, height, 0);
+  arp.wtd_mid       = f2d(width, height, 0);
+
+  //sin(x)*cos(y) is spread roughly evenly over [-1,1], so a threshold at this
+  //point leaves about the requested fraction above it
+  const double threshold = 1-2*land_fraction;
+
+  u82d mask(width, height, 0);
+  for(int y=0;y<height;y++)
+  for(int x=0;x<width;x++){
+    const double pattern = std::sin(0.003*x+0.5)*std::cos(0.004*y);
+    if(pattern<=threshold)
+      continue;
+    mask(x,y)             = 1;
+    arp.topo(x,y)         = 2000*(pattern-threshold) + 0.01*((x*7919+y*104729)%1000);
+    arp.wtd(x,y)          = -0.5 - 5*std::fabs(std::sin(0.01*x+0.02*y));
+    arp.fdepth(x,y)       = 10 + 40*std::fabs(std::cos(0.007*x));
+    arp.ksat(x,y)         = 1e-5*(1+std::fabs(std::sin(0.011*y)));
+    arp.ground_temp(x,y)  = 15 + 10*std::sin(0.002*y);
+    arp.temp(x,y)         = 14 + 10*std::sin(0.002*y);
+    arp.relhum(x,y)       = 0.6;
+    arp.wind_speed(x,y)   = 3;
+    arp.precip(x,y)       = 0.8e-8;
+    arp.starting_evap(x,y)= 0.5e-8;
+  }
+  arp.land = LandMask(mask);
+
+  arp.cellsize_e_w_metres.resize(height);
+  arp.cell_area.resize(height);
+  for(int y=0;y<height;y++){
+    arp.cellsize_e_w_metres[y] = 1000*std::cos((10+y/120.0)*M_PI/180);
+    arp.cell_area[y]           = arp.cellsize_e_w_metres[y]*params.cellsize_n_s_metres;
+  }
+}
+
+
+
+//Hardware counters of the cache references and misses of the calling thread,
+//which is the only one: like the model, the benchmark is built without OpenMP
+class CacheCounters {
+ public:
+  CacheCounters(){
+    refs   = open(PERF_COUNT_HW_CACHE_REFERENCES, -1);
+    misses = open(PERF_COUNT_HW_CACHE_MISSES,     refs);
+  }
+
+  ~CacheCounters(){
+    if(misses>=0) close(misses);
+    if(refs>=0)   close(refs);
+  }
+
+  bool available() const { return refs>=0 && misses>=0; }
+
+  void start(){
+    if(!available()) return;
+    ioctl(refs, PERF_EVENT_IOC_RESET,  PERF_IOC_FLAG_GROUP);
+    ioctl(refs, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  ///Stops counting, and adds the counts since start() to `references` and
+  ///`missed`
+  void stop(double &references, double &missed){
+    if(!available()) return;
+    ioctl(refs, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    references += read_counter(refs);
+    missed     += read_counter(misses);
+  }
+
+ private:
+  static int open(const uint64_t config, const int group){
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = config;
+    attr.disabled       = group<0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+  }
+
+  static double read_counter(const int fd){
+    uint64_t count = 0;
+    if(read(fd, &count, sizeof(count))!=sizeof(count))
+      return 0;
+    return static_cast<double>(count);
+  }
+
+  int refs   = -1;
+  int misses = -1;
+};
+
+
+
+//Mean time, cache references, and cache misses of one run of a kernel
+struct KernelCost {
+  double seconds    = 0;
+  double references = 0;
+  double misses     = 0;
+};
+
+//Runs `kernel` `steps` times, restoring wtd before each run so every step
+//does the same work, and returns the mean cost of a step
+template<class F>
+static KernelCost TimeKernel(const int steps, ArrayPack &arp, const f2d &wtd0, CacheCounters &counters, F kernel){
+  KernelCost total;
+  for(int i=0;i<steps;i++){
+    arp.wtd = wtd0;
+    rd::Timer timer;
+    counters.start();
+    timer.start();
+    kernel();
+    total.seconds += timer.stop();
+    counters.stop(total.references, total.misses);
+  }
+  total.seconds    /= steps;
+  total.references /= steps;
+  total.misses     /= steps;
+  return total;
+}
+
+static void PrintCost(const std::string &name, const KernelCost &cost, const double cells, const double bytes, const CacheCounters &counters){
+  std::cerr<<"t "<<name<<" = "<<cost.seconds<<" s"<<std::endl;
+  std::cerr<<"m "<<name<<" = "<<(cells/cost.seconds/1e6)<<" Mcells/s, "
+           <<(bytes/cost.seconds/1e9)<<" GB/s"<<std::endl;
+  if(counters.available())
+    std::cerr<<"m "<<name<<" cache references = "<<cost.references
+             <<", misses = "<<cost.misses
+             <<" ("<<(100*cost.misses/std::max(cost.references,1.0))<<"%)"<<std::endl;
+  else
+    std::cerr<<"m "<<name<<" cache counters unavailable"<<std::endl;
+}
+
+
+
+int main(int argc, char **argv){
+  if(argc<3 || argc>6){
+    std::cerr<<"Syntax: "<<argv[0]<<" <WIDTH> <HEIGHT> [LAND_FRACTION] [STEPS] [LAYOUT]"<<std::endl;
+    return -1;
+  }
+
+  try {
+    const int         width         = std::stoi(argv[1]);
+    const int         height        = std::stoi(argv[2]);
+    const double      land_fraction = argc>3 ? std::stod(argv[3]) : 0.35;
+    const int         steps         = argc>4 ? std::stoi(argv[4]) : 10;
+    const std::string layout        = argc>5 ? argv[5] : "both";
+
+    if(layout!="both" && layout!="separate" && layout!="interleaved")
+      throw std::runtime_error("Unrecognised layout '" + layout + "'!");
+
+    //There is no configuration file; every parameter the kernels use is set
+    //by MakeDomain()
+    Parameters params("/dev/null");
+    ArrayPack  arp;
+    MakeDomain(params, arp, width, height, land_fraction);
+
+    const auto land_cells = arp.land.landCells();
+    std::cerr<<"m Cells      = "<<arp.topo.size()<<std::endl;
+    std::cerr<<"m Land cells = "<<land_cells<<" ("<<(100.0*land_cells/arp.topo.size())<<"%)"<<std::endl;
+
+    const f2d wtd0 = arp.wtd;
+    f2d wtd_separate;
+    CacheCounters counters;
+
+    //Bytes of state each kernel reads or writes per land cell, assuming every
+    //neighbour is still in cache. The stencil reads topo, wtd, fdepth and
+    //ksat and writes wtd_change_total; the update reads wtd and
+    //wtd_change_total and writes wtd. The interleaved layout reads its four
+    //values as one 16-byte cell instead, and its refresh reads wtd and
+    //rewrites the cell it goes into.
+    const double update_bytes      = land_cells*3*sizeof(float);
+    const double separate_bytes    = land_cells*5*sizeof(float) + update_bytes;
+    const double interleaved_bytes = land_cells*(sizeof(HotCell) + sizeof(float)) + update_bytes \
+                                   + land_cells*(sizeof(float) + 2*sizeof(HotCell));
+    const double evap_bytes        = land_cells*(7*sizeof(float) + 4*sizeof(float));
+
+    for(const std::string this_layout: {"separate", "interleaved"}){
+      if(layout!="both" && layout!=this_layout)
+        continue;
+
+      params.groundwater_layout = this_layout;
+      const auto step = [&](){ groundwater(params, arp); };
+
+      if(this_layout=="interleaved"){
+        //The first step copies all four fields of every cell
+        arp.hot.invalidate();
+        const auto first = TimeKernel(1, arp, wtd0, counters, step);
+        std::cerr<<"t Groundwater (interleaved, first step) = "<<first.seconds<<" s"<<std::endl;
+      }
+
+      const auto gw = TimeKernel(steps, arp, wtd0, counters, step);
+      PrintCost("Groundwater ("+this_layout+")", gw, land_cells,
+        this_layout=="separate" ? separate_bytes : interleaved_bytes, counters);
+
+      if(this_layout=="separate"){
+        wtd_separate = arp.wtd;
+      } else if(wtd_separate.size()>0){
+        for(unsigned int i=0;i<arp.wtd.size();i++)
+          if(arp.wtd(i)!=wtd_separate(i))
+            throw std::runtime_error("Layouts disagree at cell " + std::to_string(i) + "!");
+        std::cerr<<"Layouts agree."<<std::endl;
+      }
+    }
+
+    //Evaporation only streams through its inputs, with no neighbours, so it
+    //is measured as a reference for the bandwidth the machine can sustain
+    const auto evap = TimeKernel(steps, arp, wtd0, counters, [&](){ evaporation_update(params, arp); });
+    PrintCost("Evaporation", evap, land_cells, evap_bytes, counters);
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+//Runs groundwater() with the domain split into strips of rows between MPI
+//ranks (see domain_decomposition.hpp), times it, and checks that the water
+//table it produces is identical to that of a single process.
+//
+//Usage: mpirun -n <RANKS> bench_mpi_groundwater <TERRAIN> <WIDTH> <HEIGHT> [STEPS]
+//
+//TERRAIN is one of the synthetic terrains of synthetic_terrain.hpp, and STEPS
+//is the number of groundwater steps taken (10 by default). Every rank makes
+//the whole synthetic domain and keeps its own strip, so that no input files
+//are needed; a real run would read only its strip. The root rank then takes
+//the same steps on the whole domain and compares the results.
+//
+//Build with `make bench_mpi_groundwater`, which defines TWSM_USE_MPI.
+#include "irf.cpp"
+#include "synthetic_terrain.hpp"
+#include <mpi.h>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+//The state groundwater() reads and writes for this rank's strip of `global`
+static ArrayPack ExtractStrip(const RowDecomposition &rows, const ArrayPack &global, const bool abs_diagnostics){
+  u82d mask(global.land.width(), global.land.height(), 0);
+  for(int y=0;y<mask.height();y++)
+  for(auto s=global.land.rowBegin(y);s!=global.land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++)
+    mask(x,y) = 1;
+
+  ArrayPack local;
+  local.land                = LandMask(rows.extract(mask));
+  local.wrap_x              = global.wrap_x;
+  local.topo                = rows.extract(global.topo);
+  local.wtd                 = rows.extract(global.wtd);
+  local.fdepth              = rows.extract(global.fdepth);
+  local.ksat                = rows.extract(global.ksat);
+  local.wtd_change_total    = rows.extract(global.wtd_change_total);
+  if(abs_diagnostics)
+    local.wtd_mid           = rows.extract(global.wtd_mid);
+  local.cellsize_e_w_metres = rows.extract(global.cellsize_e_w_metres);
+  local.cell_area           = rows.extract(global.cell_area);
+  return local;
+}
+
+
+
+int main(int argc, char **argv){
+  MPI_Init(&argc, &argv);
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  if(argc<4 || argc>5){
+    if(rank==0)
+      std::cerr<<"Syntax: "<<argv[0]<<" <TERRAIN> <WIDTH> <HEIGHT> [STEPS]"<<std::endl;
+    MPI_Finalize();
+    return -1;
+  }
+
+  int ret = 0;
+  try {
+    const std::string terrain = argv[1];
+    const int         width   = std::stoi(argv[2]);
+    const int         height  = std::stoi(argv[3]);
+    const int         steps   = argc>4 ? std::stoi(argv[4]) : 10;
+
+    Parameters params("/dev/null");
+    ArrayPack  arp;
+    params.abs_diagnostics = false;
+    MakeSyntheticDomain(params, arp, terrain, width, height, 1);
+    cell_size_area(params, arp);
+    InitialiseBoth(params, arp);
+
+    const RowDecomposition rows(MPI_COMM_WORLD, arp.land);
+    ArrayPack strip = ExtractStrip(rows, arp, params.abs_diagnostics);
+
+    Parameters strip_params = params;
+    strip_params.ncells_y   = rows.mine().height();
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    rd::Timer timer;
+    timer.start();
+    for(int i=0;i<steps;i++)
+      groundwater(strip_params, strip, rows);
+    MPI_Barrier(MPI_COMM_WORLD);
+    const double parallel_time = timer.stop();
+
+    //The land each rank computed, to show the balance between them
+    const uint64_t my_land = strip.land.landCells();
+    std::vector<uint64_t> land_per_rank(rows.size());
+    MPI_Gather(&my_land, 1, MPI_UINT64_T, land_per_rank.data(), 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    f2d wtd_parallel;
+    if(rows.isRoot())
+      wtd_parallel = f2d(width, height, 0);
+    rows.gather(strip.wtd, wtd_parallel);
+
+    if(rows.isRoot()){
+      for(int r=0;r<rows.size();r++)
+        std::cerr<<"m Rank "<<r<<" rows "<<rows.strip(r).y0<<"-"<<rows.strip(r).y1
+                 <<", land cells (with halos) = "<<land_per_rank[r]<<std::endl;
+
+      rd::Timer serial_timer;
+      serial_timer.start();
+      for(int i=0;i<steps;i++)
+        groundwater(params, arp);
+      const double serial_time = serial_timer.stop();
+
+      uint64_t differ   = 0;
+      double   max_diff = 0;
+      for(f2d::i_t i=0;i<arp.wtd.size();i++){
+        const double diff = std::fabs(static_cast<double>(arp.wtd(i))-wtd_parallel(i));
+        if(diff>0)
+          differ++;
+        max_diff = std::max(max_diff, diff);
+      }
+
+      std::cerr<<"t Groundwater, 1 process   = "<<(serial_time/steps)<<" s/step"<<std::endl;
+      std::cerr<<"t Groundwater, "<<rows.size()<<" ranks = "<<(parallel_time/steps)<<" s/step"<<std::endl;
+      std::cerr<<"m Speedup = "<<(serial_time/parallel_time)<<std::endl;
+      std::cerr<<"m Cells which differ = "<<differ<<" (largest difference "<<max_diff<<" m)"<<std::endl;
+      if(differ>0){
+        std::cerr<<"E The ranks' water table differs from that of a single process!"<<std::endl;
+        ret = -1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    MPI_Abort(MPI_COMM_WORLD, -1);
+  }
+
+  MPI_Bcast(&ret, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Finalize();
+  return ret;
+}
@@ -0,0 +1,200 @@
+//Measures how the phases of update() scale with the number of OpenMP threads,
+//on synthetic domains (see synthetic_terrain.hpp).
+//
+//Usage: bench_scaling <strong|weak> <TERRAIN> <SIZES> <THREADS> [CYCLES] [REPORT.csv]
+//
+//SIZES is a comma-separated list of domain sizes, e.g. 2000x1000,4000x2000,
+//and THREADS a comma-separated list of thread counts, e.g. 1,2,4,8. For each
+//run a fresh domain is made, its depression hierarchy is found, and CYCLES
+//cycles of update() (5 by default, at most 99) are timed with the profiler.
+//
+//  * strong: every size is run with every thread count. Speedup is relative
+//            to the first thread count at the same size, and efficiency is
+//            the speedup divided by the increase in threads.
+//  * weak:   the i-th size is run with the i-th thread count, so the sizes
+//            should grow with the threads. Efficiency is the time per land
+//            cell per thread of the first run over that of this one.
+//
+//For each phase the report gives the time per cycle, the speedup, the
+//efficiency and, for the phases which stream through the grids, an estimate
+//of the memory bandwidth they reached. If a report file is given, a row per
+//phase and run is appended to it.
+#define TWSM_NO_MAIN
+#include "TWSM.cpp"
+#include "synthetic_terrain.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+//Bytes of grid data the streaming phases read and write per land cell. The
+//other phases follow flow paths or priority queues and are bound by latency
+//rather than bandwidth, so no estimate is given for them.
+static const std::map<std::string,double> BYTES_PER_LAND_CELL = {
+  {"recharge",     3*sizeof(float)},
+  {"groundwater",  7*sizeof(float)},
+  {"print_values", 6*sizeof(float)},
+  {"evaporation", 11*sizeof(float)},
+};
+
+struct Run {
+  int      width;
+  int      height;
+  int      threads;
+  uint64_t land_cells;
+  //Mean time per cycle of each phase
+  std::map<std::string,double> seconds;
+};
+
+static std::vector<std::string> Split(const std::string &list){
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+static std::pair<int,int> ParseSize(const std::string &size){
+  const auto x = size.find('x');
+  if(x==std::string::npos)
+    throw std::runtime_error("Sizes must look like 2000x1000, not '" + size + "'!");
+  return {std::stoi(size.substr(0,x)), std::stoi(size.substr(x+1))};
+}
+
+
+
+static Run RunModel(const std::string &terrain, const int width, const int height, const int threads, const int cycles){
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  if(threads!=1)
+    throw std::runtime_error("This build has no OpenMP, so only 1 thread can be used!");
+#endif
+
+  Parameters params("/dev/null");
+  ArrayPack  arp;
+  params.abs_diagnostics = false;
+  MakeSyntheticDomain(params, arp, terrain, width, height, 1);
+  cell_size_area(params, arp);
+  InitialiseBoth(params, arp);
+
+  auto deps = dh::GetDepressionHierarchy<float,rd::Topology::D8>(arp, arp.label, arp.final_label, arp.flowdirs);
+
+  //update() saves the water table every 100 cycles, starting with cycle 0.
+  //Starting at cycle 1 keeps the files, and their time, out of the results.
+  params.cycles_done = 1;
+
+  TheProfiler().reset();
+  for(int c=0;c<cycles;c++)
+    update(params, arp, deps);
+
+  Run run{width, height, threads, arp.land.landCells(), {}};
+  for(const auto &name: TheProfiler().phaseNames())
+    if(TheProfiler().cyclesTimed(name)>0)
+      run.seconds[name] = TheProfiler().totalSeconds(name)/cycles;
+  return run;
+}
+
+
+
+int main(int argc, char **argv){
+  if(argc<5 || argc>7){
+    std::cerr<<"Syntax: "<<argv[0]<<" <strong|weak> <TERRAIN> <SIZES> <THREADS> [CYCLES] [REPORT.csv]"<<std::endl;
+    return -1;
+  }
+
+  try {
+    const std::string mode    = argv[1];
+    const std::string terrain = argv[2];
+    const auto        sizes   = Split(argv[3]);
+    const auto        threads = Split(argv[4]);
+    const int         cycles  = argc>5 ? std::stoi(argv[5]) : 5;
+    const std::string outfile = argc>6 ? argv[6] : "";
+
+    if(mode!="strong" && mode!="weak")
+      throw std::runtime_error("Unrecognised mode '" + mode + "'! Choose strong or weak.");
+    if(mode=="weak" && sizes.size()!=threads.size())
+      throw std::runtime_error("Weak scaling needs as many sizes as thread counts!");
+    if(sizes.empty() || threads.empty())
+      throw std::runtime_error("At least one size and one thread count are needed!");
+    if(cycles<1 || cycles>99)
+      throw std::runtime_error("CYCLES must be between 1 and 99!");
+
+    //The phases are timed with the profiler, which is otherwise left off
+    TheProfiler().enable("");
+
+    //Each group of runs shares a baseline, the group's first run
+    std::vector<std::vector<Run>> groups;
+    if(mode=="strong"){
+      for(const auto &size: sizes){
+        const auto wh = ParseSize(size);
+        groups.emplace_back();
+        for(const auto &t: threads)
+          groups.back().push_back(RunModel(terrain, wh.first, wh.second, std::stoi(t), cycles));
+      }
+    } else {
+      groups.emplace_back();
+      for(unsigned int i=0;i<sizes.size();i++){
+        const auto wh = ParseSize(sizes[i]);
+        groups.back().push_back(RunModel(terrain, wh.first, wh.second, std::stoi(threads[i]), cycles));
+      }
+    }
+
+    std::ofstream report;
+    if(!outfile.empty()){
+      report.open(outfile, std::ios_base::app);
+      if(!report.good())
+        throw std::runtime_error("Failed to open report file '" + outfile + "'!");
+      if(report.tellp()==0)
+        report<<"mode,terrain,width,height,land_cells,threads,phase,seconds_per_cycle,speedup,efficiency,gb_per_second\n";
+    }
+
+    std::printf("%-6s %-20s %12s %8s %12s %8s %8s %8s\n",
+      "Mode", "Phase", "Size", "Threads", "s/cycle", "Speedup", "Eff.", "GB/s");
+    for(const auto &group: groups){
+      const Run &base = group.front();
+      for(const auto &phase: base.seconds){
+        const std::string &name = phase.first;
+        for(const auto &run: group){
+          if(run.seconds.count(name)==0)
+            continue;
+          const double t  = run.seconds.at(name);
+          const double t0 = phase.second;
+          //Speedup is in land cells per second, since the domains of a weak
+          //scaling run are not exactly proportional to the threads. In a
+          //strong scaling run the land cells are the same, so this is t0/t.
+          const double work       = static_cast<double>(run.land_cells)/base.land_cells;
+          const double speedup    = work*t0/t;
+          const double efficiency = speedup*base.threads/run.threads;
+          const auto   bytes      = BYTES_PER_LAND_CELL.find(name);
+          const double gbs        = (bytes==BYTES_PER_LAND_CELL.end()) ? 0 : bytes->second*run.land_cells/t/1e9;
+
+          const std::string size = std::to_string(run.width) + "x" + std::to_string(run.height);
+          std::printf("%-6s %-20s %12s %8d %12.5f %8.2f %8.2f ",
+            mode.c_str(), name.c_str(), size.c_str(), run.threads, t, speedup, efficiency);
+          if(gbs>0)
+            std::printf("%8.2f\n", gbs);
+          else
+            std::printf("%8s\n", "-");
+
+          if(report.is_open())
+            report<<mode<<","<<terrain<<","<<run.width<<","<<run.height<<","<<run.land_cells<<","
+                  <<run.threads<<","<<name<<","<<t<<","<<speedup<<","<<efficiency<<","<<gbs<<"\n";
+        }
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+//Runs groundwater() out of core, a tile at a time (see tiled_groundwater.hpp),
+//times it, and checks that the water table it produces is identical to that
+//of groundwater() in memory.
+//
+//Usage: bench_tiled_groundwater <TERRAIN> <WIDTH> <HEIGHT> [TILE] [CACHE_TILES] [STEPS] [DIR]
+//
+//TERRAIN is one of the synthetic terrains of synthetic_terrain.hpp. TILE is
+//the size of the tiles, either WxH or H for tiles of whole rows (256x256 by
+//default). CACHE_TILES is the number of tiles of each grid held in memory (0,
+//the default, for three rows of tiles). STEPS is the number of groundwater
+//steps taken (10 by default). The inputs are written as raw grids to DIR (the
+//current directory by default) and left there.
+#include "irf.cpp"
+#include "synthetic_terrain.hpp"
+#include "tiled_groundwater.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv){
+  if(argc<4 || argc>8){
+    std::cerr<<"Syntax: "<<argv[0]<<" <TERRAIN> <WIDTH> <HEIGHT> [TILE] [CACHE_TILES] [STEPS] [DIR]"<<std::endl;
+    return -1;
+  }
+
+  try {
+    const std::string terrain     = argv[1];
+    const int         width       = std::stoi(argv[2]);
+    const int         height      = std::stoi(argv[3]);
+    const std::string tile        = argc>4 ? argv[4] : "256x256";
+    const size_t      cache_tiles = argc>5 ? std::stoul(argv[5]) : 0;
+    const int         steps       = argc>6 ? std::stoi(argv[6]) : 10;
+    const std::string dir         = argc>7 ? std::string(argv[7]) + "/" : "";
+
+    int tile_width  = -1;
+    int tile_height = 0;
+    const auto x = tile.find('x');
+    if(x==std::string::npos){
+      tile_height = std::stoi(tile);
+    } else {
+      tile_width  = std::stoi(tile.substr(0,x));
+      tile_height = std::stoi(tile.substr(x+1));
+    }
+
+    Parameters params("/dev/null");
+    ArrayPack  arp;
+    params.abs_diagnostics = false;
+    MakeSyntheticDomain(params, arp, terrain, width, height, 1);
+    cell_size_area(params, arp);
+    InitialiseBoth(params, arp);
+
+    u82d mask(width, height, 0);
+    for(int y=0;y<height;y++)
+    for(auto s=arp.land.rowBegin(y);s!=arp.land.rowEnd(y);s++)
+    for(int x=s->x0;x<s->x1;x++)
+      mask(x,y) = 1;
+
+    SaveAsRaw(arp.topo,   dir+"tiled_topo.raw");
+    SaveAsRaw(arp.fdepth, dir+"tiled_fdepth.raw");
+    SaveAsRaw(arp.ksat,   dir+"tiled_ksat.raw");
+    SaveAsRaw(mask,       dir+"tiled_mask.raw");
+    SaveAsRaw(arp.wtd,    dir+"tiled_wtd.raw");
+
+    TiledGroundwater tiled(
+      dir+"tiled_topo.raw", dir+"tiled_fdepth.raw", dir+"tiled_ksat.raw", dir+"tiled_mask.raw",
+      dir+"tiled_wtd.raw",  dir+"tiled_wtd_scratch.raw",
+      tile_width, tile_height, cache_tiles
+    );
+
+    rd::Timer tiled_timer;
+    tiled_timer.start();
+    for(int i=0;i<steps;i++)
+      tiled.step(params, arp.cellsize_e_w_metres, arp.cell_area);
+    const double tiled_time = tiled_timer.stop();
+
+    rd::Timer memory_timer;
+    memory_timer.start();
+    for(int i=0;i<steps;i++)
+      groundwater(params, arp);
+    const double memory_time = memory_timer.stop();
+
+    const f2d wtd_tiled = tiled.wtd();
+    uint64_t differ   = 0;
+    double   max_diff = 0;
+    for(f2d::i_t i=0;i<arp.wtd.size();i++){
+      const double diff = std::fabs(static_cast<double>(arp.wtd(i))-wtd_tiled(i));
+      if(diff>0)
+        differ++;
+      max_diff = std::max(max_diff, diff);
+    }
+
+    const auto   stats      = tiled.stats();
+    const double grid_bytes = static_cast<double>(width)*height*(4*sizeof(float)+sizeof(uint8_t));
+    std::cerr<<"m Tiles = "<<tile<<", cached tiles at most = "<<stats.peak_tiles<<" over 6 grids"<<std::endl;
+    std::cerr<<"m Tile hits = "<<stats.hits<<", prefetched = "<<stats.prefetch_hits<<", misses = "<<stats.misses<<std::endl;
+    std::cerr<<"m Read "<<(stats.bytes_read/1e6)<<" MB, wrote "<<(stats.bytes_written/1e6)<<" MB ("
+             <<(stats.bytes_read/grid_bytes/steps)<<" times the grids per step)"<<std::endl;
+    std::cerr<<"t Groundwater, in memory = "<<(memory_time/steps)<<" s/step"<<std::endl;
+    std::cerr<<"t Groundwater, tiled     = "<<(tiled_time/steps)<<" s/step"<<std::endl;
+    std::cerr<<"m Cells which differ = "<<differ<<" (largest difference "<<max_diff<<" m)"<<std::endl;
+    if(differ>0){
+      std::cerr<<"E The tiled water table differs from that computed in memory!"<<std::endl;
+      return -1;
+    }
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,272 @@
+#ifndef _checkpoint_hpp_
+#define _checkpoint_hpp_
+
+#include "ArrayPack.hpp"
+#include "dephier.hpp"
+#include "dephier_cache.hpp"
+#include "parameters.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace rd = richdem;
+namespace dh = richdem::dephier;
+
+//Checkpoint files are a small header followed by the raw contents of the
+//arrays which carry state from one cycle to the next. Everything else in the
+//ArrayPack is either an input (reloaded on restart) or is recomputed at the
+//start of every cycle.
+const char     CHECKPOINT_MAGIC[8] = {'T','W','S','M','C','K','P','T'};
+const uint32_t CHECKPOINT_VERSION  = 3;
+
+
+
+template<class T>
+static void CheckpointWrite(FILE *fp, const T &val){
+  if(std::fwrite(&val, sizeof(T), 1, fp)!=1)
+    throw std::runtime_error("Failed to write to checkpoint file!");
+}
+
+template<class T>
+static void CheckpointRead(FILE *fp, T &val){
+  if(std::fread(&val, sizeof(T), 1, fp)!=1)
+    throw std::runtime_error("Checkpoint file is truncated!");
+}
+
+template<class T>
+static void CheckpointWriteVector(FILE *fp, const std::vector<T> &vec){
+  CheckpointWrite(fp, static_cast<uint64_t>(vec.size()));
+  if(!vec.empty() && std::fwrite(vec.data(), sizeof(T), vec.size(), fp)!=vec.size())
+    throw std::runtime_error("Failed to write to checkpoint file!");
+}
+
+template<class T>
+static void CheckpointReadVector(FILE *fp, std::vector<T> &vec){
+  uint64_t size;
+  CheckpointRead(fp, size);
+  vec.resize(size);
+  if(size>0 && std::fread(vec.data(), sizeof(T), size, fp)!=size)
+    throw std::runtime_error("Checkpoint file is truncated!");
+}
+
+static void CheckpointWriteString(FILE *fp, const std::string &str){
+  CheckpointWriteVector(fp, std::vector<char>(str.begin(), str.end()));
+}
+
+static std::string CheckpointReadString(FILE *fp){
+  std::vector<char> buf;
+  CheckpointReadVector(fp, buf);
+  return std::string(buf.begin(), buf.end());
+}
+
+template<class T>
+static void CheckpointWriteArray(FILE *fp, const rd::Array2D<T> &arr){
+  CheckpointWrite(fp, static_cast<int32_t>(arr.width()));
+  CheckpointWrite(fp, static_cast<int32_t>(arr.height()));
+  if(std::fwrite(arr.data(), sizeof(T), arr.size(), fp)!=arr.size())
+    throw std::runtime_error("Failed to write to checkpoint file!");
+}
+
+///Reads an array into `arr`, which must already have been allocated with the
+///dimensions of the domain.
+template<class T>
+static void CheckpointReadArray(FILE *fp, rd::Array2D<T> &arr){
+  int32_t width, height;
+  CheckpointRead(fp, width);
+  CheckpointRead(fp, height);
+  if(width!=arr.width() || height!=arr.height())
+    throw std::runtime_error("Checkpoint array dimensions do not match the domain!");
+  if(std::fread(arr.data(), sizeof(T), arr.size(), fp)!=arr.size())
+    throw std::runtime_error("Checkpoint file is truncated!");
+}
+
+
+
+template<class elev_t>
+static void CheckpointWriteDepressions(
+  FILE                                  *fp,
+  const dh::DepressionHierarchy<elev_t> &deps
+){
+  const auto flat = FlattenDepressionHierarchy(deps);
+  CheckpointWriteVector(fp, flat.records);
+  CheckpointWriteVector(fp, flat.ocean_linked);
+  CheckpointWriteVector(fp, flat.subdep_vec);
+  CheckpointWriteVector(fp, flat.subdep_set);
+}
+
+template<class elev_t>
+static void CheckpointReadDepressions(
+  FILE                            *fp,
+  dh::DepressionHierarchy<elev_t> &deps
+){
+  FlatDepressionHierarchy flat;
+  CheckpointReadVector(fp, flat.records);
+  CheckpointReadVector(fp, flat.ocean_linked);
+  CheckpointReadVector(fp, flat.subdep_vec);
+  CheckpointReadVector(fp, flat.subdep_set);
+  deps = UnflattenDepressionHierarchy<elev_t>(flat);
+}
+
+
+
+///Name of the checkpoint file written during a run. Each new checkpoint
+///replaces the previous one. Each MPI rank writes one for its own strip.
+std::string CheckpointFilename(const Parameters &params){
+  return params.outfilename + ".checkpoint" + params.strip_suffix;
+}
+
+
+
+///Writes everything needed to resume a run after `params.cycles_done` cycles.
+///The checkpoint is first written to a temporary file, flushed to disk, and
+///then renamed over the previous checkpoint. Since renaming is atomic, a node
+///failure at any point leaves either the old or the new checkpoint intact.
+///
+///@param params  Global parameters. We store the cycle count, as well as the
+///               run type and times so that a restart can check it is
+///               resuming the same run. The diagnostics are recomputed every
+///               cycle, so are not stored.
+///@param arp     Global arrays. We store wtd, rech, infiltration_array and
+///               surface_array, which carry over between cycles. If `deps` is
+///               given, label, final_label and flowdirs are stored as well.
+///@param deps    Optional. The depression hierarchy. Only worth storing for
+///               equilibrium runs, where it is never recomputed.
+template<class elev_t>
+void SaveCheckpoint(
+  const Parameters                      &params,
+  const ArrayPack                       &arp,
+  const dh::DepressionHierarchy<elev_t> *deps
+){
+  const std::string filename = CheckpointFilename(params);
+  const std::string tempname = filename + ".tmp";
+
+  FILE *fp = std::fopen(tempname.c_str(), "wb");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to open checkpoint file '" + tempname + "'!");
+
+  try {
+    if(std::fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), fp)!=sizeof(CHECKPOINT_MAGIC))
+      throw std::runtime_error("Failed to write to checkpoint file!");
+    CheckpointWrite(fp, CHECKPOINT_VERSION);
+    CheckpointWriteString(fp, params.run_type);
+    CheckpointWriteString(fp, params.time_start);
+    CheckpointWriteString(fp, params.time_end);
+    CheckpointWrite(fp, static_cast<int32_t>(params.ncells_x));
+    CheckpointWrite(fp, static_cast<int32_t>(params.ncells_y));
+    CheckpointWrite(fp, static_cast<int32_t>(params.cycles_done));
+    CheckpointWrite(fp, static_cast<int32_t>(params.total_cycles));
+
+    CheckpointWriteArray(fp, arp.wtd);
+    CheckpointWriteArray(fp, arp.rech);
+    CheckpointWriteArray(fp, arp.infiltration_array);
+    CheckpointWriteArray(fp, arp.surface_array);
+
+    CheckpointWrite(fp, static_cast<uint8_t>(deps!=nullptr));
+    if(deps!=nullptr){
+      CheckpointWriteArray(fp, arp.label);
+      CheckpointWriteArray(fp, arp.final_label);
+      CheckpointWriteArray(fp, arp.flowdirs);
+      CheckpointWriteDepressions(fp, *deps);
+    }
+
+    if(std::fflush(fp)!=0 || fsync(fileno(fp))!=0)
+      throw std::runtime_error("Failed to flush checkpoint file '" + tempname + "'!");
+  } catch (...) {
+    std::fclose(fp);
+    std::remove(tempname.c_str());
+    throw;
+  }
+
+  if(std::fclose(fp)!=0)
+    throw std::runtime_error("Failed to close checkpoint file '" + tempname + "'!");
+
+  if(std::rename(tempname.c_str(), filename.c_str())!=0)
+    throw std::runtime_error("Failed to move checkpoint into place at '" + filename + "'!");
+}
+
+
+
+///Restores the state saved by `SaveCheckpoint()`. This is called after the
+///input data has been loaded and the arrays in `arp` have been allocated.
+///
+///@param filename Checkpoint to resume from
+///@param params   Global parameters. `cycles_done` is restored.
+///@param arp      Global arrays. wtd, rech, infiltration_array and
+///                surface_array are restored, and label, final_label and
+///                flowdirs if the checkpoint contains a depression hierarchy.
+///@param deps     Receives the depression hierarchy, if there is one.
+///
+///@return True if the checkpoint contained a depression hierarchy, in which
+///        case it does not need to be recomputed.
+template<class elev_t>
+bool LoadCheckpoint(
+  const std::string               &filename,
+  Parameters                      &params,
+  ArrayPack                       &arp,
+  dh::DepressionHierarchy<elev_t> &deps
+){
+  FILE *fp = std::fopen(filename.c_str(), "rb");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to open checkpoint file '" + filename + "'!");
+
+  bool has_deps = false;
+
+  try {
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    uint32_t version;
+    if(std::fread(magic, 1, sizeof(magic), fp)!=sizeof(magic) \
+      || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic))!=0)
+      throw std::runtime_error("File '" + filename + "' is not a checkpoint!");
+    CheckpointRead(fp, version);
+    if(version!=CHECKPOINT_VERSION)
+      throw std::runtime_error("Checkpoint '" + filename + "' has an unsupported version!");
+
+    if(CheckpointReadString(fp)!=params.run_type   \
+      || CheckpointReadString(fp)!=params.time_start \
+      || CheckpointReadString(fp)!=params.time_end)
+      throw std::runtime_error("Checkpoint '" + filename + "' is from a different run!");
+
+    int32_t ncells_x, ncells_y, cycles_done, total_cycles;
+    CheckpointRead(fp, ncells_x);
+    CheckpointRead(fp, ncells_y);
+    CheckpointRead(fp, cycles_done);
+    CheckpointRead(fp, total_cycles);
+    if(ncells_x!=params.ncells_x || ncells_y!=params.ncells_y)
+      throw std::runtime_error("Checkpoint '" + filename + "' does not match the domain size!");
+    //Transient inputs are interpolated using cycles_done/total_cycles, so
+    //resuming with a different total would change the remaining climate.
+    if(params.run_type=="transient" && total_cycles!=params.total_cycles)
+      throw std::runtime_error("Checkpoint '" + filename + "' was written with a different total_cycles!");
+    params.cycles_done = cycles_done;
+
+    CheckpointReadArray(fp, arp.wtd);
+    CheckpointReadArray(fp, arp.rech);
+    CheckpointReadArray(fp, arp.infiltration_array);
+    CheckpointReadArray(fp, arp.surface_array);
+    arp.hot.invalidate();
+
+    uint8_t stored_deps;
+    CheckpointRead(fp, stored_deps);
+    if(stored_deps){
+      CheckpointReadArray(fp, arp.label);
+      CheckpointReadArray(fp, arp.final_label);
+      CheckpointReadArray(fp, arp.flowdirs);
+      CheckpointReadDepressions(fp, deps);
+      has_deps = true;
+    }
+  } catch (...) {
+    std::fclose(fp);
+    throw;
+  }
+
+  std::fclose(fp);
+
+  return has_deps;
+}
+
+#endif
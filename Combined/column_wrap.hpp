@@ -0,0 +1,44 @@
+#ifndef _column_wrap_hpp_
+#define _column_wrap_hpp_
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+///Maps the column of a neighbour, which may be one beyond either the east or
+///west edge of the grid, to a column of the grid. On a global grid the east
+///and west edges meet, so column -1 is column width-1 and column width is
+///column 0. Otherwise there is nothing beyond the edges and both map to -1,
+///which inGrid() rejects.
+///
+///The mapping is a table built once, so that neighbour loops look up
+///`nx = wrap(x+dx[n])` rather than taking a modulus for every neighbour.
+class ColumnWrap {
+ public:
+  ColumnWrap() = default;
+
+  ///@param width    Width of the grid
+  ///@param periodic Whether the east and west edges of the grid meet
+  ColumnWrap(const int width, const bool periodic) : w(width), is_periodic(periodic) {
+    if(periodic && width<3)
+      throw std::runtime_error("A periodic grid must be at least 3 cells wide!");
+    table.resize(width+2);
+    table.front() = periodic ? width-1 : -1;
+    for(int x=0;x<width;x++)
+      table[x+1] = x;
+    table.back()  = periodic ? 0 : -1;
+  }
+
+  ///Column of the grid for column x, which is in [-1,width]
+  int operator()(const int x) const { return table[x+1]; }
+
+  int  width()    const { return w; }
+  bool periodic() const { return is_periodic; }
+
+ private:
+  std::vector<int32_t> table;
+  int32_t              w           = 0;
+  bool                 is_periodic = false;
+};
+
+#endif
@@ -7,6 +7,9 @@
 #include <richdem/common/grid_cell.hpp>
 #include <richdem/common/constants.hpp>
 #include "DisjointDenseIntSet.hpp"
+#include "logging.hpp"
+#include "neighbours.hpp"
+#include "profiler.hpp"
 #include "../common/netcdf.hpp"
 #include <algorithm>
 #include <cassert>
@@ -20,6 +23,7 @@
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 const double FP_ERROR = 1e-4;
 
@@ -199,6 +203,278 @@ const dh_label_t OCEAN  = 0;
 template<typename elev_t>
 using DepressionHierarchy = std::vector<Depression<elev_t>>;
 
+
+
+///Joins the depressions into a hierarchy, given the lowest outlet between each
+///pair of neighbouring depressions. `depressions` holds the ocean and the leaf
+///depressions, with their pit cells; the meta-depressions are appended to it
+///and every depression's parent, outlet, and children are set. The outlets
+///must be sorted from lowest to highest, and are modified.
+template<class elev_t>
+void BuildDepressionHierarchy(
+  DepressionHierarchy<elev_t> &depressions,
+  std::vector<Outlet<elev_t>> &outlets
+){
+  //TODO: For debugging
+  for(size_t i=1;i<outlets.size();i++)
+    assert(outlets.at(i-1).out_elev<=outlets.at(i).out_elev);
+
+  //Now that we have the outlets in order, we'll visit them from lowest to
+  //highest. If two outlets are at the same elevation we visit them in an
+  //arbitrary order. Each outlet we find is the unique lowest connection between
+  //two depressions. We join these depressions to make a meta-depression. The
+  //problem is, once we've formed a meta-depression, there may still be many
+  //outlets which believe they link to one of the child depressions.
+
+  //To deal with this, we use a Disjoint-Set/Union-Find data structure. This
+  //data structure, when passed a depression label as a query, returns the label
+  //of the upper-most meta-depression in the chain of parent depressions
+  //starting at the query label. The Disjoint-Set data structure has some nice
+  //caching properties which, *roughly speaking*, ensure that all queries
+  //execute in O(1) time.
+
+  //Presize the DisjointDenseIntSet to twice the number of depressions. Since we
+  //are building a binary tree the number of leaf nodes is about equal to the
+  //number of non-leaf nodes. The data structure will expand dynamically as
+  //needed.
+  DisjointDenseIntSet djset(depressions.size());
+
+  Log(LogLevel::Debug)<<"Constructing hierarchy from outlets"<<'\n';
+
+  //Visit outlets in order of elevation from lowest to highest. If two outlets
+  //are at the same elevation, choose one arbitrarily.
+  rd::ProgressBar progress;
+  progress.start(outlets.size());
+  for(auto &outlet: outlets){
+    ++progress;
+
+    auto depa_set = djset.findSet(outlet.depa); 
+    //Find the ultimate parent of Depression A
+    auto depb_set = djset.findSet(outlet.depb); 
+    //Find the ultimate parent of Depression B
+    
+
+    //If the depressions are already part of the same meta-depression, then
+    //nothing needs to be done.
+    if(depa_set==depb_set)
+      continue; //Do nothing, move on to the next highest outlet
+
+
+    if(depa_set==OCEAN || depb_set==OCEAN){
+      //If we're here then both depressions cannot link to the ocean, since we
+      //would have used `continue` above. Therefore, one and only one of them
+      //links to the ocean. We swap them to ensure that `depb` is the one which
+      //links to the ocean.
+      if(depa_set==OCEAN){
+        std::swap(outlet.depa, outlet.depb);
+        std::swap(depa_set, depb_set);
+      }
+
+      //We now have four values, the Depression A Label, the Depression B Label,
+      //the Depression A MetaLabel, and the Depression B MetaLabel. We know that
+      //the Depression B MetaLabel is OCEAN. Depression B Label is the label of
+      //the actual depression this outlet links to, not the meta-depressions of
+      //which it is a part. Depression A MetaLabel is the meta-depression that
+      //has just found a path to the ocean via Depression B. Depression A Label
+      //is some value we don't care about.
+
+      //What we will do is link Depression A MetaLabel to Depression B.
+      //Depression B ultimately terminates in the ocean, but the only way to get
+      //there in real-life is to crawl into Depression B, not into its meta-
+      //depression. At this point its meta-depression is the ocean, so crawling
+      //into the meta-depression would form a direct link to the ocean, which is
+      //not realistic.
+
+      //Get a reference to Depression A MetaLabel.
+      auto &dep = depressions.at(depa_set);
+
+      //If this depression has already found the ocean then don't merge it
+      //again. (TODO: Richard)
+      // if(dep.out_cell==OCEAN)
+        // continue;
+
+      //Ensure we don't modify depressions that have already found their paths
+      assert(dep.out_cell==-1);
+      assert(dep.odep==NO_VALUE);            
+
+      //Point this depression to the ocean through Depression B Label
+      dep.parent       = outlet.depb;        //Set Depression Meta(A) parent
+      dep.out_elev     = outlet.out_elev;    
+      //Set Depression Meta(A) outlet elevation                                     
+      dep.out_cell     = outlet.out_cell;    
+      //Set Depression Meta(A) outlet cell index
+      dep.odep         = depb_set;        
+      //Depression Meta(A) overflows into Depression B
+      dep.ocean_parent = true;
+      dep.geolink      = outlet.depb;        
+      //Metadepression(A) overflows, geographically, into Depression B
+      depressions.at(outlet.depb).ocean_linked.emplace_back(depa_set);
+      djset.mergeAintoB(depa_set,OCEAN); 
+      //Make a note that Depression A MetaLabel has a path to the ocean
+    } else {
+      //Neither depression has found the ocean, so we merge the two depressions
+      //into a new depression.
+      auto &depa          = depressions.at(depa_set); 
+      //Reference to Depression A MetaLabel
+      auto &depb          = depressions.at(depb_set); 
+      //Reference to Depression B MetaLabel
+
+      //Ensure we haven't already given these depressions outlet information
+      assert(depa.odep==NO_VALUE);     
+      assert(depb.odep==NO_VALUE);
+
+      const auto newlabel = depressions.size();       
+      //Label of A and B's new parent depression
+      depa.parent   = newlabel;        
+      //Set Meta(A)'s parent to be the new meta-depression
+      depb.parent   = newlabel;        
+      //Set Meta(B)'s parent to be the new meta-depression
+      depa.out_cell = outlet.out_cell; 
+      //Note that this is Meta(A)'s outlet
+      depb.out_cell = outlet.out_cell; 
+      //Note that this is Meta(B)'s outlet
+      depa.out_elev = outlet.out_elev; 
+      //Note that this is Meta(A)'s outlet's elevation
+      depb.out_elev = outlet.out_elev; 
+      //Note that this is Meta(B)'s outlet's elevation
+      depa.odep     = depb_set;        
+      //Note that Meta(A) overflows, logically, into Meta(B)
+      depb.odep     = depa_set;        
+      //Note that Meta(B) overflows, logically, into Meta(A)
+      depa.geolink  = outlet.depb;     
+      //Meta(A) overflows, geographically, into B
+      depb.geolink  = outlet.depa;     
+      //Meta(B) overflows, geographically, into A
+   
+      //Be sure that this happens AFTER we are done using the `depa` and `depb`
+      //references since they will be invalidated if `depressions` has to
+      //resize!
+      const auto depa_pitcell_temp = depa.pit_cell;
+
+      auto &newdep     = depressions.emplace_back();                                                                       
+      newdep.lchild    = depa_set;
+      newdep.rchild    = depb_set; 
+      newdep.dep_label = newlabel;
+      newdep.pit_cell  = depa_pitcell_temp;
+
+
+      newdep.my_subdepressions.emplace(depa_set);
+      newdep.my_subdepressions.emplace(depb_set);
+      newdep.my_subdepressions.insert(\
+        depressions.at(depa_set).my_subdepressions.begin()\
+        ,depressions.at(depa_set).my_subdepressions.end());
+      newdep.my_subdepressions.insert(\
+        depressions.at(depb_set).my_subdepressions.begin()\
+        ,depressions.at(depb_set).my_subdepressions.end());
+
+      
+      newdep.my_subdepressions_vec.resize(newdep.my_subdepressions.size());
+      std::copy(newdep.my_subdepressions.begin(),newdep.my_subdepressions.end()\
+        ,newdep.my_subdepressions_vec.begin());
+      newdep.my_subdepressions.erase(newdep.my_subdepressions.begin()\
+        ,newdep.my_subdepressions.end());
+ 
+
+      djset.mergeAintoB(depa_set, newlabel); //A has a parent now
+      djset.mergeAintoB(depb_set, newlabel); //B has a parent now
+    }
+  }
+  progress.stop();
+}
+
+
+
+///Labels each cell in rows [y0,y1) with the depression it lies within
+///(`final_label`), by climbing from its leaf depression until the outlet is
+///above it, and adds the cell's area and the volume above it up to that
+///depression's outlet to the depression's marginal `dep_area` and `dep_vol`.
+template<class elev_t>
+void AddMarginalVolumes(
+  const ArrayPack             &arp,
+  const rd::Array2D<int>      &label,
+  rd::Array2D<int>            &final_label,
+  DepressionHierarchy<elev_t> &depressions,
+  const int                   y0,
+  const int                   y1
+){
+  //Get the marginal depression cell counts and total elevations
+  
+  for(int y=y0;y<y1;y++)
+  for(int x=0;x<label.width();x++){
+    const auto my_elev = arp.topo(x,y);
+    auto clabel        = label(x,y);
+    
+    while(clabel!=OCEAN && my_elev>depressions.at(clabel).out_elev)
+      clabel = depressions[clabel].parent;
+     
+
+    final_label(x,y) = clabel; 
+    //I want another layer that contains the labels of which depressions these 
+    //immediately belong to, even when it is a parent depression. 
+    //This is so that I can change the wtd_vol in the correct place
+    //when we have infiltration and wtd_vol of a depression changes. 
+
+    if(clabel==OCEAN)
+      continue;
+
+    depressions[clabel].dep_area += arp.cell_area[y];         
+     //We need to know the area of our child depressions when getting 
+    //the total depression volumes below.
+    depressions[clabel].dep_vol += (static_cast<double>(\
+    depressions[clabel].out_elev)-arp.topo(x,y))*arp.cell_area[y];  
+    //Add the area of one cell at a time - elevation difference between 
+    //the outlet of this depression and the current cell, 
+    //multiplied by the area of the current cell. 
+ 
+  }
+}
+
+
+
+///Adds the volumes and areas of each meta-depression's children to its own
+///marginal ones, so that `dep_vol` and `dep_area` cover the depression and
+///everything below it. Children always have smaller labels than their
+///parents, so one pass in order of label suffices.
+template<class elev_t>
+void SumDepressionVolumes(DepressionHierarchy<elev_t> &depressions){
+  //Calculate total depression volumes and areas
+  rd::ProgressBar progress;
+  progress.start(depressions.size());
+  for(int d=0;d<(int)depressions.size();d++){
+    ++progress;
+
+    auto &dep = depressions.at(d);
+    if(dep.lchild!=NO_VALUE){
+      assert(dep.rchild!=NO_VALUE); //Either no children or two children
+      assert(dep.lchild<d);         //ID of child must be smaller than parent's
+      assert(dep.rchild<d);         //ID of child must be smaller than parent's
+
+      dep.dep_vol += depressions.at(dep.lchild).dep_vol;  
+      //Add the actual dep volume of the child
+      dep.dep_vol += (dep.out_elev - depressions.at(dep.lchild).out_elev)\
+      * depressions.at(dep.lchild).dep_area; 
+      //add the water volume higher than the child depression's outlet, 
+      //but on the same cells
+
+      dep.dep_vol += depressions.at(dep.rchild).dep_vol;
+      dep.dep_vol += (dep.out_elev - depressions.at(dep.rchild).out_elev)\
+      * depressions.at(dep.rchild).dep_area;
+      
+      dep.dep_area += depressions.at(dep.lchild).dep_area;  
+      //remember to add the area covered by child depression cells, 
+      //so that our parent can also get the correct total dep_vol. 
+      dep.dep_area += depressions.at(dep.rchild).dep_area;
+    }
+
+
+    assert(dep.lchild==NO_VALUE || (depressions.at(dep.lchild).dep_vol + \
+      depressions.at(dep.rchild).dep_vol) - dep.dep_vol <= FP_ERROR);
+  }
+  progress.stop();
+}
+
+
+
 //Calculate the hierarchy of depressions. Takes as input a digital elevation
 //model and a set of labels. The labels should have `OCEAN` for cells
 //representing the "ocean" (the place to which depressions drain) and `NO_DEP`
@@ -222,29 +498,15 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
 
 ){
   rd::ProgressBar progress;
-  rd::Timer timer_overall;
-  timer_overall.start();
-
-  std::cerr<<"\033[91m#########Getting depression hierarchy\033[39m"<<std::endl;
-
-  //A D4 or D8 topology can be used.
-  const int    *dx;
-  const int    *dy;
-  const int    *dinverse;
-  int     neighbours;
-  if(topo==Topology::D4){
-    dx         = d4x;
-    dy         = d4y;
-    dinverse   = d4_inverse;
-    neighbours = 4;
-  } else if(topo==Topology::D8){
-    dx         = d8x;
-    dy         = d8y;
-    dinverse   = d8_inverse;
-    neighbours = 8;    
-  } else {
-    throw std::runtime_error("Unrecognised topology!");
-  }
+  ProfilePhase phase_overall("dephier");
+
+  Log()<<"Getting depression hierarchy"<<'\n';
+
+  //A D4 or D8 topology can be used. It is fixed at compile time, so the loops
+  //over neighbours are unrolled (see neighbours.hpp). Columns of neighbours
+  //wrap across the east and west edges of a periodic grid.
+  using Offsets = NeighbourOffsets<topo>;
+  const Neighbourhood<topo> hood(arp.topo.width(), arp.topo.height(), arp.wrap_x);
 
   //Depressions are identified by a number [0,*). The ocean is always
   //"depression" 0. This vector holds the depressions.
@@ -264,7 +526,7 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
   //depression gets all the cells within a flat area.
   rd::GridCellZk_high_pq<elev_t> pq;
 
-  std::cerr<<"p Adding ocean cells to priority-queue..."<<std::endl;
+  Log(LogLevel::Debug)<<"Adding ocean cells to priority-queue"<<'\n';
   //We assume the user has already specified a few ocean cells from which to
   //begin looking for depressions. We add all of these ocean cells to the
   //priority queue now.
@@ -296,7 +558,7 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
   }
 
 
-  std::cerr<<"p Finding pit cells..."<<std::endl;
+  Log(LogLevel::Debug)<<"Finding pit cells"<<'\n';
 
   //Here we find the pit cells of internally-draining regions. We define these
   //to be cells without any downstream neighbours. Note that this means we will
@@ -307,35 +569,69 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
   //Drainage Direction Over Flat Surfaces") as a way of reducing the number of
   //flat cells. Regardless, the algorithm will deal gracefully with the flats it
   //finds and this shouldn't slow things down too much!
-  int pit_cell_count = 0;
-  progress.start(arp.topo.size());
-  #pragma omp parallel for collapse(2) reduction(+:pit_cell_count)
-  for(int y=0;y<arp.topo.height();y++){  //Look at all the cells
-  for(int x=0;x<arp.topo.width() ;x++){ //Yes, all of them
-    ++progress;
-    const auto my_elev = arp.topo(x,y); //Focal cell's elevation
-    bool has_lower     = false;    //Pretend we have no lower neighbours
-    for(int n=1;n<=neighbours;n++){ //Check out our neighbours
-      //Use offset to get neighbour x coordinate, wrapping as needed
-      // const int nx = ModFloor(x+dx[n],dem.width()); 
-      const int nx = x+dx[n];
-      //Use offset to get neighbour y coordinate
-      const int ny = y+dy[n];      
-      if(!arp.topo.inGrid(nx,ny))  //Is cell outside grid (too far North/South)?
-        continue;             //Yup: skip it.
-      if(arp.topo(nx,ny)<my_elev){ //Is this neighbour lower than focal cell?
-        has_lower = true;     //Make a note of it
-        break;                //Don't need to look at additional neighbours
+  //
+  //The test is a sweep over the grid in two stages. First each block of rows
+  //finds its pit cells, in parallel: cells away from the edges of the grid
+  //have all of their neighbours, at fixed offsets, so a whole row of them is
+  //compared with its neighbours in one vectorised pass (see
+  //Neighbourhood::anyLowerInRow()). Only the first and last cells of each row,
+  //and the first and last rows, take the border path. Then the blocks' pits
+  //are added to the priority queue, in order, by one thread, so no locking is
+  //needed and ties in the queue are broken the same way for any number of
+  //threads.
+  const int width  = arp.topo.width();
+  const int height = arp.topo.height();
+  const int blocks = std::min(height, 256);
+  std::vector<std::vector<f2d::i_t>> block_pits(blocks);
+  progress.start(height);
+  #pragma omp parallel
+  {
+    //Flags which cells of a row have a lower neighbour
+    std::vector<uint8_t> row_lower(width);
+
+    #pragma omp for schedule(static)
+    for(int b=0;b<blocks;b++){
+      auto &pits = block_pits[b];
+      const auto border_pit = [&](const int x, const int y){
+        const auto my_elev = arp.topo(x,y); //Focal cell's elevation
+        //Is any neighbour lower than the focal cell? We don't need to look at
+        //additional neighbours once one is found.
+        const bool has_lower = hood.anyBorder(x, y, [&](int, int, int, const auto ni){
+          return arp.topo(ni)<my_elev;
+        });
+        if(!has_lower)          //The cell can't drain, so it is a pit cell
+          pits.push_back(arp.topo.xyToI(x,y));
+      };
+
+      const int y0 = static_cast<int64_t>(height)*b/blocks;
+      const int y1 = static_cast<int64_t>(height)*(b+1)/blocks;
+      for(int y=y0;y<y1;y++){
+        ++progress;
+        if(y==0 || y==height-1){
+          for(int x=0;x<width;x++)
+            border_pit(x, y);
+          continue;
+        }
+        border_pit(0, y);
+        hood.anyLowerInRow(arp.topo.data(), y, row_lower.data());
+        for(int x=1;x<width-1;x++)
+          if(!row_lower[x])
+            pits.push_back(arp.topo.xyToI(x,y));
+        if(width>1)
+          border_pit(width-1, y);
       }
     }
-    if(!has_lower){           //The cell can't drain, so it is a pit cell
-      //Add to pit cell count. Parallel safe because of reduction.
-      pit_cell_count++;       
-      #pragma omp critical    //Only one thread can safely access pq at a time
-      pq.emplace(x,y,arp.topo(x,y)); //Add cell to pq
+  }
+
+  int pit_cell_count = 0;
+  for(const auto &pits: block_pits){
+    for(const auto i: pits){
+      int x, y;
+      arp.topo.iToxy(i, x, y);
+      pq.emplace(x,y,arp.topo(i)); //Add cell to pq
     }
+    pit_cell_count += pits.size();
   }
-}
   progress.stop();
 
 
@@ -376,8 +672,9 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
   //cells are of the same elevation then we visit the one added last (most
   //recently) first.
 
-  std::cerr<<"p Searching for outlets..."<<std::endl;
+  Log(LogLevel::Debug)<<"Searching for outlets"<<'\n';
 
+  uint64_t neighbour_pushes = 0;
   progress.start(arp.topo.size());
   while(!pq.empty()){
     ++progress;
@@ -426,19 +723,15 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
     }
 
   
-    //Consider the cell's neighbours
-    for(int n=1;n<=neighbours;n++){
-      const int nx = c.x + dx[n]; //Get neighbour's y-coordinate using an offset
-      const int ny = c.y + dy[n]; //Get neighbour's y-coordinate using an offset
-      if(!arp.topo.inGrid(nx,ny))                    //Is this cell in the grid?
-        continue;                                    //Nope: out of bounds.
-      const auto ni     = arp.topo.xyToI(nx,ny);     //Flat index of neighbour
+    //Consider the cell's neighbours which are in the grid
+    hood.forEach(c.x, c.y, [&](const int n, const int nx, const int ny, const auto ni){
       const auto nlabel = label(ni);                 //Label of neighbour
 
       if(nlabel==NO_DEP){                  //Neighbour has not been visited yet 
         label(ni) = clabel;                //Give the neighbour my label
         pq.emplace(nx,ny,arp.topo(ni));//Add the neighbour to the priority queue
-        flowdirs(nx,ny) = dinverse[n]; 
+        neighbour_pushes++;
+        flowdirs(nx,ny) = Offsets::inverse[n]; 
         //Neighbour flows in the direction of this cell
       } else if (nlabel==clabel) {
         //Skip because we are not interested in ourself. That would be vain.
@@ -498,7 +791,7 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
           Outlet<elev_t>(clabel,nlabel,out_cell,out_elev);   
         }
       }
-    }
+    });
   }
   progress.stop();
 
@@ -546,172 +839,7 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
     return a.out_elev<b.out_elev;
   });
 
-  //TODO: For debugging
-  for(unsigned int i=0;i<outlets.size()-1;i++)
-    assert(outlets.at(i).out_elev<=outlets.at(i+1).out_elev);  
-    //TODO: I think this causes a problem in the case where you have only one 
-  //depression? Which should be very unlikely in a real-world case, but still
-
-  //Now that we have the outlets in order, we'll visit them from lowest to
-  //highest. If two outlets are at the same elevation we visit them in an
-  //arbitrary order. Each outlet we find is the unique lowest connection between
-  //two depressions. We join these depressions to make a meta-depression. The
-  //problem is, once we've formed a meta-depression, there may still be many
-  //outlets which believe they link to one of the child depressions.
-
-  //To deal with this, we use a Disjoint-Set/Union-Find data structure. This
-  //data structure, when passed a depression label as a query, returns the label
-  //of the upper-most meta-depression in the chain of parent depressions
-  //starting at the query label. The Disjoint-Set data structure has some nice
-  //caching properties which, *roughly speaking*, ensure that all queries
-  //execute in O(1) time.
-
-  //Presize the DisjointDenseIntSet to twice the number of depressions. Since we
-  //are building a binary tree the number of leaf nodes is about equal to the
-  //number of non-leaf nodes. The data structure will expand dynamically as
-  //needed.
-  DisjointDenseIntSet djset(depressions.size());
-
-  std::cerr<<"p Constructing hierarchy from outlets..."<<std::endl;
-
-  //Visit outlets in order of elevation from lowest to highest. If two outlets
-  //are at the same elevation, choose one arbitrarily.
-  progress.start(outlets.size());
-  for(auto &outlet: outlets){
-    ++progress;
-
-    auto depa_set = djset.findSet(outlet.depa); 
-    //Find the ultimate parent of Depression A
-    auto depb_set = djset.findSet(outlet.depb); 
-    //Find the ultimate parent of Depression B
-    
-
-    //If the depressions are already part of the same meta-depression, then
-    //nothing needs to be done.
-    if(depa_set==depb_set)
-      continue; //Do nothing, move on to the next highest outlet
-
-
-    if(depa_set==OCEAN || depb_set==OCEAN){
-      //If we're here then both depressions cannot link to the ocean, since we
-      //would have used `continue` above. Therefore, one and only one of them
-      //links to the ocean. We swap them to ensure that `depb` is the one which
-      //links to the ocean.
-      if(depa_set==OCEAN){
-        std::swap(outlet.depa, outlet.depb);
-        std::swap(depa_set, depb_set);
-      }
-
-      //We now have four values, the Depression A Label, the Depression B Label,
-      //the Depression A MetaLabel, and the Depression B MetaLabel. We know that
-      //the Depression B MetaLabel is OCEAN. Depression B Label is the label of
-      //the actual depression this outlet links to, not the meta-depressions of
-      //which it is a part. Depression A MetaLabel is the meta-depression that
-      //has just found a path to the ocean via Depression B. Depression A Label
-      //is some value we don't care about.
-
-      //What we will do is link Depression A MetaLabel to Depression B.
-      //Depression B ultimately terminates in the ocean, but the only way to get
-      //there in real-life is to crawl into Depression B, not into its meta-
-      //depression. At this point its meta-depression is the ocean, so crawling
-      //into the meta-depression would form a direct link to the ocean, which is
-      //not realistic.
-
-      //Get a reference to Depression A MetaLabel.
-      auto &dep = depressions.at(depa_set);
-
-      //If this depression has already found the ocean then don't merge it
-      //again. (TODO: Richard)
-      // if(dep.out_cell==OCEAN)
-        // continue;
-
-      //Ensure we don't modify depressions that have already found their paths
-      assert(dep.out_cell==-1);
-      assert(dep.odep==NO_VALUE);            
-
-      //Point this depression to the ocean through Depression B Label
-      dep.parent       = outlet.depb;        //Set Depression Meta(A) parent
-      dep.out_elev     = outlet.out_elev;    
-      //Set Depression Meta(A) outlet elevation                                     
-      dep.out_cell     = outlet.out_cell;    
-      //Set Depression Meta(A) outlet cell index
-      dep.odep         = depb_set;        
-      //Depression Meta(A) overflows into Depression B
-      dep.ocean_parent = true;
-      dep.geolink      = outlet.depb;        
-      //Metadepression(A) overflows, geographically, into Depression B
-      depressions.at(outlet.depb).ocean_linked.emplace_back(depa_set);
-      djset.mergeAintoB(depa_set,OCEAN); 
-      //Make a note that Depression A MetaLabel has a path to the ocean
-    } else {
-      //Neither depression has found the ocean, so we merge the two depressions
-      //into a new depression.
-      auto &depa          = depressions.at(depa_set); 
-      //Reference to Depression A MetaLabel
-      auto &depb          = depressions.at(depb_set); 
-      //Reference to Depression B MetaLabel
-
-      //Ensure we haven't already given these depressions outlet information
-      assert(depa.odep==NO_VALUE);     
-      assert(depb.odep==NO_VALUE);
-
-      const auto newlabel = depressions.size();       
-      //Label of A and B's new parent depression
-      depa.parent   = newlabel;        
-      //Set Meta(A)'s parent to be the new meta-depression
-      depb.parent   = newlabel;        
-      //Set Meta(B)'s parent to be the new meta-depression
-      depa.out_cell = outlet.out_cell; 
-      //Note that this is Meta(A)'s outlet
-      depb.out_cell = outlet.out_cell; 
-      //Note that this is Meta(B)'s outlet
-      depa.out_elev = outlet.out_elev; 
-      //Note that this is Meta(A)'s outlet's elevation
-      depb.out_elev = outlet.out_elev; 
-      //Note that this is Meta(B)'s outlet's elevation
-      depa.odep     = depb_set;        
-      //Note that Meta(A) overflows, logically, into Meta(B)
-      depb.odep     = depa_set;        
-      //Note that Meta(B) overflows, logically, into Meta(A)
-      depa.geolink  = outlet.depb;     
-      //Meta(A) overflows, geographically, into B
-      depb.geolink  = outlet.depa;     
-      //Meta(B) overflows, geographically, into A
-   
-      //Be sure that this happens AFTER we are done using the `depa` and `depb`
-      //references since they will be invalidated if `depressions` has to
-      //resize!
-      const auto depa_pitcell_temp = depa.pit_cell;
-
-      auto &newdep     = depressions.emplace_back();                                                                       
-      newdep.lchild    = depa_set;
-      newdep.rchild    = depb_set; 
-      newdep.dep_label = newlabel;
-      newdep.pit_cell  = depa_pitcell_temp;
-
-
-      newdep.my_subdepressions.emplace(depa_set);
-      newdep.my_subdepressions.emplace(depb_set);
-      newdep.my_subdepressions.insert(\
-        depressions.at(depa_set).my_subdepressions.begin()\
-        ,depressions.at(depa_set).my_subdepressions.end());
-      newdep.my_subdepressions.insert(\
-        depressions.at(depb_set).my_subdepressions.begin()\
-        ,depressions.at(depb_set).my_subdepressions.end());
-
-      
-      newdep.my_subdepressions_vec.resize(newdep.my_subdepressions.size());
-      std::copy(newdep.my_subdepressions.begin(),newdep.my_subdepressions.end()\
-        ,newdep.my_subdepressions_vec.begin());
-      newdep.my_subdepressions.erase(newdep.my_subdepressions.begin()\
-        ,newdep.my_subdepressions.end());
- 
-
-      djset.mergeAintoB(depa_set, newlabel); //A has a parent now
-      djset.mergeAintoB(depb_set, newlabel); //B has a parent now
-    }
-  }
-  progress.stop();
+  BuildDepressionHierarchy(depressions, outlets);
 
 
   //At this point we have a 2D array in which each cell is labeled. This label
@@ -721,77 +849,15 @@ DepressionHierarchy<elev_t> GetDepressionHierarchy(
   //The labels array has been modified in place. The depression hierarchy is
   //returned.
 
-  std::cerr<<"p Calculating depression marginal volumes..."<<std::endl;
-
-  //Get the marginal depression cell counts and total elevations
-  
-  for(int y=0;y<label.height();y++)
-  for(int x=0;x<label.width();x++){
-    const auto my_elev = arp.topo(x,y);
-    auto clabel        = label(x,y);
-    
-    while(clabel!=OCEAN && my_elev>depressions.at(clabel).out_elev)
-      clabel = depressions[clabel].parent;
-     
-
-    final_label(x,y) = clabel; 
-    //I want another layer that contains the labels of which depressions these 
-    //immediately belong to, even when it is a parent depression. 
-    //This is so that I can change the wtd_vol in the correct place
-    //when we have infiltration and wtd_vol of a depression changes. 
-
-    if(clabel==OCEAN)
-      continue;
-
-    depressions[clabel].dep_area += arp.cell_area[y];         
-     //We need to know the area of our child depressions when getting 
-    //the total depression volumes below.
-    depressions[clabel].dep_vol += (static_cast<double>(\
-    depressions[clabel].out_elev)-arp.topo(x,y))*arp.cell_area[y];  
-    //Add the area of one cell at a time - elevation difference between 
-    //the outlet of this depression and the current cell, 
-    //multiplied by the area of the current cell. 
- 
-  }
-
-  
-  std::cerr<<"p Calculating depression total volumes..."<<std::endl;
-  //Calculate total depression volumes and areas
-  progress.start(depressions.size());
-  for(int d=0;d<(int)depressions.size();d++){
-    ++progress;
-
-    auto &dep = depressions.at(d);
-    if(dep.lchild!=NO_VALUE){
-      assert(dep.rchild!=NO_VALUE); //Either no children or two children
-      assert(dep.lchild<d);         //ID of child must be smaller than parent's
-      assert(dep.rchild<d);         //ID of child must be smaller than parent's
-
-      dep.dep_vol += depressions.at(dep.lchild).dep_vol;  
-      //Add the actual dep volume of the child
-      dep.dep_vol += (dep.out_elev - depressions.at(dep.lchild).out_elev)\
-      * depressions.at(dep.lchild).dep_area; 
-      //add the water volume higher than the child depression's outlet, 
-      //but on the same cells
-
-      dep.dep_vol += depressions.at(dep.rchild).dep_vol;
-      dep.dep_vol += (dep.out_elev - depressions.at(dep.rchild).out_elev)\
-      * depressions.at(dep.rchild).dep_area;
-      
-      dep.dep_area += depressions.at(dep.lchild).dep_area;  
-      //remember to add the area covered by child depression cells, 
-      //so that our parent can also get the correct total dep_vol. 
-      dep.dep_area += depressions.at(dep.rchild).dep_area;
-    }
+  Log(LogLevel::Debug)<<"Calculating depression marginal volumes"<<'\n';
 
+  AddMarginalVolumes(arp, label, final_label, depressions, 0, label.height());
 
-    assert(dep.lchild==NO_VALUE || (depressions.at(dep.lchild).dep_vol + \
-      depressions.at(dep.rchild).dep_vol) - dep.dep_vol <= FP_ERROR);
-  }
-  progress.stop();
+  Log(LogLevel::Debug)<<"Calculating depression total volumes"<<'\n';
+  SumDepressionVolumes(depressions);
 
-  std::cerr<<"t Depression Hierarchy Wall-Time = " \
-  <<timer_overall.stop()<<" s"<<std::endl;
+  TheProfiler().count(ProfileCounter::PQPushes, \
+    ocean_cells + pit_cell_count + neighbour_pushes);
 
   return depressions;
 }
@@ -0,0 +1,508 @@
+#ifndef _dephier_cache_hpp_
+#define _dephier_cache_hpp_
+
+#include "ArrayPack.hpp"
+#include "dephier.hpp"
+#include "parameters.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace rd = richdem;
+namespace dh = richdem::dephier;
+
+//The depression hierarchy depends only on the topography and on which cells
+//are ocean. For equilibrium runs neither changes, so the hierarchy (and the
+//label, final_label and flowdirs arrays it produces) can be computed once for
+//a domain and reused by every run over that domain.
+//
+//The cache file is laid out so that it can be memory-mapped and read in place:
+//a fixed-size header, a table of fixed-size depression records, three flat
+//arrays holding the depressions' variable-length lists, and finally the three
+//grids. Each section starts on a 64-byte boundary and its offset is recorded
+//in the header.
+
+const char     DEPHIER_CACHE_MAGIC[8] = {'T','W','S','M','D','H','C','1'};
+const uint32_t DEPHIER_CACHE_VERSION  = 1;
+const uint64_t DEPHIER_CACHE_ALIGN    = 64;
+
+struct DepHierCacheHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t elev_size;          //sizeof(elev_t) used to build the hierarchy
+  uint64_t key;                //Hash of the topography and land mask
+  int32_t  width;
+  int32_t  height;
+  uint64_t depression_count;
+  uint64_t ocean_linked_count; //Total length of all ocean_linked lists
+  uint64_t subdep_vec_count;   //Total length of all my_subdepressions_vec lists
+  uint64_t subdep_set_count;   //Total length of all my_subdepressions sets
+  uint64_t depressions_offset;
+  uint64_t ocean_linked_offset;
+  uint64_t subdep_vec_offset;
+  uint64_t subdep_set_offset;
+  uint64_t label_offset;
+  uint64_t final_label_offset;
+  uint64_t flowdirs_offset;
+  uint64_t file_size;
+};
+
+//Fixed-size form of a `Depression`. Its variable-length members are stored as
+//ranges into the flat list arrays which follow the depression table.
+struct DepressionRecord {
+  dh_label_t pit_cell;
+  dh_label_t out_cell;
+  dh_label_t parent;
+  dh_label_t odep;
+  dh_label_t geolink;
+  dh_label_t lchild;
+  dh_label_t rchild;
+  dh_label_t dep_label;
+  double     pit_elev;
+  double     out_elev;
+  double     dep_area;
+  double     dep_vol;
+  double     water_vol;
+  double     wtd_vol;
+  double     wtd_only;
+  uint64_t   ocean_linked_begin;
+  uint64_t   subdep_vec_begin;
+  uint64_t   subdep_set_begin;
+  uint32_t   ocean_linked_count;
+  uint32_t   subdep_vec_count;
+  uint32_t   subdep_set_count;
+  uint8_t    ocean_parent;
+  uint8_t    padding[3];
+};
+
+///A depression hierarchy flattened into fixed-size records and flat lists.
+///This is the on-disk form used by the cache and by checkpoints.
+struct FlatDepressionHierarchy {
+  std::vector<DepressionRecord> records;
+  std::vector<dh_label_t>       ocean_linked;
+  std::vector<dh_label_t>       subdep_vec;
+  std::vector<dh_label_t>       subdep_set;
+};
+
+
+
+template<class elev_t>
+FlatDepressionHierarchy FlattenDepressionHierarchy(
+  const dh::DepressionHierarchy<elev_t> &deps
+){
+  FlatDepressionHierarchy flat;
+  flat.records.resize(deps.size());
+
+  for(unsigned int d=0;d<deps.size();d++){
+    const auto &dep = deps[d];
+    auto &rec       = flat.records[d];
+    std::memset(&rec, 0, sizeof(rec));
+    rec.pit_cell     = dep.pit_cell;
+    rec.out_cell     = dep.out_cell;
+    rec.parent       = dep.parent;
+    rec.odep         = dep.odep;
+    rec.geolink      = dep.geolink;
+    rec.lchild       = dep.lchild;
+    rec.rchild       = dep.rchild;
+    rec.dep_label    = dep.dep_label;
+    rec.pit_elev     = dep.pit_elev;
+    rec.out_elev     = dep.out_elev;
+    rec.dep_area     = dep.dep_area;
+    rec.dep_vol      = dep.dep_vol;
+    rec.water_vol    = dep.water_vol;
+    rec.wtd_vol      = dep.wtd_vol;
+    rec.wtd_only     = dep.wtd_only;
+    rec.ocean_parent = dep.ocean_parent;
+
+    rec.ocean_linked_begin = flat.ocean_linked.size();
+    rec.ocean_linked_count = dep.ocean_linked.size();
+    flat.ocean_linked.insert(flat.ocean_linked.end(), \
+      dep.ocean_linked.begin(), dep.ocean_linked.end());
+
+    rec.subdep_vec_begin = flat.subdep_vec.size();
+    rec.subdep_vec_count = dep.my_subdepressions_vec.size();
+    flat.subdep_vec.insert(flat.subdep_vec.end(), \
+      dep.my_subdepressions_vec.begin(), dep.my_subdepressions_vec.end());
+
+    rec.subdep_set_begin = flat.subdep_set.size();
+    rec.subdep_set_count = dep.my_subdepressions.size();
+    flat.subdep_set.insert(flat.subdep_set.end(), \
+      dep.my_subdepressions.begin(), dep.my_subdepressions.end());
+  }
+
+  return flat;
+}
+
+
+
+///Rebuilds a depression hierarchy from its flattened form. The arrays may
+///point directly into a memory-mapped file.
+template<class elev_t>
+dh::DepressionHierarchy<elev_t> UnflattenDepressionHierarchy(
+  const DepressionRecord *records,
+  const uint64_t          depression_count,
+  const dh_label_t       *ocean_linked,
+  const dh_label_t       *subdep_vec,
+  const dh_label_t       *subdep_set
+){
+  dh::DepressionHierarchy<elev_t> deps(depression_count);
+
+  for(uint64_t d=0;d<depression_count;d++){
+    const auto &rec  = records[d];
+    auto &dep        = deps[d];
+    dep.pit_cell     = rec.pit_cell;
+    dep.out_cell     = rec.out_cell;
+    dep.parent       = rec.parent;
+    dep.odep         = rec.odep;
+    dep.geolink      = rec.geolink;
+    dep.lchild       = rec.lchild;
+    dep.rchild       = rec.rchild;
+    dep.dep_label    = rec.dep_label;
+    dep.pit_elev     = rec.pit_elev;
+    dep.out_elev     = rec.out_elev;
+    dep.dep_area     = rec.dep_area;
+    dep.dep_vol      = rec.dep_vol;
+    dep.water_vol    = rec.water_vol;
+    dep.wtd_vol      = rec.wtd_vol;
+    dep.wtd_only     = rec.wtd_only;
+    dep.ocean_parent = rec.ocean_parent;
+
+    dep.ocean_linked.assign(ocean_linked + rec.ocean_linked_begin, \
+      ocean_linked + rec.ocean_linked_begin + rec.ocean_linked_count);
+    dep.my_subdepressions_vec.assign(subdep_vec + rec.subdep_vec_begin, \
+      subdep_vec + rec.subdep_vec_begin + rec.subdep_vec_count);
+    dep.my_subdepressions.insert(subdep_set + rec.subdep_set_begin, \
+      subdep_set + rec.subdep_set_begin + rec.subdep_set_count);
+  }
+
+  return deps;
+}
+
+
+
+template<class elev_t>
+dh::DepressionHierarchy<elev_t> UnflattenDepressionHierarchy(
+  const FlatDepressionHierarchy &flat
+){
+  return UnflattenDepressionHierarchy<elev_t>(flat.records.data(), \
+    flat.records.size(), flat.ocean_linked.data(), flat.subdep_vec.data(), \
+    flat.subdep_set.data());
+}
+
+
+
+///Mixes a block of memory into a running 64-bit hash. This only needs to
+///distinguish one input grid from another, not resist deliberate collisions,
+///so we consume a word at a time for speed.
+static uint64_t HashBytes(const void *data, const size_t bytes, uint64_t hash){
+  const unsigned char *p = static_cast<const unsigned char*>(data);
+  size_t i = 0;
+  for(;i+8<=bytes;i+=8){
+    uint64_t word;
+    std::memcpy(&word, p+i, 8);
+    hash ^= word * 0x9E3779B97F4A7C15ULL;
+    hash  = ((hash << 31) | (hash >> 33)) * 0xBF58476D1CE4E5B9ULL;
+  }
+  for(;i<bytes;i++){
+    hash ^= p[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+
+
+///The cache key: a hash of everything `GetDepressionHierarchy()` depends on.
+template<class elev_t>
+uint64_t DepressionHierarchyKey(const ArrayPack &arp){
+  uint64_t key = 0xCBF29CE484222325ULL;
+  const int32_t dims[2] = {arp.topo.width(), arp.topo.height()};
+  const uint32_t elev_size = sizeof(elev_t);
+  key = HashBytes(dims, sizeof(dims), key);
+  key = HashBytes(&elev_size, sizeof(elev_size), key);
+  key = HashBytes(arp.topo.data(), arp.topo.size()*sizeof(*arp.topo.data()), key);
+  key = HashBytes(arp.land.words().data(), \
+    arp.land.words().size()*sizeof(uint64_t), key);
+  //Neighbours wrap around a periodic grid, which changes the hierarchy. Other
+  //grids hash as they did before periodic grids were supported.
+  if(arp.wrap_x.periodic()){
+    const uint32_t periodic = 1;
+    key = HashBytes(&periodic, sizeof(periodic), key);
+  }
+  return key;
+}
+
+
+
+///Location of the cache file for a given key within the cache directory. Each
+///strip of a domain split between MPI ranks has a file of its own.
+std::string DepressionHierarchyCacheFilename(
+  const Parameters &params,
+  const uint64_t    key
+){
+  std::ostringstream oss;
+  oss<<params.dephier_cache<<"/dephier_"<<std::hex<<std::setw(16)\
+  <<std::setfill('0')<<key<<params.strip_suffix<<".bin";
+  return oss.str();
+}
+
+
+
+///Makes sure the cache directory exists and can be written to, creating it if
+///need be. This is called before the hierarchy is computed, so that a bad
+///directory is reported before the work rather than when saving it.
+static void PrepareDepressionHierarchyCacheDir(const Parameters &params){
+  const std::string &dir = params.dephier_cache;
+  if(mkdir(dir.c_str(), 0777)!=0 && errno!=EEXIST)
+    throw std::runtime_error("Failed to create cache directory '" + dir + "'!");
+
+  struct stat st;
+  if(stat(dir.c_str(), &st)!=0 || !S_ISDIR(st.st_mode))
+    throw std::runtime_error("Cache directory '" + dir + "' is not a directory!");
+  if(access(dir.c_str(), W_OK | X_OK)!=0)
+    throw std::runtime_error("Cache directory '" + dir + "' is not writable!");
+}
+
+
+
+static uint64_t AlignCacheOffset(const uint64_t offset){
+  return (offset + DEPHIER_CACHE_ALIGN - 1) / DEPHIER_CACHE_ALIGN \
+    * DEPHIER_CACHE_ALIGN;
+}
+
+//Whether `count` items of `item_size` bytes starting at `offset` lie within a
+//file of `file_size` bytes, without overflowing
+static bool CacheSectionFits(
+  const uint64_t offset, const uint64_t count, const uint64_t item_size,
+  const uint64_t file_size
+){
+  return offset<=file_size && count<=(file_size-offset)/item_size;
+}
+
+static void CacheWriteAt(
+  FILE *fp, const uint64_t offset, const void *data, const size_t bytes
+){
+  if(std::fseek(fp, offset, SEEK_SET)!=0 || \
+    (bytes>0 && std::fwrite(data, 1, bytes, fp)!=bytes))
+    throw std::runtime_error("Failed to write depression hierarchy cache!");
+}
+
+
+
+///Stores the depression hierarchy along with label, final_label and flowdirs.
+///The file is written under a temporary name and renamed into place so that
+///concurrent runs over the same domain never see a partial cache.
+///
+///`key` identifies the domain; a strip of a domain split between MPI ranks
+///(see `Parameters::strip_suffix`) is stored under its whole domain's key.
+template<class elev_t>
+void SaveDepressionHierarchyCache(
+  const Parameters                      &params,
+  const ArrayPack                       &arp,
+  const dh::DepressionHierarchy<elev_t> &deps,
+  const uint64_t                         key
+){
+  const std::string filename = DepressionHierarchyCacheFilename(params, key);
+  const std::string tempname = filename + ".tmp" + std::to_string(getpid());
+
+  const auto flat = FlattenDepressionHierarchy(deps);
+
+  DepHierCacheHeader hdr;
+  std::memset(&hdr, 0, sizeof(hdr));
+  std::memcpy(hdr.magic, DEPHIER_CACHE_MAGIC, sizeof(hdr.magic));
+  hdr.version             = DEPHIER_CACHE_VERSION;
+  hdr.elev_size           = sizeof(elev_t);
+  hdr.key                 = key;
+  hdr.width               = arp.label.width();
+  hdr.height              = arp.label.height();
+  hdr.depression_count    = flat.records.size();
+  hdr.ocean_linked_count  = flat.ocean_linked.size();
+  hdr.subdep_vec_count    = flat.subdep_vec.size();
+  hdr.subdep_set_count    = flat.subdep_set.size();
+
+  const uint64_t cells    = arp.label.size();
+  hdr.depressions_offset  = AlignCacheOffset(sizeof(hdr));
+  hdr.ocean_linked_offset = AlignCacheOffset(hdr.depressions_offset  + \
+    flat.records.size()*sizeof(DepressionRecord));
+  hdr.subdep_vec_offset   = AlignCacheOffset(hdr.ocean_linked_offset + \
+    flat.ocean_linked.size()*sizeof(dh_label_t));
+  hdr.subdep_set_offset   = AlignCacheOffset(hdr.subdep_vec_offset   + \
+    flat.subdep_vec.size()*sizeof(dh_label_t));
+  hdr.label_offset        = AlignCacheOffset(hdr.subdep_set_offset   + \
+    flat.subdep_set.size()*sizeof(dh_label_t));
+  hdr.final_label_offset  = AlignCacheOffset(hdr.label_offset        + \
+    cells*sizeof(dh_label_t));
+  hdr.flowdirs_offset     = AlignCacheOffset(hdr.final_label_offset  + \
+    cells*sizeof(dh_label_t));
+  hdr.file_size           = hdr.flowdirs_offset + cells*sizeof(rd::flowdir_t);
+
+  FILE *fp = std::fopen(tempname.c_str(), "wb");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to open cache file '" + tempname + "'!");
+
+  try {
+    CacheWriteAt(fp, 0,                        &hdr, sizeof(hdr));
+    CacheWriteAt(fp, hdr.depressions_offset,   flat.records.data(), \
+      flat.records.size()*sizeof(DepressionRecord));
+    CacheWriteAt(fp, hdr.ocean_linked_offset,  flat.ocean_linked.data(), \
+      flat.ocean_linked.size()*sizeof(dh_label_t));
+    CacheWriteAt(fp, hdr.subdep_vec_offset,    flat.subdep_vec.data(), \
+      flat.subdep_vec.size()*sizeof(dh_label_t));
+    CacheWriteAt(fp, hdr.subdep_set_offset,    flat.subdep_set.data(), \
+      flat.subdep_set.size()*sizeof(dh_label_t));
+    CacheWriteAt(fp, hdr.label_offset,         arp.label.data(), \
+      cells*sizeof(dh_label_t));
+    CacheWriteAt(fp, hdr.final_label_offset,   arp.final_label.data(), \
+      cells*sizeof(dh_label_t));
+    CacheWriteAt(fp, hdr.flowdirs_offset,      arp.flowdirs.data(), \
+      cells*sizeof(rd::flowdir_t));
+  } catch (...) {
+    std::fclose(fp);
+    std::remove(tempname.c_str());
+    throw;
+  }
+
+  //The data must be on disk before the rename makes it visible, or a crash
+  //could leave a complete-looking cache that is really empty or partial
+  if(std::fflush(fp)!=0 || fsync(fileno(fp))!=0){
+    std::fclose(fp);
+    std::remove(tempname.c_str());
+    throw std::runtime_error("Failed to flush cache file '" + tempname + "'!");
+  }
+
+  if(std::fclose(fp)!=0)
+    throw std::runtime_error("Failed to close cache file '" + tempname + "'!");
+
+  if(std::rename(tempname.c_str(), filename.c_str())!=0)
+    throw std::runtime_error("Failed to move cache into place at '" + filename + "'!");
+}
+
+
+
+//Whether the list ranges of every depression record lie within the lists.
+//The sections themselves must already have been checked.
+static bool CacheRecordsFit(const DepHierCacheHeader &hdr, const char *const base){
+  const auto *const records = reinterpret_cast<const DepressionRecord*>(base + hdr.depressions_offset);
+  for(uint64_t d=0;d<hdr.depression_count;d++){
+    const auto &rec = records[d];
+    if(rec.ocean_linked_begin>hdr.ocean_linked_count || rec.ocean_linked_count>hdr.ocean_linked_count-rec.ocean_linked_begin
+      || rec.subdep_vec_begin>hdr.subdep_vec_count   || rec.subdep_vec_count>hdr.subdep_vec_count-rec.subdep_vec_begin
+      || rec.subdep_set_begin>hdr.subdep_set_count   || rec.subdep_set_count>hdr.subdep_set_count-rec.subdep_set_begin)
+      return false;
+  }
+  return true;
+}
+
+
+
+///Looks for a cached depression hierarchy matching the current topography
+///and land mask. If one is found it is memory-mapped, label, final_label and
+///flowdirs are copied out of it, and the hierarchy is rebuilt from its
+///records.
+///
+///@return True if a matching cache was found and loaded into `deps` and
+///        `arp`. False if there is no cache for this domain, in which case
+///        nothing has been modified.
+template<class elev_t>
+bool LoadDepressionHierarchyCache(
+  const Parameters                &params,
+  ArrayPack                       &arp,
+  dh::DepressionHierarchy<elev_t> &deps,
+  const uint64_t                   key
+){
+  const std::string filename = DepressionHierarchyCacheFilename(params, key);
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if(fd<0)
+    return false;
+
+  struct stat st;
+  if(fstat(fd, &st)!=0 || static_cast<size_t>(st.st_size)<sizeof(DepHierCacheHeader)){
+    close(fd);
+    throw std::runtime_error("Depression hierarchy cache '" + filename + "' is truncated!");
+  }
+
+  void *const map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map==MAP_FAILED)
+    throw std::runtime_error("Failed to map depression hierarchy cache '" + filename + "'!");
+
+  const char *const base = static_cast<const char*>(map);
+  const auto &hdr        = *reinterpret_cast<const DepHierCacheHeader*>(base);
+
+  const uint64_t cells = arp.label.size();
+  const bool valid =
+       std::memcmp(hdr.magic, DEPHIER_CACHE_MAGIC, sizeof(hdr.magic))==0
+    && hdr.version   == DEPHIER_CACHE_VERSION
+    && hdr.elev_size == sizeof(elev_t)
+    && hdr.key       == key
+    && hdr.width     == arp.label.width()
+    && hdr.height    == arp.label.height()
+    && hdr.file_size == static_cast<uint64_t>(st.st_size)
+    && CacheSectionFits(hdr.depressions_offset,  hdr.depression_count,   sizeof(DepressionRecord), hdr.file_size)
+    && CacheSectionFits(hdr.ocean_linked_offset, hdr.ocean_linked_count, sizeof(dh_label_t),       hdr.file_size)
+    && CacheSectionFits(hdr.subdep_vec_offset,   hdr.subdep_vec_count,   sizeof(dh_label_t),       hdr.file_size)
+    && CacheSectionFits(hdr.subdep_set_offset,   hdr.subdep_set_count,   sizeof(dh_label_t),       hdr.file_size)
+    && CacheSectionFits(hdr.label_offset,        cells,                  sizeof(dh_label_t),       hdr.file_size)
+    && CacheSectionFits(hdr.final_label_offset,  cells,                  sizeof(dh_label_t),       hdr.file_size)
+    && CacheSectionFits(hdr.flowdirs_offset,     cells,                  sizeof(rd::flowdir_t),    hdr.file_size)
+    && CacheRecordsFit(hdr, base);
+
+  if(!valid){
+    munmap(map, st.st_size);
+    throw std::runtime_error("Depression hierarchy cache '" + filename + \
+      "' is corrupt or from an incompatible version!");
+  }
+
+  deps = UnflattenDepressionHierarchy<elev_t>(
+    reinterpret_cast<const DepressionRecord*>(base + hdr.depressions_offset),
+    hdr.depression_count,
+    reinterpret_cast<const dh_label_t*>(base + hdr.ocean_linked_offset),
+    reinterpret_cast<const dh_label_t*>(base + hdr.subdep_vec_offset),
+    reinterpret_cast<const dh_label_t*>(base + hdr.subdep_set_offset)
+  );
+
+  std::memcpy(arp.label.data(),       base + hdr.label_offset,       \
+    cells*sizeof(dh_label_t));
+  std::memcpy(arp.final_label.data(), base + hdr.final_label_offset, \
+    cells*sizeof(dh_label_t));
+  std::memcpy(arp.flowdirs.data(),    base + hdr.flowdirs_offset,    \
+    cells*sizeof(rd::flowdir_t));
+
+  munmap(map, st.st_size);
+
+  return true;
+}
+
+///SaveDepressionHierarchyCache() for the domain held in `arp`
+template<class elev_t>
+void SaveDepressionHierarchyCache(
+  const Parameters                      &params,
+  const ArrayPack                       &arp,
+  const dh::DepressionHierarchy<elev_t> &deps
+){
+  SaveDepressionHierarchyCache(params, arp, deps, DepressionHierarchyKey<elev_t>(arp));
+}
+
+///LoadDepressionHierarchyCache() for the domain held in `arp`
+template<class elev_t>
+bool LoadDepressionHierarchyCache(
+  const Parameters                &params,
+  ArrayPack                       &arp,
+  dh::DepressionHierarchy<elev_t> &deps
+){
+  return LoadDepressionHierarchyCache(params, arp, deps, DepressionHierarchyKey<elev_t>(arp));
+}
+
+#endif
@@ -0,0 +1,427 @@
+#ifndef _distributed_dephier_hpp_
+#define _distributed_dephier_hpp_
+
+#ifdef TWSM_USE_MPI
+
+#include "ArrayPack.hpp"
+#include "DisjointDenseIntSet.hpp"
+#include "dephier.hpp"
+#include "dephier_cache.hpp"
+#include "domain_decomposition.hpp"
+#include "logging.hpp"
+#include "neighbours.hpp"
+#include "profiler.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <richdem/common/grid_cell.hpp>
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace richdem::dephier {
+
+//The depression hierarchy of a domain split into strips of rows between MPI
+//ranks (see domain_decomposition.hpp), after Barnes (2017, "Parallel
+//Priority-Flood depression filling for trillion cell digital elevation
+//models"), where each tile is flooded on its own and only a small graph of
+//what crosses the tiles' edges is joined on one process.
+//
+//Each rank floods the rows it owns exactly as GetDepressionHierarchy() floods
+//the whole domain, except that it doesn't look beyond them. A cell whose only
+//lower neighbours are in the next strip is therefore taken for a pit: it
+//starts a depression which in truth is part of the depression in the next
+//strip that its lowest neighbour there belongs to. The ranks then send the
+//root:
+//  - the pit of each depression they found, and for those which are really
+//    part of a depression in the next strip, the label there of the cell they
+//    drain into;
+//  - the lowest outlet between each pair of their depressions, and between
+//    theirs and those of the strip above, across the rows where they meet;
+//  - pairs of pits on either side of those rows which are a single flat.
+//The root joins the depressions which are really one, giving each the pit of
+//the lowest of its parts, keeps the lowest outlet between each pair of the
+//joined depressions, and builds the hierarchy from them as
+//GetDepressionHierarchy() does. Every rank gets the hierarchy, relabels its
+//cells, and adds up the areas and volumes of its cells, which are then summed
+//over the ranks.
+//
+//Depressions' pit and outlet cells are flat indices into the whole domain.
+//The depressions, with their outlets and volumes, are those a single process
+//finds, except that ties between cells of equal elevation in different strips
+//may be broken differently. A cell above the outlet of its depression takes
+//the label of whichever flood reaches it first, though, which near a strip
+//boundary may be a different one than on a single process, so such cells may
+//drain into a different neighbouring depression.
+
+///The pit of a depression found by one strip's flood, as sent to the root
+template<class elev_t>
+struct StripDepression {
+  dh_label_t pit_cell;  //Flat index in the domain
+  elev_t     pit_elev;
+  dh_label_t drains_to; //Label of the cell in the next strip which the pit
+                        //drains into, or NO_VALUE if it is a true pit
+};
+
+///Two depressions which should be joined into one
+struct DepressionPair {
+  dh_label_t a;
+  dh_label_t b;
+};
+
+
+
+///GetDepressionHierarchy() for a domain split into strips of rows between MPI
+///ranks. Collective over the ranks of `rows`.
+///
+///@param arp          This rank's strip, including its halo rows
+///@param label        As for GetDepressionHierarchy(), over the strip. Halo
+///                    rows are set as well as the rows the rank owns.
+///@param final_label  As for GetDepressionHierarchy(), over the strip
+///@param flowdirs     As for GetDepressionHierarchy(), over the strip
+///@param rows         How the domain is split between the ranks
+///
+///@return The hierarchy of the whole domain, the same on every rank
+template<class elev_t, Topology topo>
+DepressionHierarchy<elev_t> GetDepressionHierarchy(
+  const ArrayPack           &arp,
+  rd::Array2D<int>          &label,
+  rd::Array2D<int>          &final_label,
+  rd::Array2D<int8_t>       &flowdirs,
+  const RowDecomposition    &rows
+){
+  ProfilePhase phase_overall("dephier");
+
+  Log()<<"Getting depression hierarchy over "<<rows.size()<<" strips"<<'\n';
+
+  using Offsets = NeighbourOffsets<topo>;
+  const Neighbourhood<topo> hood(arp.topo.width(), arp.topo.height(), arp.wrap_x);
+
+  const auto &strip = rows.mine();
+  const int   width = arp.topo.width();
+  const int   y0    = strip.ownedBegin();
+  const int   y1    = strip.ownedEnd();
+  const auto  owned = [&](const int y){ return y0<=y && y<y1; };
+  //Flat index in the domain of a cell of the strip
+  const auto  global_cell = [&](const int64_t i){
+    return static_cast<dh_label_t>(i+static_cast<int64_t>(strip.halo_y0)*width);
+  };
+
+  //Seed the flood with the strip's ocean cells and then its pits, in the same
+  //order as GetDepressionHierarchy()
+  rd::GridCellZk_high_pq<elev_t> pq;
+
+  int ocean_cells = 0;
+  for(int y=y0;y<y1;y++)
+  for(int x=0;x<width;x++){
+    if(label(x,y)==OCEAN){
+      pq.emplace(x,y,arp.topo(x,y));
+      ocean_cells++;
+    }
+  }
+
+  if(rows.sum(static_cast<double>(ocean_cells))==0)
+    throw std::runtime_error("No initial ocean cells were found!");
+
+  //A cell with no lower neighbour is a pit. One whose lower neighbours are all
+  //in the next strip is treated as a pit here too, and remembered so that its
+  //depression can be joined to theirs. Pits which are neither are flagged so
+  //that a flat of pits across the edge of the strip can be joined as well.
+  rd::Array2D<uint8_t> true_pit(width, arp.topo.height(), 0);
+  std::vector<std::vector<int>> row_pits(y1-y0);
+  #pragma omp parallel for schedule(static)
+  for(int y=y0;y<y1;y++)
+  for(int x=0;x<width;x++){
+    const auto my_elev = arp.topo(x,y);
+    bool lower_here  = false;
+    bool lower_there = false;
+    hood.forEach(x, y, [&](int, int, const int ny, const auto ni){
+      if(arp.topo(ni)<my_elev)
+        (owned(ny) ? lower_here : lower_there) = true;
+    });
+    if(lower_here)
+      continue;
+    row_pits[y-y0].push_back(x);
+    if(!lower_there)
+      true_pit(x,y) = 1;
+  }
+
+  int pit_cell_count = 0;
+  for(int y=y0;y<y1;y++){
+    for(const auto x: row_pits[y-y0])
+      pq.emplace(x,y,arp.topo(x,y));
+    pit_cell_count += row_pits[y-y0].size();
+  }
+  row_pits = std::vector<std::vector<int>>();
+
+  //The flood of GetDepressionHierarchy(), over the rows this rank owns.
+  //Depressions are numbered from 1 in the order they are found, and the
+  //outlets between them are keyed on those labels.
+  std::vector<StripDepression<elev_t>> found;
+  std::vector<int64_t>                 drain_cells; //Strip cell each drains into, or -1
+  std::unordered_map<OutletLink, Outlet<elev_t>, OutletHash<elev_t>> outlet_database;
+  outlet_database.reserve(3*(pit_cell_count+1));
+
+  uint64_t neighbour_pushes = 0;
+  while(!pq.empty()){
+    const auto c = pq.top();
+    pq.pop();
+    const auto celev  = c.z;
+    const auto ci     = arp.topo.xyToI(c.x,c.y);
+    auto       clabel = label(ci);
+
+    if(clabel==NO_DEP){
+      //A new depression. If it only seemed to be a pit because its lower
+      //neighbours are in the next strip, it drains to the lowest of them.
+      clabel       = found.size()+1;
+      label(ci)    = clabel;
+      int64_t drain = -1;
+      elev_t  lowest = celev;
+      hood.forEach(c.x, c.y, [&](const int n, int, const int ny, const auto ni){
+        if(!owned(ny) && arp.topo(ni)<lowest){
+          lowest       = arp.topo(ni);
+          drain        = ni;
+          flowdirs(ci) = n;
+        }
+      });
+      found.push_back({global_cell(ci), celev, NO_VALUE});
+      drain_cells.push_back(drain);
+    }
+
+    hood.forEach(c.x, c.y, [&](const int n, const int nx, const int ny, const auto ni){
+      if(!owned(ny))
+        return;
+      const auto nlabel = label(ni);
+      if(nlabel==NO_DEP){
+        label(ni) = clabel;
+        pq.emplace(nx,ny,arp.topo(ni));
+        neighbour_pushes++;
+        flowdirs(nx,ny) = Offsets::inverse[n];
+      } else if(nlabel!=clabel){
+        //The outlet between two depressions is the higher of the two cells
+        auto out_cell = global_cell(ci);
+        auto out_elev = celev;
+        if(arp.topo(ni)>out_elev){
+          out_cell = global_cell(ni);
+          out_elev = arp.topo(ni);
+        }
+        const OutletLink olink(clabel,nlabel);
+        const auto o = outlet_database.find(olink);
+        if(o==outlet_database.end())
+          outlet_database[olink] = Outlet<elev_t>(clabel,nlabel,out_cell,out_elev);
+        else if(o->second.out_elev>out_elev){
+          o->second.out_cell = out_cell;
+          o->second.out_elev = out_elev;
+        }
+      }
+    });
+  }
+
+  TheProfiler().count(ProfileCounter::PQPushes, \
+    ocean_cells + pit_cell_count + neighbour_pushes);
+
+  //Make the labels unique across the ranks by numbering each rank's
+  //depressions after those of the ranks before it
+  const dh_label_t my_count = found.size();
+  dh_label_t       offset   = 0;
+  MPI_Exscan(&my_count, &offset, 1, MPI_INT32_T, MPI_SUM, rows.communicator());
+  if(rows.rank()==0)
+    offset = 0;
+
+  for(int y=y0;y<y1;y++)
+  for(int x=0;x<width;x++)
+    if(label(x,y)!=OCEAN)
+      label(x,y) += offset;
+  rows.exchangeHalos(label);
+  rows.exchangeHalos(flowdirs);
+  rows.exchangeHalos(true_pit);
+
+  for(size_t d=0;d<found.size();d++)
+    if(drain_cells[d]>=0)
+      found[d].drains_to = label(static_cast<rd::Array2D<int>::i_t>(drain_cells[d]));
+
+  std::vector<Outlet<elev_t>> outlets;
+  outlets.reserve(outlet_database.size());
+  for(const auto &o: outlet_database){
+    auto outlet = o.second;
+    if(outlet.depa!=OCEAN) outlet.depa += offset;
+    if(outlet.depb!=OCEAN) outlet.depb += offset;
+    outlets.push_back(outlet);
+  }
+  outlet_database = decltype(outlet_database)();
+
+  //Where this strip meets the one above, every pair of neighbours in
+  //different depressions is an outlet between them, and neighbouring pits of
+  //the same elevation are a single flat
+  std::vector<DepressionPair> flats;
+  if(strip.halo_y1>strip.y1){
+    const int y = y1-1;
+    for(int x=0;x<width;x++){
+      const auto ci = arp.topo.xyToI(x,y);
+      hood.forEach(x, y, [&](int, int, const int ny, const auto ni){
+        if(ny!=y1 || label(ci)==label(ni))
+          return;
+        if(arp.topo(ni)>arp.topo(ci))
+          outlets.emplace_back(label(ci), label(ni), global_cell(ni), arp.topo(ni));
+        else
+          outlets.emplace_back(label(ci), label(ni), global_cell(ci), arp.topo(ci));
+        if(true_pit(ci) && true_pit(ni) && arp.topo(ci)==arp.topo(ni))
+          flats.push_back({label(ci), label(ni)});
+      });
+    }
+  }
+  true_pit = rd::Array2D<uint8_t>();
+
+  std::vector<int> dep_counts, outlet_counts, flat_counts;
+  const auto all_found   = rows.gatherItems(found,   0, dep_counts);
+  const auto all_outlets = rows.gatherItems(outlets, 0, outlet_counts);
+  const auto all_flats   = rows.gatherItems(flats,   0, flat_counts);
+  outlets = std::vector<Outlet<elev_t>>();
+
+  DepressionHierarchy<elev_t> depressions;
+  std::vector<dh_label_t>     new_labels; //New label of each strip depression
+
+  if(rows.isRoot()){
+    //Join the depressions which are really one. A depression joined to the
+    //ocean is part of it.
+    const dh_label_t n_found = all_found.size();
+    DisjointDenseIntSet djset(n_found+1);
+    for(dh_label_t d=1;d<=n_found;d++)
+      if(all_found[d-1].drains_to!=NO_VALUE)
+        djset.unionSet(d, all_found[d-1].drains_to);
+    for(const auto &f: all_flats)
+      djset.unionSet(f.a, f.b);
+
+    //Each joined depression takes the pit of its lowest true pit, and its
+    //parts' lowest label decides its place, so that a domain of one strip is
+    //numbered as GetDepressionHierarchy() numbers it
+    std::vector<dh_label_t> lowest(n_found+1, NO_VALUE);
+    std::vector<dh_label_t> first(n_found+1, NO_VALUE);
+    const auto ocean_set = djset.findSet(OCEAN);
+    for(dh_label_t d=1;d<=n_found;d++){
+      const auto s = djset.findSet(d);
+      if(s==ocean_set)
+        continue;
+      if(first[s]==NO_VALUE)
+        first[s] = d;
+      if(all_found[d-1].drains_to!=NO_VALUE)
+        continue;
+      const auto &p = all_found[d-1];
+      if(lowest[s]==NO_VALUE || std::make_tuple(p.pit_elev, p.pit_cell) < \
+        std::make_tuple(all_found[lowest[s]-1].pit_elev, all_found[lowest[s]-1].pit_cell))
+        lowest[s] = d;
+    }
+
+    {
+      auto &oceandep     = depressions.emplace_back();
+      oceandep.pit_elev  = -std::numeric_limits<elev_t>::infinity();
+      oceandep.pit_cell  = NO_VALUE;
+      oceandep.dep_label = 0;
+    }
+
+    std::vector<dh_label_t> set_label(n_found+1, OCEAN);
+    for(dh_label_t d=1;d<=n_found;d++){
+      const auto s = djset.findSet(d);
+      if(s==ocean_set || first[s]!=d)
+        continue;
+      if(lowest[s]==NO_VALUE)
+        throw std::logic_error("A depression spanning strips has no pit!");
+      set_label[s]       = depressions.size();
+      auto &newdep       = depressions.emplace_back();
+      newdep.pit_cell    = all_found[lowest[s]-1].pit_cell;
+      newdep.pit_elev    = all_found[lowest[s]-1].pit_elev;
+      newdep.dep_label   = set_label[s];
+    }
+
+    new_labels.resize(n_found);
+    for(dh_label_t d=1;d<=n_found;d++)
+      new_labels[d-1] = set_label[djset.findSet(d)];
+    const auto relabel = [&](const dh_label_t l){
+      return l==OCEAN ? OCEAN : new_labels[l-1];
+    };
+
+    //Keep the lowest outlet between each pair of joined depressions. Ties go
+    //to the lower cell, so that the choice doesn't depend on the order in
+    //which the outlets arrived.
+    std::unordered_map<OutletLink, Outlet<elev_t>, OutletHash<elev_t>> joined;
+    joined.reserve(all_outlets.size());
+    for(auto outlet: all_outlets){
+      outlet.depa = relabel(outlet.depa);
+      outlet.depb = relabel(outlet.depb);
+      if(outlet.depa==outlet.depb)
+        continue;
+      const OutletLink olink(outlet.depa, outlet.depb);
+      const auto o = joined.find(olink);
+      if(o==joined.end())
+        joined[olink] = outlet;
+      else if(std::make_tuple(outlet.out_elev, outlet.out_cell) < \
+        std::make_tuple(o->second.out_elev, o->second.out_cell))
+        o->second = outlet;
+    }
+
+    std::vector<Outlet<elev_t>> joined_outlets;
+    joined_outlets.reserve(joined.size());
+    for(const auto &o: joined)
+      joined_outlets.push_back(o.second);
+    joined = decltype(joined)();
+
+    //The hash table's order differs between runs, so ties in elevation are
+    //put in a fixed order
+    std::sort(joined_outlets.begin(), joined_outlets.end(), [](const Outlet<elev_t> &a, \
+      const Outlet<elev_t> &b){
+      return std::make_tuple(a.out_elev, std::min(a.depa,a.depb), std::max(a.depa,a.depb)) < \
+             std::make_tuple(b.out_elev, std::min(b.depa,b.depb), std::max(b.depa,b.depb));
+    });
+
+    BuildDepressionHierarchy(depressions, joined_outlets);
+  }
+
+  //Every rank gets the hierarchy and the new labels of its depressions
+  {
+    auto flat = rows.isRoot() ? FlattenDepressionHierarchy(depressions) : FlatDepressionHierarchy();
+    rows.broadcast(flat.records,      0);
+    rows.broadcast(flat.ocean_linked, 0);
+    rows.broadcast(flat.subdep_vec,   0);
+    rows.broadcast(flat.subdep_set,   0);
+    if(!rows.isRoot())
+      depressions = UnflattenDepressionHierarchy<elev_t>(flat);
+  }
+  const auto my_labels = rows.scatterItems(new_labels, 0, dep_counts);
+
+  for(int y=y0;y<y1;y++)
+  for(int x=0;x<width;x++)
+    if(label(x,y)!=OCEAN)
+      label(x,y) = my_labels[label(x,y)-offset-1];
+  rows.exchangeHalos(label);
+
+  Log(LogLevel::Debug)<<"Calculating depression marginal volumes"<<'\n';
+
+  AddMarginalVolumes(arp, label, final_label, depressions, y0, y1);
+  rows.exchangeHalos(final_label);
+
+  std::vector<double> areas(depressions.size()), volumes(depressions.size());
+  for(size_t d=0;d<depressions.size();d++){
+    areas[d]   = depressions[d].dep_area;
+    volumes[d] = depressions[d].dep_vol;
+  }
+  rows.sum(areas);
+  rows.sum(volumes);
+  for(size_t d=0;d<depressions.size();d++){
+    depressions[d].dep_area = areas[d];
+    depressions[d].dep_vol  = volumes[d];
+  }
+
+  Log(LogLevel::Debug)<<"Calculating depression total volumes"<<'\n';
+  SumDepressionVolumes(depressions);
+
+  return depressions;
+}
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,778 @@
+#ifndef _distributed_fill_spill_merge_hpp_
+#define _distributed_fill_spill_merge_hpp_
+
+#ifdef TWSM_USE_MPI
+
+#include "ArrayPack.hpp"
+#include "dephier.hpp"
+#include "domain_decomposition.hpp"
+#include "fill_spill_merge.hpp"
+#include "logging.hpp"
+#include "neighbours.hpp"
+#include "parameters.hpp"
+#include "profiler.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace richdem::dephier {
+
+//FillSpillMerge() for a domain split into strips of rows between MPI ranks
+//(see domain_decomposition.hpp), using the hierarchy from the distributed
+//GetDepressionHierarchy() (see distributed_dephier.hpp). Every rank holds the
+//whole hierarchy, so the traversals of it run on every rank alike, and only
+//the steps which touch cells are split:
+//
+//  - Water is routed into the pits over the rows each rank owns. Water which
+//    flows into the next strip is sent to its rank in rounds, until none is
+//    left in flight, and the volumes reaching the pits are summed.
+//  - The storage space of each depression is summed over the ranks.
+//  - Water overflowing a depression is routed downslope from its outlet by
+//    the rank owning the cell it has reached. When it flows into the next
+//    strip, that rank carries on. The changes to the depressions' volumes are
+//    sent to every rank as they go.
+//  - A depression lying within one rank's rows is filled there. One spanning
+//    strips has its cells, and those around it, gathered on the rank owning
+//    its pit, which fills it and sends the new water tables back.
+//
+//Each cell is updated by the same arithmetic as on a single process, so the
+//results differ only where the labels and flow directions do (see
+//distributed_dephier.hpp), in the order in which volumes are summed, and in
+//the order in which water arriving from both strips infiltrates a cell.
+
+///Water flowing from a cell into the next strip
+struct RunoffMessage {
+  int32_t x;          //The cell receiving the water, whose row is in the domain
+  int32_t y;
+  uint8_t infiltrate; //Whether some of the water infiltrates on the way
+  float   runoff;     //Depth of the water, over the cell it left
+  double  distance;   //Distance it infiltrates over
+  double  area;       //Area of the cell it left
+};
+
+///The state of water overflowing a depression, as passed between the ranks
+///routing it. Cells are flat indices in the domain.
+struct OverflowWalk {
+  float    extra_water;
+  int64_t  current;
+  int64_t  previous;
+  int64_t  move_to;
+  int32_t  x;         //The outlet the water started from
+  int32_t  y;
+  int32_t  nx;        //The cell last moved to, for infiltration distances
+  int32_t  ny;
+  double   ew_out;    //East-west size of the outlet's cells
+  float    out_topo;  //Elevation of the outlet
+  uint8_t  resume;    //The next rank starts by checking the slope
+  uint8_t  done;
+};
+
+///Water infiltrating on the way between depressions, which changes the
+///storage space of the depressions the cell it reaches lies within
+struct OverflowInfiltration {
+  dh_label_t label;
+  dh_label_t final_label;
+  double     volume;
+};
+
+///A cell gathered to fill a depression spanning strips
+struct FillCell {
+  int64_t    cell;    //Flat index in the domain
+  double     area;
+  float      topo;
+  float      wtd;
+  float      surface;
+  dh_label_t label;
+};
+
+
+
+///MoveWaterIntoPits() over the rows of the domain this rank owns
+template<class elev_t>
+static void MoveWaterIntoPits(
+  Parameters                   &params,
+  DepressionHierarchy<elev_t>  &deps,
+  ArrayPack                    &arp,
+  const RowDecomposition       &rows
+){
+  ProfilePhase phase("fsm.move_into_pits");
+
+  Log(LogLevel::Debug)<<"Moving surface water downstream"<<'\n';
+
+  const auto &land  = arp.land;
+  const auto &strip = rows.mine();
+  const int   y0    = strip.ownedBegin();
+  const int   y1    = strip.ownedEnd();
+  const auto  owned = [&](const int y){ return y0<=y && y<y1; };
+
+  #pragma omp parallel for
+  for(int y=y0;y<y1;y++)
+  for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
+    if(arp.wtd(i)>0){
+      arp.runoff(i) = arp.wtd(i);
+      arp.wtd(i) = 0;
+      arp.infiltration_array(i) = 0;
+      arp.surface_array(i) = 0;
+    }
+  }
+
+  const D8Neighbourhood hood(arp.topo.width(), arp.topo.height(), arp.wrap_x);
+
+  //Land cells in the halo rows which flow into our cells count too; their
+  //water arrives from their rank
+  rd::Array2D<char> dependencies(arp.topo.width(),arp.topo.height(),0);
+  #pragma omp parallel for
+  for(int y=y0;y<y1;y++)
+  for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    hood.forEach(x, y, [&](const int n, int, int, const auto ni){
+      if(land.isLand(ni) && arp.flowdirs(ni)==Offsets::inverse[n])
+        dependencies(x,y)++;
+    });
+  }
+
+  std::queue<int> q;
+  for(int y=y0;y<y1;y++)
+  for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
+    if(dependencies(i)==0)
+      q.emplace(i);
+  }
+
+  for(auto &dep: deps){
+    dep.water_vol = 0;
+    dep.wtd_vol   = 0;
+  }
+
+  std::vector<RunoffMessage> to_below, to_above;
+  uint64_t cells_routed = 0;
+
+  //The loop of MoveWaterIntoPits(), except that water leaving our rows is
+  //sent on to their rank
+  const auto route = [&](){
+    while(!q.empty()){
+      cells_routed++;
+
+      const auto c = q.front();
+      q.pop();
+
+      const auto ndir = arp.flowdirs(c);
+      int x,y,nx,ny;
+      arp.topo.iToxy(c,x,y);
+      nx = -1;
+      ny = -1;
+
+      int n = NO_FLOW;
+      if(ndir!=NO_FLOW){
+        n = hood.neighbour(x, y, ndir, nx, ny);
+        assert(n>=0);
+      }
+      const bool remote = ndir!=NO_FLOW && !owned(ny);
+
+      if(arp.label(c) == OCEAN)
+        arp.runoff(c) = 0;
+
+      if(n == NO_FLOW && !remote){
+        if(arp.runoff(c)>0){
+          deps[arp.label(c)].water_vol += arp.runoff(c)*arp.cell_area[y];
+          assert(deps[arp.label(c)].water_vol >= -FP_ERROR);
+          if(deps[arp.label(c)].water_vol < 0)
+            deps[arp.label(c)].water_vol = 0.0;
+          arp.runoff(c) = 0;
+        }
+        continue;
+      }
+
+      bool   infiltrate = false;
+      double distance   = 0;
+      if(params.infiltration_on == true && arp.runoff(c)>0){
+        infiltrate = true;
+
+        if(x == nx)
+          distance += arp.cellsize_e_w_metres[ny]/2.0;
+        else if(y == ny)
+          distance += params.cellsize_n_s_metres/2.0;
+        else
+          distance += (std::pow( (std::pow(arp.cellsize_e_w_metres[ny], 2.0) \
+          + std::pow(params.cellsize_n_s_metres,2.0)), 0.5))/2.0;
+
+        CalculateInfiltration(c,distance,arp.runoff(c),params,arp);
+        arp.wtd(c) += params.infiltration;
+        arp.runoff(c) -= params.infiltration;
+        assert(arp.wtd(c)<=FP_ERROR);
+        assert(arp.runoff(c)>=-FP_ERROR);
+        if(arp.wtd(c) > 0 )
+          arp.wtd(c) = 0;
+        if(arp.runoff(c)<0)
+          arp.runoff(c) = 0;
+
+        //Infiltration into a cell of the next strip is left to its rank
+        if(!remote){
+          if(arp.runoff(c) > 0 && land.isLand(n)){
+            CalculateInfiltration(n,distance,arp.runoff(c),params,arp);
+            arp.wtd(n) += params.infiltration;
+            arp.runoff(c) -= params.infiltration;
+          }
+
+          assert(arp.wtd(n)<=FP_ERROR);
+          assert(arp.runoff(c)>=-FP_ERROR);
+          if(arp.wtd(n) > 0 )
+            arp.wtd(n) = 0;
+          if(arp.runoff(c)<0)
+            arp.runoff(c) = 0;
+        }
+      }
+
+      if(!land.isLand(n)){
+        arp.runoff(c) = 0;
+        continue;
+      }
+
+      if(remote){
+        const RunoffMessage m{nx, strip.halo_y0+ny, infiltrate, arp.runoff(c), \
+          distance, arp.cell_area[y]};
+        (ny<y0 ? to_below : to_above).push_back(m);
+        arp.runoff(c) = 0;
+        continue;
+      }
+
+      if(arp.runoff(c)>0){
+        arp.runoff(n) += arp.runoff(c)*arp.cell_area[y]/arp.cell_area[ny];
+        arp.runoff(c)  = 0;
+      }
+
+      if(--dependencies(n)==0){
+        assert(dependencies(n)>=0);
+        q.emplace(n);
+      }
+    }
+  };
+
+  //Water arriving from the next strip, as it would arrive from a neighbour
+  //in our own rows
+  const auto receive = [&](const std::vector<RunoffMessage> &messages){
+    for(const auto &m: messages){
+      const int  ny     = m.y-strip.halo_y0;
+      const auto n      = arp.topo.xyToI(m.x,ny);
+      float      runoff = m.runoff;
+      if(m.infiltrate){
+        if(runoff > 0){
+          CalculateInfiltration(n,m.distance,runoff,params,arp);
+          arp.wtd(n) += params.infiltration;
+          runoff     -= params.infiltration;
+        }
+
+        assert(arp.wtd(n)<=FP_ERROR);
+        assert(runoff>=-FP_ERROR);
+        if(arp.wtd(n) > 0 )
+          arp.wtd(n) = 0;
+        if(runoff<0)
+          runoff = 0;
+      }
+
+      if(runoff>0)
+        arp.runoff(n) += runoff*m.area/arp.cell_area[ny];
+
+      if(--dependencies(n)==0){
+        assert(dependencies(n)>=0);
+        q.emplace(n);
+      }
+    }
+  };
+
+  while(true){
+    route();
+    std::vector<RunoffMessage> from_below, from_above;
+    rows.exchange(to_below, to_above, from_below, from_above);
+    const double sent = rows.sum(static_cast<double>(to_below.size()+to_above.size()));
+    to_below.clear();
+    to_above.clear();
+    receive(from_below);
+    receive(from_above);
+    if(sent==0)
+      break;
+  }
+
+  std::vector<double> water_vols(deps.size());
+  for(size_t d=0;d<deps.size();d++)
+    water_vols[d] = deps[d].water_vol;
+  rows.sum(water_vols);
+  for(size_t d=0;d<deps.size();d++)
+    deps[d].water_vol = water_vols[d];
+
+  TheProfiler().count(ProfileCounter::CellsRouted, cells_routed);
+}
+
+
+
+///CalculateWtdVol() over the rows of the domain this rank owns
+template<class elev_t>
+static void CalculateWtdVol(
+  DepressionHierarchy<elev_t>   &deps,
+  ArrayPack                     &arp,
+  const RowDecomposition        &rows
+){
+  const auto &strip = rows.mine();
+  AddWtdVols(arp.wtd, arp.final_label, deps, arp, strip.ownedBegin(), strip.ownedEnd());
+
+  std::vector<double> wtd_only(deps.size());
+  for(size_t d=0;d<deps.size();d++)
+    wtd_only[d] = deps[d].wtd_only;
+  rows.sum(wtd_only);
+  for(size_t d=0;d<deps.size();d++){
+    auto &dep = deps[d];
+    if(dep.dep_label==OCEAN)
+      continue;
+    dep.wtd_only = wtd_only[d];
+    dep.wtd_vol  = dep.dep_vol + wtd_only[d];
+  }
+
+  SumWtdVols(deps);
+}
+
+
+
+///Takes the infiltration recorded by MoveWaterInOverflow() out of the storage
+///space of the depressions, as MoveWaterInOverflow() does on a single process
+template<class elev_t>
+static void ApplyOverflowInfiltration(
+  const OverflowInfiltration  &inf,
+  const float                 out_topo,
+  DepressionHierarchy<elev_t> &deps
+){
+  auto my_label = inf.label;
+  while(my_label != inf.final_label){
+    if(out_topo<deps.at(my_label).out_elev){
+      deps.at(my_label).wtd_vol   -= inf.volume;
+      deps.at(my_label).water_vol -= inf.volume;
+    }
+
+    assert(deps.at(my_label).wtd_vol - deps.at(my_label).dep_vol >= -FP_ERROR);
+    if(deps.at(my_label).wtd_vol < deps.at(my_label).dep_vol)
+      deps.at(my_label).wtd_vol = deps.at(my_label).dep_vol;
+
+    if(deps.at(my_label).water_vol < 0)
+      deps.at(my_label).water_vol = 0;
+
+    my_label = deps.at(my_label).parent;
+  }
+}
+
+
+
+///MoveWaterInOverflow() for a domain split between ranks. Collective over the
+///ranks of `rows`, which all call it with the same arguments.
+///
+///The rank owning the cell the water has reached routes it, until it flows
+///into the next strip or stops. It then sends every rank the state of the
+///water, the infiltration to take out of the depressions' storage space, and
+///the cells of other strips whose water table it clamped. The rank owning the
+///water's new cell carries on.
+template<class elev_t>
+static void MoveWaterInOverflow(
+  float                          extra_water,
+  const dh_label_t               current_dep,
+  const dh_label_t               previous_dep,
+  DepressionHierarchy<elev_t>    &deps,
+  Parameters                     &params,
+  ArrayPack                      &arp,
+  const RowDecomposition         &rows
+){
+  const auto &this_dep = deps.at(current_dep);
+  const auto &last_dep = deps.at(previous_dep);
+  const auto &strip    = rows.mine();
+  const int   width    = rows.width();
+  //Neighbours are found in the domain, and read from the strip
+  const D8Neighbourhood hood(width, rows.height(), arp.wrap_x);
+  const auto local = [&](const int64_t cell){
+    return static_cast<rd::Array2D<float>::i_t>(cell-static_cast<int64_t>(strip.halo_y0)*width);
+  };
+  const auto row = [&](const int y){ return y-strip.halo_y0; };
+
+  OverflowWalk walk;
+  walk.x      = last_dep.out_cell % width;
+  walk.y      = last_dep.out_cell / width;
+  walk.resume = 0;
+  walk.done   = 0;
+
+  std::vector<OverflowInfiltration> infiltrated;
+  std::vector<int64_t>              saturated;
+  uint64_t cells_routed = 0;
+
+  //The rank owning the outlet finds where the water goes first
+  if(rows.owns(walk.y)){
+    walk.out_topo    = arp.topo(local(last_dep.out_cell));
+    walk.ew_out      = arp.cellsize_e_w_metres[row(walk.y)];
+    walk.extra_water = extra_water/arp.cell_area[row(walk.y)];
+    assert(walk.extra_water > 0);
+
+    walk.current  = last_dep.out_cell;
+    walk.move_to  = NO_VALUE;
+    walk.previous = NO_VALUE;
+    hood.forEach(walk.x, walk.y, [&](int, int, int, const auto ni){
+      const auto nlabel = arp.label(local(ni));
+      const auto ntopo  = arp.topo(local(ni));
+      if((this_dep.my_subdepressions.count(nlabel)!=0 || \
+        this_dep.dep_label == nlabel) && (walk.move_to == NO_VALUE \
+        || ntopo<arp.topo(local(walk.move_to))))
+        walk.move_to = ni;
+
+      if((last_dep.my_subdepressions.count(nlabel)!=0 || \
+        last_dep.dep_label == nlabel) && (walk.previous == NO_VALUE \
+        || ntopo<arp.topo(local(walk.previous))))
+        walk.previous = ni;
+    });
+    hood.neighbour(walk.x, walk.y, Offsets::count, walk.nx, walk.ny);
+    assert(walk.move_to != NO_VALUE);
+  }
+
+  //Routes the water until it leaves this rank's rows or stops
+  const auto route = [&](){
+    while(true){
+      if(!walk.resume){
+        cells_routed++;
+
+        if(params.infiltration_on == true){
+          double distance = 0;
+          const int p_x = walk.previous % width;
+          const int p_y = walk.previous / width;
+          if(p_x == walk.x)
+            distance += walk.ew_out/2.0;
+          else if(p_y == walk.y)
+            distance += params.cellsize_n_s_metres/2.0;
+          else
+            distance += (std::pow( (std::pow(walk.ew_out, 2.0) + \
+              std::pow(params.cellsize_n_s_metres,2.0)), 0.5))/2.0;
+
+          const double ew_n = arp.cellsize_e_w_metres[row(walk.ny)];
+          if(walk.x == walk.nx)
+            distance += ew_n/2.0;
+          else if(walk.y == walk.ny)
+            distance += params.cellsize_n_s_metres/2.0;
+          else
+            distance += (std::pow( (std::pow(ew_n, 2.0) + \
+              std::pow(params.cellsize_n_s_metres,2.0)), 0.5))/2.0;
+
+          const auto c = local(walk.current);
+          CalculateInfiltration(c,distance,walk.extra_water,params,arp);
+          arp.wtd(c) += params.infiltration;
+          walk.extra_water -= params.infiltration;
+          assert(arp.wtd(c)<=FP_ERROR);
+          assert(walk.extra_water>=-FP_ERROR);
+        }
+
+        if(walk.extra_water <= 0){
+          walk.done = 1;
+          return;
+        }
+
+        const auto m = local(walk.move_to);
+        infiltrated.push_back({arp.label(m), arp.final_label(m), \
+          params.infiltration*arp.cell_area[row(walk.ny)]});
+
+        if(rows.owns(walk.move_to / width)){
+          assert(arp.wtd(m)<= FP_ERROR);
+          if(arp.wtd(m)>=0)
+            arp.wtd(m) = 0;
+        } else {
+          saturated.push_back(walk.move_to);
+        }
+
+        const auto ndir = arp.flowdirs(m);
+        if(ndir == NO_FLOW){
+          walk.done = 1;
+          return;
+        }
+
+        walk.previous = walk.current;
+        walk.current  = walk.move_to;
+        walk.move_to  = hood.neighbour(walk.current % width, walk.current / width, \
+          ndir, walk.nx, walk.ny);
+        assert(walk.move_to>=0);
+
+        if(!rows.owns(walk.current / width)){
+          walk.resume = 1;
+          return;
+        }
+      }
+      walk.resume = 0;
+
+      if(arp.topo(local(walk.move_to))>arp.topo(local(walk.current)))
+        walk.extra_water = 0;
+
+      assert(walk.extra_water > - FP_ERROR);
+      if(!(walk.extra_water > 0)){
+        walk.done = 1;
+        return;
+      }
+    }
+  };
+
+  int router = rows.owner(walk.y);
+  while(true){
+    if(rows.rank()==router)
+      route();
+
+    std::vector<OverflowWalk> state(1, walk);
+    rows.broadcast(state,       router);
+    rows.broadcast(infiltrated, router);
+    rows.broadcast(saturated,   router);
+    walk = state[0];
+
+    for(const auto &inf: infiltrated)
+      ApplyOverflowInfiltration(inf, walk.out_topo, deps);
+    for(const auto cell: saturated){
+      if(rows.owns(cell / width) && arp.wtd(local(cell))>=0)
+        arp.wtd(local(cell)) = 0;
+    }
+    infiltrated.clear();
+    saturated.clear();
+
+    if(walk.done)
+      break;
+    router = rows.owner(walk.current / width);
+  }
+
+  TheProfiler().count(ProfileCounter::CellsRouted, cells_routed);
+}
+
+
+
+///The cells gathered by StripFill to fill a depression spanning strips, in the
+///form FillDepressions() reads them. Cells are flat indices in the domain.
+class GatheredCells {
+ public:
+  GatheredCells(std::vector<FillCell> &cells, const int width, const int height, \
+    const ColumnWrap &wrap)
+    : cells(cells), width(width), hood(width, height, wrap)
+  {
+    slots.reserve(cells.size());
+    for(size_t s=0;s<cells.size();s++){
+      slots[cells[s].cell]       = s;
+      areas[cells[s].cell/width] = cells[s].area;
+    }
+  }
+
+  void pit(const dh_label_t pit_cell, int &x, int &y) const {
+    x = pit_cell % width;
+    y = pit_cell / width;
+  }
+
+  int64_t index(const int x, const int y) const { return static_cast<int64_t>(y)*width+x; }
+
+  float      topo   (const int64_t i) const { return at(i).topo;    }
+  dh_label_t label  (const int64_t i) const { return at(i).label;   }
+  float&     wtd    (const int64_t i)       { return at(i).wtd;     }
+  float&     surface(const int64_t i)       { return at(i).surface; }
+  double     area   (const int y)     const { return areas.at(y);   }
+
+  template<class F>
+  void forEachNeighbour(const int x, const int y, F f) const {
+    hood.forEach(x, y, [&](int, const int nx, const int ny, const auto){
+      f(nx, ny, index(nx,ny));
+    });
+  }
+
+ private:
+  FillCell& at(const int64_t i) const {
+    const auto s = slots.find(i);
+    if(s==slots.end())
+      throw std::logic_error("A cell needed to fill a depression was not gathered!");
+    return cells[s->second];
+  }
+
+  std::vector<FillCell>               &cells;
+  const int                            width;
+  const D8Neighbourhood                hood;
+  std::unordered_map<int64_t, size_t>  slots;
+  std::unordered_map<int, double>      areas;
+};
+
+
+
+///Fills the depressions found by FindDepressionsToFill() on a domain split
+///between ranks. Every rank calls it for every depression, in the same order.
+///
+///A depression and the cells around it which lie within one rank's rows are
+///filled by that rank alone. Otherwise its cells and those around it are
+///gathered on the rank owning its pit, which fills it and sends back the new
+///water tables and surface water.
+template<class elev_t>
+class StripFill {
+ public:
+  StripFill(const DepressionHierarchy<elev_t> &deps, ArrayPack &arp, const RowDecomposition &rows)
+    : deps(deps), arp(arp), rows(rows), local(arp, rows.mine().halo_y0),
+      hood(arp.topo.width(), arp.topo.height(), arp.wrap_x),
+      first_row(deps.size(), std::numeric_limits<int32_t>::max()),
+      last_row(deps.size(), -1)
+  {
+    //The rows each leaf depression's cells span
+    const auto &strip = rows.mine();
+    for(int y=strip.ownedBegin();y<strip.ownedEnd();y++)
+    for(int x=0;x<arp.label.width();x++){
+      const auto l = arp.label(x,y);
+      if(l==OCEAN)
+        continue;
+      first_row[l] = std::min(first_row[l], strip.halo_y0+y);
+      last_row[l]  = std::max(last_row[l],  strip.halo_y0+y);
+    }
+    rows.min(first_row);
+    rows.max(last_row);
+  }
+
+  void operator()(SubtreeDepressionInfo &stdi, const double water_vol){
+    if(water_vol==0)
+      return;
+
+    //The flood visits the depression's cells and their neighbours
+    int32_t lo = std::numeric_limits<int32_t>::max();
+    int32_t hi = -1;
+    for(const auto l: stdi.my_labels){
+      lo = std::min(lo, first_row.at(l));
+      hi = std::max(hi, last_row.at(l));
+    }
+    lo = std::max(lo-1, 0);
+    hi = std::min(hi+1, rows.height()-1);
+
+    const int owner = rows.owner(lo);
+    if(owner==rows.owner(hi)){
+      if(rows.rank()==owner)
+        FillDepressions(stdi, water_vol, deps, local);
+      return;
+    }
+
+    fillGathered(stdi, water_vol);
+  }
+
+ private:
+  void fillGathered(SubtreeDepressionInfo &stdi, const double water_vol){
+    const auto &strip = rows.mine();
+    const int   width = arp.topo.width();
+    const int   root  = rows.owner(deps.at(stdi.leaf_label).pit_cell / width);
+
+    indexCells();
+
+    std::vector<FillCell>       mine;
+    std::unordered_set<int64_t> taken;
+    const auto take = [&](const int x, const int y){
+      if(!rows.owns(strip.halo_y0+y))
+        return;
+      const auto i = arp.topo.xyToI(x,y);
+      if(!taken.insert(i).second)
+        return;
+      mine.push_back({i+static_cast<int64_t>(strip.halo_y0)*width, arp.cell_area[y], \
+        arp.topo(i), arp.wtd(i), arp.surface_array(i), arp.label(i)});
+    };
+    for(const auto l: stdi.my_labels)
+    for(auto c=cell_start[l];c<cell_start[l+1];c++){
+      int x, y;
+      arp.topo.iToxy(cells[c], x, y);
+      take(x, y);
+      hood.forEach(x, y, [&](int, const int nx, const int ny, const auto){
+        take(nx, ny);
+      });
+    }
+
+    std::vector<int> counts;
+    auto gathered = rows.gatherItems(mine, root, counts);
+    if(rows.rank()==root){
+      GatheredCells gathered_cells(gathered, width, rows.height(), arp.wrap_x);
+      FillDepressions(stdi, water_vol, deps, gathered_cells);
+    }
+    mine = rows.scatterItems(gathered, root, counts);
+
+    for(const auto &c: mine){
+      const auto i = static_cast<rd::Array2D<float>::i_t>(c.cell-static_cast<int64_t>(strip.halo_y0)*width);
+      arp.wtd(i)           = c.wtd;
+      arp.surface_array(i) = c.surface;
+    }
+  }
+
+  //Lists the cells of the strip, halo rows included, in each leaf depression,
+  //the first time a depression has to be gathered
+  void indexCells(){
+    if(!cell_start.empty())
+      return;
+    cell_start.assign(deps.size()+1, 0);
+    for(rd::Array2D<float>::i_t i=0;i<arp.label.size();i++)
+      if(arp.label(i)!=OCEAN && arp.label(i)!=NO_DEP)
+        cell_start[arp.label(i)+1]++;
+    for(size_t d=0;d<deps.size();d++)
+      cell_start[d+1] += cell_start[d];
+    cells.resize(cell_start.back());
+    auto next = cell_start;
+    for(rd::Array2D<float>::i_t i=0;i<arp.label.size();i++)
+      if(arp.label(i)!=OCEAN && arp.label(i)!=NO_DEP)
+        cells[next[arp.label(i)]++] = i;
+  }
+
+  const DepressionHierarchy<elev_t>    &deps;
+  ArrayPack                            &arp;
+  const RowDecomposition               &rows;
+  GridCells                             local;
+  const D8Neighbourhood                 hood;
+  std::vector<int32_t>                  first_row;
+  std::vector<int32_t>                  last_row;
+  std::vector<uint64_t>                 cell_start;
+  std::vector<rd::Array2D<float>::i_t>  cells;
+};
+
+
+
+///FillSpillMerge() for a domain split into strips of rows between MPI ranks.
+///Collective over the ranks of `rows`.
+///
+///@param params  Global parameters
+///@param deps    The hierarchy from the distributed GetDepressionHierarchy(),
+///               the same on every rank
+///@param arp     This rank's strip, including its halo rows. Only the rows
+///               the rank owns are updated.
+///@param rows    How the domain is split between the ranks
+template<class elev_t>
+void FillSpillMerge(
+  Parameters                    &params,
+  DepressionHierarchy<elev_t>   &deps,
+  ArrayPack                     &arp,
+  const RowDecomposition        &rows
+){
+  ProfilePhase phase_overall("fsm");
+
+  MoveWaterIntoPits(params, deps, arp, rows);
+
+  {
+    ProfilePhase phase_overflow("fsm.overflow");
+    std::unordered_map<dh_label_t, dh_label_t> jump_table;
+
+    CalculateWtdVol(deps, arp, rows);
+
+    auto overflow = [&](const float extra_water, const dh_label_t current_dep, \
+      const dh_label_t previous_dep){
+      MoveWaterInOverflow(extra_water, current_dep, previous_dep, deps, params, arp, rows);
+    };
+    MoveWaterInDepHier(OCEAN, deps, jump_table, overflow);
+  }
+
+  CheckWaterVols(deps);
+
+  Log(LogLevel::Debug)<<"Finding filled"<<'\n';
+  ProfilePhase phase_filled("fsm.fill");
+  StripFill<elev_t> fill(deps, arp, rows);
+  FindDepressionsToFill(OCEAN, deps, fill);
+}
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef _domain_decomposition_hpp_
+#define _domain_decomposition_hpp_
+
+#ifdef TWSM_USE_MPI
+
+#include "land_mask.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace rd = richdem;
+
+///The rows of the grid a rank is responsible for. A rank owns rows [y0,y1)
+///and also holds the row either side of them (its halo), where there is one,
+///so it holds rows [halo_y0,halo_y1). Local row 0 is global row halo_y0.
+struct RowStrip {
+  int32_t y0;
+  int32_t y1;
+  int32_t halo_y0;
+  int32_t halo_y1;
+
+  int32_t height() const { return halo_y1-halo_y0; }
+  ///Local index of the first and one past the last owned rows
+  int32_t ownedBegin() const { return y0-halo_y0; }
+  int32_t ownedEnd()   const { return y1-halo_y0; }
+};
+
+
+
+///Splits the grid into horizontal strips of rows, one per MPI rank, for the
+///kernels which are stencils over the grid, such as groundwater(). A cell's
+///new state depends only on its four neighbours, so each rank can update the
+///rows it owns as long as the row beyond each edge of its strip (the halo) is
+///refreshed from the neighbouring rank beforehand; see exchangeHalos().
+///
+///Strips hold equal shares of the land rather than of the rows, since only
+///land cells are computed: a strip across the open ocean is mostly free.
+///
+///Strips are used in place of 2D tiles because every row of our grids is
+///contiguous in memory, so a halo is a single message of one row with no
+///packing, and a rank has at most two neighbours.
+class RowDecomposition {
+ public:
+  ///Collective over `comm`.
+  ///@param comm  Communicator whose ranks share the grid
+  ///@param land  Land mask of the whole grid. Only the root's is used, so the
+  ///             other ranks may pass an empty mask.
+  RowDecomposition(MPI_Comm comm, const LandMask &land) : comm(comm) {
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &n_ranks);
+
+    int32_t dims[2] = {land.width(), land.height()};
+    MPI_Bcast(dims, 2, MPI_INT32_T, 0, comm);
+    global_width  = dims[0];
+    global_height = dims[1];
+    if(global_height<n_ranks)
+      throw std::runtime_error("The grid has fewer rows than there are ranks!");
+
+    //Every row costs a little even without land, so empty rows are not free
+    std::vector<uint64_t> row_cost(global_height);
+    if(isRoot()){
+      for(int y=0;y<global_height;y++){
+        row_cost[y] = 1;
+        for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+          row_cost[y] += s->x1-s->x0;
+      }
+    }
+    MPI_Bcast(row_cost.data(), global_height, MPI_UINT64_T, 0, comm);
+    split(row_cost);
+  }
+
+  ///Collective over `comm`, for when no rank holds the whole grid.
+  ///@param comm      Communicator whose ranks share the grid
+  ///@param width     Width of the grid
+  ///@param row_cost  Cost of each row of the grid, the same on every rank:
+  ///                 1 plus the number of land cells in the row
+  RowDecomposition(MPI_Comm comm, const int32_t width, const std::vector<uint64_t> &row_cost)
+    : comm(comm), global_width(width), global_height(row_cost.size())
+  {
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &n_ranks);
+    if(global_height<n_ranks)
+      throw std::runtime_error("The grid has fewer rows than there are ranks!");
+    split(row_cost);
+  }
+
+  int rank() const { return my_rank; }
+  int size() const { return n_ranks; }
+  bool isRoot() const { return my_rank==0; }
+
+  ///Size of the whole grid
+  int32_t width()  const { return global_width;  }
+  int32_t height() const { return global_height; }
+
+  MPI_Comm communicator() const { return comm; }
+
+  const RowStrip& strip(const int r) const { return strips.at(r); }
+  const RowStrip& mine() const { return strips[my_rank]; }
+
+  ///Rank which owns row `y` of the grid
+  int owner(const int32_t y) const {
+    int lo = 0, hi = n_ranks-1;
+    while(lo<hi){
+      const int mid = (lo+hi+1)/2;
+      if(strips[mid].y0<=y)
+        lo = mid;
+      else
+        hi = mid-1;
+    }
+    return lo;
+  }
+
+  ///Whether this rank owns row `y` of the grid
+  bool owns(const int32_t y) const { return mine().y0<=y && y<mine().y1; }
+
+  ///Copies the rows this rank holds out of a grid of the whole domain
+  template<class T>
+  rd::Array2D<T> extract(const rd::Array2D<T> &global) const {
+    const auto &s = mine();
+    rd::Array2D<T> local(global.width(), s.height());
+    for(int y=0;y<s.height();y++)
+    for(int x=0;x<global.width();x++)
+      local(x,y) = global(x,s.halo_y0+y);
+    return local;
+  }
+
+  ///Copies the per-row values, such as cell areas, of the rows this rank holds
+  template<class T>
+  std::vector<T> extract(const std::vector<T> &global) const {
+    const auto &s = mine();
+    return std::vector<T>(global.begin()+s.halo_y0, global.begin()+s.halo_y1);
+  }
+
+  ///Sends each rank the rows it holds, halos included, of `global`, which is
+  ///only read on the root rank, into `local`. Sizes `local` to the strip if
+  ///it isn't already.
+  template<class T>
+  void scatter(const rd::Array2D<T> &global, rd::Array2D<T> &local) const {
+    const auto &s = mine();
+    if(local.width()!=global_width || local.height()!=s.height())
+      local = rd::Array2D<T>(global_width, s.height());
+
+    if(!isRoot()){
+      MPI_Recv(local.data(), s.height()*global_width, mpiType<T>(), 0, 2, comm, MPI_STATUS_IGNORE);
+      return;
+    }
+    for(int r=1;r<n_ranks;r++){
+      const auto &t = strips[r];
+      MPI_Send(global.data()+static_cast<size_t>(t.halo_y0)*global_width, t.height()*global_width,
+               mpiType<T>(), r, 2, comm);
+    }
+    std::copy(global.data()+static_cast<size_t>(s.halo_y0)*global_width,
+              global.data()+static_cast<size_t>(s.halo_y1)*global_width, local.data());
+  }
+
+  ///Sends each rank the per-row values, such as cell areas, of the rows it
+  ///holds. `global` is only read on the root rank.
+  template<class T>
+  void scatter(const std::vector<T> &global, std::vector<T> &local) const {
+    const auto &s = mine();
+    local.resize(s.height());
+    if(!isRoot()){
+      MPI_Recv(local.data(), s.height(), mpiType<T>(), 0, 3, comm, MPI_STATUS_IGNORE);
+      return;
+    }
+    for(int r=1;r<n_ranks;r++)
+      MPI_Send(global.data()+strips[r].halo_y0, strips[r].height(), mpiType<T>(), r, 3, comm);
+    std::copy(global.begin()+s.halo_y0, global.begin()+s.halo_y1, local.begin());
+  }
+
+  ///Replaces the halo rows of `local`, which holds this rank's strip, with the
+  ///current values of those rows from the ranks which own them
+  template<class T>
+  void exchangeHalos(rd::Array2D<T> &local) const {
+    const auto &s     = mine();
+    const int   w     = local.width();
+    const int   below = (my_rank>0)         ? my_rank-1 : MPI_PROC_NULL;
+    const int   above = (my_rank<n_ranks-1) ? my_rank+1 : MPI_PROC_NULL;
+    T *const    rows  = local.data();
+    const auto  type  = mpiType<T>();
+
+    //First owned row down to the rank below, while its last owned row comes up
+    //into our lower halo; then the same upwards
+    MPI_Sendrecv(rows+static_cast<size_t>(s.ownedBegin())*w,   w, type, below, 0,
+                 rows+static_cast<size_t>(s.height()-1)*w,     w, type, above, 0,
+                 comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(rows+static_cast<size_t>(s.ownedEnd()-1)*w,   w, type, above, 1,
+                 rows,                                         w, type, below, 1,
+                 comm, MPI_STATUS_IGNORE);
+  }
+
+  ///Copies the rows each rank owns of its strip `local` into `global` on the
+  ///root rank, which must be sized for the whole domain. Other ranks leave
+  ///`global` untouched.
+  template<class T>
+  void gather(const rd::Array2D<T> &local, rd::Array2D<T> &global) const {
+    const auto &s = mine();
+    const int   w = local.width();
+
+    std::vector<int> counts, offsets;
+    if(isRoot()){
+      for(const auto &t: strips){
+        counts.push_back((t.y1-t.y0)*w);
+        offsets.push_back(t.y0*w);
+      }
+    }
+    MPI_Gatherv(local.data()+static_cast<size_t>(s.ownedBegin())*w, (s.y1-s.y0)*w, mpiType<T>(),
+                isRoot() ? global.data() : nullptr, counts.data(), offsets.data(), mpiType<T>(),
+                0, comm);
+  }
+
+  ///Reductions of a value over all ranks, returned on every rank
+  double sum(const double x) const { return allreduce(x, MPI_SUM); }
+  float  max(const float  x) const { return allreduce(x, MPI_MAX); }
+  float  min(const float  x) const { return allreduce(x, MPI_MIN); }
+  ///True on every rank if `x` is true on every rank
+  bool   all(const bool   x) const { return allreduce<int32_t>(x, MPI_MIN)!=0; }
+
+  ///Element-wise reductions of a vector, of the same length on every rank,
+  ///over all ranks. The result replaces `values` on every rank.
+  void sum(std::vector<double>  &values) const { allreduce(values, MPI_SUM); }
+  void min(std::vector<int32_t> &values) const { allreduce(values, MPI_MIN); }
+  void max(std::vector<int32_t> &values) const { allreduce(values, MPI_MAX); }
+
+  //The lists below are sent as bytes, so they may hold any plain structs
+
+  ///Sends `items` from rank `root` to every rank
+  template<class T>
+  void broadcast(std::vector<T> &items, const int root) const {
+    static_assert(std::is_trivially_copyable<T>::value, "Items are sent as bytes");
+    uint64_t count = items.size();
+    MPI_Bcast(&count, 1, MPI_UINT64_T, root, comm);
+    items.resize(count);
+    if(count>0)
+      MPI_Bcast(items.data(), count*sizeof(T), MPI_BYTE, root, comm);
+  }
+
+  ///Sends `to_below` and `to_above` to the ranks owning the strips either
+  ///side of this one, and receives what they send into `from_below` and
+  ///`from_above`. The lists may be of any length, including zero.
+  template<class T>
+  void exchange(
+    const std::vector<T> &to_below, const std::vector<T> &to_above,
+    std::vector<T>       &from_below, std::vector<T>     &from_above
+  ) const {
+    static_assert(std::is_trivially_copyable<T>::value, "Items are sent as bytes");
+    const int below = (my_rank>0)         ? my_rank-1 : MPI_PROC_NULL;
+    const int above = (my_rank<n_ranks-1) ? my_rank+1 : MPI_PROC_NULL;
+
+    int32_t counts_out[2] = {static_cast<int32_t>(to_below.size()), static_cast<int32_t>(to_above.size())};
+    int32_t counts_in[2]  = {0, 0};
+    MPI_Sendrecv(&counts_out[0], 1, MPI_INT32_T, below, 4, &counts_in[1], 1, MPI_INT32_T, above, 4,
+                 comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&counts_out[1], 1, MPI_INT32_T, above, 5, &counts_in[0], 1, MPI_INT32_T, below, 5,
+                 comm, MPI_STATUS_IGNORE);
+    from_below.resize(counts_in[0]);
+    from_above.resize(counts_in[1]);
+    MPI_Sendrecv(to_below.data(),   to_below.size()*sizeof(T),   MPI_BYTE, below, 6,
+                 from_above.data(), from_above.size()*sizeof(T), MPI_BYTE, above, 6,
+                 comm, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(to_above.data(),   to_above.size()*sizeof(T),   MPI_BYTE, above, 7,
+                 from_below.data(), from_below.size()*sizeof(T), MPI_BYTE, below, 7,
+                 comm, MPI_STATUS_IGNORE);
+  }
+
+  ///Collects every rank's `items` on rank `root`, in order of rank. On the
+  ///root, `counts` receives how many items came from each rank; elsewhere the
+  ///result is empty.
+  template<class T>
+  std::vector<T> gatherItems(const std::vector<T> &items, const int root, std::vector<int> &counts) const {
+    static_assert(std::is_trivially_copyable<T>::value, "Items are sent as bytes");
+    const int count = items.size();
+    counts.assign(my_rank==root ? n_ranks : 0, 0);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+
+    std::vector<T>   all;
+    std::vector<int> bytes, offsets;
+    if(my_rank==root){
+      int total = 0;
+      for(const auto c: counts){
+        bytes.push_back(c*sizeof(T));
+        offsets.push_back(total*sizeof(T));
+        total += c;
+      }
+      all.resize(total);
+    }
+    MPI_Gatherv(items.data(), count*sizeof(T), MPI_BYTE, all.data(), bytes.data(),
+                offsets.data(), MPI_BYTE, root, comm);
+    return all;
+  }
+
+  ///The reverse of gatherItems(): sends each rank its share of `all`, which
+  ///is only read on rank `root`, where `counts` gives the size of each share.
+  template<class T>
+  std::vector<T> scatterItems(const std::vector<T> &all, const int root, const std::vector<int> &counts) const {
+    static_assert(std::is_trivially_copyable<T>::value, "Items are sent as bytes");
+    int count = 0;
+    MPI_Scatter(counts.data(), 1, MPI_INT, &count, 1, MPI_INT, root, comm);
+
+    std::vector<int> bytes, offsets;
+    if(my_rank==root){
+      int total = 0;
+      for(const auto c: counts){
+        bytes.push_back(c*sizeof(T));
+        offsets.push_back(total*sizeof(T));
+        total += c;
+      }
+    }
+    std::vector<T> items(count);
+    MPI_Scatterv(all.data(), bytes.data(), offsets.data(), MPI_BYTE, items.data(),
+                 count*sizeof(T), MPI_BYTE, root, comm);
+    return items;
+  }
+
+ private:
+  //Each strip ends where the running cost passes its share of the total,
+  //leaving at least one row for each of the strips still to come
+  void split(const std::vector<uint64_t> &row_cost){
+    uint64_t total = 0;
+    for(const auto c: row_cost)
+      total += c;
+
+    strips.resize(n_ranks);
+    int32_t  y   = 0;
+    uint64_t sum = 0;
+    for(int r=0;r<n_ranks;r++){
+      strips[r].y0 = y;
+      const uint64_t target = total*(r+1)/n_ranks;
+      do {
+        sum += row_cost[y++];
+      } while(y<global_height-(n_ranks-1-r) && sum<target);
+      if(r==n_ranks-1)
+        y = global_height;
+      strips[r].y1      = y;
+      strips[r].halo_y0 = std::max(strips[r].y0-1, 0);
+      strips[r].halo_y1 = std::min(strips[r].y1+1, global_height);
+    }
+  }
+
+  template<class T>
+  static MPI_Datatype mpiType(){
+    if(std::is_same<T,float>::value)    return MPI_FLOAT;
+    if(std::is_same<T,double>::value)   return MPI_DOUBLE;
+    if(std::is_same<T,uint8_t>::value)  return MPI_UINT8_T;
+    if(std::is_same<T,int8_t>::value)   return MPI_INT8_T;
+    if(std::is_same<T,int32_t>::value)  return MPI_INT32_T;
+    if(std::is_same<T,uint32_t>::value) return MPI_UINT32_T;
+    throw std::runtime_error("No MPI type for this grid!");
+  }
+
+  template<class T>
+  T allreduce(const T x, MPI_Op op) const {
+    T result;
+    MPI_Allreduce(&x, &result, 1, mpiType<T>(), op, comm);
+    return result;
+  }
+
+  template<class T>
+  void allreduce(std::vector<T> &values, MPI_Op op) const {
+    MPI_Allreduce(MPI_IN_PLACE, values.data(), values.size(), mpiType<T>(), op, comm);
+  }
+
+  MPI_Comm              comm;
+  int                   my_rank       = 0;
+  int                   n_ranks       = 1;
+  int32_t               global_width  = 0;
+  int32_t               global_height = 0;
+  std::vector<RowStrip> strips;
+};
+
+#endif
+
+#endif
@@ -19,7 +19,17 @@ typedef rd::Array2D<float>  f2d;
 ///update the amount of evaporation that occurs in each cell. 
 ///We use Dalton's Law to calculate evaporation
 ///in cells that contain surface water. 
-void evaporation_update(Parameters &params, ArrayPack &arp){
+///The climate inputs are passed in separately, since they may be held either
+///as floats or quantized (see QuantizeInputs).
+template<class Grid>
+static void evaporation_update(
+  Parameters  &params,
+  ArrayPack   &arp,
+  const Grid  &ground_temp,
+  const Grid  &relhum,
+  const Grid  &temp,
+  const Grid  &wind_speed
+){
   float atm_p = 101.3;
   float p_a = 1.220;
   float p_w = 1000;
@@ -33,15 +43,23 @@ void evaporation_update(Parameters &params, ArrayPack &arp){
   float K_e = (0.622*p_a*k*k)/(atm_p*p_w*std::pow(log_bracket,2));
 
 
-  for(unsigned int i=0;i<arp.topo.size();i++){
+  //Evaporation is only calculated on land; ocean cells keep whatever values
+  //they were initialised with.
+  for(int y=0;y<arp.land.height();y++)
+  for(auto s=arp.land.rowBegin(y);s!=arp.land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
+
+    const float cell_ground_temp = ground_temp(i);
+    const float cell_temp        = temp(i);
 
-    arp.e_sat(i) = 0.611 * std::exp((17.3*arp.ground_temp(i))\
-    /(arp.ground_temp(i)+237.3));
+    arp.e_sat(i) = 0.611 * std::exp((17.3*cell_ground_temp)\
+    /(cell_ground_temp+237.3));
 
-    arp.e_a(i) = arp.relhum(i) * 0.611 * std::exp((17.3*arp.temp(i))\
-    /(arp.temp(i)+237.3));
+    arp.e_a(i) = relhum(i) * 0.611 * std::exp((17.3*cell_temp)\
+    /(cell_temp+237.3));
 
-    arp.surface_evap(i) = (K_e*arp.wind_speed(i))*(arp.e_sat(i) - arp.e_a(i));        
+    arp.surface_evap(i) = (K_e*wind_speed(i))*(arp.e_sat(i) - arp.e_a(i));        
 
     if(arp.wtd(i)>0)  //if there is surface water present
       arp.rech(i) = arp.precip(i) - arp.surface_evap(i);
@@ -55,4 +73,13 @@ void evaporation_update(Parameters &params, ArrayPack &arp){
     //considered that way.
    //could happen in a location where climate is drying through time
   }
-}
\ No newline at end of file
+}
+
+void evaporation_update(Parameters &params, ArrayPack &arp){
+  if(arp.quantized)
+    evaporation_update(params, arp, arp.q_ground_temp, arp.q_relhum, 
+      arp.q_temp, arp.q_wind_speed);
+  else
+    evaporation_update(params, arp, arp.ground_temp, arp.relhum, 
+      arp.temp, arp.wind_speed);
+}
@@ -3,6 +3,9 @@
 
 #include "dephier.hpp"
 #include "DisjointDenseIntSet.hpp"
+#include "logging.hpp"
+#include "neighbours.hpp"
+#include "profiler.hpp"
 #include "../common/netcdf.hpp"
 #include <algorithm>
 #include <cassert>
@@ -24,10 +27,9 @@
 
 namespace richdem::dephier {
 
-const int *const dx         = d8x;
-const int *const dy         = d8y;
-const int *const dinverse   = d8_inverse;
-const int        neighbours = 8;
+//Water moves between the D8 neighbours of cells (see neighbours.hpp)
+using Offsets         = NeighbourOffsets<Topology::D8>;
+using D8Neighbourhood = Neighbourhood<Topology::D8>;
 
 const double FP_ERROR = 1e-4;
 
@@ -54,6 +56,22 @@ static void CalculateWtdVol(
   rd::Array2D<wtd_t>            &wtd,
   const rd::Array2D<elev_t>     &topo,
   const rd::Array2D<dh_label_t> &final_label,
+  DepressionHierarchy<elev_t>   &deps,
+  ArrayPack                     &arp
+);
+
+template<class elev_t, class wtd_t>
+static void AddWtdVols(
+  rd::Array2D<wtd_t>            &wtd,
+  const rd::Array2D<dh_label_t> &final_label,
+  DepressionHierarchy<elev_t>   &deps,
+  const ArrayPack               &arp,
+  const int                     y0,
+  const int                     y1
+);
+
+template<class elev_t>
+static void SumWtdVols(
   DepressionHierarchy<elev_t>   &deps
 );
 
@@ -66,13 +84,12 @@ static void CalculateWtdVol(
 );
 
 
-template<class elev_t>
+template<class elev_t, class Overflow>
 static void MoveWaterInDepHier(
   int                                        current_depression,
   DepressionHierarchy<elev_t>                &deps,
   std::unordered_map<dh_label_t, dh_label_t> &jump_table,
-  Parameters                                 &params,
-  ArrayPack                                  &arp
+  Overflow                                   &overflow
 );
 
 
@@ -86,7 +103,7 @@ static void MoveWaterInOverflow(
   ArrayPack                      &arp
   );
 
-template<class elev_t>
+template<class elev_t, class Overflow>
 static dh_label_t OverflowInto(
   const dh_label_t                           root,
   const dh_label_t                           previous_dep,
@@ -94,25 +111,30 @@ static dh_label_t OverflowInto(
   DepressionHierarchy<elev_t>                &deps,
   std::unordered_map<dh_label_t, dh_label_t> &jump_table,
   double                                     extra_water,
-  Parameters                                 &params,
-  ArrayPack                                  &arp
+  Overflow                                   &overflow
 );
 
 
 class SubtreeDepressionInfo;
-template<class elev_t>
+template<class elev_t, class Fill>
 static SubtreeDepressionInfo FindDepressionsToFill(
   const int                         current_depression, 
   const DepressionHierarchy<elev_t> &deps,               
-  ArrayPack                         &arp     
+  Fill                              &fill
 );
 
-template<class elev_t>
+template<class elev_t, class Cells>
 static void FillDepressions(
   SubtreeDepressionInfo             &stdi,  
   double                            water_vol, 
   const DepressionHierarchy<elev_t> &deps,      
-  ArrayPack                         &arp     
+  Cells                             &cells
+);
+
+
+template<class elev_t>
+static void CheckWaterVols(
+  DepressionHierarchy<elev_t>       &deps
 );
 
 
@@ -122,6 +144,54 @@ static void FillDepressions(
 
 
 
+///The cells which FillDepressions() floods, held in the grids of an
+///ArrayPack. Depressions store their pit cells as flat indices into the whole
+///domain, so when the grids hold a strip of the domain (see
+///distributed_fill_spill_merge.hpp) `row_offset` is the domain's row of the
+///strip's first row. Cells are otherwise identified by their flat indices in
+///the grids.
+class GridCells {
+ public:
+  GridCells(ArrayPack &arp, const int row_offset = 0)
+    : arp(arp), hood(arp.topo.width(), arp.topo.height(), arp.wrap_x),
+      row_offset(row_offset) {}
+
+  ///Coordinates, within the grids, of a depression's pit cell
+  void pit(const dh_label_t pit_cell, int &x, int &y) const {
+    x = pit_cell % arp.topo.width();
+    y = pit_cell / arp.topo.width() - row_offset;
+  }
+
+  int64_t index(const int x, const int y) const { return arp.topo.xyToI(x,y); }
+
+  float      topo   (const int64_t i) const { return arp.topo(cell(i));  }
+  dh_label_t label  (const int64_t i) const { return arp.label(cell(i)); }
+  float&     wtd    (const int64_t i)       { return arp.wtd(cell(i));   }
+  float&     surface(const int64_t i)       { return arp.surface_array(cell(i)); }
+  ///Area of the cells of a row
+  double     area   (const int y)     const { return arp.cell_area[y]; }
+
+  ///Calls `f(nx, ny, ni)` for each of the neighbours of (x,y) in the grid
+  template<class F>
+  void forEachNeighbour(const int x, const int y, F f) const {
+    hood.forEach(x, y, [&](int, const int nx, const int ny, const auto ni){
+      f(nx, ny, static_cast<int64_t>(ni));
+    });
+  }
+
+ private:
+  static rd::Array2D<float>::i_t cell(const int64_t i){
+    return static_cast<rd::Array2D<float>::i_t>(i);
+  }
+
+  ArrayPack             &arp;
+  const D8Neighbourhood  hood;
+  const int              row_offset;
+};
+
+
+
+
 ///This function routes surface water from into pit cells and then distributes
 ///it so that it fills the bottoms of depressions, taking account of overflows.
 ///
@@ -146,17 +216,15 @@ void FillSpillMerge(
   DepressionHierarchy<elev_t>   &deps,
   ArrayPack                     &arp
 ){
-  rd::Timer timer_overall;
-  timer_overall.start();
+  ProfilePhase phase_overall("fsm");
   
   //We move standing water downhill to the pit cells of each depression
   MoveWaterIntoPits(params, deps, arp);
 
   { 
-    //Scope to limit `timer_overflow` and `jump_table`. Also ensures
+    //Scope to limit `phase_overflow` and `jump_table`. Also ensures
     //`jump_table` frees its memory
-    rd::Timer timer_overflow;
-    timer_overflow.start();
+    ProfilePhase phase_overflow("fsm.overflow");
     std::unordered_map<dh_label_t, dh_label_t> jump_table;
  
     //calculate the wtd_vol of depressions, in order to be able to know which 
@@ -170,14 +238,38 @@ void FillSpillMerge(
     //Now that the water is in the pit cells, we move it around so that
     //depressions which contain too much water overflow into depressions that
     //have less water. If enough overflow happens, then the water is ultimately
-    //routed to the ocean.
-    MoveWaterInDepHier(OCEAN, deps,jump_table,params,arp);
-
-    std::cerr<<"t FlowInDepressionHierarchy: Overflow time = "\
-    <<timer_overflow.stop()<<std::endl;
+    //routed to the ocean. Water overflowing into a depression with room in
+    //its water table is routed downslope from the outlet, infiltrating as it
+    //goes.
+    auto overflow = [&](const float extra_water, const dh_label_t current_dep, \
+      const dh_label_t previous_dep){
+      MoveWaterInOverflow(extra_water, current_dep, previous_dep, deps, params, arp);
+    };
+    MoveWaterInDepHier(OCEAN, deps, jump_table, overflow);
   }
 
-  //Sanity checks
+  CheckWaterVols(deps);
+
+  Log(LogLevel::Debug)<<"Finding filled"<<'\n';
+  ProfilePhase phase_filled("fsm.fill");
+  //We start at the ocean, crawl to the bottom of the depression hierarchy and
+  //determine which depressions or metadepressions contain standing water. We
+  //then modify `wtd` in order to distribute this water across the cells of the
+  //depression which will lie below its surface.
+  GridCells cells(arp);
+  auto fill = [&](SubtreeDepressionInfo &stdi, const double water_vol){
+    FillDepressions(stdi, water_vol, deps, cells);
+  };
+  FindDepressionsToFill(OCEAN, deps, fill);
+}
+
+
+
+///Sanity checks on the water volumes once MoveWaterInDepHier() has moved the
+///overflows. A depression's children can't hold more water than it does, so
+///any which do, through floating-point error, are trimmed.
+template<class elev_t>
+static void CheckWaterVols(DepressionHierarchy<elev_t> &deps){
   for(int d=1;d<(int)deps.size();d++){
     const auto &dep = deps.at(d);
  
@@ -194,20 +286,6 @@ void FillSpillMerge(
       deps.at(dep.rchild).water_vol = dep.water_vol;
 
   }
-
-  std::cerr<<"p Finding filled..."<<std::endl;
-  rd::Timer timer_filled;
-  timer_filled.start();
-  //We start at the ocean, crawl to the bottom of the depression hierarchy and
-  //determine which depressions or metadepressions contain standing water. We
-  //then modify `wtd` in order to distribute this water across the cells of the
-  //depression which will lie below its surface.
-  FindDepressionsToFill(OCEAN,deps,arp);                              
-  std::cerr<<"t FlowInDepressionHierarchy: Fill time = "<<timer_filled.stop()\
-  <<" s"<<std::endl;
-
-  std::cerr<<"t FlowInDepressionHierarchy = "<<timer_overall.stop()\
-  <<" s"<<std::endl;
 }
 
 
@@ -237,9 +315,8 @@ static void MoveWaterIntoPits(
   DepressionHierarchy<elev_t>  &deps,
   ArrayPack                    &arp
 ){
-  rd::Timer timer;
+  ProfilePhase phase("fsm.move_into_pits");
   rd::ProgressBar progress;
-  timer.start();
 
   double distance = 0;
 
@@ -247,11 +324,17 @@ static void MoveWaterIntoPits(
   //so, we use the steepest-descent flow directions provided by the depression
   //hierarchy code
 
-  std::cerr<<"p Moving surface water downstream..."<<std::endl;
+  Log(LogLevel::Debug)<<"Moving surface water downstream"<<'\n';
 
+  //Water only ever stands on land, so only land cells are visited here and
+  //below. Water which flows into the ocean is dropped from the model.
+  const auto &land = arp.land;
 
-  #pragma omp parallel for 
-  for(unsigned int i=0;i<arp.topo.size();i++){   
+  #pragma omp parallel for
+  for(int y=0;y<land.height();y++)
+  for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
     if(arp.wtd(i)>0){
       //Move any surface water into a separate array. 
       //This is to allow us to have infiltration into wtd, that does not 
@@ -265,19 +348,31 @@ static void MoveWaterIntoPits(
     }
   }
 
-  //Calculate how many upstream cells flow into each cell
+  const D8Neighbourhood hood(arp.topo.width(), arp.topo.height(), arp.wrap_x);
+
+  //Calculate how many upstream land cells flow into each land cell. Cells away
+  //from the edges of the grid are counted without bounds checks, and then the
+  //few on the edges.
   rd::Array2D<char>  dependencies(arp.topo.width(),arp.topo.height(),0);
-  #pragma omp parallel for collapse(2)
-  for(int y=0;y<arp.topo.height();y++)
-  for(int x=0;x<arp.topo.width(); x++)
-  for(int n=1;n<=neighbours;n++){     //Loop through neighbours
-    const int nx = x+dx[n];           //Identify coordinates of neighbour
-    const int ny = y+dy[n];
-    if(!arp.topo.inGrid(nx,ny))
-      continue;    
-    if(arp.flowdirs(nx,ny)==dinverse[n])  //Does my neighbour flow into me?
-      dependencies(x,y)++;            //Increment my dependencies
+  #pragma omp parallel for
+  for(int y=1;y<land.height()-1;y++)
+  for(auto s=land.interiorRowBegin(y);s!=land.interiorRowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
+    hood.forEachInterior(x, y, i, [&](const int n, int, int, const auto ni){
+      //Does my neighbour, if it is land, flow into me?
+      if(land.isLand(ni) && arp.flowdirs(ni)==Offsets::inverse[n])
+        dependencies(i)++;            //Increment my dependencies
+    });
   }
+  hood.forEachEdgeCell([&](const int x, const int y){
+    if(!land.isLand(x,y))
+      return;
+    hood.forEachBorder(x, y, [&](const int n, int, int, const auto ni){
+      if(land.isLand(ni) && arp.flowdirs(ni)==Offsets::inverse[n])
+        dependencies(x,y)++;
+    });
+  });
 
   
   //Find the peaks. These are the cells into which no other cells pass flow 
@@ -287,7 +382,10 @@ static void MoveWaterIntoPits(
   //can begin a breadth-first traversal in the downstream direction by adding
   //each cell to the frontier/queue as its dependency count drops to zero.
   std::queue<int> q;
-  for(unsigned int i=0;i<arp.topo.size();i++){
+  for(int y=0;y<land.height();y++)
+  for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+  for(int x=s->x0;x<s->x1;x++){
+    const auto i = arp.topo.xyToI(x,y);
     if(dependencies(i)==0)// && flowdirs(i)!=NO_FLOW)  //Is it a peak?
       q.emplace(i); 
   }  //Yes.
@@ -302,10 +400,12 @@ static void MoveWaterIntoPits(
 
   
   //Starting with the peaks, pass flow downstream
-  progress.start(arp.topo.size());
+  uint64_t cells_routed = 0;
+  progress.start(land.landCells());
   while(!q.empty()){
 
     ++progress;
+    cells_routed++;
 
     const auto c = q.front();          //Copy focal cell from queue
     q.pop();                           //Clear focal cell from queue
@@ -319,9 +419,7 @@ static void MoveWaterIntoPits(
 
     int n = NO_FLOW;
     if(ndir!=NO_FLOW){  //TODO: Fix this monkey patching
-      nx = x+dx[ndir];
-      ny = y+dy[ndir];
-      n            = arp.topo.xyToI(nx,ny);
+      n            = hood.neighbour(x, y, ndir, nx, ny);
       assert(n>=0);
     }
 
@@ -376,8 +474,9 @@ static void MoveWaterIntoPits(
             arp.runoff(c) = 0;
 
           //then, we do the same for the neighbour cell receiving the water, 
-          //from its edge that it receives along, to its centre. 
-          if(arp.runoff(c) > 0){   
+          //from its edge that it receives along, to its centre. The ocean is
+          //saturated, so nothing infiltrates there.
+          if(arp.runoff(c) > 0 && land.isLand(n)){   
           //check again if there is water available since it's possible 
             //the infiltration above used it up. 
           CalculateInfiltration(n,distance,arp.runoff(c),params,arp);
@@ -395,6 +494,13 @@ static void MoveWaterIntoPits(
     }
 
 
+      //Water flowing into the ocean leaves the model, and the ocean cell is
+      //never visited.
+      if(!land.isLand(n)){
+        arp.runoff(c) = 0;
+        continue;
+      }
+
       //If we still have water, pass it downstream.
       if(arp.runoff(c)>0){ 
         //We use cell areas because the depth will change if we are moving 
@@ -415,9 +521,7 @@ static void MoveWaterIntoPits(
   }
 
   progress.stop();
-
-  std::cerr<<"t FlowInDepressionHierarchy: Surface water = "\
-  <<timer.stop()<<" s"<<std::endl;
+  TheProfiler().count(ProfileCounter::CellsRouted, cells_routed);
 }
 
 
@@ -448,6 +552,25 @@ static void CalculateWtdVol(
   DepressionHierarchy<elev_t>   &deps,
   ArrayPack                     &arp
 ){
+  AddWtdVols(wtd, final_label, deps, arp, 0, wtd.height());
+  SumWtdVols(deps);
+}
+
+
+
+///The first part of CalculateWtdVol(): resets each depression's wtd_vol to its
+///dep_vol, and adds the groundwater storage space of the cells in rows
+///[y0,y1) to the marginal wtd_only and wtd_vol of the depressions they lie
+///within.
+template<class elev_t, class wtd_t>
+static void AddWtdVols(
+  rd::Array2D<wtd_t>            &wtd,
+  const rd::Array2D<dh_label_t> &final_label,
+  DepressionHierarchy<elev_t>   &deps,
+  const ArrayPack               &arp,
+  const int                     y0,
+  const int                     y1
+){
 
   for(int d=0;d<(int)deps.size();d++){
     auto &dep = deps.at(d);
@@ -473,7 +596,7 @@ static void CalculateWtdVol(
   //When a depression
   //is completely saturated in groundwater, we will have wtd_vol == dep_vol.
 
-  for(int y=0;y<wtd.height();y++)
+  for(int y=y0;y<y1;y++)
   for(int x=0;x<wtd.width();x++){  
   //cycle through the domain and add up all of the 
     //below-ground water storage space available
@@ -496,8 +619,15 @@ static void CalculateWtdVol(
     //and this records the total volume - above and below ground - 
     //available to store water. 
     }
+}
+
 
 
+///The second part of CalculateWtdVol(): adds each meta-depression's
+///children's storage space to its own, once AddWtdVols() has found the
+///marginal space of every depression.
+template<class elev_t>
+static void SumWtdVols(DepressionHierarchy<elev_t> &deps){
   for(int d=0;d<(int)deps.size();d++){
     auto &dep = deps.at(d);
     if(dep.dep_label==OCEAN)
@@ -558,7 +688,8 @@ for(int d=0;d<(int)deps.size();d++){
 ///                ksat is a representation of hydraulic conductivity based 
 ///                on soil types, used as an indicator for how rapidly
 ///                infiltration can occur. 
-///                slope is the topographic slope 
+///                slope is the topographic slope (q_slope if the inputs
+///                are quantized)
 ///
 ///@return Calculates the amount of infiltration that will happen within 
 ///        the time it takes the amount of  water to travel the given distance.
@@ -574,7 +705,8 @@ for(int d=0;d<(int)deps.size();d++){
 
   float vert_ksat = arp.vert_ksat(cell);
 
-  float slope = std::max(arp.slope(cell), 0.000001f);  
+  const float cell_slope = arp.quantized ? arp.q_slope(cell) : arp.slope(cell);
+  float slope = std::max(cell_slope, 0.000001f);  
   //assigning a small minimum slope, since otherwise in cells with zero slope, 
   //the delta_t will be infinity.
   float bracket = std::pow(h_0,(5.0/3.0)) - (vert_ksat * distance * \
@@ -640,17 +772,19 @@ for(int d=0;d<(int)deps.size();d++){
 ///                           the highest known meta-depression which still has
 ///                           unfilled volume. Ensures the traversal happens in
 ///                           O(N) time.
+///@param overflow            Called as `overflow(extra_water, current_dep,
+///                           previous_dep)` to route water downslope from an
+///                           outlet (see MoveWaterInOverflow()).
 ///
 ///@return Modifies the depression hierarchy `deps` to indicate the amount of
 ///        water in each depression. This information can be used to add
 ///        standing surface water to the cells within a depression.
-template<class elev_t>
+template<class elev_t, class Overflow>
 static void MoveWaterInDepHier(
   int                                        current_depression,
   DepressionHierarchy<elev_t>                &deps,
   std::unordered_map<dh_label_t, dh_label_t> &jump_table,
-  Parameters                                 &params,
-  ArrayPack                                  &arp
+  Overflow                                   &overflow
 ){
  
   if(current_depression==NO_VALUE)
@@ -660,15 +794,15 @@ static void MoveWaterInDepHier(
 
   //Visit child depressions. When these both overflow, then we spread water
   //across them by spreading water across their common metadepression
-  MoveWaterInDepHier(this_dep.lchild, deps, jump_table,params,arp);
-  MoveWaterInDepHier(this_dep.rchild, deps, jump_table,params,arp);
+  MoveWaterInDepHier(this_dep.lchild, deps, jump_table, overflow);
+  MoveWaterInDepHier(this_dep.rchild, deps, jump_table, overflow);
 
   //Catch depressions that link to the ocean through this one. These are special
   //cases because we will never spread water across the union of these
   //depressions and the current depressions: they only flow into the current
   //depression
   for(const auto c: this_dep.ocean_linked)
-    MoveWaterInDepHier(c, deps, jump_table,params,arp);
+    MoveWaterInDepHier(c, deps, jump_table, overflow);
 
   //If the current depression is the ocean then at this point we've visited all
   //of its ocean-linked depressions (the ocean has no children). Since we do not
@@ -763,7 +897,7 @@ static void MoveWaterInDepHier(
     //worry about the extra water here any more.
 
     OverflowInto(this_dep.geolink, this_dep.dep_label, this_dep.parent, deps, \
-    jump_table, extra_water,params,arp); //TODO: use odep or geolink here?
+    jump_table, extra_water, overflow); //TODO: use odep or geolink here?
 
 
     assert(this_dep.water_vol >= -FP_ERROR);
@@ -856,29 +990,28 @@ static void MoveWaterInOverflow(
   //towards this_dep and doesn't flow back into last_dep
   move_to_cell = NO_VALUE;   
   previous_cell = NO_VALUE;
-  for(int n=1;n<=neighbours;n++){ //Check out our neighbours
-    //Use offset to get neighbour x coordinate
-    nx = x+dx[n];
-    //Use offset to get neighbour y coordinate
-    ny = y+dy[n];      
-    if(!arp.topo.inGrid(nx,ny))  //Is cell outside grid (too far North/South)?
-      continue;              //Yup: skip it.
-
-    if((this_dep.my_subdepressions.count(arp.label(nx,ny))!=0 || \
-      this_dep.dep_label == arp.label(nx,ny)) && (move_to_cell == NO_VALUE \
-      || arp.topo(nx,ny)<arp.topo(move_to_cell)))  
-      move_to_cell = arp.topo.xyToI(nx,ny);
-
-    if((last_dep.my_subdepressions.count(arp.label(nx,ny))!=0 || \
-      last_dep.dep_label == arp.label(nx,ny)) && (previous_cell == NO_VALUE \
-      || arp.topo(nx,ny)<arp.topo(previous_cell)))
-      previous_cell = arp.topo.xyToI(nx,ny);
+  const D8Neighbourhood hood(arp.topo.width(), arp.topo.height(), arp.wrap_x);
+  hood.forEach(x, y, [&](int, int, int, const auto ni){ //Check out our neighbours
+    if((this_dep.my_subdepressions.count(arp.label(ni))!=0 || \
+      this_dep.dep_label == arp.label(ni)) && (move_to_cell == NO_VALUE \
+      || arp.topo(ni)<arp.topo(move_to_cell)))  
+      move_to_cell = ni;
+
+    if((last_dep.my_subdepressions.count(arp.label(ni))!=0 || \
+      last_dep.dep_label == arp.label(ni)) && (previous_cell == NO_VALUE \
+      || arp.topo(ni)<arp.topo(previous_cell)))
+      previous_cell = ni;
                
-  }  //so now we know which is the correct starting cell.
+  });  //so now we know which is the correct starting cell.
+  //nx and ny are left at the last neighbour looked at, as the distances 
+  //below expect
+  hood.neighbour(x, y, Offsets::count, nx, ny);
   assert(move_to_cell != NO_VALUE);       
     
+  uint64_t cells_routed = 0;
 
   while(extra_water > 0){
+    cells_routed++;
  
   if(params.infiltration_on == true){
     distance = 0;
@@ -966,9 +1099,8 @@ static void MoveWaterInOverflow(
       arp.topo.iToxy(move_to_cell,x1,y1);             
        //then we can use flowdirs to move the water all 
       //the way down to this_dep's pit cell. 
-      nx = x1+dx[ndir];
-      ny = y1+dy[ndir];
-      move_to_cell = arp.topo.xyToI(nx,ny);  //get the new move_to_cell
+      //get the new move_to_cell
+      move_to_cell = hood.neighbour(x1, y1, ndir, nx, ny);
       assert(move_to_cell>=0);
     }
 
@@ -980,6 +1112,8 @@ static void MoveWaterInOverflow(
     assert(extra_water > - FP_ERROR);
     
   }
+
+  TheProfiler().count(ProfileCounter::CellsRouted, cells_routed);
 }
 
 
@@ -1026,9 +1160,11 @@ static void MoveWaterInOverflow(
 ///@param extra_water The amount of water left to distribute. We'll try to stash
 ///                   it in root. If we fail, we'll pass it to root's neighbour
 ///                   or, if the neighbour's full, to root's parent.
+///@param overflow    Routes water downslope from an outlet; see
+///                   MoveWaterInDepHier().
 //@return The depression where the water ultimately ended up. This is used to
 //        update the jump table
-template<class elev_t>
+template<class elev_t, class Overflow>
 static dh_label_t OverflowInto(
   const dh_label_t                           root,
   const dh_label_t                           previous_dep, 
@@ -1039,13 +1175,13 @@ static dh_label_t OverflowInto(
   std::unordered_map<dh_label_t, dh_label_t> &jump_table,  
   //Shortcut from one depression to its next known empty neighbour
   double                                     extra_water,
-  Parameters                                 &params,
-  ArrayPack                                  &arp 
+  Overflow                                   &overflow
 ){
 
   auto &this_dep = deps.at(root);
   auto &last_dep = deps.at(previous_dep);
 
+  TheProfiler().count(ProfileCounter::OverflowHops, 1);
   
   if(root==OCEAN)             //We've reached the ocean
     return OCEAN;             
@@ -1098,8 +1234,7 @@ static dh_label_t OverflowInto(
         //okay, there is groundwater volume to fill, so we must 
         //move the water properly.                                   
                              //TODO: is the second part of that if correct?
-          MoveWaterInOverflow(extra_water,this_dep.dep_label,\
-            last_dep.dep_label,deps,params,arp);
+          overflow(extra_water,this_dep.dep_label,last_dep.dep_label);
           assert(this_dep.water_vol==0 || this_dep.water_vol - \
             this_dep.wtd_vol <= FP_ERROR);                  
         } 
@@ -1149,8 +1284,7 @@ static dh_label_t OverflowInto(
         //TODO: Is this right? Something is off about water vols and 
       //extra water but I am VERY unsure if this is right. 
         //NO - extra_water is based on what the water_vol already was!!!
-        MoveWaterInOverflow(extra_water,this_dep.dep_label,\
-          last_dep.dep_label,deps,params,arp);
+        overflow(extra_water,this_dep.dep_label,last_dep.dep_label);
         extra_water = 0;
         assert(this_dep.water_vol==0 || this_dep.water_vol - \
         this_dep.wtd_vol <= FP_ERROR);        
@@ -1200,7 +1334,7 @@ static dh_label_t OverflowInto(
       pdep.water_vol += this_dep.water_vol;
     this_dep.water_vol = this_dep.wtd_vol;
     return jump_table[root] = OverflowInto(this_dep.parent, \
-    this_dep.dep_label, stop_node, deps, jump_table, extra_water,params,arp);  
+    this_dep.dep_label, stop_node, deps, jump_table, extra_water, overflow);  
     //Nope. Pass the water to the parent
   }
 
@@ -1227,7 +1361,7 @@ static dh_label_t OverflowInto(
    // this_dep.water_vol -= extra_water;
    // this_dep.water_vol = std::max(this_dep.water_vol,0.0);
     return jump_table[root] = OverflowInto(this_dep.geolink, \
-      this_dep.dep_label, stop_node, deps, jump_table, extra_water,params,arp);
+      this_dep.dep_label, stop_node, deps, jump_table, extra_water, overflow);
   }  //TODO: I am concerned that using the geolink here may actually no 
   //longer be the best choice now that I've implemented downslope flow 
   //of water when overflowing. 
@@ -1251,7 +1385,7 @@ static dh_label_t OverflowInto(
 
   //THIRD PLACE TO STASH WATER: IN THIS DEPRESSION'S PARENT
   return jump_table[root] = OverflowInto(this_dep.parent, this_dep.dep_label, \
-    stop_node,deps, jump_table, extra_water,params,arp);
+    stop_node,deps, jump_table, extra_water, overflow);
 }
 
 
@@ -1299,20 +1433,16 @@ class SubtreeDepressionInfo {
 ///
 ///@param current_depression  The depression we're currently considering
 ///@param deps     The DepressionHierarchy generated by GetDepressionHierarchy
-///@param topo     Topography used to generate the DepressionHierarchy
-///@param label    Labels from GetDepressionHierarchy indicate which depression 
-///                each cell belongs to.
-///@param wtd      Water table depth. Values of 0 indicate saturation. 
-///                Negative values indicate additional water can be added to the
-///                cell. Positive values indicate standing surface water.
+///@param fill     Called as `fill(stdi, water_vol)` to spread the water of a
+///                partially-filled metadepression; see FillDepressions().
 ///@return Information about the subtree: its leaf node, depressions it 
 ///        contains, and its root node.
-template<class elev_t>
+template<class elev_t, class Fill>
 static SubtreeDepressionInfo FindDepressionsToFill(
   const int                         current_depression,
   //Depression we are currently in
   const DepressionHierarchy<elev_t> &deps,    //Depression hierarchy
-  ArrayPack                         &arp
+  Fill                              &fill
 ){
   //Stop when we reach one level below the leaves
   if(current_depression==NO_VALUE)
@@ -1325,7 +1455,7 @@ static SubtreeDepressionInfo FindDepressionsToFill(
   //metadepression tree by MoveWaterInDepHier(). Similarly, it doesn't matter 
   //what their leaf labels are since we will never spread water into them.
   for(const auto c: this_dep.ocean_linked)
-    FindDepressionsToFill(c, deps, arp);
+    FindDepressionsToFill(c, deps, fill);
 
   //At this point we've visited all of the ocean-linked depressions. Since all
   //depressions link to the ocean and the ocean has no children, this means we
@@ -1337,9 +1467,9 @@ static SubtreeDepressionInfo FindDepressionsToFill(
   //We visit both of the children. We need to keep track of info from these
   //because we may spread water across them.
   SubtreeDepressionInfo left_info  = FindDepressionsToFill(this_dep.lchild, \
-    deps, arp);
+    deps, fill);
   SubtreeDepressionInfo right_info = FindDepressionsToFill(this_dep.rchild, \
-    deps, arp );   
+    deps, fill);   
 
   SubtreeDepressionInfo combined;
   combined.my_labels.emplace(current_depression);
@@ -1411,7 +1541,7 @@ static SubtreeDepressionInfo FindDepressionsToFill(
     //If both of a depression's children have already spread their water,
     // we do notnwant to attempt to do so again in an empty parent depression. 
     //We check to see if both children have finished spreading water. 
-      FillDepressions(combined, this_dep.water_vol, deps,arp);
+      fill(combined, this_dep.water_vol);
 
     //At this point there should be no more water all the way up the tree until
     //we pass through an ocean link, so we pass this up as a kind of null value.
@@ -1446,14 +1576,11 @@ static SubtreeDepressionInfo FindDepressionsToFill(
 ///                the extent of the flooding.
 ///@param water_vol How much water needs to be spread throughout the depression
 ///@param deps     The DepressionHierarchy generated by GetDepressionHierarchy
-///@param topo     Topography used to generate the DepressionHierarchy
-///@param label    Labels from GetDepressionHierarchy indicate which depression 
-///                each cell belongs to.
-///@param wtd      Water table depth. Values of 0 indicate saturation. 
-///                Negative values indicate additional water can be added to the
-///                cell. Positive values indicate standing surface water.
+///@param cells    The cells of the depression and around it: their topography,
+///                labels, water table depths, and surface water (see
+///                GridCells).
 ///@return         N/A
-template<class elev_t>
+template<class elev_t, class Cells>
 static void FillDepressions(
   //Identifies a meta-depression through which water should be spread, leaf node
   //from which the water should be spread, and valid depressions across which
@@ -1462,12 +1589,14 @@ static void FillDepressions(
   double                            water_vol, 
   //Amount of water to spread around this depression
   const DepressionHierarchy<elev_t> &deps,      //Depression hierarchy
-  ArrayPack                         &arp
+  Cells                             &cells
 ){
   //Nothing to do if we have no water
   if(water_vol==0)
     return; 
 
+  TheProfiler().count(ProfileCounter::LakesFilled, 1);
+
   //Hashset stores the ids of the cells we've visited. We don't want to use a 2D
   //array because the size of the DEM as a whole could be massive and that's a
   //lot of memory to allocate/deallocate each time this function is called. We
@@ -1475,7 +1604,7 @@ static void FillDepressions(
   //This should be large than most depressions while still being small by the
   //computer's standards.
 
-  std::unordered_set<int> visited(2048);
+  std::unordered_set<int64_t> visited(2048);
 
   //Priority queue that sorts cells by lowest elevation first. If two cells are
   //of equal elevation the one added most recently is popped first. The ordering
@@ -1483,7 +1612,7 @@ static void FillDepressions(
   //the cells processed by the depression hierarchy.
   rd::GridCellZk_high_pq<elev_t> flood_q;  
   rd::GridCellZk_high_pq<elev_t> neighbour_q;    
-  
+
   { //Scope to limit pit_cell
     //Cell from which we can begin flooding the meta-depression. Which one we
     //choose is arbitrary, since we will fill all of the leaf depressions and
@@ -1494,17 +1623,18 @@ static void FillDepressions(
 
     //We start flooding at the pit cell of the depression and work our way
     //upwards
-    flood_q.emplace(
-      pit_cell % arp.topo.width(),
-      pit_cell / arp.topo.width(),
-      arp.topo(pit_cell)
-    );
+    int pit_x, pit_y;
+    cells.pit(pit_cell, pit_x, pit_y);
+    const auto pit_i = cells.index(pit_x, pit_y);
+    flood_q.emplace(pit_x, pit_y, cells.topo(pit_i));
 
-    visited.emplace(pit_cell);
+    visited.emplace(pit_i);
   }
 
+  uint64_t pq_pushes = 1;
+
   //Cells whose wtd will be affected as we spread water around
-  std::vector<int> cells_affected;
+  std::vector<int64_t> cells_affected;
 
   //Stores the sum of the elevations of all of the cells in cells_affected. Used
   //for calculating the volume we've seen so far. (See explanation above or in
@@ -1524,7 +1654,8 @@ static void FillDepressions(
   while(!flood_q.empty()){
     const auto c = flood_q.top();
     flood_q.pop();
-    current_elevation = static_cast<double>(arp.topo(c.x,c.y));
+    const auto ci = cells.index(c.x,c.y);
+    current_elevation = static_cast<double>(cells.topo(ci));
 
     //We keep track of the current volume of the depression by noting the total
     //elevation of the cells we've seen as well as the number of cells we've
@@ -1554,7 +1685,7 @@ static void FillDepressions(
     //into the pit cell. Since we may already have filled other depressions
     //their cells are allowed to have wtd>0. Thus, we raise a warning if we are
     //looking at a cell in this unfilled depression with wtd>0.
-    if(stdi.my_labels.count(arp.label(c.x,c.y))==1 && arp.wtd(c.x,c.y)>FP_ERROR)
+    if(stdi.my_labels.count(cells.label(ci))==1 && cells.wtd(ci)>FP_ERROR)
       throw std::runtime_error("A cell was discovered in an \
         unfilled depression with wtd>0!");
 
@@ -1567,7 +1698,7 @@ static void FillDepressions(
     //sufficient topographic volume to hold all the water.
     //   In this case, the cell's water table is left unaffected.
 
-    if(water_vol - (current_volume-arp.wtd(c.x,c.y)*arp.cell_area[c.y]) \
+    if(water_vol - (current_volume-cells.wtd(ci)*cells.area(c.y)) \
       <= FP_ERROR){
       //The current scope of the depression plus the water storage capacity of
       //this cell is sufficient to store all of the water. We'll stop adding
@@ -1594,15 +1725,15 @@ static void FillDepressions(
    //     if(fill_amount < 0)
      //     fill_amount = 0; 
 
-        arp.wtd(c.x,c.y)   += fill_amount/arp.cell_area[c.y];
+        cells.wtd(ci)   += fill_amount/cells.area(c.y);
         water_vol -= fill_amount;   
         //Doesn't matter because we don't use water_vol anymore
-        water_level     = arp.topo(c.x,c.y);
+        water_level     = cells.topo(ci);
 
       } else if (current_volume==water_vol) {  
         //The volume of water is exactly equal to the above ground volume 
         //so we set the water level equal to this cell's elevation
-          water_level = arp.topo(c.x,c.y);
+          water_level = cells.topo(ci);
         }
       else {  //The water volume is less than this cell's elevation, 
         //so we calculate what the water level should be.
@@ -1620,33 +1751,35 @@ static void FillDepressions(
       }
       //Water level must be higher than (or equal to) the previous cell
       // we looked at, but lower than (or equal to) the current cell
-      assert(cells_affected.size()==0 || arp.topo(cells_affected.back()) - \
+      assert(cells_affected.size()==0 || cells.topo(cells_affected.back()) - \
         water_level <= FP_ERROR); 
-      assert(arp.topo(c.x,c.y)-water_level >= -FP_ERROR);
+      assert(cells.topo(ci)-water_level >= -FP_ERROR);
 
       for(const auto c: cells_affected){
-        assert(arp.wtd(c) >= -FP_ERROR);               
+        auto &wtd = cells.wtd(c);
+        assert(wtd >= -FP_ERROR);               
         //This should be true since we have been filling wtds as we go.
-        if(arp.wtd(c) < 0)
-          arp.wtd(c) = 0;
+        if(wtd < 0)
+          wtd = 0;
 
           
-        assert(water_level - arp.topo(c) >= -FP_ERROR);
-        if(water_level < arp.topo(c))
-          water_level = arp.topo(c);
+        assert(water_level - cells.topo(c) >= -FP_ERROR);
+        if(water_level < cells.topo(c))
+          water_level = cells.topo(c);
         
-        arp.wtd(c) = water_level - arp.topo(c);  
+        wtd = water_level - cells.topo(c);  
         //only change the wtd if it is an increase, here. 
         //We can't take water away from cells that already have it 
         //(ie reduce groundwater in saddle cells within a metadepression.)
-        arp.surface_array(c) = arp.wtd(c);
-        if(-FP_ERROR<=arp.wtd(c) && arp.wtd(c)<0)
-          arp.wtd(c) = 0;
-        assert(arp.wtd(c)>= -FP_ERROR);
-        if(arp.wtd(c) < 0)
-          arp.wtd(c) = 0;
+        cells.surface(c) = wtd;
+        if(-FP_ERROR<=wtd && wtd<0)
+          wtd = 0;
+        assert(wtd>= -FP_ERROR);
+        if(wtd < 0)
+          wtd = 0;
       }
       //We've spread the water, so we're done        
+      TheProfiler().count(ProfileCounter::PQPushes, pq_pushes);
       return;
       
     }  else {
@@ -1657,7 +1790,7 @@ static void FillDepressions(
       //happens at the edge of a flat abuting an ocean). These cells will then
       //be popped and could be processed inappropriately. To prevent this, we
       //skip them here.
-      if(stdi.my_labels.count(arp.label(c.x,c.y))==0){  
+      if(stdi.my_labels.count(cells.label(ci))==0){  
       //CHECK. This was preventing cells that flowed to the ocean from 
         //allowing my depression volume to update. 
         //Is this way ok? Is this even needed?
@@ -1669,36 +1802,29 @@ static void FillDepressions(
 
       //Add this cell to those affected so that its volume is available for
       //filling.
-      cells_affected.emplace_back(arp.topo.xyToI(c.x,c.y));
+      cells_affected.emplace_back(ci);
       //Fill in cells' water tables as we go
 
-      assert(arp.wtd(c.x,c.y) <= FP_ERROR);
-      if(arp.wtd(c.x,c.y) > 0)
-        arp.wtd(c.x,c.y) = 0;
-      water_vol += arp.wtd(c.x,c.y)*arp.cell_area[c.y];  
+      assert(cells.wtd(ci) <= FP_ERROR);
+      if(cells.wtd(ci) > 0)
+        cells.wtd(ci) = 0;
+      water_vol += cells.wtd(ci)*cells.area(c.y);  
       //We use += because wtd is less than or equal to zero
-      arp.wtd(c.x,c.y)    = 0;             
+      cells.wtd(ci)    = 0;             
       //Now we are sure that wtd is 0, since we've just filled it
 
            //Add the current cell's information to the running total
-      total_elevation += arp.topo(c.x,c.y);
-      current_area += arp.cell_area[c.y];  
+      total_elevation += cells.topo(ci);
+      current_area += cells.area(c.y);  
       //adding to the area after the volume because when there is only 1 cell, 
       //the answer for volume should be 0, etc. 
       //Don't want to include the area of the target cell. 
-      area_times_elevation_total += arp.topo(c.x,c.y)*arp.cell_area[c.y];
+      area_times_elevation_total += cells.topo(ci)*cells.area(c.y);
 
       
  
-      for(int n=1;n<=neighbours;n++){
-        const int nx = c.x + dx[n]; 
-        //TODO ModFloor(x+dx[n],topo.width()); 
-        //Get neighbour's x-coordinate using an offset and wrapping
-        const int ny = c.y + dy[n];     
-        //Get neighbour's y-coordinate using an offset
-        if(!arp.topo.inGrid(nx,ny))          //Is this cell in the grid?
-          continue;                              //Nope: out of bounds.
-        const int ni = arp.topo.xyToI(nx,ny);   //Get neighbour's flat index
+      //Visit the neighbours which are in the grid
+      cells.forEachNeighbour(c.x, c.y, [&](const int nx, const int ny, const auto ni){
      
         //Ocean cells may be found at the edge of a depression. They might get
         //added to this list even if there are other, lower, cells within the
@@ -1714,26 +1840,28 @@ static void FillDepressions(
   
         if(visited.count(ni)==0){ //&& ((label(nx,ny)!=OCEAN) 
         //|| arp.land_mask(nx,ny)>0.0f)){
-          if(stdi.my_labels.count(arp.label(nx,ny))==0)  
+          if(stdi.my_labels.count(cells.label(ni))==0)  
           //CHECK. This was preventing cells that flowed to the ocean from 
             //allowing my depression volume to update. 
             //Is this way ok? Is this even needed?
-            neighbour_q.emplace(nx,ny,arp.topo(nx,ny));
+            neighbour_q.emplace(nx,ny,cells.topo(ni));
           else
-            flood_q.emplace(nx,ny,arp.topo(nx,ny));
+            flood_q.emplace(nx,ny,cells.topo(ni));
           visited.emplace(ni);
+          pq_pushes++;
         }
-      }
+      });
     }
 
 
     if(flood_q.empty() && !neighbour_q.empty()){
       const auto c = neighbour_q.top();
       neighbour_q.pop();    
-      flood_q.emplace(c.x,c.y,arp.topo(c.x,c.y));
+      flood_q.emplace(c.x,c.y,cells.topo(cells.index(c.x,c.y)));
+      pq_pushes++;
     }
 
-    previous_elevation = static_cast<double>(arp.topo(c.x,c.y));
+    previous_elevation = static_cast<double>(cells.topo(ci));
   }
 
   //Since we're in this function we are supposed to be guaranteed to be able to
@@ -1741,9 +1869,10 @@ static void FillDepressions(
   //Therefore, if we've reached this point, something has gone horribly wrong
   //somewhere. :-(
 
-  std::cerr<<"E PQ loop exited without filling a depression!"<<std::endl;
-  std::cerr<<"water vol "<<water_vol<<" current vol "\
-  <<current_volume<<std::endl;
+  TheProfiler().count(ProfileCounter::PQPushes, pq_pushes);
+
+  Log(LogLevel::Error)<<"PQ loop exited without filling a depression! water vol "\
+  <<water_vol<<" current vol "<<current_volume<<std::endl;
   
 
   assert(!flood_q.empty());
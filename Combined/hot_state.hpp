@@ -0,0 +1,97 @@
+#ifndef _hot_state_hpp_
+#define _hot_state_hpp_
+
+#include "land_mask.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace rd = richdem;
+
+///The values the groundwater stencil reads for a single cell
+struct HotCell {
+  float topo;
+  float wtd;
+  float fdepth;
+  float ksat;
+};
+
+static_assert(sizeof(HotCell)==16, "HotCell must pack into 16 bytes!");
+
+///An interleaved copy of the state read by the groundwater stencil. Each cell
+///of the stencil needs topo, wtd, fdepth, and ksat; held in separate arrays,
+///the five cells of the stencil touch fifteen rows of four different arrays,
+///each a separate stream for the prefetcher. Interleaved, the four values of a
+///cell are one 16-byte load, and a cache line holds four whole cells.
+///
+///The copy persists between steps. topo, fdepth and ksat only change when the
+///inputs do, so they are copied again only after invalidate(). The water
+///table changes every cycle, so refresh() copies wtd on land each time; the
+///ocean's water table never changes. The separate arrays remain the model's
+///real state.
+class HotState {
+ public:
+  ///Brings the copy up to date before a step: everything if it is empty, the
+  ///grid has changed size, or invalidate() has been called since the last
+  ///refresh, and otherwise only the water table of the land cells.
+  void refresh(
+    const rd::Array2D<float> &topo,
+    const rd::Array2D<float> &wtd,
+    const rd::Array2D<float> &fdepth,
+    const rd::Array2D<float> &ksat,
+    const LandMask           &land
+  ){
+    if(!inputs_valid || w!=topo.width() || h!=topo.height()){
+      gather(topo, wtd, fdepth, ksat);
+      return;
+    }
+
+    #pragma omp parallel for
+    for(int y=0;y<h;y++){
+      HotCell *const row = &cells[static_cast<size_t>(y)*w];
+      for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+      for(int x=s->x0;x<s->x1;x++)
+        row[x].wtd = wtd(x,y);
+    }
+  }
+
+  ///Marks topo, fdepth and ksat as changed, so that the next refresh() copies
+  ///all of the state again
+  void invalidate(){
+    inputs_valid = false;
+  }
+
+  const HotCell& operator()(const int x, const int y) const {
+    return cells[static_cast<size_t>(y)*w+x];
+  }
+
+  int32_t width()  const { return w; }
+  int32_t height() const { return h; }
+
+ private:
+  void gather(
+    const rd::Array2D<float> &topo,
+    const rd::Array2D<float> &wtd,
+    const rd::Array2D<float> &fdepth,
+    const rd::Array2D<float> &ksat
+  ){
+    w = topo.width();
+    h = topo.height();
+    cells.resize(static_cast<size_t>(w)*h);
+
+    #pragma omp parallel for
+    for(int y=0;y<h;y++){
+      HotCell *const row = &cells[static_cast<size_t>(y)*w];
+      for(int x=0;x<w;x++)
+        row[x] = HotCell{topo(x,y), wtd(x,y), fdepth(x,y), ksat(x,y)};
+    }
+    inputs_valid = true;
+  }
+
+  int32_t              w            = 0;
+  int32_t              h            = 0;
+  bool                 inputs_valid = false;
+  std::vector<HotCell> cells;
+};
+
+#endif
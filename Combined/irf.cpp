@@ -1,10 +1,18 @@
 #include "transient_groundwater.hpp"
 #include "fill_spill_merge.hpp"
 #include "evaporation.hpp"
+#include "checkpoint.hpp"
+#include "dephier_cache.hpp"
+#include "logging.hpp"
+#include "profiler.hpp"
+#include "reduction.hpp"
 
 #include "../common/netcdf.hpp"
+#include "../common/parallel_load.hpp"
 #include "ArrayPack.hpp"
 #include "parameters.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <iomanip>
@@ -24,104 +32,191 @@ namespace dh = richdem::dephier;
 const double UNDEF  = -1.0e7;
 
 
+///The file whose grid all of the inputs are assumed to share
+std::string WindowGridFile(const Parameters &params){
+  return params.surfdatadir + params.region + "ksat." + params.input_format;
+}
+
+
+
+///The part of the input grids the parameters ask for, from either the 
+///window_x0/y0/width/height or the window_south/north/west/east keys. The 
+///bounding box is converted to cells using the lat and lon coordinates of the 
+///ksat file; all inputs are assumed to share its grid.
+GridWindow RequestedWindow(const Parameters &params){
+  GridWindow window;
+  const std::string grid_file = WindowGridFile(params);
+
+  const bool have_bounds = !std::isnan(params.window_south) || \
+  !std::isnan(params.window_north) || !std::isnan(params.window_west) || \
+  !std::isnan(params.window_east);
+
+  if(have_bounds){
+    if(std::isnan(params.window_south) || std::isnan(params.window_north) || \
+    std::isnan(params.window_west) || std::isnan(params.window_east))
+      throw std::runtime_error("All of window_south, window_north, window_west, and window_east must be given!");
+    window = WindowFromBounds(grid_file, params.window_south, \
+    params.window_north, params.window_west, params.window_east);
+  } else {
+    window.x0     = params.window_x0;
+    window.y0     = params.window_y0;
+    window.width  = params.window_width;
+    window.height = params.window_height;
+  }
+
+  return window;
+}
+
+
+
+///Works out which part of the input grids the model will run on (see
+///RequestedWindow()).
+///Since row 0 of the grid is at southern_edge, southern_edge is moved north by 
+///the number of rows skipped, so that latitudes and cell areas stay correct.
+///That only holds if latitude increases with the row, so a window that skips
+///rows of a grid whose latitude decreases is rejected.
+GridWindow InputWindow(Parameters &params){
+  const GridWindow window = RequestedWindow(params);
+  const std::string grid_file = WindowGridFile(params);
+
+  if(window.y0!=0 && LatitudeDecreasesByRow(grid_file))
+    throw std::runtime_error("Latitude decreases down the rows of '" + grid_file + \
+    "', so southern_edge can't be moved for a window that skips rows!");
+
+  if(!window.whole())
+    Log()<<"Reading a window of the inputs starting at cell ("<<window.x0 \
+    <<","<<window.y0<<")"<<'\n';
+
+  params.southern_edge += static_cast<double>(window.y0)/params.cells_per_degree;
+
+  return window;
+}
+
+
 ///This function initialises those arrays that are needed only for transient 
 ///model runs. This includes both start and end states for slope, precipitation,
 ///temperature, topography, ET, and relative humidity. We also have a land vs 
 ///ocean mask for the end time. It also includes the starting water table depth 
 ///array, a requirement for transient runs.
-///We also calculate the e-folding depth here, using temperature and slope. 
+///We also calculate the e-folding depth here, using temperature and slope, 
+///unless fdepth_from_file is set, in which case its start and end states are 
+///read from _fdepth files instead.
 ///TODO: the e-folding depth uses some calibration constants that are dependent 
 ///on cell-size. How to deal with this when a user may
 ///have differing cell size inputs? Should these be user-set values?
 void InitialiseTransient(Parameters &params, ArrayPack &arp){
+  //All of the input files are independent, so they are queued up here and 
+  //read together, several at a time if load_jobs allows it.
+  LoadQueue loads(InputWindow(params));
+
+  loads.add(params.surfdatadir + params.region + "ksat." + \
+  params.input_format, "value", arp.vert_ksat);   //Units of ksat are m/s. 
+  loads.add(params.surfdatadir + params.region + "horizontal_ksat." + \
+  params.input_format, "value", arp.ksat);   //Units of ksat are m/s. 
+
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_slope." + params.input_format,  "value", arp.slope_start);  //Slope as a value from 0 to 1. 
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_precip." + params.input_format, "value", arp.precip_start);  //Units: m/yr. 
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_temp." + params.input_format,   "value", arp.temp_start);  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_ground_temp." + params.input_format,   "value", arp.ground_temp_start);  
+  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_topo." + params.input_format,   "value", arp.topo_start);  //Units: metres
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_evap." + params.input_format,   "value", arp.starting_evap_start);  //Units: m/yr
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_relhum." + params.input_format, "value", arp.relhum_start);  //Units: proportion from 0 to 1
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_wind_speed." + params.input_format, "value", arp.wind_speed_start);  //Units: m/s
+
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_slope." + params.input_format,  "value", arp.slope_end);  //Slope as a value from 0 to 1. 
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_mask." + params.input_format,   "value", arp.land_mask);  //A binary mask that is 1 where 
+  //there is land and 0 in the ocean
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_precip." + params.input_format, "value", arp.precip_end);  //Units: m/yr. 
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_temp." + params.input_format,   "value", arp.temp_end);  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_ground_temp." + params.input_format,   "value", arp.ground_temp_end);  
+  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_topo." + params.input_format,   "value", arp.topo_end);  //Units: metres
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_evap." + params.input_format,   "value", arp.starting_evap_end);  //Units: m/yr
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_relhum." + params.input_format, "value", arp.relhum_end);  //Units: proportion from 0 to 1.
+  loads.add(params.surfdatadir + params.region + params.time_end + \
+  "_wind_speed." + params.input_format, "value", arp.wind_speed_end);  //Units: m/s
+
+  //The e-folding depth is either read from files or, by default, computed 
+  //from slope and temperature below
+  if(params.fdepth_from_file){
+    loads.add(params.surfdatadir + params.region + params.time_start + \
+    "_fdepth." + params.input_format, "value", arp.fdepth_start);  //Units: metres
+    loads.add(params.surfdatadir + params.region + params.time_end + \
+    "_fdepth." + params.input_format, "value", arp.fdepth_end);  //Units: metres
+  }
 
-  arp.vert_ksat = LoadData<float>(params.surfdatadir + params.region + \
-  "ksat.nc", "value");   //Units of ksat are m/s. 
+  //load in the wtd result from the previous time. When restarting, the wtd 
+  //comes from the checkpoint instead, so we only need an array of the right 
+  //size here. 
+  if(params.restart_from==UNINIT_STR)
+    loads.add(params.surfdatadir + params.region + params.time_start + \
+    "_wtd." + params.input_format, "value", arp.wtd);
+
+  loads.run(params.load_jobs);
+
+  if(params.restart_from!=UNINIT_STR)
+    arp.wtd  = rd::Array2D<float>(arp.topo_start,0.0);
 
 //width and height in number of cells in the array
   params.ncells_x = arp.vert_ksat.width();  
   params.ncells_y = arp.vert_ksat.height();
 
-
-  arp.slope_start         = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_slope.nc",  "value");  //Slope as a value from 0 to 1. 
-  arp.precip_start        = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_precip.nc", "value");  //Units: m/yr. 
-  arp.temp_start          = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_temp.nc",   "value");  //Units: degress Celsius
-  arp.ground_temp_start          = LoadData<float>(params.surfdatadir + \
-    params.region + params.time_start + "_ground_temp.nc",   "value");  
-    //Units: degress Celsius
-  arp.topo_start          = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_topo.nc",   "value");  //Units: metres
-  arp.starting_evap_start = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_evap.nc",   "value");  //Units: m/yr
-  arp.relhum_start        = LoadData<float>(params.surfdatadir + params.region \
-  + params.time_start + "_relhum.nc", "value");  //Units: proportion from 0 to 1
-  arp.wind_speed_start  = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_wind_speed.nc", "value");  //Units: m/s
-
-  arp.slope_end         = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_slope.nc",  "value");  //Slope as a value from 0 to 1. 
-  arp.land_mask         = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_mask.nc",   "value");  //A binary mask that is 1 where 
-  //there is land and 0 in the ocean
-  arp.precip_end        = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_precip.nc", "value");  //Units: m/yr. 
-  arp.temp_end          = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_temp.nc",   "value");  //Units: degress Celsius
-  arp.ground_temp_end          = LoadData<float>(params.surfdatadir + \
-    params.region + params.time_end + "_ground_temp.nc",   "value");  
-    //Units: degress Celsius
-  arp.topo_end          = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_topo.nc",   "value");  //Units: metres
-  arp.starting_evap_end = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_evap.nc",   "value");  //Units: m/yr
-  arp.relhum_end        = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_relhum.nc", "value");  //Units: proportion from 0 to 1.
-  arp.wind_speed_end    = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_end + "_wind_speed.nc", "value");  //Units: m/s
-
-  //load in the wtd result from the previous time: 
-  arp.wtd    = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_wtd.nc", "value");
-
   //calculate the fdepth (e-folding depth, representing rate of decay of the 
   //hydraulic conductivity with depth) arrays:
-  arp.fdepth_start = rd::Array2D<float>(arp.topo_start,0); 
-  arp.fdepth_end   = rd::Array2D<float>(arp.topo_start,0); 
-  //TODO: allow user to vary these calibration constants depending on their 
-  //input cellsize? Or do some kind of auto variation of them? 
-  for(unsigned int i=0;i<arp.topo_start.size();i++){
-    if(arp.temp_start(i) > -5)  //then fdepth = f from Ying's equation S7. 
-      arp.fdepth_start(i) = std::max(1000/(1+150*arp.slope_start(i)),25.0f);  
-    else{ //then fdpth = f*fT, Ying's equations S7 and S8. 
-      if(arp.temp_start(i) < -14)
-        arp.fdepth_start(i) = (std::max(1000/(1+150*arp.slope_start(i)),25.0f))\
-         * (std::max(0.05, 0.17 + 0.005 * arp.temp_start(i)));
-      else
-        arp.fdepth_start(i) = (std::max(1000/(1+150*arp.slope_start(i)),25.0f))\
-         * (std::min(1.0, 1.5 + 0.1 * arp.temp_start(i)));
-    }
-    if(arp.temp_end(i) > -5)  //then fdepth = f from Ying's equation S7. 
-      arp.fdepth_end(i) = std::max(1000/(1+150*arp.slope_end(i)),25.0f);  
-    else{ //then fdpth = f*fT, Ying's equations S7 and S8. 
-      if(arp.temp_end(i) < -14)
-        arp.fdepth_end(i) = (std::max(1000/(1+150*arp.slope_end(i)),25.0f)) * \
-      (std::max(0.05, 0.17 + 0.005 * arp.temp_end(i)));
-      else
-        arp.fdepth_end(i) = (std::max(1000/(1+150*arp.slope_end(i)),25.0f)) * \
-      (std::min(1.0, 1.5 + 0.1 * arp.temp_end(i)));
+  if(!params.fdepth_from_file){
+    arp.fdepth_start = rd::Array2D<float>(arp.topo_start,0); 
+    arp.fdepth_end   = rd::Array2D<float>(arp.topo_start,0); 
+    //TODO: allow user to vary these calibration constants depending on their 
+    //input cellsize? Or do some kind of auto variation of them? 
+    for(unsigned int i=0;i<arp.topo_start.size();i++){
+      if(arp.temp_start(i) > -5)  //then fdepth = f from Ying's equation S7. 
+        arp.fdepth_start(i) = std::max(1000/(1+150*arp.slope_start(i)),25.0f);  
+      else{ //then fdpth = f*fT, Ying's equations S7 and S8. 
+        if(arp.temp_start(i) < -14)
+          arp.fdepth_start(i) = (std::max(1000/(1+150*arp.slope_start(i)),25.0f))\
+           * (std::max(0.05, 0.17 + 0.005 * arp.temp_start(i)));
+        else
+          arp.fdepth_start(i) = (std::max(1000/(1+150*arp.slope_start(i)),25.0f))\
+           * (std::min(1.0, 1.5 + 0.1 * arp.temp_start(i)));
+      }
+      if(arp.temp_end(i) > -5)  //then fdepth = f from Ying's equation S7. 
+        arp.fdepth_end(i) = std::max(1000/(1+150*arp.slope_end(i)),25.0f);  
+      else{ //then fdpth = f*fT, Ying's equations S7 and S8. 
+        if(arp.temp_end(i) < -14)
+          arp.fdepth_end(i) = (std::max(1000/(1+150*arp.slope_end(i)),25.0f)) * \
+        (std::max(0.05, 0.17 + 0.005 * arp.temp_end(i)));
+        else
+          arp.fdepth_end(i) = (std::max(1000/(1+150*arp.slope_end(i)),25.0f)) * \
+        (std::min(1.0, 1.5 + 0.1 * arp.temp_end(i)));
+      }
     }
   }
 
-//initialise the arrays to be as at the starting time:
-  arp.fdepth        = arp.fdepth_start;
-  arp.precip        = arp.precip_start;
-  arp.temp          = arp.temp_start;
-  arp.topo          = arp.topo_start;
-  arp.starting_evap = arp.starting_evap_start;
-  arp.relhum        = arp.relhum_start;
+//initialise the arrays to be as at the starting time. Those interpolated 
+  //each cycle must not share cells with their starting state (see OwnedCopy()):
+  arp.fdepth        = OwnedCopy(arp.fdepth_start);
+  arp.precip        = OwnedCopy(arp.precip_start);
+  arp.temp          = OwnedCopy(arp.temp_start);
+  arp.topo          = OwnedCopy(arp.topo_start);
+  arp.starting_evap = OwnedCopy(arp.starting_evap_start);
+  arp.relhum        = OwnedCopy(arp.relhum_start);
   arp.slope         = arp.slope_start;
   arp.evap          = arp.starting_evap;
   arp.ground_temp   = arp.ground_temp_start;
@@ -135,43 +230,57 @@ void InitialiseTransient(Parameters &params, ArrayPack &arp){
 ///topography, ET, land vs ocean mask, and relative humidity. 
 ///It also includes setting the starting water table depth array to 
 ///zero everywhere.
-///We also calculate the e-folding depth here, using temperature and slope. 
+///We also calculate the e-folding depth here, using temperature and slope, 
+///unless fdepth_from_file is set, in which case it is read from a _fdepth file.
 ///TODO: the e-folding depth uses some calibration constants that are dependent 
 ///on cell-size. How to deal with this when a user may
 ///have differing cell size inputs? Should these be user-set values?
 void InitialiseEquilibrium(Parameters &params, ArrayPack &arp){
-
-  arp.vert_ksat = LoadData<float>(params.surfdatadir + params.region + \
-  "ksat.nc", "value");   //Units of ksat are m/s. 
+  //All of the input files are independent, so they are queued up here and 
+  //read together, several at a time if load_jobs allows it.
+  LoadQueue loads(InputWindow(params));
+
+  loads.add(params.surfdatadir + params.region + "ksat." + \
+  params.input_format, "value", arp.vert_ksat);   //Units of ksat are m/s. 
+  loads.add(params.surfdatadir + params.region + "horizontal_ksat." + \
+  params.input_format, "value", arp.ksat);   //Units of ksat are m/s. 
+
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_slope." + params.input_format,  "value", arp.slope);  //Slope as a value from 0 to 1. 
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_mask." + params.input_format,   "value", arp.land_mask); 
+  //A binary mask that is 1 where there is land and 0 in the ocean
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_precip." + params.input_format, "value", arp.precip);  //Units: m/yr. 
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_temp." + params.input_format,   "value", arp.temp);  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_ground_temp." + params.input_format,   "value", arp.ground_temp);  
+  //Units: degress Celsius
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_topo." + params.input_format,   "value", arp.topo);  //Units: metres
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_evap." + params.input_format,   "value", arp.starting_evap);  //Units: m/yr
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_relhum." + params.input_format, "value", arp.relhum);  //Units: proportion from 0 to 1.
+  loads.add(params.surfdatadir + params.region + params.time_start + \
+  "_wind_speed." + params.input_format, "value", arp.wind_speed);  //Units: m/s
+  if(params.fdepth_from_file)
+    loads.add(params.surfdatadir + params.region + params.time_start + \
+    "_fdepth." + params.input_format, "value", arp.fdepth);  //Units: metres
+
+  loads.run(params.load_jobs);
 
 //width and height in number of cells in the array
   params.ncells_x = arp.vert_ksat.width();  
   params.ncells_y = arp.vert_ksat.height();
 
-  arp.slope         = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_slope.nc",  "value");  //Slope as a value from 0 to 1. 
-  arp.land_mask     = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_mask.nc",   "value"); 
-  //A binary mask that is 1 where there is land and 0 in the ocean
-  arp.precip        = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_precip.nc", "value");  //Units: m/yr. 
-  arp.temp          = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_temp.nc",   "value");  //Units: degress Celsius
-  arp.ground_temp          = LoadData<float>(params.surfdatadir + \
-  params.region + params.time_start + "_ground_temp.nc",   "value");  
-  //Units: degress Celsius
-  arp.topo          = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_topo.nc",   "value");  //Units: metres
-  arp.starting_evap = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_evap.nc",   "value");  //Units: m/yr
-  arp.relhum        = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_relhum.nc", "value");  //Units: proportion from 0 to 1.
-  arp.wind_speed    = LoadData<float>(params.surfdatadir + params.region + \
-  params.time_start + "_wind_speed.nc", "value");  //Units: m/s
-
   arp.wtd           = rd::Array2D<float>(arp.topo,0.0);  
   //we start with a water table at the surface for equilibrium runs. 
-  arp.evap          = arp.starting_evap;
+  arp.evap          = OwnedCopy(arp.starting_evap);
+
+  if(params.fdepth_from_file)
+    return;
 
   arp.fdepth   = rd::Array2D<float>(arp.topo,0); 
   for(unsigned int i=0;i<arp.topo.size();i++){
@@ -268,21 +377,27 @@ void cell_size_area(Parameters &params, ArrayPack &arp){
 
 ///This function initialises those arrays that are used for both equilibrium 
 ///and transient model runs. This includes arrays that start off with zero 
-///values, as well as the label, final_label, and flowdirs arrays. 
+///values, as well as the label, final_label, and flowdirs arrays. The 
+///horizontal ksat used here is loaded along with the other inputs by 
+///InitialiseTransient or InitialiseEquilibrium.
 void InitialiseBoth(const Parameters &params, ArrayPack &arp){
 
-  arp.ksat = LoadData<float>(params.surfdatadir + params.region + \
-  "horizontal_ksat.nc", "value");   //Units of ksat are m/s. 
+  //Pack the land mask into bits and find the runs of land in each row. The 
+  //byte-per-cell mask is not needed after this. 
+  arp.land      = LandMask(arp.land_mask);
+  arp.land_mask = u82d();
 
+  //Neighbours across the east and west edges, which meet on a global grid
+  arp.wrap_x    = ColumnWrap(arp.land.width(), params.periodic_x);
 
   //Set arrays that start off with zero or other values, 
   //that are not imported files. Just to initialise these - 
   //we'll add the appropriate values later. 
 
-  //These two are just informational, to see how much change 
-  //happens in FSM vs in groundwater
-  arp.wtd_old            = arp.wtd;                               
-  arp.wtd_mid            = arp.wtd;
+  //Just informational, to see how much change happens in FSM vs in 
+  //groundwater. Only needed for the absolute value diagnostics.
+  if(params.abs_diagnostics)
+    arp.wtd_mid          = arp.wtd;
 
   arp.runoff             = rd::Array2D<float>(arp.ksat,0);
   arp.head               = rd::Array2D<float>(arp.ksat,0);        
@@ -322,7 +437,7 @@ void InitialiseBoth(const Parameters &params, ArrayPack &arp){
       arp.topo(i) = 0;
     }
     //Converting units to appropriate time step
-    arp.precip(i)        *= (params.deltat/(60*60*24*365));                 
+    arp.precip(i)        *= (params.deltat/(60*60*24*365))*params.precip_scale;
     arp.starting_evap(i) *= (params.deltat/(60*60*24*365));                 
 
   } 
@@ -335,19 +450,12 @@ void InitialiseBoth(const Parameters &params, ArrayPack &arp){
       arp.rech(i) = 0.0f;
   }
 
-//Wtd is 0 in the ocean:
-  #pragma omp parallel for
-  for(unsigned int i=0;i<arp.topo.size();i++){
-    if(arp.land_mask(i) == 0){ 
-      arp.wtd  (i) = 0;
-    }
-  }
-
-//Label the ocean cells. This is a precondition for 
+//Wtd is 0 in the ocean. Label the ocean cells, which is a precondition for 
   //using `GetDepressionHierarchy()`.
   #pragma omp parallel for
   for(unsigned int i=0;i<arp.label.size();i++){
-    if(arp.land_mask(i) == 0.0f){ 
+    if(!arp.land.isLand(i)){ 
+      arp.wtd  (i) = 0;
       arp.label(i) = dh::OCEAN;
       arp.final_label(i) = dh::OCEAN;
     }
@@ -355,12 +463,84 @@ void InitialiseBoth(const Parameters &params, ArrayPack &arp){
 }
 
 
+///Replaces slope and the climate inputs with 16-bit quantized copies, which 
+///halves the memory they take and the bandwidth needed to read them. This is 
+///done once initialisation is finished, so the e-folding depth is still 
+///computed from the full-precision slope and temperature. wtd, topo, and the 
+///remaining inputs stay in full precision.
+///In transient runs temperature and relative humidity are interpolated between
+///their start and end states every cycle, so each shares a single range across
+///its start, end, and current grids. The start and end states of slope, ground
+///temperature, and wind speed are never read after initialisation, and are 
+///released.
+void QuantizeInputs(const Parameters &params, ArrayPack &arp){
+  using QG = QuantizedGrid;
+
+  if(params.run_type=="transient"){
+    const float temp_lo   = std::min(QG::FiniteMin(arp.temp_start),   QG::FiniteMin(arp.temp_end));
+    const float temp_hi   = std::max(QG::FiniteMax(arp.temp_start),   QG::FiniteMax(arp.temp_end));
+    const float relhum_lo = std::min(QG::FiniteMin(arp.relhum_start), QG::FiniteMin(arp.relhum_end));
+    const float relhum_hi = std::max(QG::FiniteMax(arp.relhum_start), QG::FiniteMax(arp.relhum_end));
+
+    arp.q_temp_start   = QG(arp.temp_start,   temp_lo,   temp_hi);
+    arp.q_temp_end     = QG(arp.temp_end,     temp_lo,   temp_hi);
+    arp.q_temp         = QG(arp.temp,         temp_lo,   temp_hi);
+    arp.q_relhum_start = QG(arp.relhum_start, relhum_lo, relhum_hi);
+    arp.q_relhum_end   = QG(arp.relhum_end,   relhum_lo, relhum_hi);
+    arp.q_relhum       = QG(arp.relhum,       relhum_lo, relhum_hi);
+
+    arp.temp_start        = f2d();
+    arp.temp_end          = f2d();
+    arp.relhum_start      = f2d();
+    arp.relhum_end        = f2d();
+    arp.slope_start       = f2d();
+    arp.slope_end         = f2d();
+    arp.ground_temp_start = f2d();
+    arp.ground_temp_end   = f2d();
+    arp.wind_speed_start  = f2d();
+    arp.wind_speed_end    = f2d();
+  } else {
+    arp.q_temp   = QG(arp.temp);
+    arp.q_relhum = QG(arp.relhum);
+  }
+
+  arp.q_slope       = QG(arp.slope);
+  arp.q_ground_temp = QG(arp.ground_temp);
+  arp.q_wind_speed  = QG(arp.wind_speed);
+
+  arp.temp        = f2d();
+  arp.relhum      = f2d();
+  arp.slope       = f2d();
+  arp.ground_temp = f2d();
+  arp.wind_speed  = f2d();
+
+  arp.quantized = true;
+
+  Log()<<"quantization error: slope = "<<arp.q_slope.maxError()
+       <<", relhum = "     <<arp.q_relhum.maxError()
+       <<", temp = "       <<arp.q_temp.maxError()
+       <<", ground_temp = "<<arp.q_ground_temp.maxError()
+       <<", wind_speed = " <<arp.q_wind_speed.maxError()<<'\n';
+}
+
+
+
 ///In transient runs, we adjust the input arrays via a 
 //linear interpolation from the start state to the end state at each iteration. 
 ///We do so here, and also reset the label and flow direction arrays, 
 ///since the depression hierarchy needs to be 
 ///recalculated due to the changed topography. 
-void UpdateTransientArrays(const Parameters &params, ArrayPack &arp){
+template<class Grid>
+static void UpdateTransientArrays(
+  const Parameters &params,
+  ArrayPack        &arp,
+  Grid             &temp,
+  const Grid       &temp_start,
+  const Grid       &temp_end,
+  Grid             &relhum,
+  const Grid       &relhum_start,
+  const Grid       &relhum_end
+){
   for(unsigned int i=0;i<arp.topo.size();i++){
 
     arp.fdepth(i)         = (arp.fdepth_start(i)        * \
@@ -369,35 +549,126 @@ void UpdateTransientArrays(const Parameters &params, ArrayPack &arp){
     arp.precip(i)         = (arp.precip_start(i)        * \
       (1-(params.cycles_done/params.total_cycles))) + (arp.precip_end(i)       \
        * (params.cycles_done/params.total_cycles));
-    arp.temp(i)           = (arp.temp_start(i)          * \
-      (1-(params.cycles_done/params.total_cycles))) + (arp.temp_end(i)         \
-       * (params.cycles_done/params.total_cycles));
+    SetCell(temp, i,        (temp_start(i)              * \
+      (1-(params.cycles_done/params.total_cycles))) + (temp_end(i)             \
+       * (params.cycles_done/params.total_cycles)));
     arp.topo(i)           = (arp.topo_start(i)          * \
       (1-(params.cycles_done/params.total_cycles))) + (arp.topo_end(i)         \
        * (params.cycles_done/params.total_cycles));
     arp.starting_evap(i)  = (arp.starting_evap_start(i) * \
       (1-(params.cycles_done/params.total_cycles))) + (arp.starting_evap_end(i)\
        * (params.cycles_done/params.total_cycles));
-    arp.relhum(i)         = (arp.relhum_start(i)        * \
-      (1-(params.cycles_done/params.total_cycles))) + (arp.relhum_end(i)       \
-       * (params.cycles_done/params.total_cycles));
+    SetCell(relhum, i,      (relhum_start(i)            * \
+      (1-(params.cycles_done/params.total_cycles))) + (relhum_end(i)           \
+       * (params.cycles_done/params.total_cycles)));
 
     //Converting to appropriate time step
-    arp.precip(i)        *= (params.deltat/(60*60*24*365));                  
+    arp.precip(i)        *= (params.deltat/(60*60*24*365))*params.precip_scale;
     arp.starting_evap(i) *= (params.deltat/(60*60*24*365));                  
  
-    arp.label(i)        = dh::NO_DEP; //No cells are part of a depression
-    arp.final_label(i)  = dh::NO_DEP; //No cells are part of a depression
+    //No land cells are part of a depression, and ocean cells are labelled 
+    //as such
+    const auto label    = arp.land.isLand(i) ? dh::NO_DEP : dh::OCEAN;
+    arp.label(i)        = label;
+    arp.final_label(i)  = label;
     arp.flowdirs(i)     = rd::NO_FLOW; //No cells flow anywhere
   } 
+}
 
-  #pragma omp parallel for
-  for(unsigned int i=0;i<arp.label.size();i++){
-    if(arp.land_mask(i) == 0.0f){ 
-      arp.label(i) = dh::OCEAN;
-      arp.final_label(i) = dh::OCEAN;
+///Interpolates the transient inputs, whether or not they are quantized
+void UpdateTransientArrays(const Parameters &params, ArrayPack &arp){
+  if(arp.quantized)
+    UpdateTransientArrays(params, arp, arp.q_temp, arp.q_temp_start, 
+      arp.q_temp_end, arp.q_relhum, arp.q_relhum_start, arp.q_relhum_end);
+  else
+    UpdateTransientArrays(params, arp, arp.temp, arp.temp_start, 
+      arp.temp_end, arp.relhum, arp.relhum_start, arp.relhum_end);
+
+  //topo and fdepth have moved, so the interleaved copy must be rebuilt
+  arp.hot.invalidate();
+}
+
+
+///Volume of water (m^3) held by the water table over the land cells which 
+///groundwater acts on (the interior, and the seam of a periodic grid), 
+///measured from the land surface. PrintValues measures the total change in 
+///the water table from the change in this volume between cycles, so no copy 
+///of the previous water table is needed.
+double WtdVolume(const ArrayPack &arp){
+  return ReduceOverLand<1>(arp.land, true, arp.wrap_x.periodic(), \
+    [&](const int x, const int y, CompensatedSum *const sum){
+    sum[0].add(static_cast<double>(arp.wtd(x,y))*arp.cell_area[y]);
+  })[0];
+}
+
+
+
+enum ChangeSum {CHANGE_VOLUME, CHANGE_MID, CHANGE_ABS_TOTAL, CHANGE_ABS_GW, \
+  CHANGE_ABS_MID, CHANGE_INFILTRATION, CHANGE_SURFACE, N_CHANGE_SUMS};
+using ChangeSums = std::array<double,N_CHANGE_SUMS>;
+
+//The sums PrintValues() reports, over the land cells of `arp`
+static ChangeSums SumChanges(const Parameters &params, const ArrayPack &arp){
+  const bool abs_diagnostics = params.abs_diagnostics;
+
+  //Only land cells can change, so the ocean is skipped
+  return ReduceOverLand<N_CHANGE_SUMS>(arp.land, true, arp.wrap_x.periodic(), \
+    [&](const int x, const int y, CompensatedSum *const sum){
+    const double area  = arp.cell_area[y];
+    const double mid   = static_cast<double>(arp.rech(x,y)) + arp.wtd_change_total(x,y);
+    sum[CHANGE_VOLUME      ].add(arp.wtd(x,y)*area);
+    sum[CHANGE_MID         ].add(mid*area);
+    sum[CHANGE_INFILTRATION].add(arp.infiltration_array(x,y)*area);
+    sum[CHANGE_SURFACE     ].add(arp.surface_array(x,y)     *area);
+    if(abs_diagnostics){
+      const double gw = arp.wtd(x,y) - arp.wtd_mid(x,y);
+      sum[CHANGE_ABS_TOTAL ].add(std::fabs(gw+mid)*area);
+      sum[CHANGE_ABS_GW    ].add(std::fabs(gw)    *area);
+      sum[CHANGE_ABS_MID   ].add(std::fabs(mid)   *area);
     }
+  });
+}
+
+//Stores the changes in `params` and writes them to the log and the records
+static void ReportChanges(Parameters &params, const ChangeSums &sums){
+  const bool abs_diagnostics = params.abs_diagnostics;
+
+  params.total_wtd_change     = sums[CHANGE_VOLUME] - params.wtd_volume;
+  params.wtd_mid_change       = sums[CHANGE_MID];
+  params.GW_wtd_change        = params.total_wtd_change - params.wtd_mid_change;
+  params.abs_total_wtd_change = sums[CHANGE_ABS_TOTAL];
+  params.abs_GW_wtd_change    = sums[CHANGE_ABS_GW];
+  params.abs_wtd_mid_change   = sums[CHANGE_ABS_MID];
+  params.infiltration_change  = sums[CHANGE_INFILTRATION];
+  params.surface_change       = sums[CHANGE_SURFACE];
+  params.wtd_volume           = sums[CHANGE_VOLUME];
+
+  auto &log = Log();
+  const auto old_precision = log.precision(12);
+  log<<"params.cycles_done "<<params.cycles_done<<'\n';
+  log<<"total wtd change was "<<params.total_wtd_change<<\
+  " m^3 change in GW only was "<<params.GW_wtd_change<<\
+  " m^3 and change in SW only was "<<params.wtd_mid_change<<" m^3"<<'\n';
+  if(abs_diagnostics)
+    log<<"absolute value total wtd change was "<<params.abs_total_wtd_change\
+    <<" m^3 change in GW only was "<<params.abs_GW_wtd_change<<\
+    " m^3 and change in SW only was "<<params.abs_wtd_mid_change<<" m^3"<<'\n';
+  log<<"the change in infiltration was "<<params.infiltration_change\
+  <<" m^3 and change to surface water was "<<params.surface_change<<" m^3"<<'\n';
+  log.precision(old_precision);
+
+  auto &logger = TheLogger();
+  logger.record("total_wtd_change",    params.total_wtd_change);
+  logger.record("GW_wtd_change",       params.GW_wtd_change);
+  logger.record("wtd_mid_change",      params.wtd_mid_change);
+  if(abs_diagnostics){
+    logger.record("abs_total_wtd_change",params.abs_total_wtd_change);
+    logger.record("abs_GW_wtd_change",   params.abs_GW_wtd_change);
+    logger.record("abs_wtd_mid_change",  params.abs_wtd_mid_change);
   }
+  logger.record("infiltration_change", params.infiltration_change);
+  logger.record("surface_change",      params.surface_change);
+  logger.record("wtd_volume",          params.wtd_volume);
 }
 
 
@@ -405,38 +676,35 @@ void UpdateTransientArrays(const Parameters &params, ArrayPack &arp){
 ///informational purposes to help us understand how much the water table 
 ///is changing per iteration, and where in 
 ///the code that change is occurring. We print these values to a text file.
+///Each change is weighted by the area of its cell, so the totals are volumes 
+///of water (m^3). All of them are gathered in a single pass over the land, 
+///using compensated double-precision sums so that they stay accurate on 
+///large grids.
+///The change in the recharge and groundwater part of the cycle is 
+///rech + wtd_change_total, and the total change is found from the change in 
+///WtdVolume(); the surface water part is the difference. Only the absolute 
+///values need the water table as it was after groundwater (wtd_mid), so this 
+///must be called before evaporation_update replaces rech.
 void PrintValues(Parameters &params, ArrayPack &arp){
+  ReportChanges(params, SumChanges(params, arp));
+}
+
 
-  ofstream textfile;
-  textfile.open (params.textfilename, std::ios_base::app);  
-
-  params.abs_total_wtd_change = 0.0;
-  params.abs_wtd_mid_change = 0.0;
-  params.abs_GW_wtd_change = 0.0;
-  params.total_wtd_change = 0.0;
-  params.wtd_mid_change = 0.0;
-  params.GW_wtd_change = 0.0;
-
-  for(int y=1;y<params.ncells_y-1;y++)
-  for(int x=1;x<params.ncells_x-1; x++){
-    params.abs_total_wtd_change += fabs(arp.wtd(x,y)     - arp.wtd_old(x,y));
-    params.abs_GW_wtd_change    += fabs(arp.wtd(x,y)     - arp.wtd_mid(x,y));
-    params.abs_wtd_mid_change   += fabs(arp.wtd_mid(x,y) - arp.wtd_old(x,y));
-    params.total_wtd_change     += (arp.wtd(x,y)         - arp.wtd_old(x,y));
-    params.GW_wtd_change        += (arp.wtd(x,y)         - arp.wtd_mid(x,y));
-    params.wtd_mid_change       += (arp.wtd_mid(x,y)     - arp.wtd_old(x,y));
-    params.infiltration_change  += arp.infiltration_array(x,y);
-    params.surface_change       += arp.surface_array(x,y);
-  }
 
-  textfile<<"params.cycles_done "<<params.cycles_done<<std::endl;
-  textfile<<"total wtd change was "<<params.total_wtd_change<<\
-  " change in GW only was "<<params.GW_wtd_change<<\
-  " and change in SW only was "<<params.wtd_mid_change<<std::endl;
-  textfile<<"absolute value total wtd change was "<<params.abs_total_wtd_change\
-  <<" change in GW only was "<<params.abs_GW_wtd_change<<\
-  " and change in SW only was "<<params.abs_wtd_mid_change<<std::endl;
-  textfile<<"the change in infiltration was "<<params.infiltration_change\
-  <<" and change to surface water was "<<params.surface_change<<std::endl;
-  textfile.close();
-}
\ No newline at end of file
+#ifdef TWSM_USE_MPI
+///WtdVolume() over the strips of all of the ranks. `arp` is this rank's strip,
+///whose interior rows are the rows of the domain's interior it owns.
+double WtdVolume(const ArrayPack &arp, const RowDecomposition &rows){
+  return rows.sum(WtdVolume(arp));
+}
+
+///PrintValues() over the strips of all of the ranks
+void PrintValues(Parameters &params, ArrayPack &arp, const RowDecomposition &rows){
+  const auto sums = SumChanges(params, arp);
+  std::vector<double> all(sums.begin(), sums.end());
+  rows.sum(all);
+  ChangeSums total;
+  std::copy(all.begin(), all.end(), total.begin());
+  ReportChanges(params, total);
+}
+#endif
@@ -0,0 +1,125 @@
+#ifndef _land_mask_hpp_
+#define _land_mask_hpp_
+
+#include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace rd = richdem;
+
+///A run of land cells [x0,x1) within a single row
+struct LandSpan {
+  int32_t x0;
+  int32_t x1;
+};
+
+///The land/ocean mask, packed into one bit per cell, together with the runs of
+///land cells in each row. Kernels which only act on land iterate over the
+///spans instead of testing every cell, so long stretches of ocean cost
+///nothing; point queries use the bits.
+///
+///Spans are stored compressed-sparse-row style: the spans of row `y` are
+///`spans[row_start[y]]` to `spans[row_start[y+1]-1]`. A second set holds the
+///same spans clipped to the interior of the grid (excluding the outermost
+///rows and columns), which is where the groundwater and recharge kernels
+///operate.
+class LandMask {
+ public:
+  LandMask() = default;
+
+  ///Builds the mask from a grid in which land cells are non-zero
+  template<class T>
+  explicit LandMask(const rd::Array2D<T> &mask){
+    w = mask.width();
+    h = mask.height();
+    bits.assign((static_cast<size_t>(w)*h+63)/64, 0);
+    for(int y=0;y<h;y++)
+    for(int x=0;x<w;x++){
+      const uint64_t i = static_cast<uint64_t>(y)*w+x;
+      if(mask(x,y)!=0)
+        bits[i/64] |= uint64_t(1)<<(i%64);
+    }
+
+    row_start.assign(h+1, 0);
+    interior_row_start.assign(h+1, 0);
+    for(int y=0;y<h;y++){
+      row_start[y]          = spans.size();
+      interior_row_start[y] = interior_spans.size();
+      int x = 0;
+      while(x<w){
+        while(x<w && !isLand(x,y))
+          x++;
+        const int x0 = x;
+        while(x<w && isLand(x,y))
+          x++;
+        if(x0==x)
+          continue;
+        spans.push_back(LandSpan{x0,x});
+        land_cells += x-x0;
+        if(y==0 || y==h-1)
+          continue;
+        const int ix0 = std::max(x0, 1);
+        const int ix1 = std::min(x,  w-1);
+        if(ix0<ix1)
+          interior_spans.push_back(LandSpan{ix0,ix1});
+      }
+    }
+    row_start[h]          = spans.size();
+    interior_row_start[h] = interior_spans.size();
+  }
+
+  int32_t width()  const { return w; }
+  int32_t height() const { return h; }
+
+  bool isLand(const uint64_t i) const {
+    return (bits[i/64]>>(i%64)) & 1;
+  }
+
+  bool isLand(const int x, const int y) const {
+    return isLand(static_cast<uint64_t>(y)*w+x);
+  }
+
+  ///Number of land cells in the grid
+  uint64_t landCells() const { return land_cells; }
+
+  ///Spans of land cells in row `y`, as [rowBegin(y),rowEnd(y))
+  const LandSpan* rowBegin(const int y) const { return spans.data()+row_start[y];   }
+  const LandSpan* rowEnd  (const int y) const { return spans.data()+row_start[y+1]; }
+
+  ///Spans of land cells in row `y` that are not on the edge of the grid
+  const LandSpan* interiorRowBegin(const int y) const { return interior_spans.data()+interior_row_start[y];   }
+  const LandSpan* interiorRowEnd  (const int y) const { return interior_spans.data()+interior_row_start[y+1]; }
+
+  ///Calls f(x,y) for each land cell of row `y` that the groundwater and
+  ///recharge kernels act on: the interior spans and, on a grid whose east and
+  ///west edges meet, the land in the first and last columns, which are
+  ///neighbours of each other. The first and last rows have none.
+  template<class F>
+  void forEachActiveCell(const int y, const bool periodic, F &&f) const {
+    if(y==0 || y==h-1)
+      return;
+    if(periodic && isLand(0,y))
+      f(0,y);
+    for(auto s=interiorRowBegin(y);s!=interiorRowEnd(y);s++)
+    for(int x=s->x0;x<s->x1;x++)
+      f(x,y);
+    if(periodic && w>1 && isLand(w-1,y))
+      f(w-1,y);
+  }
+
+  ///The packed bits, for hashing
+  const std::vector<uint64_t>& words() const { return bits; }
+
+ private:
+  int32_t               w          = 0;
+  int32_t               h          = 0;
+  uint64_t              land_cells = 0;
+  std::vector<uint64_t> bits;
+  std::vector<LandSpan> spans;
+  std::vector<uint32_t> row_start;
+  std::vector<LandSpan> interior_spans;
+  std::vector<uint32_t> interior_row_start;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef _logging_hpp_
+#define _logging_hpp_
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+///How important a message in the text log is. Messages less important than the
+///configured level are discarded without being formatted. The names are not
+///upper case since DEBUG and ERROR are often defined as macros.
+enum class LogLevel : int {
+  Error   = 0,
+  Warning = 1,
+  Info    = 2,
+  Debug   = 3
+};
+
+static LogLevel ParseLogLevel(const std::string &name){
+  if(name=="error")   return LogLevel::Error;
+  if(name=="warning") return LogLevel::Warning;
+  if(name=="info")    return LogLevel::Info;
+  if(name=="debug")   return LogLevel::Debug;
+  throw std::runtime_error("Unrecognised log_level '" + name + "'! Choose error, warning, info, or debug.");
+}
+
+
+
+///The model's log. There are two sinks, each opened once for the whole run:
+///
+///  * The text log (`textfilename`), a buffered stream written with Log().
+///  * An optional records file (`log_records`) holding one JSON object per
+///    cycle, on its own line. Any stage of a cycle can add fields to the
+///    current record with record(); update() starts and ends the records.
+///
+///Both files are appended to, as the text log always has been, so a restarted
+///run continues the history of the run it resumes. Both are flushed at the end
+///of every cycle, so at most one cycle of output is lost if the model is
+///killed; warnings and errors should end with std::endl so that they reach the
+///file at once.
+class Logger {
+ public:
+  Logger() : null_stream(nullptr) {}
+
+  ~Logger(){ close(); }
+
+  ///@param textfilename    Text log. Messages are discarded if this is empty.
+  ///@param recordsfilename Records file. No records are kept if this is empty.
+  ///@param max_level       Least important level of message to keep
+  void open(const std::string &textfilename, const std::string &recordsfilename, const LogLevel max_level){
+    close();
+    level = max_level;
+    if(!textfilename.empty()){
+      text.open(textfilename, std::ios_base::app);
+      if(!text.good())
+        throw std::runtime_error("Failed to open log file '" + textfilename + "'!");
+    }
+    if(!recordsfilename.empty()){
+      records.open(recordsfilename, std::ios_base::app);
+      if(!records.good())
+        throw std::runtime_error("Failed to open records file '" + recordsfilename + "'!");
+    }
+  }
+
+  void close(){
+    if(text.is_open())
+      text.close();
+    if(records.is_open())
+      records.close();
+    in_record = false;
+  }
+
+  void flush(){
+    if(text.is_open())
+      text.flush();
+    if(records.is_open())
+      records.flush();
+  }
+
+  ///Stream for a message at `msg_level`
+  std::ostream& stream(const LogLevel msg_level){
+    if(msg_level>level || !text.is_open())
+      return null_stream;
+    return text;
+  }
+
+  ///Starts the record for a cycle. Any record already open is ended first.
+  void beginRecord(const int cycle){
+    if(in_record)
+      endRecord();
+    current   = "{\"cycle\":" + std::to_string(cycle);
+    in_record = true;
+  }
+
+  ///Adds a field to the current record. Ignored if there is no open record.
+  void record(const std::string &key, const double value){
+    if(!in_record)
+      return;
+    current += ",\"" + Escape(key) + "\":" + Number(value);
+  }
+
+  void record(const std::string &key, const std::string &value){
+    if(!in_record)
+      return;
+    current += ",\"" + Escape(key) + "\":\"" + Escape(value) + "\"";
+  }
+
+  ///Writes the current record and flushes both sinks
+  void endRecord(){
+    if(in_record && records.is_open())
+      records<<current<<"}\n";
+    in_record = false;
+    current.clear();
+    flush();
+  }
+
+ private:
+  static std::string Escape(const std::string &str){
+    std::string ret;
+    for(const char c: str){
+      if(c=='"' || c=='\\'){
+        ret += '\\';
+        ret += c;
+      } else if(static_cast<unsigned char>(c)<0x20){
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        ret += buf;
+      } else {
+        ret += c;
+      }
+    }
+    return ret;
+  }
+
+  //JSON has no representation of NaN or infinity, so they become null
+  static std::string Number(const double value){
+    if(!std::isfinite(value))
+      return "null";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.17g", value);
+    return buf;
+  }
+
+  LogLevel      level = LogLevel::Info;
+  std::ofstream text;
+  std::ofstream records;
+  std::ostream  null_stream;
+  std::string   current;
+  bool          in_record = false;
+};
+
+
+
+///The log for the whole process
+inline Logger& TheLogger(){
+  static Logger logger;
+  return logger;
+}
+
+///Stream for a message in the text log, e.g. `Log()<<"Groundwater"<<'\n';`
+inline std::ostream& Log(const LogLevel level = LogLevel::Info){
+  return TheLogger().stream(level);
+}
+
+#endif
@@ -0,0 +1,105 @@
+//Converts NetCDF input files into raw grids, which the model can map straight
+//into memory at startup. Each input `name.nc` is written to `name.raw` in the
+//same directory. To use the raw files, set `input_format raw` in the
+//configuration file.
+//
+//Usage: nc2raw [--var NAME] [--type TYPE] FILE.nc [FILE.nc ...]
+//
+//NAME is the variable to convert, "value" by default. TYPE is the type the
+//grid is stored as: float (the default), double, int32, int16, or uint8. The
+//model loads land masks as uint8, so they are best converted with
+//`--type uint8`; other types still load, but must then be converted (and
+//copied) at startup.
+#include "../common/netcdf.hpp"
+#include "../common/raw_grid.hpp"
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rd = richdem;
+
+//Gets the coordinate of the first cell and the spacing between cells. Raw
+//grids assume evenly spaced coordinates; if the file has none, NaN is used and
+//the raw grid can't be windowed by a bounding box.
+static void GetCoordinates(const std::string &filename, double &start, double &step, const std::string &name, const int len){
+  start = std::numeric_limits<double>::quiet_NaN();
+  step  = std::numeric_limits<double>::quiet_NaN();
+
+  int width, height;
+  const int ncid = OpenNetCDF(filename, width, height);
+  try {
+    const auto coord = ReadCoordinate(ncid, filename, name, len);
+    start = coord.at(0);
+    step  = len>1 ? (coord.back()-coord.front())/(len-1) : 0;
+  } catch (const std::runtime_error &e) {
+    std::cerr<<"W No usable '"<<name<<"' coordinate in '"<<filename<<"'"<<std::endl;
+  }
+  CloseNetCDF(ncid, filename);
+}
+
+
+
+template<class T>
+static void Convert(const std::string &in, const std::string &out, const std::string &datavar){
+  const auto grid = LoadNetCDF<T>(in, datavar);
+
+  double lon0, dlon, lat0, dlat;
+  GetCoordinates(in, lon0, dlon, "lon", grid.width());
+  GetCoordinates(in, lat0, dlat, "lat", grid.height());
+
+  SaveAsRaw(grid, out, lon0, lat0, dlon, dlat);
+
+  std::cout<<"Wrote "<<out<<" ("<<grid.width()<<"x"<<grid.height()<<")"<<std::endl;
+}
+
+
+
+int main(int argc, char **argv){
+  std::string datavar = "value";
+  std::string type    = "float";
+  std::vector<std::string> files;
+
+  for(int i=1;i<argc;i++){
+    const std::string arg = argv[i];
+    if(arg=="--var" && i+1<argc)
+      datavar = argv[++i];
+    else if(arg=="--type" && i+1<argc)
+      type = argv[++i];
+    else
+      files.push_back(arg);
+  }
+
+  if(files.empty()){
+    std::cerr<<"Syntax: "<<argv[0]<<" [--var NAME] [--type TYPE] FILE.nc [FILE.nc ...]"<<std::endl;
+    return -1;
+  }
+
+  try {
+    for(const auto &in: files){
+      if(in.size()<3 || in.substr(in.size()-3)!=".nc")
+        throw std::runtime_error("Input '" + in + "' does not end in .nc!");
+      const std::string out = in.substr(0, in.size()-3) + ".raw";
+
+      if(type=="float")
+        Convert<float>  (in, out, datavar);
+      else if(type=="double")
+        Convert<double> (in, out, datavar);
+      else if(type=="int32")
+        Convert<int32_t>(in, out, datavar);
+      else if(type=="int16")
+        Convert<int16_t>(in, out, datavar);
+      else if(type=="uint8")
+        Convert<uint8_t>(in, out, datavar);
+      else
+        throw std::runtime_error("Unrecognised type '" + type + "'!");
+    }
+  } catch (const std::exception &e) {
+    std::cerr<<"E "<<e.what()<<std::endl;
+    return -1;
+  }
+
+  return 0;
+}
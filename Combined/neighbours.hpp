@@ -0,0 +1,208 @@
+#ifndef _neighbours_hpp_
+#define _neighbours_hpp_
+
+#include "column_wrap.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <richdem/common/constants.hpp>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+namespace rd = richdem;
+
+///Offsets of the neighbours of a cell in each topology, numbered as RichDEM
+///numbers them (d8x, d8y, d8_inverse, etc.), since flow directions are stored
+///with those numbers. Entry 0 is the cell itself; neighbours are [1,count].
+template<rd::Topology topo> struct NeighbourOffsets;
+
+template<> struct NeighbourOffsets<rd::Topology::D4> {
+  static constexpr int count      = 4;
+  static constexpr int dx[5]      = {0,-1, 0, 1, 0};
+  static constexpr int dy[5]      = {0, 0,-1, 0, 1};
+  static constexpr int inverse[5] = {0, 3, 4, 1, 2};
+};
+
+template<> struct NeighbourOffsets<rd::Topology::D8> {
+  static constexpr int count      = 8;
+  static constexpr int dx[9]      = {0,-1,-1, 0, 1, 1, 1, 0,-1};
+  static constexpr int dy[9]      = {0, 0,-1,-1,-1, 0, 1, 1, 1};
+  static constexpr int inverse[9] = {0, 5, 6, 7, 8, 1, 2, 3, 4};
+};
+
+
+
+///Visits the neighbours of cells of a grid. The topology is a template
+///parameter, so the loop over neighbours is unrolled at compile time into
+///straight-line code, which the compiler can then schedule and vectorise.
+///
+///A cell away from the edges of the grid has all its neighbours, each at a
+///fixed offset in flat-index space, so its neighbours are visited without any
+///bounds checks (the interior path). Cells on the edges take the border path,
+///which checks each neighbour is in the grid and wraps columns around a
+///periodic grid (see column_wrap.hpp). forEach() and any() pick the path for
+///each cell; kernels which sweep the grid can instead call the paths directly.
+///
+///Visitors are called as f(n, nx, ny, ni) with the neighbour's direction n in
+///[1,count], its coordinates, and its flat index, of the grids' index type.
+template<rd::Topology topo>
+class Neighbourhood {
+ public:
+  using Offsets = NeighbourOffsets<topo>;
+  static constexpr int count = Offsets::count;
+  using i_t = rd::Array2D<float>::i_t;
+
+  ///@param width, height Size of the grid
+  ///@param wrap          Columns of neighbours across the east and west edges,
+  ///                     which must be for a grid of this width
+  Neighbourhood(const int width, const int height, const ColumnWrap &wrap)
+    : w(width), h(height), wrap(wrap)
+  {
+    if(wrap.width()!=width)
+      throw std::runtime_error("The column wrap does not match the grid! It is set by InitialiseBoth().");
+    for(int n=0;n<=count;n++)
+      di[n] = static_cast<int64_t>(Offsets::dy[n])*w + Offsets::dx[n];
+  }
+
+  int width()  const { return w; }
+  int height() const { return h; }
+
+  ///Whether all of the neighbours of (x,y) are in the grid without wrapping
+  bool isInterior(const int x, const int y) const {
+    return 0<x && x<w-1 && 0<y && y<h-1;
+  }
+
+  ///The neighbour of (x,y) in direction n, as a flat index, or -1 if it is
+  ///beyond the edge of the grid
+  int64_t neighbour(const int x, const int y, const int n, int &nx, int &ny) const {
+    nx = wrap(x+Offsets::dx[n]);
+    ny = y+Offsets::dy[n];
+    if(nx<0 || ny<0 || ny>=h)
+      return -1;
+    return static_cast<int64_t>(ny)*w+nx;
+  }
+
+  ///Visits every neighbour of the interior cell (x,y), whose flat index is i
+  template<class F>
+  void forEachInterior(const int x, const int y, const int64_t i, F &&f) const {
+    forEachInterior(x, y, i, f, std::make_integer_sequence<int,count>());
+  }
+
+  ///Visits every neighbour of the cell (x,y) on the edge of the grid which is
+  ///in the grid, or is across the seam of a periodic grid
+  template<class F>
+  void forEachBorder(const int x, const int y, F &&f) const {
+    forEachBorder(x, y, f, std::make_integer_sequence<int,count>());
+  }
+
+  ///Visits every neighbour of the cell (x,y) which is in the grid
+  template<class F>
+  void forEach(const int x, const int y, F &&f) const {
+    if(isInterior(x,y))
+      forEachInterior(x, y, static_cast<int64_t>(y)*w+x, f);
+    else
+      forEachBorder(x, y, f);
+  }
+
+  ///For each cell x in [1,width-1) of row y of `grid`, which must not be the
+  ///first or last row, sets lower[x] to whether any neighbour of the cell is
+  ///lower than it. The loop has no branches, and the neighbours are at offsets
+  ///fixed at compile time, so the compiler vectorises it.
+  template<class T>
+  void anyLowerInRow(const T *grid, const int y, uint8_t *lower) const {
+    anyLowerInRow(grid+static_cast<int64_t>(y)*w, lower, std::make_integer_sequence<int,count>());
+  }
+
+  ///Calls f(x,y) for each cell on the edges of the grid, which are those that
+  ///take the border path, in row-major order
+  template<class F>
+  void forEachEdgeCell(F &&f) const {
+    for(int y=0;y<h;y++){
+      if(y==0 || y==h-1){
+        for(int x=0;x<w;x++)
+          f(x,y);
+      } else {
+        f(0,y);
+        if(w>1)
+          f(w-1,y);
+      }
+    }
+  }
+
+  ///Whether f is true of any neighbour of the interior cell (x,y). Stops at the
+  ///first neighbour of which it is true.
+  template<class F>
+  bool anyInterior(const int x, const int y, const int64_t i, F &&f) const {
+    return anyInterior(x, y, i, f, std::make_integer_sequence<int,count>());
+  }
+
+  ///Whether f is true of any neighbour in the grid of the edge cell (x,y)
+  template<class F>
+  bool anyBorder(const int x, const int y, F &&f) const {
+    return anyBorder(x, y, f, std::make_integer_sequence<int,count>());
+  }
+
+  ///Whether f is true of any neighbour of (x,y) in the grid
+  template<class F>
+  bool any(const int x, const int y, F &&f) const {
+    if(isInterior(x,y))
+      return anyInterior(x, y, static_cast<int64_t>(y)*w+x, f);
+    else
+      return anyBorder(x, y, f);
+  }
+
+ private:
+  //The index sequences run over [0,count), so direction n is N+1
+
+  template<class F, int... N>
+  void forEachInterior(const int x, const int y, const int64_t i, F &f, std::integer_sequence<int,N...>) const {
+    (f(N+1, x+Offsets::dx[N+1], y+Offsets::dy[N+1], static_cast<i_t>(i+di[N+1])), ...);
+  }
+
+  template<class F, int... N>
+  bool anyInterior(const int x, const int y, const int64_t i, F &f, std::integer_sequence<int,N...>) const {
+    return (f(N+1, x+Offsets::dx[N+1], y+Offsets::dy[N+1], static_cast<i_t>(i+di[N+1])) || ...);
+  }
+
+  template<class T, int... N>
+  void anyLowerInRow(const T *row, uint8_t *lower, std::integer_sequence<int,N...>) const {
+    //The rows above, at, and below the cell, indexed by dy+1
+    const T *const rows[3] = {row-w, row, row+w};
+    const int      end     = w-1;
+    for(int x=1;x<end;x++){
+      const T me = row[x];
+      lower[x] = ((rows[Offsets::dy[N+1]+1][x+Offsets::dx[N+1]]<me) | ...);
+    }
+  }
+
+  template<class F>
+  void visitBorder(const int x, const int y, const int n, F &f) const {
+    int nx, ny;
+    const auto ni = neighbour(x, y, n, nx, ny);
+    if(ni>=0)
+      f(n, nx, ny, static_cast<i_t>(ni));
+  }
+
+  template<class F, int... N>
+  void forEachBorder(const int x, const int y, F &f, std::integer_sequence<int,N...>) const {
+    (visitBorder(x, y, N+1, f), ...);
+  }
+
+  template<class F>
+  bool testBorder(const int x, const int y, const int n, F &f) const {
+    int nx, ny;
+    const auto ni = neighbour(x, y, n, nx, ny);
+    return ni>=0 && f(n, nx, ny, static_cast<i_t>(ni));
+  }
+
+  template<class F, int... N>
+  bool anyBorder(const int x, const int y, F &f, std::integer_sequence<int,N...>) const {
+    return (testBorder(x, y, N+1, f) || ...);
+  }
+
+  int               w;
+  int               h;
+  const ColumnWrap &wrap;
+  int64_t           di[count+1];
+};
+
+#endif
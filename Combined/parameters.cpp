@@ -23,12 +23,27 @@ Parameters::Parameters(const std::string config_file){
 
   //Dummy key to make it easier to alphabetize list below
     if     (key=="")                   {}                 
+    else if(key=="abs_diagnostics")    ss>>abs_diagnostics;
     else if(key=="cells_per_degree")   ss>>cells_per_degree;
+    else if(key=="checkpoint_dephier") ss>>checkpoint_dephier;
+    else if(key=="checkpoint_interval")ss>>checkpoint_interval;
     else if(key=="deltat")             ss>>deltat;
+    else if(key=="dephier_cache")      ss>>dephier_cache;
+    else if(key=="fdepth_from_file")   ss>>fdepth_from_file;
+    else if(key=="groundwater_layout") ss>>groundwater_layout;
     else if(key=="infiltration_on")    ss>>infiltration_on;
+    else if(key=="input_format")       ss>>input_format;
+    else if(key=="load_jobs")          ss>>load_jobs;
+    else if(key=="log_level")          ss>>log_level;
+    else if(key=="log_records")        ss>>log_records;
     else if(key=="maxiter")            ss>>maxiter;
     else if(key=="outfilename")        ss>>outfilename;
+    else if(key=="periodic_x")         ss>>periodic_x;
+    else if(key=="precip_scale")       ss>>precip_scale;
+    else if(key=="profile_file")       ss>>profile_file;
+    else if(key=="quantize_inputs")    ss>>quantize_inputs;
     else if(key=="region")             ss>>region;
+    else if(key=="restart_from")       ss>>restart_from;
     else if(key=="run_type")           ss>>run_type;
     else if(key=="southern_edge")      ss>>southern_edge;
     else if(key=="surfdatadir")        ss>>surfdatadir;
@@ -36,6 +51,14 @@ Parameters::Parameters(const std::string config_file){
     else if(key=="time_end")           ss>>time_end;
     else if(key=="time_start")         ss>>time_start;
     else if(key=="total_cycles")       ss>>total_cycles;
+    else if(key=="window_east")        ss>>window_east;
+    else if(key=="window_height")      ss>>window_height;
+    else if(key=="window_north")       ss>>window_north;
+    else if(key=="window_south")       ss>>window_south;
+    else if(key=="window_west")        ss>>window_west;
+    else if(key=="window_width")       ss>>window_width;
+    else if(key=="window_x0")          ss>>window_x0;
+    else if(key=="window_y0")          ss>>window_y0;
 
     else
       throw std::runtime_error("Unrecognised key!");
@@ -43,18 +66,41 @@ Parameters::Parameters(const std::string config_file){
 }
 
 void Parameters::print() const {
-  std::cout<<"c cells_per_degree = "<<cells_per_degree <<std::endl;
-  std::cout<<"c deltat           = "<<deltat           <<std::endl;
-  std::cout<<"c infiltration_on  = "<<infiltration_on  <<std::endl;
-  std::cout<<"c maxiter          = "<<maxiter          <<std::endl;
-  std::cout<<"c outfilename      = "<<outfilename      <<std::endl;
-  std::cout<<"c region           = "<<region           <<std::endl;
-  std::cout<<"c run_type         = "<<run_type         <<std::endl;
-  std::cout<<"c southern_edge    = "<<southern_edge    <<std::endl;
-  std::cout<<"c surfdatadir      = "<<surfdatadir      <<std::endl;
-  std::cout<<"c textfilename     = "<<textfilename     <<std::endl;
-  std::cout<<"c time_end         = "<<time_end         <<std::endl;
-  std::cout<<"c time_start       = "<<time_start       <<std::endl;
-  std::cout<<"c total_cycles     = "<<total_cycles     <<std::endl;
+  std::cout<<"c abs_diagnostics     = "<<abs_diagnostics     <<std::endl;
+  std::cout<<"c cells_per_degree    = "<<cells_per_degree    <<std::endl;
+  std::cout<<"c checkpoint_dephier  = "<<checkpoint_dephier  <<std::endl;
+  std::cout<<"c checkpoint_interval = "<<checkpoint_interval <<std::endl;
+  std::cout<<"c deltat              = "<<deltat              <<std::endl;
+  std::cout<<"c dephier_cache       = "<<dephier_cache       <<std::endl;
+  std::cout<<"c fdepth_from_file    = "<<fdepth_from_file    <<std::endl;
+  std::cout<<"c groundwater_layout  = "<<groundwater_layout  <<std::endl;
+  std::cout<<"c infiltration_on     = "<<infiltration_on     <<std::endl;
+  std::cout<<"c input_format        = "<<input_format        <<std::endl;
+  std::cout<<"c load_jobs           = "<<load_jobs           <<std::endl;
+  std::cout<<"c log_level           = "<<log_level           <<std::endl;
+  std::cout<<"c log_records         = "<<log_records         <<std::endl;
+  std::cout<<"c maxiter             = "<<maxiter             <<std::endl;
+  std::cout<<"c outfilename         = "<<outfilename         <<std::endl;
+  std::cout<<"c periodic_x          = "<<periodic_x          <<std::endl;
+  std::cout<<"c precip_scale        = "<<precip_scale        <<std::endl;
+  std::cout<<"c profile_file        = "<<profile_file        <<std::endl;
+  std::cout<<"c quantize_inputs     = "<<quantize_inputs     <<std::endl;
+  std::cout<<"c region              = "<<region              <<std::endl;
+  std::cout<<"c restart_from        = "<<restart_from        <<std::endl;
+  std::cout<<"c run_type            = "<<run_type            <<std::endl;
+  std::cout<<"c southern_edge       = "<<southern_edge       <<std::endl;
+  std::cout<<"c surfdatadir         = "<<surfdatadir         <<std::endl;
+  std::cout<<"c textfilename        = "<<textfilename        <<std::endl;
+  std::cout<<"c time_end            = "<<time_end            <<std::endl;
+  std::cout<<"c time_start          = "<<time_start          <<std::endl;
+  std::cout<<"c total_cycles        = "<<total_cycles        <<std::endl;
+  std::cout<<"c window_east         = "<<window_east         <<std::endl;
+  std::cout<<"c window_height       = "<<window_height       <<std::endl;
+  std::cout<<"c window_north        = "<<window_north        <<std::endl;
+  std::cout<<"c window_south        = "<<window_south        <<std::endl;
+  std::cout<<"c window_west         = "<<window_west         <<std::endl;
+  std::cout<<"c window_width        = "<<window_width        <<std::endl;
+  std::cout<<"c window_x0           = "<<window_x0           <<std::endl;
+  std::cout<<"c window_y0           = "<<window_y0           <<std::endl;
   //TODO: Synchronize with structure
 }
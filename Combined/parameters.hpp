@@ -21,32 +21,84 @@ class Parameters {
   std::string time_end     = UNINIT_STR;
   std::string textfilename = UNINIT_STR;
   std::string outfilename  = UNINIT_STR;
+  std::string restart_from = UNINIT_STR;
+  std::string dephier_cache= UNINIT_STR;
+  std::string log_level    = "info";     //error, warning, info, or debug
+  std::string log_records  = UNINIT_STR; //File of per-cycle JSON records
+  std::string profile_file = UNINIT_STR; //File of per-cycle phase times and counts
+  std::string input_format = "nc";
+  //Memory layout of the state read by the groundwater stencil: "separate"
+  //arrays, or "interleaved" into one array of cells
+  std::string groundwater_layout = "separate";
 
   int cells_per_degree = -1;
 
   const double UNDEF  = -1.0e7;
 
   bool infiltration_on;
+
+  //Whether the e-folding depth is read from _fdepth files rather than 
+  //computed from slope and temperature
+  bool   fdepth_from_file     = false;
+  //Factor applied to precipitation once it is converted to the time step, 
+  //e.g. 0.1 to let only a tenth of it reach the land surface
+  double precip_scale         = 1.0;
   
   double southern_edge        = std::numeric_limits<double>::signaling_NaN();
   double deltat               = std::numeric_limits<double>::signaling_NaN();
   double cellsize_n_s_metres  = std::numeric_limits<double>::signaling_NaN();
   float  infiltration         = 0.0;
   int    cycles_done          = 0;
-  float  total_wtd_change     = 0.0;
-  float  wtd_mid_change       = 0.0;
-  float  GW_wtd_change        = 0.0;
-  float  abs_total_wtd_change = 0.0;
-  float  abs_wtd_mid_change   = 0.0;
-  float  abs_GW_wtd_change    = 0.0;
-  float  infiltration_change  = 0.0;
-  float  surface_change       = 0.0;
+  //Diagnostics for the most recent cycle, as volumes of water (m^3) summed
+  //over the land. Set by PrintValues. The absolute value diagnostics need an
+  //extra copy of wtd, so can be turned off.
+  bool   abs_diagnostics      = true;
+  double total_wtd_change     = 0.0;
+  double wtd_mid_change       = 0.0;
+  double GW_wtd_change        = 0.0;
+  double abs_total_wtd_change = 0.0;
+  double abs_wtd_mid_change   = 0.0;
+  double abs_GW_wtd_change    = 0.0;
+  double infiltration_change  = 0.0;
+  double surface_change       = 0.0;
+  //Volume of water held by the water table at the end of the last cycle
+  double wtd_volume           = std::numeric_limits<double>::quiet_NaN();
   int    total_cycles         = -1;
 
+  //Write a checkpoint every this many cycles (0 disables checkpointing)
+  int    checkpoint_interval  = 0;
+  //Whether checkpoints of equilibrium runs include the depression hierarchy
+  bool   checkpoint_dephier   = true;
+
+  //Whether slope and the climate inputs are held as 16-bit integers
+  bool   quantize_inputs      = false;
+
+  //Whether the east and west edges of the grid meet, as they do for a grid
+  //spanning all longitudes. Neighbours then wrap around between them.
+  bool   periodic_x           = false;
+
+  //Number of input files to read at once during initialisation
+  int    load_jobs            = 1;
+
+  //Part of the input grids to use, either as cell indices or as a bounding
+  //box in degrees. By default the whole grid is used.
+  int    window_x0            = 0;
+  int    window_y0            = 0;
+  int    window_width         = -1;
+  int    window_height        = -1;
+  double window_south         = std::numeric_limits<double>::quiet_NaN();
+  double window_north         = std::numeric_limits<double>::quiet_NaN();
+  double window_west          = std::numeric_limits<double>::quiet_NaN();
+  double window_east          = std::numeric_limits<double>::quiet_NaN();
+
   //Set for convenience within the code
   int ncells_x  = -1;
   int ncells_y  = -1;
 
+  //Added to the names of the files each MPI rank writes for its own strip of
+  //the domain, e.g. ".strip2of4"; empty when one process holds the domain
+  std::string strip_suffix;
+
   void print() const;
 };
 
@@ -0,0 +1,284 @@
+#ifndef _profiler_hpp_
+#define _profiler_hpp_
+
+#include "logging.hpp"
+#include <richdem/common/timer.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rd = richdem;
+
+///Events counted by the profiler. Kernels count into a local variable and add
+///the total once, so counting costs nothing per cell.
+enum class ProfileCounter : int {
+  CellsRouted = 0, ///< Cells surface water was routed through
+  LakesFilled,     ///< Depressions whose standing water was spread over cells
+  OverflowHops,    ///< Steps of overflow from one depression to another
+  PQPushes,        ///< Cells added to a priority queue
+  N_COUNTERS
+};
+
+///Times the phases of the model and counts the work they do, cycle by cycle.
+///
+///Phases are named when they are first timed, so any stage of the model can
+///add one with a ProfilePhase and no central list. Nested phases are named
+///with a dotted prefix, e.g. "fsm.fill" within "fsm". At the end of each
+///cycle the cycle's times and counts are
+///
+///  * added to the cycle's record in the log (see logging.hpp) as `t_<phase>`
+///    and `n_<counter>` fields,
+///  * written to the profile file as `cycle,kind,name,value` rows, and
+///  * added to the totals printed by printSummary().
+///
+///Work done outside a cycle, such as the first depression hierarchy, is
+///written with a cycle of -1 and kept apart from the totals of the cycles.
+///
+///Until enable() is called nothing is stored and nothing is written.
+class Profiler {
+ public:
+  ///@param filename File to which the per-cycle rows are appended. If empty,
+  ///                the rows are not written anywhere.
+  void enable(const std::string &filename){
+    if(!filename.empty()){
+      file.open(filename, std::ios_base::app);
+      if(!file.good())
+        throw std::runtime_error("Failed to open profile file '" + filename + "'!");
+      if(file.tellp()==0)
+        file<<"cycle,kind,name,value\n";
+    }
+    on = true;
+  }
+
+  bool enabled() const { return on; }
+
+  ///Forgets every phase and count, e.g. between the runs of a benchmark
+  void reset(){
+    phases.clear();
+    counters = {};
+    pending  = false;
+  }
+
+  ///Names of the phases timed so far, in the order they were first timed
+  std::vector<std::string> phaseNames() const {
+    std::vector<std::string> names;
+    for(const auto &phase: phases)
+      names.push_back(phase.name);
+    return names;
+  }
+
+  ///Total time spent in a phase over all cycles, and the number of cycles in
+  ///which it was timed. Both are 0 for a phase that has never been timed.
+  double totalSeconds(const std::string &name) const {
+    for(const auto &phase: phases)
+      if(phase.name==name)
+        return phase.total_seconds;
+    return 0;
+  }
+
+  int cyclesTimed(const std::string &name) const {
+    for(const auto &phase: phases)
+      if(phase.name==name)
+        return phase.cycles;
+    return 0;
+  }
+
+  ///Adds `seconds` to the phase called `name`
+  void addTime(const std::string &name, const double seconds){
+    if(!on)
+      return;
+    auto &phase = find(name);
+    phase.cycle_seconds += seconds;
+    phase.timed_this_cycle = true;
+    pending = true;
+  }
+
+  void count(const ProfileCounter counter, const uint64_t n){
+    if(!on)
+      return;
+    counters[static_cast<int>(counter)].cycle += n;
+    pending = true;
+  }
+
+  ///Writes out the work done since the last cycle ended, which was not part
+  ///of any cycle
+  void beginCycle(){
+    if(pending)
+      endCycle(-1);
+  }
+
+  ///Writes out the times and counts of `cycle` and adds them to the totals.
+  ///A cycle of -1 is work done outside any cycle.
+  void endCycle(const int cycle){
+    if(!on)
+      return;
+
+    for(auto &phase: phases){
+      if(!phase.timed_this_cycle)
+        continue;
+      TheLogger().record("t_" + phase.name, phase.cycle_seconds);
+      if(file.is_open())
+        file<<cycle<<",time,"<<phase.name<<","<<phase.cycle_seconds<<"\n";
+      if(cycle<0){
+        phase.setup_seconds += phase.cycle_seconds;
+      } else {
+        phase.total_seconds += phase.cycle_seconds;
+        phase.max_seconds    = std::max(phase.max_seconds, phase.cycle_seconds);
+        phase.cycles        += 1;
+      }
+      phase.cycle_seconds    = 0;
+      phase.timed_this_cycle = false;
+    }
+
+    for(int c=0;c<N;c++){
+      auto &counter = counters[c];
+      TheLogger().record(std::string("n_") + CounterNames[c], counter.cycle);
+      if(file.is_open())
+        file<<cycle<<",count,"<<CounterNames[c]<<","<<counter.cycle<<"\n";
+      (cycle<0 ? counter.setup : counter.total) += counter.cycle;
+      counter.cycle = 0;
+    }
+
+    file.flush();
+    pending = false;
+  }
+
+  ///Prints a table of the time spent in each phase and the total counts, with
+  ///the work done outside the cycles in its own column. The share of each
+  ///phase is of the time the cycles spent in the phase named `overall`.
+  void printSummary(std::ostream &out, const std::string &overall) const {
+    if(!on)
+      return;
+
+    double overall_seconds = 0;
+    for(const auto &phase: phases)
+      if(phase.name==overall)
+        overall_seconds = phase.total_seconds;
+
+    const auto flags     = out.flags();
+    const auto precision = out.precision();
+    out<<std::fixed<<std::setprecision(3);
+
+    out<<"t "<<std::left<<std::setw(32)<<"Phase"<<std::right
+       <<std::setw(12)<<"Setup (s)"<<std::setw(8)<<"Cycles"<<std::setw(12)<<"Total (s)"<<std::setw(12)<<"Mean (s)"
+       <<std::setw(12)<<"Max (s)"<<std::setw(8)<<"%"<<"\n";
+    for(const auto &phase: phases){
+      out<<"t "<<std::left<<std::setw(32)<<phase.name<<std::right
+         <<std::setw(12)<<phase.setup_seconds
+         <<std::setw(8)<<phase.cycles
+         <<std::setw(12)<<phase.total_seconds
+         <<std::setw(12)<<(phase.cycles>0 ? phase.total_seconds/phase.cycles : 0)
+         <<std::setw(12)<<phase.max_seconds
+         <<std::setw(8)<<std::setprecision(1)<<(overall_seconds>0 ? 100*phase.total_seconds/overall_seconds : 0)
+         <<std::setprecision(3)<<"\n";
+    }
+    out<<"m "<<std::left<<std::setw(32)<<"Counter"<<std::right
+       <<std::setw(12)<<"Setup"<<std::setw(16)<<"Cycles"<<"\n";
+    for(int c=0;c<N;c++)
+      out<<"m "<<std::left<<std::setw(32)<<CounterNames[c]<<std::right
+         <<std::setw(12)<<counters[c].setup<<std::setw(16)<<counters[c].total<<"\n";
+    out<<std::flush;
+
+    out.flags(flags);
+    out.precision(precision);
+  }
+
+ private:
+  static constexpr int N = static_cast<int>(ProfileCounter::N_COUNTERS);
+  static constexpr std::array<const char*,N> CounterNames = {{
+    "cells_routed", "lakes_filled", "overflow_hops", "pq_pushes"
+  }};
+
+  struct Phase {
+    std::string name;
+    double      cycle_seconds    = 0;
+    double      setup_seconds    = 0;
+    double      total_seconds    = 0;
+    double      max_seconds      = 0;
+    int         cycles           = 0;
+    bool        timed_this_cycle = false;
+  };
+
+  struct Counter {
+    uint64_t cycle = 0;
+    uint64_t setup = 0;
+    uint64_t total = 0;
+  };
+
+  //There are only a dozen or so phases, each timed a few times per cycle, so
+  //a linear search costs nothing and keeps the phases in order of first use
+  Phase& find(const std::string &name){
+    for(auto &phase: phases)
+      if(phase.name==name)
+        return phase;
+    phases.emplace_back();
+    phases.back().name = name;
+    return phases.back();
+  }
+
+  bool                   on      = false;
+  bool                   pending = false;
+  std::ofstream          file;
+  std::vector<Phase>     phases;
+  std::array<Counter,N>  counters;
+};
+
+
+
+///The profiler for the whole process
+inline Profiler& TheProfiler(){
+  static Profiler profiler;
+  return profiler;
+}
+
+
+
+///Times a phase of the model from its construction until stop() is called or
+///it goes out of scope, e.g.
+///
+///    {
+///      ProfilePhase phase("groundwater");
+///      groundwater(params,arp);
+///    }
+///
+///It can be used in place of an rd::Timer, since stop() returns the time taken.
+///The clock is read only twice per phase, so phases cost nothing worth
+///measuring whether or not the profiler is enabled.
+class ProfilePhase {
+ public:
+  explicit ProfilePhase(const char *name) : name(name) {
+    timer.start();
+  }
+
+  ~ProfilePhase(){
+    stop();
+  }
+
+  ///Ends the phase, if it has not already ended
+  ///@return The time the phase took, in seconds
+  double stop(){
+    if(!stopped){
+      seconds = timer.stop();
+      TheProfiler().addTime(name, seconds);
+      stopped = true;
+    }
+    return seconds;
+  }
+
+  ProfilePhase(const ProfilePhase&)            = delete;
+  ProfilePhase& operator=(const ProfilePhase&) = delete;
+
+ private:
+  const char *name;
+  rd::Timer   timer;
+  double      seconds = 0;
+  bool        stopped = false;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef _quantized_grid_hpp_
+#define _quantized_grid_hpp_
+
+#include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace rd = richdem;
+
+///A grid of floats stored as 16-bit integers with a scale and offset, at half
+///the memory of an rd::Array2D<float>. Values are decoded on every read as
+///`offset + scale*q`, so kernels can take either kind of grid as a template
+///parameter and read it with `grid(i)`.
+///
+///The scale is chosen so that the range given on construction spans the
+///65535 integer levels, giving an error of at most scale()/2 for values within
+///that range; values outside it are clamped. NaN is stored as a reserved level
+///and decodes as NaN.
+class QuantizedGrid {
+ public:
+  QuantizedGrid() = default;
+
+  ///Quantizes `grid` over the range [lo,hi]
+  QuantizedGrid(const rd::Array2D<float> &grid, const float lo, const float hi){
+    w      = grid.width();
+    h      = grid.height();
+    offset = lo/2+hi/2;
+    scale  = (hi>lo) ? (hi/2-lo/2)/LEVEL_MAX : 1.0f;
+    cells.resize(grid.size());
+    for(unsigned int i=0;i<grid.size();i++)
+      set(i, grid(i));
+  }
+
+  ///Quantizes `grid` over the range of its finite values
+  explicit QuantizedGrid(const rd::Array2D<float> &grid)
+    : QuantizedGrid(grid, FiniteMin(grid), FiniteMax(grid)) {}
+
+  float operator()(const uint64_t i) const {
+    const int16_t q = cells[i];
+    return (q==NODATA) ? std::numeric_limits<float>::quiet_NaN() : offset+scale*q;
+  }
+
+  float operator()(const int x, const int y) const {
+    return (*this)(static_cast<uint64_t>(y)*w+x);
+  }
+
+  ///Stores `value` in cell `i`, clamping it to the range of the grid
+  void set(const uint64_t i, const float value){
+    if(std::isnan(value)){
+      cells[i] = NODATA;
+      return;
+    }
+    const float q = std::round((value-offset)/scale);
+    cells[i] = static_cast<int16_t>(std::max(-LEVEL_MAX, std::min(LEVEL_MAX, q)));
+  }
+
+  int32_t  width()  const { return w; }
+  int32_t  height() const { return h; }
+  uint64_t size()   const { return cells.size(); }
+  bool     empty()  const { return cells.empty(); }
+
+  ///Largest error made in storing a value within the range of the grid
+  float maxError() const { return scale/2; }
+
+  ///Smallest and largest finite values in `grid`; both 0 if there are none
+  static float FiniteMin(const rd::Array2D<float> &grid){
+    float lo = std::numeric_limits<float>::max();
+    for(unsigned int i=0;i<grid.size();i++)
+      if(std::isfinite(grid(i)))
+        lo = std::min(lo, grid(i));
+    return (lo==std::numeric_limits<float>::max()) ? 0 : lo;
+  }
+
+  static float FiniteMax(const rd::Array2D<float> &grid){
+    float hi = std::numeric_limits<float>::lowest();
+    for(unsigned int i=0;i<grid.size();i++)
+      if(std::isfinite(grid(i)))
+        hi = std::max(hi, grid(i));
+    return (hi==std::numeric_limits<float>::lowest()) ? 0 : hi;
+  }
+
+ private:
+  static constexpr float   LEVEL_MAX = 32767;
+  static constexpr int16_t NODATA    = std::numeric_limits<int16_t>::min();
+
+  int32_t              w      = 0;
+  int32_t              h      = 0;
+  float                offset = 0;
+  float                scale  = 1;
+  std::vector<int16_t> cells;
+};
+
+///Writes a value into either kind of grid, so that templated kernels can
+///update float and quantized grids alike
+inline void SetCell(rd::Array2D<float> &grid, const rd::Array2D<float>::i_t i, const float value){
+  grid(i) = value;
+}
+
+inline void SetCell(QuantizedGrid &grid, const uint64_t i, const float value){
+  grid.set(i, value);
+}
+
+#endif
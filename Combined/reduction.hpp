@@ -0,0 +1,84 @@
+#ifndef _reduction_hpp_
+#define _reduction_hpp_
+
+#include "land_mask.hpp"
+#include <array>
+#include <cmath>
+#include <vector>
+
+///A running sum in double precision with Neumaier's compensation (Kahan
+///summation that also handles terms larger than the sum). The rounding error
+///of each addition is carried separately and added back at the end, so sums
+///of hundreds of millions of terms keep nearly full double precision.
+class CompensatedSum {
+ public:
+  void add(const double x){
+    const double t = sum + x;
+    if(std::fabs(sum)>=std::fabs(x))
+      compensation += (sum - t) + x;
+    else
+      compensation += (x - t) + sum;
+    sum = t;
+  }
+
+  void add(const CompensatedSum &other){
+    add(other.sum);
+    add(other.compensation);
+  }
+
+  double value() const { return sum + compensation; }
+
+ private:
+  double sum          = 0;
+  double compensation = 0;
+};
+
+
+
+///Sums `N` quantities over the land cells of a grid in a single pass.
+///`cell(x,y,sums)` is called once for each land cell and adds that cell's
+///terms to `sums`, an array of `N` CompensatedSums.
+///
+///Each row is summed separately, with the rows shared out between threads,
+///and the row sums are then combined in order. The result therefore does not
+///depend on the number of threads.
+///
+///@param land          Land cells of the grid
+///@param interior_only If true, only the cells the groundwater kernels act on
+///                     are summed (see LandMask::forEachActiveCell())
+///@param periodic      Whether the east and west edges of the grid meet, so
+///                     that the first and last columns are not skipped
+///@param cell          Adds the terms of a cell
+///
+///@return The `N` sums
+template<int N, class F>
+std::array<double,N> ReduceOverLand(const LandMask &land, const bool interior_only, const bool periodic, F cell){
+  const int height = land.height();
+  std::vector<std::array<CompensatedSum,N>> rows(height);
+
+  #pragma omp parallel for schedule(dynamic,16)
+  for(int y=0;y<height;y++){
+    auto *const sums = rows[y].data();
+    if(interior_only){
+      land.forEachActiveCell(y, periodic, [&](const int x, const int cy){
+        cell(x, cy, sums);
+      });
+    } else {
+      for(auto s=land.rowBegin(y);s!=land.rowEnd(y);s++)
+      for(int x=s->x0;x<s->x1;x++)
+        cell(x, y, sums);
+    }
+  }
+
+  std::array<CompensatedSum,N> total;
+  for(const auto &row: rows)
+  for(int n=0;n<N;n++)
+    total[n].add(row[n]);
+
+  std::array<double,N> ret;
+  for(int n=0;n<N;n++)
+    ret[n] = total[n].value();
+  return ret;
+}
+
+#endif
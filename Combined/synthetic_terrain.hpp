@@ -0,0 +1,224 @@
+#ifndef _synthetic_terrain_hpp_
+#define _synthetic_terrain_hpp_
+
+#include "ArrayPack.hpp"
+#include "parameters.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+///Generators of synthetic model domains, so that the model can be benchmarked
+///at any size without real input data. Each kind of terrain stresses a
+///different part of the model:
+///
+///  * `fractal`:     fractional Brownian motion, like real topography; 60% land.
+///  * `nested_pits`: depressions within depressions at four scales, giving a
+///                   deep depression hierarchy and many overflows; 85% land.
+///  * `flats`:       terraces of exactly equal elevation, the worst case for
+///                   priority-flood and flow routing; up to 70% land, as the
+///                   terrace at sea level is all ocean.
+///  * `ocean_heavy`: a scattering of islands; 15% land.
+///
+///A domain depends only on its kind, size, and seed, and is generated with
+///integer hashing rather than the standard library's random distributions,
+///whose output differs between implementations. The same arguments therefore
+///give the same domain on every machine.
+namespace synthetic {
+
+const std::vector<std::string> TERRAINS = {"fractal", "nested_pits", "flats", "ocean_heavy"};
+
+///A well-mixed hash of a lattice point, in [0,1)
+inline double Hash(const int32_t x, const int32_t y, const uint32_t seed){
+  uint32_t h = seed ^ 0x9E3779B9u;
+  h ^= static_cast<uint32_t>(x) * 0x85EBCA6Bu;
+  h  = (h << 13) | (h >> 19);
+  h ^= static_cast<uint32_t>(y) * 0xC2B2AE35u;
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return h / 4294967296.0;
+}
+
+///Smoothly interpolated lattice noise, in [0,1)
+inline double ValueNoise(const double x, const double y, const uint32_t seed){
+  const double  fx = std::floor(x);
+  const double  fy = std::floor(y);
+  const int32_t x0 = static_cast<int32_t>(fx);
+  const int32_t y0 = static_cast<int32_t>(fy);
+  //Smoothstep, so the noise has no creases along the lattice
+  const double  tx = (x-fx)*(x-fx)*(3-2*(x-fx));
+  const double  ty = (y-fy)*(y-fy)*(3-2*(y-fy));
+  const double  a  = Hash(x0,   y0,   seed);
+  const double  b  = Hash(x0+1, y0,   seed);
+  const double  c  = Hash(x0,   y0+1, seed);
+  const double  d  = Hash(x0+1, y0+1, seed);
+  return (a + (b-a)*tx)*(1-ty) + (c + (d-c)*tx)*ty;
+}
+
+///Fractional Brownian motion: `octaves` layers of noise, each at twice the
+///frequency and half the amplitude of the last. In roughly [0,1).
+inline double Fbm(const double x, const double y, const int octaves, const uint32_t seed){
+  double sum       = 0;
+  double amplitude = 0.5;
+  double frequency = 1;
+  double norm      = 0;
+  for(int o=0;o<octaves;o++){
+    sum       += amplitude*ValueNoise(x*frequency, y*frequency, seed+o);
+    norm      += amplitude;
+    amplitude *= 0.5;
+    frequency *= 2;
+  }
+  return sum/norm;
+}
+
+///Elevation of a cell, before sea level is subtracted
+inline double Elevation(const std::string &terrain, const int x, const int y, const uint32_t seed){
+  if(terrain=="fractal" || terrain=="ocean_heavy"){
+    return 3000*Fbm(x/256.0, y/256.0, 8, seed);
+  } else if(terrain=="nested_pits"){
+    //Egg-crates at four scales, each a quarter the size of the last, so every
+    //depression is made of smaller depressions
+    double elev = 600*Fbm(x/512.0, y/512.0, 3, seed);
+    double period = 400, amplitude = 200;
+    for(int k=0;k<4;k++){
+      elev      += amplitude*std::cos(2*M_PI*x/period)*std::cos(2*M_PI*y/period);
+      period    /= 4;
+      amplitude /= 4;
+    }
+    return elev;
+  } else if(terrain=="flats"){
+    //Terraces 100 m apart. floor() makes every cell of a terrace exactly
+    //equal in elevation.
+    return 100*std::floor(30*Fbm(x/256.0, y/256.0, 6, seed));
+  }
+  throw std::runtime_error("Unrecognised terrain '" + terrain + "'!");
+}
+
+///Proportion of the domain which is land
+inline double LandFraction(const std::string &terrain){
+  if(terrain=="nested_pits") return 0.85;
+  if(terrain=="flats")       return 0.70;
+  if(terrain=="ocean_heavy") return 0.15;
+  return 0.60;
+}
+
+}
+
+
+
+///Fills `arp` with a synthetic domain and sets the parameters that describe
+///it. The arrays set are those InitialiseEquilibrium() leaves behind; the
+///caller should then call cell_size_area() and InitialiseBoth(), as
+///initialise() does.
+///
+///@param params  Parameters to which the grid size, time step, and location
+///               are written
+///@param arp     ArrayPack to fill
+///@param terrain One of synthetic::TERRAINS
+///@param width   Width of the domain, in cells
+///@param height  Height of the domain, in cells
+///@param seed    Seed of the domain. Each seed gives a different domain.
+inline void MakeSyntheticDomain(
+  Parameters        &params,
+  ArrayPack         &arp,
+  const std::string &terrain,
+  const int          width,
+  const int          height,
+  const uint32_t     seed
+){
+  if(width<3 || height<3)
+    throw std::runtime_error("Synthetic domains must be at least 3x3!");
+
+  params.ncells_x         = width;
+  params.ncells_y         = height;
+  params.run_type         = "equilibrium";
+  params.cells_per_degree = 120;
+  params.southern_edge    = 30;
+  params.deltat           = 31536000;
+  params.infiltration_on  = true;
+
+  arp.topo = f2d(width, height, 0);
+  #pragma omp parallel for
+  for(int y=0;y<height;y++)
+  for(int x=0;x<width;x++)
+    arp.topo(x,y) = synthetic::Elevation(terrain, x, y, seed);
+
+  //Sea level is the elevation which leaves the terrain's share of land above
+  //it. A strided sample is plenty to find it.
+  float sea_level;
+  {
+    std::vector<float> sample;
+    const f2d::i_t stride = std::max<f2d::i_t>(1, arp.topo.size()/1000000);
+    for(f2d::i_t i=0;i<arp.topo.size();i+=stride)
+      sample.push_back(arp.topo(i));
+    const auto nth = sample.begin() + static_cast<int64_t>((1-synthetic::LandFraction(terrain))*(sample.size()-1));
+    std::nth_element(sample.begin(), nth, sample.end());
+    sea_level = *nth;
+  }
+
+  arp.land_mask     = u82d(width, height, 0);
+  arp.slope         = f2d(width, height, 0);
+  arp.fdepth        = f2d(width, height, 0);
+  arp.wtd           = f2d(width, height, 0);
+  arp.ksat          = f2d(width, height, 0);
+  arp.vert_ksat     = f2d(width, height, 0);
+  arp.precip        = f2d(width, height, 0);
+  arp.starting_evap = f2d(width, height, 0);
+  arp.temp          = f2d(width, height, 0);
+  arp.ground_temp   = f2d(width, height, 0);
+  arp.relhum        = f2d(width, height, 0);
+  arp.wind_speed    = f2d(width, height, 0);
+
+  #pragma omp parallel for
+  for(int y=0;y<height;y++)
+  for(int x=0;x<width;x++){
+    arp.topo(x,y) -= sea_level;
+    if(arp.topo(x,y)>0)
+      arp.land_mask(x,y) = 1;
+  }
+
+  //Cells are about 926 m apart at 120 cells per degree
+  const double spacing = 926;
+
+  #pragma omp parallel for
+  for(int y=0;y<height;y++)
+  for(int x=0;x<width;x++){
+    //Smooth fields for the climate, independent of the terrain
+    const double n1 = synthetic::Fbm(x/128.0, y/128.0, 4, seed+101);
+    const double n2 = synthetic::Fbm(x/128.0, y/128.0, 4, seed+202);
+    const double elev = std::max(0.0f, arp.topo(x,y));
+
+    const int xe = std::min(x+1, width-1),  xw = std::max(x-1, 0);
+    const int yn = std::min(y+1, height-1), ys = std::max(y-1, 0);
+    const double gx = (arp.topo(xe,y)-arp.topo(xw,y))/((xe-xw)*spacing);
+    const double gy = (arp.topo(x,yn)-arp.topo(x,ys))/((yn-ys)*spacing);
+    arp.slope(x,y) = std::min(1.0, std::sqrt(gx*gx+gy*gy));
+
+    //The e-folding depth as InitialiseEquilibrium() computes it where it is
+    //not too cold
+    arp.fdepth(x,y)        = std::max(1000/(1+150*arp.slope(x,y)), 25.0f);
+
+    arp.temp(x,y)          = 25 - 20.0*y/height - 0.0065*elev;
+    arp.ground_temp(x,y)   = arp.temp(x,y) + 1;
+    arp.relhum(x,y)        = 0.4 + 0.5*n1;
+    arp.wind_speed(x,y)    = 1 + 5*n2;
+    arp.precip(x,y)        = 0.2 + 1.5*n1;   //m/yr
+    arp.starting_evap(x,y) = 0.6*arp.precip(x,y);
+    arp.ksat(x,y)          = 1e-6*(1 + 9*n2); //m/s
+    arp.vert_ksat(x,y)     = arp.ksat(x,y);
+
+    //The water table starts a few metres down, so that groundwater flows and
+    //surface water infiltrates
+    if(arp.land_mask(x,y))
+      arp.wtd(x,y) = -(1 + 4*n2);
+  }
+
+  arp.evap = arp.starting_evap;
+}
+
+#endif
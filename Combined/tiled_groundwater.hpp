@@ -0,0 +1,235 @@
+#ifndef _tiled_groundwater_hpp_
+#define _tiled_groundwater_hpp_
+
+#include "../common/tile_cache.hpp"
+#include "ArrayPack.hpp"
+#include "land_mask.hpp"
+#include "parameters.hpp"
+#include "transient_groundwater.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+///Runs groundwater() on grids stored on disk rather than in memory, for
+///domains too large to hold. The inputs of the stencil (topo, fdepth, ksat,
+///and the land mask) and the water table are raw grids (see raw_grid.hpp), as
+///written by nc2raw or SaveAsRaw(), and only a few rows of tiles of each are
+///held in memory at once (see tile_cache.hpp).
+///
+///Each step sweeps over the tiles row by row. For every tile the cells it
+///covers, plus a one-cell halo, are copied out of the cached tiles, the same
+///stencil as groundwater() is run on them, and the new water table of the
+///tile is written to a second file. The water table is read from one file and
+///written to the other so that the halos always hold the water table from
+///before the step; the files swap roles after every step. The results are
+///therefore identical to those of groundwater() in memory.
+///
+///While a tile is computed the tiles needed for the next one are read in the
+///background. With room for three rows of tiles in each cache, every tile is
+///read once per step.
+class TiledGroundwater {
+ public:
+  ///@param topo, fdepth, ksat Raw grids of floats
+  ///@param mask               Raw grid of uint8, non-zero on land
+  ///@param wtd                Raw grid of floats holding the starting water
+  ///                          table. It is changed by the steps.
+  ///@param scratch            A file the size of `wtd` to write the water table
+  ///                          to. It is created, or overwritten if it exists.
+  ///@param tile_width         Width of a tile; -1 for whole rows
+  ///@param tile_height        Height of a tile
+  ///@param cache_tiles        Tiles of each grid to hold in memory; 0 for three
+  ///                          rows of tiles and three more
+  TiledGroundwater(
+    const std::string &topo,
+    const std::string &fdepth,
+    const std::string &ksat,
+    const std::string &mask,
+    const std::string &wtd,
+    const std::string &scratch,
+    const int          tile_width,
+    const int          tile_height,
+    size_t             cache_tiles = 0
+  ){
+    //The scratch file is a copy of wtd's header followed by room for its cells
+    {
+      const auto header = ReadRawHeader(wtd);
+      std::vector<float> row(header.width, 0);
+      FILE *fp = std::fopen(scratch.c_str(), "wb");
+      if(fp==nullptr)
+        throw std::runtime_error("Failed to create file '" + scratch + "'!");
+      char padding[RAW_GRID_PAYLOAD] = {};
+      std::memcpy(padding, &header, sizeof(header));
+      bool ok = std::fwrite(padding, 1, header.payload, fp)==header.payload;
+      for(int y=0;ok && y<header.height;y++)
+        ok = std::fwrite(row.data(), sizeof(float), row.size(), fp)==row.size();
+      if(std::fclose(fp)!=0 || !ok)
+        throw std::runtime_error("Failed to write file '" + scratch + "'!");
+    }
+
+    if(cache_tiles==0){
+      const int tw     = (tile_width==-1) ? ReadRawHeader(wtd).width : tile_width;
+      const int across = (ReadRawHeader(wtd).width+tw-1)/tw;
+      cache_tiles = 3*across+3;
+    }
+
+    g_topo   .reset(new TiledRawGrid<float>  (topo,    tile_width, tile_height, cache_tiles, false));
+    g_fdepth .reset(new TiledRawGrid<float>  (fdepth,  tile_width, tile_height, cache_tiles, false));
+    g_ksat   .reset(new TiledRawGrid<float>  (ksat,    tile_width, tile_height, cache_tiles, false));
+    g_mask   .reset(new TiledRawGrid<uint8_t>(mask,    tile_width, tile_height, cache_tiles, false));
+    g_wtd    .reset(new TiledRawGrid<float>  (wtd,     tile_width, tile_height, cache_tiles, true ));
+    g_wtd_new.reset(new TiledRawGrid<float>  (scratch, tile_width, tile_height, cache_tiles, true ));
+
+    for(const auto *g: {g_topo.get(), g_fdepth.get(), g_ksat.get(), g_wtd_new.get()})
+      if(g->width()!=g_wtd->width() || g->height()!=g_wtd->height())
+        throw std::runtime_error("Raw grid '" + g->file() + "' is not the size of the water table!");
+    if(g_mask->width()!=g_wtd->width() || g_mask->height()!=g_wtd->height())
+      throw std::runtime_error("Raw grid '" + g_mask->file() + "' is not the size of the water table!");
+  }
+
+  int width()  const { return g_wtd->width();  }
+  int height() const { return g_wtd->height(); }
+
+  ///The file holding the water table after the last step
+  const std::string& wtdFile() const { return g_wtd->file(); }
+
+  ///Takes one groundwater step and logs its statistics, as groundwater() does.
+  ///`cellsize_e_w_metres` and `cell_area` are for every row of the grid, as
+  ///cell_size_area() computes them. `params.abs_diagnostics` and
+  ///`params.groundwater_layout` are ignored, as there is no wtd_mid on disk
+  ///and the windows are too small for the interleaved layout to pay. A
+  ///periodic grid (`params.periodic_x`) needs tiles of whole rows.
+  void step(const Parameters &params, const dvec &cellsize_e_w_metres, const dvec &cell_area){
+    if(params.periodic_x && g_wtd->tilesX()>1)
+      throw std::runtime_error("Periodic grids can only be tiled in whole rows!");
+
+    Log()<<"Groundwater"<<'\n';
+
+    GroundwaterStats stats;
+    const int tiles_x = g_wtd->tilesX();
+    const int tiles_y = g_wtd->tilesY();
+
+    for(int ty=0;ty<tiles_y;ty++)
+    for(int tx=0;tx<tiles_x;tx++){
+      //Of the tiles around the next one, only those in the following row of
+      //tiles have not been read yet in this sweep
+      const int nx = (tx+1<tiles_x) ? tx+1 : 0;
+      const int ny = (tx+1<tiles_x) ? ty   : ty+1;
+      for(int dx=-1;dx<=1;dx++){
+        g_topo  ->prefetch(nx+dx, ny+1);
+        g_fdepth->prefetch(nx+dx, ny+1);
+        g_ksat  ->prefetch(nx+dx, ny+1);
+        g_mask  ->prefetch(nx+dx, ny+1);
+        g_wtd   ->prefetch(nx+dx, ny+1);
+      }
+
+      stepTile(params, cellsize_e_w_metres, cell_area, tx, ty, stats);
+    }
+
+    g_wtd_new->flush();
+    std::swap(g_wtd, g_wtd_new);
+
+    log_groundwater(stats);
+  }
+
+  ///Copies the whole water table into memory, e.g. to check it
+  f2d wtd(){
+    f2d out(width(), height());
+    GridWindow all;
+    all.width  = width();
+    all.height = height();
+    g_wtd->readWindow(all, out);
+    return out;
+  }
+
+  ///Tile traffic of every grid, summed
+  TileCacheStats stats() const {
+    TileCacheStats total;
+    auto add = [&](const TileCacheStats &s){
+      total.hits          += s.hits;
+      total.prefetch_hits += s.prefetch_hits;
+      total.misses        += s.misses;
+      total.bytes_read    += s.bytes_read;
+      total.bytes_written += s.bytes_written;
+      total.peak_tiles    += s.peak_tiles;
+    };
+    add(g_topo->stats());
+    add(g_fdepth->stats());
+    add(g_ksat->stats());
+    add(g_mask->stats());
+    add(g_wtd->stats());
+    add(g_wtd_new->stats());
+    return total;
+  }
+
+ private:
+  void stepTile(
+    const Parameters &params,
+    const dvec       &cellsize_e_w_metres,
+    const dvec       &cell_area,
+    const int         tx,
+    const int         ty,
+    GroundwaterStats &stats
+  ){
+    const GridWindow tile = g_wtd->tileWindow(tx, ty);
+
+    //The tile plus its halo, clipped to the grid. At the edges of the grid
+    //there is no halo, but neither are the outermost cells computed.
+    GridWindow win;
+    win.x0     = std::max(tile.x0-1, 0);
+    win.y0     = std::max(tile.y0-1, 0);
+    win.width  = std::min(tile.x0+tile.width +1, width() )-win.x0;
+    win.height = std::min(tile.y0+tile.height+1, height())-win.y0;
+
+    //The state of the window, laid out as groundwater() expects, with the
+    //window's rows standing in for the whole grid
+    ArrayPack local;
+    u82d mask(win.width, win.height);
+    local.topo             = f2d(win.width, win.height);
+    local.wtd              = f2d(win.width, win.height);
+    local.fdepth           = f2d(win.width, win.height);
+    local.ksat             = f2d(win.width, win.height);
+    local.wtd_change_total = f2d(win.width, win.height, 0);
+    g_mask  ->readWindow(win, mask);
+    g_topo  ->readWindow(win, local.topo);
+    g_wtd   ->readWindow(win, local.wtd);
+    g_fdepth->readWindow(win, local.fdepth);
+    g_ksat  ->readWindow(win, local.ksat);
+    local.land   = LandMask(mask);
+    local.wrap_x = ColumnWrap(win.width, params.periodic_x);
+    local.cellsize_e_w_metres.assign(cellsize_e_w_metres.begin()+win.y0, cellsize_e_w_metres.begin()+win.y0+win.height);
+    local.cell_area          .assign(cell_area          .begin()+win.y0, cell_area          .begin()+win.y0+win.height);
+
+    Parameters local_params = params;
+    local_params.ncells_x           = win.width;
+    local_params.ncells_y           = win.height;
+    local_params.abs_diagnostics    = false;
+    local_params.groundwater_layout = "separate";
+
+    //The halo is the outermost ring of the window, so only the tile's own
+    //cells are computed
+    const auto tile_stats = groundwater_step(local_params, local);
+    stats.total_changes += tile_stats.total_changes;
+    stats.max_total      = std::max(stats.max_total,  tile_stats.max_total);
+    stats.min_total      = std::min(stats.min_total,  tile_stats.min_total);
+    stats.max_change     = std::max(stats.max_change, tile_stats.max_change);
+
+    float *const out = g_wtd_new->mutableTile(tx, ty, false);
+    for(int y=0;y<tile.height;y++)
+    for(int x=0;x<tile.width;x++)
+      out[static_cast<size_t>(y)*tile.width+x] = local.wtd(tile.x0-win.x0+x, tile.y0-win.y0+y);
+  }
+
+  std::unique_ptr<TiledRawGrid<float>>   g_topo;
+  std::unique_ptr<TiledRawGrid<float>>   g_fdepth;
+  std::unique_ptr<TiledRawGrid<float>>   g_ksat;
+  std::unique_ptr<TiledRawGrid<uint8_t>> g_mask;
+  std::unique_ptr<TiledRawGrid<float>>   g_wtd;
+  std::unique_ptr<TiledRawGrid<float>>   g_wtd_new;
+};
+
+#endif
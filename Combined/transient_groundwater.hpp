@@ -1,5 +1,11 @@
+#ifndef _transient_groundwater_hpp_
+#define _transient_groundwater_hpp_
+
 #include "../common/netcdf.hpp"
 #include "ArrayPack.hpp"
+#include "domain_decomposition.hpp"
+#include "hot_state.hpp"
+#include "logging.hpp"
 #include "parameters.hpp"
 #include <cassert>
 #include <cmath>
@@ -17,6 +23,24 @@ using namespace std;
 typedef std::vector<double> dvec;
 typedef rd::Array2D<float>  f2d;
 
+///Hydraulic conductivity integrated over the flow depth, from the values of a
+///single cell. See kcell(x,y,arp) below.
+inline double kcell(const float fdepth, const float wtd, const float ksat){
+  if(fdepth>0){
+    // Equation S6 from the Fan paper
+    if(wtd<-1.5)
+      return fdepth * ksat * std::exp((wtd+1.5)/fdepth); 
+    // If wtd is greater than 0, max out rate of groundwater movement 
+    // as though wtd were 0. The surface water will get to move in 
+    // FillSpillMerge.
+    else if(wtd > 0)
+      return ksat * (0+1.5+fdepth);                                        
+    else
+      return ksat * (wtd+1.5+fdepth);  //Equation S4 from the Fan paper
+  }else
+    return 0;
+}
+
 double kcell(const int x, const int y, const ArrayPack &arp){
   /**
   Mini-function that gives the hydraulic conductivity per cell, kcell.
@@ -36,40 +60,212 @@ double kcell(const int x, const int y, const ArrayPack &arp){
            integreation of the hydraulic conductivity over flow depth.
   **/
 
-  if(arp.fdepth(x,y)>0){
-    // Equation S6 from the Fan paper
-    if(arp.wtd(x,y)<-1.5)
-      return arp.fdepth(x,y) * arp.ksat(x,y) \
-                 * std::exp((arp.wtd(x,y)+1.5)/arp.fdepth(x,y)); 
-    // If wtd is greater than 0, max out rate of groundwater movement 
-    // as though wtd were 0. The surface water will get to move in 
-    // FillSpillMerge.
-    else if(arp.wtd(x,y) > 0)
-      return arp.ksat(x,y) * (0+1.5+arp.fdepth(x,y));                                        
-    else
-      return arp.ksat(x,y) * (arp.wtd(x,y)+1.5+arp.fdepth(x,y));                             //Equation S4 from the Fan paper
-  }else
-    return 0;
+  return kcell(arp.fdepth(x,y), arp.wtd(x,y), arp.ksat(x,y));
+}
+
+///Computes wtd_change_total, the change in water-table depth of each land cell
+///due to groundwater flow over one time step, and tracks the extremes of wtd
+///and of the change. `cell(x,y)` returns the HotCell holding the state of a
+///cell, wherever that state is stored.
+template<class CellAccessor>
+static void groundwater_changes(
+  const Parameters   &params,
+  ArrayPack          &arp,
+  const CellAccessor &cell,
+  float              &max_total,
+  float              &min_total,
+  float              &max_change
+){
+  // The change of the cell at (x,y), whose west and east neighbours are in 
+  // columns xw and xe. These are x-1 and x+1 except across the seam of a 
+  // periodic grid.
+  const auto cell_change = [&](const int x, const int y, const int xw, const int xe){
+    const HotCell me = cell(x,  y  );
+    const HotCell cN = cell(x,  y+1);
+    const HotCell cS = cell(x,  y-1);
+    const HotCell cW = cell(xw, y  );
+    const HotCell cE = cell(xe, y  );
+
+    // Elevation head - topography plus the water table depth (negative if 
+    // water table is below earth surface)               
+    const auto my_head = me.topo + me.wtd;
+    // heads for each of my neighbour cells
+    const auto headN   = cN.topo + cN.wtd;
+    const auto headS   = cS.topo + cS.wtd;              
+    const auto headW   = cW.topo + cW.wtd;              
+    const auto headE   = cE.topo + cE.wtd;              
+
+    // Get the hydraulic conductivity for our cells of interest
+    const auto my_k = kcell(me.fdepth, me.wtd, me.ksat);
+    const auto kN = ( my_k + kcell(cN.fdepth, cN.wtd, cN.ksat) ) / 2.;
+    const auto kS = ( my_k + kcell(cS.fdepth, cS.wtd, cS.ksat) ) / 2.;                
+    const auto kW = ( my_k + kcell(cW.fdepth, cW.wtd, cW.ksat) ) / 2.;
+    const auto kE = ( my_k + kcell(cE.fdepth, cE.wtd, cE.ksat) ) / 2.;
+
+    // Change in water-table depth.
+    // (1) Discharge across cell boundaries
+    // Average hydraulic conductivity of the two cells * 
+    // head difference between the two / distance (i.e., dH/dx_i) *
+    // width of cell across which the water is discharged *
+    // time step
+    // (2) Divide by the area of the given cell: maps water volume 
+    // increases/decreases to change in head
+    const double wtd_change_N = kN * (headN - my_head) / params.cellsize_n_s_metres \
+                    * arp.cellsize_e_w_metres[y] * params.deltat \
+                    / arp.cell_area[y];
+    const double wtd_change_S = kS * (headS - my_head) / params.cellsize_n_s_metres \
+                    * arp.cellsize_e_w_metres[y] * params.deltat \
+                    / arp.cell_area[y];
+    const double wtd_change_E = kE * (headE - my_head) / arp.cellsize_e_w_metres[y] \
+                    * params.cellsize_n_s_metres * params.deltat \
+                    / arp.cell_area[y];
+    const double wtd_change_W = kW * (headW - my_head) / arp.cellsize_e_w_metres[y] \
+                    * params.cellsize_n_s_metres * params.deltat \
+                    / arp.cell_area[y];
+
+    //Total change in wtd for our target cell in this iteration
+    arp.wtd_change_total(x,y) = ( wtd_change_N + wtd_change_S \
+                                  + wtd_change_E + wtd_change_W );
+
+    // Update variables with some potentially interesting values:
+    //   - highest wtd
+    //   - lowest wtd
+    //   - greatest change in wtd during this time step
+    if(me.wtd> max_total)
+      max_total  = me.wtd;
+    else if(me.wtd< min_total)
+      min_total  = me.wtd;
+    if(fabs(arp.wtd_change_total(x,y)) > max_change)
+      max_change = fabs(arp.wtd_change_total(x,y));
+  };
+
+  // Cycle through the entire array, calculating how much the water-table 
+  // changes in each cell per iteration.
+  // We do this instead of using a staggered grid to approx. double CPU time 
+  // in exchange for using less memory.
+  // Only land cells are visited; the ocean has no water table.
+  for(int y=1; y<params.ncells_y-1; y++){
+    for(auto s=arp.land.interiorRowBegin(y); s!=arp.land.interiorRowEnd(y); s++)
+    for(int x=s->x0; x<s->x1; x++)
+      cell_change(x, y, x-1, x+1);
+  }
+
+  // The outermost columns are skipped above. On a periodic grid they are 
+  // neighbours of each other, so their land is computed too.
+  if(arp.wrap_x.periodic()){
+    const int last = arp.land.width()-1;
+    for(int y=1; y<params.ncells_y-1; y++){
+      if(arp.land.isLand(0,y))
+        cell_change(0,    y, arp.wrap_x(-1),     1);
+      if(arp.land.isLand(last,y))
+        cell_change(last, y, last-1, arp.wrap_x(last+1));
+    }
+  }
+}
+
+///Extremes and totals of one groundwater step, which groundwater() logs
+struct GroundwaterStats {
+  double total_changes = 0.;
+  float  max_total     = 0.;
+  float  min_total     = 0.;
+  float  max_change    = 0.;
+};
+
+///Moves the water table by one groundwater step, on every interior row of
+///`arp`. See groundwater() below.
+static GroundwaterStats groundwater_step(const Parameters &params, ArrayPack &arp){
+  GroundwaterStats stats;
+
+  ////////////////////////////
+  // COMPUTE CHANGES IN WTD //
+  ////////////////////////////
+
+  // The stencil reads the state either straight from the separate arrays, or
+  // from an interleaved copy of them (see hot_state.hpp), which is kept
+  // between steps and only needs the water table of the land refreshed.
+  if(params.groundwater_layout=="interleaved"){
+    arp.hot.refresh(arp.topo, arp.wtd, arp.fdepth, arp.ksat, arp.land);
+    groundwater_changes(params, arp, [&](const int x, const int y){
+      return arp.hot(x,y);
+    }, stats.max_total, stats.min_total, stats.max_change);
+  } else if(params.groundwater_layout=="separate"){
+    groundwater_changes(params, arp, [&](const int x, const int y){
+      return HotCell{arp.topo(x,y), arp.wtd(x,y), arp.fdepth(x,y), arp.ksat(x,y)};
+    }, stats.max_total, stats.min_total, stats.max_change);
+  } else {
+    throw std::runtime_error("Unrecognised groundwater_layout '" + params.groundwater_layout + "'!");
+  }
+
+
+  ////////////////
+  // UPDATE WTD // 
+  ////////////////
+
+  // wtd_change_total is only ever set on land, so ocean cells are skipped.
+  // The new water table is also copied to wtd_mid here, rather than in a 
+  // separate pass, if the absolute value diagnostics need it. 
+  const bool keep_mid = params.abs_diagnostics;
+  const auto update   = [&](const int x, const int y){
+    // Update the whole wtd array at once. 
+    // This is the new water table after groundwater has moved 
+    // for delta_t seconds. 
+    arp.wtd(x,y) = arp.wtd(x,y) + arp.wtd_change_total(x,y);   
+    stats.total_changes += arp.wtd_change_total(x,y);
+    if(keep_mid)
+      arp.wtd_mid(x,y) = arp.wtd(x,y);
+  };
+  // These are the cells groundwater_changes() computed, including the
+  // outermost columns of a periodic grid.
+  for(int y=1;y<params.ncells_y-1;y++)
+    arp.land.forEachActiveCell(y, arp.wrap_x.periodic(), update);
+
+  return stats;
+}
+
+static void log_groundwater(const GroundwaterStats &stats){
+  // Write status to text file
+  Log() << "total GW changes were " << stats.total_changes << '\n';
+  //The extremes are also in the per-cycle records
+  Log(LogLevel::Debug) << "max wtd was " << stats.max_total \
+                       << " and min wtd was " << stats.min_total << '\n';
+  Log(LogLevel::Debug) << "max GW change was " << stats.max_change << '\n';
+
+  auto &logger = TheLogger();
+  logger.record("gw_total_changes", stats.total_changes);
+  logger.record("gw_max_wtd",       stats.max_total);
+  logger.record("gw_min_wtd",       stats.min_total);
+  logger.record("gw_max_change",    stats.max_change);
 }
 
 void groundwater(const Parameters &params, ArrayPack &arp){
   /**
-  @param params   Global paramaters - we use the texfilename, run type, 
+  @param params   Global paramaters - we use the run type, 
+                  groundwater_layout, abs_diagnostics, 
                   number of cells in the x and y directions (ncells_x 
                   and ncells_y), delta_t (number of seconds in a time step), 
                   and cellsize_n_s_metres (size of a cell in the north-south 
                   direction)
 
-  @param arp      Global arrays - we access land_mask, topo, wtd, 
-                  wtd_change_total, cellsize_e_w_metres, and cell_area.
-                  land_mask is a binary representation of where land is vs 
-                                        where ocean is.
+  @param arp      Global arrays - we access land, topo, wtd, fdepth, ksat,
+                  hot, wtd_change_total, wtd_mid, cellsize_e_w_metres, and
+                  cell_area.
+                  land is a packed representation of where land is vs 
+                                        where ocean is, with the runs of land 
+                                        cells in each row.
                   topo is the input topography, i.e. land elevation above 
                                         sea level in each cell.
                   wtd is the water table depth.  
+                  hot is an interleaved copy of topo, wtd, fdepth, and ksat,
+                                        used if groundwater_layout is
+                                        interleaved. Its wtd on land is
+                                        refreshed here; whoever changes
+                                        topo, fdepth or ksat must call
+                                        hot.invalidate().
                   wtd_change_total is the amount by which wtd will change 
                                         during this time step as a result of
                                         groundwater movement.
+                  wtd_mid receives the updated wtd on land, if
+                                        abs_diagnostics is set.
                   cellsize_e_w_metres is the distance across a cell in the
                                         east-west direction.
                   cell_area is the area of the cell, needed because different 
@@ -82,111 +278,34 @@ void groundwater(const Parameters &params, ArrayPack &arp){
            by delta_t.
   **/
 
-  // Declare variables updated in the loop
-  double wtd_change_N;
-  double wtd_change_S;
-  double wtd_change_E;
-  double wtd_change_W;
+  Log()<<"Groundwater"<<'\n';
 
-  // Declare status variables and set initial values to 0
-  double total_changes = 0.;
-  float max_total      = 0.;
-  float min_total      = 0.;
-  float max_change     = 0.;
-  
-  // Set up log file
-  ofstream textfile;
-  textfile.open (params.textfilename, std::ios_base::app);
-  
-  textfile<<"Groundwater"<<std::endl;
-
-  
-  ////////////////////////////
-  // COMPUTE CHANGES IN WTD //
-  ////////////////////////////
-  
-  // Cycle through the entire array, calculating how much the water-table 
-  // changes in each cell per iteration.
-  // We do this instead of using a staggered grid to approx. double CPU time 
-  // in exchange for using less memory.
-  for(int y=1; y<params.ncells_y-1; y++){
-    for(int x=1; x<params.ncells_x-1; x++){
-      //skip ocean cells
-      if(arp.land_mask(x,y) == 0)
-        continue;
-
-      // Elevation head - topography plus the water table depth (negative if 
-      // water table is below earth surface)               
-      const auto my_head = arp.topo(x,y) + arp.wtd(x,y);
-      // heads for each of my neighbour cells
-      const auto headN   = arp.topo(x,y+1) + arp.wtd(x,y+1);
-      const auto headS   = arp.topo(x,y-1) + arp.wtd(x,y-1);              
-      const auto headW   = arp.topo(x-1,y) + arp.wtd(x-1,y);              
-      const auto headE   = arp.topo(x+1,y) + arp.wtd(x+1,y);              
-
-      // Get the hydraulic conductivity for our cells of interest
-      const auto kN = ( kcell(x,  y,   arp) + kcell(x,  y+1, arp) ) / 2.;
-      const auto kS = ( kcell(x,  y,   arp) + kcell(x,  y-1, arp) ) / 2.;                
-      const auto kW = ( kcell(x,  y,   arp) + kcell(x-1,y,   arp) ) / 2.;
-      const auto kE = ( kcell(x,  y,   arp) + kcell(x+1,y,   arp) ) / 2.;
-
-      // Change in water-table depth.
-      // (1) Discharge across cell boundaries
-      // Average hydraulic conductivity of the two cells * 
-      // head difference between the two / distance (i.e., dH/dx_i) *
-      // width of cell across which the water is discharged *
-      // time step
-      // (2) Divide by the area of the given cell: maps water volume 
-      // increases/decreases to change in head
-      wtd_change_N = kN * (headN - my_head) / params.cellsize_n_s_metres \
-                      * arp.cellsize_e_w_metres[y] * params.deltat \
-                      / arp.cell_area[y];
-      wtd_change_S = kS * (headS - my_head) / params.cellsize_n_s_metres \
-                      * arp.cellsize_e_w_metres[y] * params.deltat \
-                      / arp.cell_area[y];
-      wtd_change_E = kE * (headE - my_head) / arp.cellsize_e_w_metres[y] \
-                      * params.cellsize_n_s_metres * params.deltat \
-                      / arp.cell_area[y];
-      wtd_change_W = kW * (headW - my_head) / arp.cellsize_e_w_metres[y] \
-                      * params.cellsize_n_s_metres * params.deltat \
-                      / arp.cell_area[y];
-
-      //Total change in wtd for our target cell in this iteration
-      arp.wtd_change_total(x,y) = ( wtd_change_N + wtd_change_S \
-                                    + wtd_change_E + wtd_change_W );
-
-      // Update variables with some potentially interesting values:
-      //   - highest wtd
-      //   - lowest wtd
-      //   - greatest change in wtd during this time step
-      if(arp.wtd(x,y)> max_total)
-        max_total  = arp.wtd(x,y);
-      else if(arp.wtd(x,y)< min_total)
-        min_total  = arp.wtd(x,y);
-      if(fabs(arp.wtd_change_total(x,y)) > max_change)
-        max_change = fabs(arp.wtd_change_total(x,y));
-    }
-  }
+  log_groundwater(groundwater_step(params, arp));
+}
 
 
-  ////////////////
-  // UPDATE WTD // 
-  ////////////////
 
-  for(int y=1;y<params.ncells_y-1;y++){
-    for(int x=1;x<params.ncells_x-1; x++){
-      // Update the whole wtd array at once. 
-      // This is the new water table after groundwater has moved 
-      // for delta_t seconds. 
-      arp.wtd(x,y) = arp.wtd(x,y) + arp.wtd_change_total(x,y);   
-      total_changes += arp.wtd_change_total(x,y);
-    }
-  }
+#ifdef TWSM_USE_MPI
+///groundwater() for a domain split into strips of rows between MPI ranks (see
+///domain_decomposition.hpp). `arp` holds this rank's strip, including its
+///halo rows, and `params.ncells_y` is the height of the strip. The halo rows
+///of wtd are refreshed from the neighbouring ranks before the step, which is
+///the only state that changes between steps; the other inputs to the stencil
+///are read into the halos along with the rest of the strip. Each rank then
+///updates the rows it owns, so the water tables are the same as those of a
+///single process. The statistics are combined over all ranks and logged.
+void groundwater(const Parameters &params, ArrayPack &arp, const RowDecomposition &rows){
+  Log()<<"Groundwater"<<'\n';
 
-  // Write status to text file
-  textfile << "total GW changes were " << total_changes << std::endl;
-  textfile << "max wtd was " << max_total << " and min wtd was " \
-           << min_total << std::endl;
-  textfile << "max GW change was " << max_change << std::endl;
-  textfile.close();
+  rows.exchangeHalos(arp.wtd);
+  auto stats = groundwater_step(params, arp);
+
+  stats.total_changes = rows.sum(stats.total_changes);
+  stats.max_total     = rows.max(stats.max_total);
+  stats.min_total     = rows.min(stats.min_total);
+  stats.max_change    = rows.max(stats.max_change);
+  log_groundwater(stats);
 }
+#endif
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef _ascii_grid_hpp_
+#define _ascii_grid_hpp_
+
+#include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<charconv>)
+  #include <charconv>
+#endif
+
+namespace rd = richdem;
+
+//ESRI ASCII grids ("*.dem") are a short header of `key value` lines followed
+//by the cells as whitespace-separated text, starting with the north-western
+//cell and proceeding row by row.
+
+
+
+///The header of an ESRI ASCII grid
+struct AsciiGridHeader {
+  int    ncols        = -1;
+  int    nrows        = -1;
+  double xll          = std::numeric_limits<double>::quiet_NaN(); //xllcorner or xllcenter
+  double yll          = std::numeric_limits<double>::quiet_NaN(); //yllcorner or yllcenter
+  bool   ll_is_center = false;
+  double cellsize     = std::numeric_limits<double>::quiet_NaN();
+  bool   has_nodata   = false;
+  double nodata       = 0;
+};
+
+
+
+///Parses the header of an ASCII grid held in `buf`. Keys are case-insensitive
+///and may come in any order; NODATA_value is optional.
+///
+///@return Pointer to the first character after the header.
+static const char* ParseAsciiGridHeader(const char *p, const char *const end, AsciiGridHeader &header, const std::string &filename){
+  while(p<end){
+    //Skip whitespace
+    while(p<end && std::isspace(static_cast<unsigned char>(*p)))
+      p++;
+    //The header ends at the first line which doesn't start with a letter
+    if(p==end || !std::isalpha(static_cast<unsigned char>(*p)))
+      break;
+
+    const char *const key_start = p;
+    while(p<end && !std::isspace(static_cast<unsigned char>(*p)))
+      p++;
+    std::string key(key_start, p);
+    std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c){ return std::tolower(c); });
+
+    char *val_end;
+    const double val = std::strtod(p, &val_end);
+    if(val_end==p)
+      throw std::runtime_error("Missing value for '" + key + "' in the header of '" + filename + "'!");
+    p = val_end;
+
+    if(key=="ncols")
+      header.ncols = static_cast<int>(val);
+    else if(key=="nrows")
+      header.nrows = static_cast<int>(val);
+    else if(key=="xllcorner" || key=="xllcenter"){
+      header.xll          = val;
+      header.ll_is_center = key=="xllcenter";
+    } else if(key=="yllcorner" || key=="yllcenter")
+      header.yll = val;
+    else if(key=="cellsize")
+      header.cellsize = val;
+    else if(key=="nodata_value"){
+      header.has_nodata = true;
+      header.nodata     = val;
+    } else
+      throw std::runtime_error("Unrecognised key '" + key + "' in the header of '" + filename + "'!");
+  }
+
+  if(header.ncols<=0 || header.nrows<=0)
+    throw std::runtime_error("Header of '" + filename + "' does not give ncols and nrows!");
+
+  return p;
+}
+
+
+
+//Parses a single cell value starting at `p`, returning a pointer to the first
+//character after it, or nullptr if there was no valid number. std::from_chars
+//is fastest and locale-independent, but older standard libraries lack it for
+//floating-point types, so strtod/strtoll are used there instead.
+template<class T>
+static const char* ParseAsciiCell(const char *const p, const char *const end, T &val){
+#ifdef __cpp_lib_to_chars
+  const auto res = std::from_chars(p, end, val);
+  return res.ec==std::errc() ? res.ptr : nullptr;
+#else
+  char *val_end;
+  if(std::is_same<T,float>::value)
+    val = static_cast<T>(std::strtof(p, &val_end));
+  else if(std::is_floating_point<T>::value)
+    val = static_cast<T>(std::strtod(p, &val_end));
+  else
+    val = static_cast<T>(std::strtoll(p, &val_end, 10));
+  (void)end;
+  return val_end==p ? nullptr : val_end;
+#endif
+}
+
+
+
+static inline bool IsAsciiSpace(const char c){
+  return c==' ' || c=='\n' || c=='\r' || c=='\t' || c=='\v' || c=='\f';
+}
+
+
+
+///Loads an ESRI ASCII grid. The whole file is read into memory with a single
+///read, and the cells are then parsed in two passes over chunks of the text,
+///in parallel if OpenMP is enabled. The first pass counts the values in each
+///chunk, which tells each chunk where its values go in the grid; the second
+///parses them into place.
+template<class T>
+rd::Array2D<T> LoadDEM(const std::string filename){
+  FILE *fp = std::fopen(filename.c_str(), "rb");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to open file '"+filename+"'!");
+
+  std::fseek(fp, 0, SEEK_END);
+  const long file_size = std::ftell(fp);
+  std::fseek(fp, 0, SEEK_SET);
+  if(file_size<0){
+    std::fclose(fp);
+    throw std::runtime_error("Failed to get size of file '"+filename+"'!");
+  }
+
+  //The trailing NUL stops strtod at the end of the buffer
+  std::vector<char> buf(file_size+1, '\0');
+  const size_t got = std::fread(buf.data(), 1, file_size, fp);
+  std::fclose(fp);
+  if(got!=static_cast<size_t>(file_size))
+    throw std::runtime_error("Failed to read file '"+filename+"'!");
+
+  const char *const end = buf.data()+file_size;
+
+  AsciiGridHeader header;
+  const char *const body = ParseAsciiGridHeader(buf.data(), end, header, filename);
+
+  rd::Array2D<T> temp(header.ncols,header.nrows);
+  if(header.has_nodata)
+    temp.setNoData(static_cast<T>(header.nodata));
+
+  //Split the body into chunks of roughly 4MB, with each boundary moved forward
+  //to the next whitespace so that no value is split between chunks.
+  const size_t body_size   = end-body;
+  const size_t chunk_bytes = 4<<20;
+  const int    nchunks     = std::max<size_t>(1, body_size/chunk_bytes);
+
+  std::vector<const char*> bounds(nchunks+1);
+  bounds[0]       = body;
+  bounds[nchunks] = end;
+  for(int c=1;c<nchunks;c++){
+    const char *p = body + c*(body_size/nchunks);
+    while(p<end && !IsAsciiSpace(*p))
+      p++;
+    bounds[c] = std::max(p, bounds[c-1]);
+  }
+
+  //First pass: count the values in each chunk. Each chunk starts at
+  //whitespace (or the start of the body), so a value starts wherever a
+  //non-space character follows a space.
+  std::vector<size_t> counts(nchunks+1, 0);
+  #pragma omp parallel for schedule(static)
+  for(int c=0;c<nchunks;c++){
+    size_t count  = 0;
+    bool in_space = true;
+    for(const char *p=bounds[c];p<bounds[c+1];p++){
+      const bool space = IsAsciiSpace(*p);
+      if(in_space && !space)
+        count++;
+      in_space = space;
+    }
+    counts[c+1] = count;
+  }
+
+  for(int c=0;c<nchunks;c++)
+    counts[c+1] += counts[c];
+
+  if(counts[nchunks]!=temp.size())
+    throw std::runtime_error("File '" + filename + "' should have " + std::to_string(temp.size()) \
+      + " values but has " + std::to_string(counts[nchunks]) + "!");
+
+  //Second pass: parse each chunk into its part of the grid
+  bool bad_value = false;
+  T *const data  = temp.data();
+  #pragma omp parallel for schedule(static) reduction(||:bad_value)
+  for(int c=0;c<nchunks;c++){
+    size_t i = counts[c];
+    const char *p = bounds[c];
+    const char *const chunk_end = bounds[c+1];
+    while(p<chunk_end){
+      while(p<chunk_end && IsAsciiSpace(*p))
+        p++;
+      if(p==chunk_end)
+        break;
+      p = ParseAsciiCell(p, chunk_end, data[i++]);
+      if(p==nullptr){
+        bad_value = true;
+        break;
+      }
+    }
+  }
+
+  if(bad_value)
+    throw std::runtime_error("File '" + filename + "' contains a value which is not a number!");
+
+  return temp;
+}
+
+
+
+///The original iostream-based ASCII grid loader. It is much slower than
+///LoadDEM(), reads the header into integers, and requires the header keys to
+///be in a fixed order; it is kept only as a reference for benchmarking.
+template<class T>
+rd::Array2D<T> LoadDEMReference(const std::string filename){
+  std::ifstream fin(filename);
+
+  if(!fin.good())
+    throw std::runtime_error("Failed to open file '"+filename+"'!");
+
+  std::string header;
+  int val;
+
+  int mywidth,myheight;
+
+  fin>>header>>mywidth;
+  if(header!="ncols")
+    throw std::runtime_error("Not ncols");
+
+  fin>>header>>myheight;
+  if(header!="nrows")
+    throw std::runtime_error("Not ncols");
+
+  rd::Array2D<T> temp(mywidth,myheight);
+
+  fin>>header>>val; //xllcorner
+  fin>>header>>val; //yllcorner
+  fin>>header>>val; //cellsize
+  fin>>header>>val; //no_data value
+  if(header=="NODATA_value")
+    temp.setNoData(val);
+
+  for(int y=0;y<myheight;y++)
+  for(int x=0;x<mywidth; x++)
+    fin>>temp(x,y);
+
+  return temp;
+}
+
+#endif
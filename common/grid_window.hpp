@@ -0,0 +1,82 @@
+#ifndef _grid_window_hpp_
+#define _grid_window_hpp_
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+///A rectangular subset of a grid, in cells. Row 0 is the first `lat` row in
+///the file and column 0 the first `lon` column. A default-constructed window
+///covers the whole grid.
+struct GridWindow {
+  int x0     = 0;
+  int y0     = 0;
+  int width  = -1; //-1 means "to the edge of the grid"
+  int height = -1;
+
+  bool whole() const {
+    return x0==0 && y0==0 && width==-1 && height==-1;
+  }
+
+  ///Fills in the width and height, if they were left unset, for a grid of the
+  ///given size, and checks that the window lies inside it.
+  GridWindow resolve(const int grid_width, const int grid_height, const std::string &filename) const {
+    GridWindow ret = *this;
+    if(ret.width==-1)
+      ret.width = grid_width-x0;
+    if(ret.height==-1)
+      ret.height = grid_height-y0;
+    if(ret.x0<0 || ret.y0<0 || ret.width<=0 || ret.height<=0 \
+      || ret.x0+ret.width>grid_width || ret.y0+ret.height>grid_height)
+      throw std::runtime_error("Window does not lie within the grid of file '" + filename + "'!");
+    return ret;
+  }
+};
+
+
+
+//Finds the first and last indices of `coord` which lie within [lo,hi]. The
+//coordinate may be either ascending or descending.
+inline void CoordinateRange(const std::vector<double> &coord, const double lo, const double hi, int &start, int &count){
+  int first = -1;
+  int last  = -1;
+  for(int i=0;i<(int)coord.size();i++){
+    if(coord[i]<lo || coord[i]>hi)
+      continue;
+    if(first==-1)
+      first = i;
+    last = i;
+  }
+  start = first;
+  count = first==-1 ? 0 : last-first+1;
+}
+
+
+
+///Finds the window of cells whose coordinates lie within a bounding box.
+///
+///@param lat      Latitude of each row
+///@param lon      Longitude of each column
+///@param filename Name of the grid's file, for error messages
+///
+///@return The window. Throws if no cells lie within the box.
+inline GridWindow WindowFromCoordinates(
+  const std::vector<double> &lat,
+  const std::vector<double> &lon,
+  const double south,
+  const double north,
+  const double west,
+  const double east,
+  const std::string &filename
+){
+  GridWindow window;
+  CoordinateRange(lat, south, north, window.y0, window.height);
+  CoordinateRange(lon, west,  east,  window.x0, window.width);
+
+  if(window.width<=0 || window.height<=0)
+    throw std::runtime_error("No cells of file '" + filename + "' lie within the requested bounds!");
+
+  return window;
+}
+
+#endif
@@ -1,9 +1,18 @@
 #ifndef _kr_netcdf_
 #define _kr_netcdf_
 
+#include "ascii_grid.hpp"
+#include "grid_window.hpp"
+#include "raw_grid.hpp"
 #include <netcdf.h>
 #include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 namespace rd = richdem;
 
@@ -27,10 +36,16 @@ static void GetDimLength(const int ncid, const int dimnum, int &mywidth, int &my
 
 
 
-template<class T>
-rd::Array2D<T> LoadNetCDF(const std::string filename, const std::string datavar){
-  /* This will be the netCDF ID for the file and data variable. */
-  int ncid, varid, retval, dim_count;
+///Opens a NetCDF file and determines the size of the grid it contains.
+///
+///@param filename File to open
+///@param mywidth  Set to the length of the file's `lon` dimension
+///@param myheight Set to the length of the file's `lat` dimension
+///
+///@return The netCDF ID of the open file. Close it with `CloseNetCDF()`.
+static int OpenNetCDF(const std::string &filename, int &mywidth, int &myheight){
+  /* This will be the netCDF ID for the file. */
+  int ncid, retval, dim_count;
 
   /* Open the file. NC_NOWRITE tells netCDF we want read-only access
    * to the file.*/
@@ -45,8 +60,8 @@ rd::Array2D<T> LoadNetCDF(const std::string filename, const std::string datavar)
   if(dim_count!=3)
     throw std::runtime_error("File '" + filename + "' did not have 2 dimensions!");    
 
-  int mywidth;
-  int myheight;
+  mywidth  = -1;
+  myheight = -1;
   GetDimLength(ncid, 0, mywidth, myheight);
   GetDimLength(ncid, 1, mywidth, myheight);
   GetDimLength(ncid, 2, mywidth, myheight);
@@ -54,74 +69,301 @@ rd::Array2D<T> LoadNetCDF(const std::string filename, const std::string datavar)
   if(mywidth==-1 || myheight==-1)
     throw std::runtime_error("File '" + filename + "' did not have a lat or lon dimension!");    
 
-  rd::Array2D<T> dem(mywidth,myheight);
+  return ncid;
+}
+
+
+
+//Reads a hyperslab directly into an array of the matching C type, so that
+//libnetcdf doesn't need to convert it.
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, float *data){
+  return nc_get_vara_float(ncid, varid, start, count, data);
+}
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, double *data){
+  return nc_get_vara_double(ncid, varid, start, count, data);
+}
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, int32_t *data){
+  return nc_get_vara_int(ncid, varid, start, count, data);
+}
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, int16_t *data){
+  return nc_get_vara_short(ncid, varid, start, count, data);
+}
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, uint8_t *data){
+  return nc_get_vara_uchar(ncid, varid, start, count, data);
+}
+static int NetCDFGetVara(const int ncid, const int varid, const size_t *start, const size_t *count, int8_t *data){
+  return nc_get_vara_schar(ncid, varid, start, count, data);
+}
+
+
+
+//Reads a hyperslab stored as `Disk` into an array of `T`, a block of rows at a
+//time, through a small buffer. This avoids ever holding the whole variable in
+//its on-disk type (e.g. a full grid of doubles when floats are wanted), and
+//avoids libnetcdf's own conversion buffers.
+template<class Disk, class T>
+static int NetCDFGetVaraConverting(
+  const int ncid,
+  const int varid,
+  const int ndims,
+  const int lat_dim,
+  const size_t *const start,
+  const size_t *const count,
+  T *const data
+){
+  //Number of cells in one row of the hyperslab and the number of rows
+  size_t row_cells = 1;
+  for(int d=0;d<ndims;d++)
+    if(d!=lat_dim)
+      row_cells *= count[d];
+  const size_t nrows = lat_dim==-1 ? 1 : count[lat_dim];
+
+  const size_t buffer_bytes = 4<<20;
+  const size_t block_rows   = std::max<size_t>(1, buffer_bytes/sizeof(Disk)/row_cells);
+
+  std::vector<Disk> buffer(std::min(block_rows,nrows)*row_cells);
+
+  size_t block_start[NC_MAX_VAR_DIMS];
+  size_t block_count[NC_MAX_VAR_DIMS];
+  std::copy(start, start+ndims, block_start);
+  std::copy(count, count+ndims, block_count);
+
+  for(size_t row=0;row<nrows;row+=block_rows){
+    const size_t rows = std::min(block_rows, nrows-row);
+    if(lat_dim!=-1){
+      block_start[lat_dim] = start[lat_dim]+row;
+      block_count[lat_dim] = rows;
+    }
+    const int retval = NetCDFGetVara(ncid, varid, block_start, block_count, buffer.data());
+    if(retval)
+      return retval;
+    T *const out = data + row*row_cells;
+    for(size_t i=0;i<rows*row_cells;i++)
+      out[i] = ConvertGridValue<T>(buffer[i]);
+  }
+
+  return NC_NOERR;
+}
+
+
+
+///Reads `datavar` from an open NetCDF file into `data`. Only the cells within
+///`window` are read, using a hyperslab, so the I/O and memory needed scale
+///with the window rather than with the file.
+///
+///@param ncid     ID of a file opened with `OpenNetCDF()`
+///@param filename Name of the file, for error messages
+///@param datavar  Variable to read
+///@param window   Part of the grid to read. Must already have been resolved
+///                against the size of the grid.
+///@param data     Receives the data. Must have room for the whole window.
+template<class T>
+static void ReadNetCDF(const int ncid, const std::string &filename, const std::string &datavar, const GridWindow &window, T *const data){
+  int varid, retval, ndims;
 
   /* Get the varid of the data variable, based on its name. */
   if ((retval = nc_inq_varid(ncid, datavar.c_str(), &varid)))
-    throw std::runtime_error("Failed to get dataset '"+datavar+"' from file '" + filename + "'!");
+    throw std::runtime_error("Failed to get variable '"+datavar+"' from file '" + filename + "'! Error: " + nc_strerror(retval));
+
+  //Work out where the variable's `lat` and `lon` dimensions are. Any other
+  //dimension (such as time) is read at index 0. The hyperslab is copied as it
+  //is laid out in the file, so `lat` must come before `lon`; otherwise the
+  //grid would be loaded transposed.
+  if ((retval = nc_inq_varndims(ncid, varid, &ndims)))
+    throw std::runtime_error("Failed to get dimensions of '"+datavar+"' in file '" + filename + "'! Error: " + nc_strerror(retval));
+  if(ndims>NC_MAX_VAR_DIMS)
+    throw std::runtime_error("Variable '"+datavar+"' in file '" + filename + "' has too many dimensions!");
+
+  int dimids[NC_MAX_VAR_DIMS];
+  if ((retval = nc_inq_vardimid(ncid, varid, dimids)))
+    throw std::runtime_error("Failed to get dimensions of '"+datavar+"' in file '" + filename + "'! Error: " + nc_strerror(retval));
+
+  size_t start[NC_MAX_VAR_DIMS];
+  size_t count[NC_MAX_VAR_DIMS];
+  int lat_dim = -1;
+  int lon_dim = -1;
+  for(int d=0;d<ndims;d++){
+    char dimname[NC_MAX_NAME+1];
+    if ((retval = nc_inq_dimname(ncid, dimids[d], dimname)))
+      throw std::runtime_error("Couldn't get name of dimension!");
+    if(std::string(dimname)=="lat"){
+      start[d] = window.y0;
+      count[d] = window.height;
+      lat_dim  = d;
+    } else if(std::string(dimname)=="lon"){
+      start[d] = window.x0;
+      count[d] = window.width;
+      lon_dim  = d;
+    } else {
+      start[d] = 0;
+      count[d] = 1;
+    }
+  }
+  if(lat_dim!=-1 && lon_dim!=-1 && lon_dim<lat_dim)
+    throw std::runtime_error("Variable '"+datavar+"' in file '" + filename + "' has its lon dimension before its lat dimension; only (lat,lon) grids are supported!");
+
+  nc_type vartype;
+  if ((retval = nc_inq_vartype(ncid, varid, &vartype)))
+    throw std::runtime_error("Failed to get type of '"+datavar+"' in file '" + filename + "'! Error: " + nc_strerror(retval));
 
   /* Read the data. */
-  //TODO: Check data type
-  if ((retval = nc_get_var_float(ncid, varid, dem.data())))
+  //If the file holds the type we want, it is read straight into place.
+  //Otherwise we convert it ourselves a block at a time. Any other on-disk type
+  //is left to libnetcdf to convert.
+  const bool same_type = (vartype==NC_FLOAT  && std::is_same<T,float>::value)   \
+                      || (vartype==NC_DOUBLE && std::is_same<T,double>::value)  \
+                      || (vartype==NC_INT    && std::is_same<T,int32_t>::value) \
+                      || (vartype==NC_SHORT  && std::is_same<T,int16_t>::value) \
+                      || (vartype==NC_UBYTE  && std::is_same<T,uint8_t>::value) \
+                      || (vartype==NC_BYTE   && std::is_same<T,int8_t>::value);
+
+  if(same_type)
+    retval = NetCDFGetVara(ncid, varid, start, count, data);
+  else if(vartype==NC_DOUBLE)
+    retval = NetCDFGetVaraConverting<double> (ncid, varid, ndims, lat_dim, start, count, data);
+  else if(vartype==NC_FLOAT)
+    retval = NetCDFGetVaraConverting<float>  (ncid, varid, ndims, lat_dim, start, count, data);
+  else if(vartype==NC_INT)
+    retval = NetCDFGetVaraConverting<int32_t>(ncid, varid, ndims, lat_dim, start, count, data);
+  else if(vartype==NC_SHORT)
+    retval = NetCDFGetVaraConverting<int16_t>(ncid, varid, ndims, lat_dim, start, count, data);
+  else if(vartype==NC_UBYTE)
+    retval = NetCDFGetVaraConverting<uint8_t>(ncid, varid, ndims, lat_dim, start, count, data);
+  else if(vartype==NC_BYTE)
+    retval = NetCDFGetVaraConverting<int8_t> (ncid, varid, ndims, lat_dim, start, count, data);
+  else
+    retval = NetCDFGetVara(ncid, varid, start, count, data);
+
+  if(retval)
     throw std::runtime_error("Failed to read data from '"+datavar+" from file '" + filename + "'! Error: " + nc_strerror(retval));
+}
 
- // for(int i=0;i<mywidth*myheight;i++)
-   // std::cout<<data[i]<<std::endl;
+
+
+static void CloseNetCDF(const int ncid, const std::string &filename){
+  int retval;
 
   /* Close the file, freeing all resources. */
   if ((retval = nc_close(ncid)))
     throw std::runtime_error("Failed to close file '" + filename + "'!");
+}
+
+
+
+template<class T>
+rd::Array2D<T> LoadNetCDF(const std::string filename, const std::string datavar, const GridWindow &window = GridWindow()){
+  int mywidth, myheight;
+  const int ncid = OpenNetCDF(filename, mywidth, myheight);
+
+  const auto win = window.resolve(mywidth, myheight, filename);
+
+  rd::Array2D<T> dem(win.width,win.height);
+  ReadNetCDF(ncid, filename, datavar, win, dem.data());
+
+  CloseNetCDF(ncid, filename);
 
   return dem;
 }
 
 
 
+static std::vector<double> ReadCoordinate(const int ncid, const std::string &filename, const std::string &name, const int len){
+  int varid, retval;
+  if ((retval = nc_inq_varid(ncid, name.c_str(), &varid)))
+    throw std::runtime_error("Failed to get coordinate variable '"+name+"' from file '" + filename + "'! Error: " + nc_strerror(retval));
+  std::vector<double> coord(len);
+  if ((retval = nc_get_var_double(ncid, varid, coord.data())))
+    throw std::runtime_error("Failed to read coordinate variable '"+name+"' from file '" + filename + "'! Error: " + nc_strerror(retval));
+  return coord;
+}
 
-template<class T>
-rd::Array2D<T> LoadDEM(const std::string filename){
-  std::ifstream fin(filename);
+///Converts a latitude/longitude bounding box into a window, using the `lat`
+///and `lon` coordinate variables of a NetCDF file (or the coordinates in the
+///header of a raw grid). A cell is inside the box if
+///its coordinate is. All of the model's inputs are on the same grid, so the
+///window found from one file applies to all of them.
+///
+///@return The window. Throws if no cells lie within the box.
+static GridWindow WindowFromBounds(const std::string &filename, const double south, const double north, const double west, const double east){
+  if(filename.substr(filename.size()-3)=="raw")
+    return RawWindowFromBounds(filename, south, north, west, east);
 
-  if(!fin.good())
-    throw std::runtime_error("Failed to open file '"+filename+"'!");
+  int mywidth, myheight;
+  const int ncid = OpenNetCDF(filename, mywidth, myheight);
 
-  std::string header;
-  int val;
+  const auto lat = ReadCoordinate(ncid, filename, "lat", myheight);
+  const auto lon = ReadCoordinate(ncid, filename, "lon", mywidth);
 
-  int mywidth,myheight;
+  CloseNetCDF(ncid, filename);
+
+  return WindowFromCoordinates(lat, lon, south, north, west, east, filename);
+}
 
-  fin>>header>>mywidth;
-  if(header!="ncols")
-    throw std::runtime_error("Not ncols");
 
-  fin>>header>>myheight;
-  if(header!="nrows")
-    throw std::runtime_error("Not ncols");
 
-  rd::Array2D<T> temp(mywidth,myheight);
+///Whether latitude decreases from one row of a grid to the next, according to
+///the `lat` coordinate variable of a NetCDF file or the header of a raw grid.
+///Grids whose coordinates aren't known are taken to increase.
+static bool LatitudeDecreasesByRow(const std::string &filename){
+  if(filename.substr(filename.size()-3)=="raw")
+    return ReadRawHeader(filename).dlat<0;
+  if(filename.substr(filename.size()-2)!="nc")
+    return false;
 
-  fin>>header>>val; //xllcorner
-  fin>>header>>val; //yllcorner
-  fin>>header>>val; //cellsize
-  fin>>header>>val; //no_data value
-  if(header=="NODATA_value")
-    temp.setNoData(val);
+  int mywidth, myheight, varid;
+  const int ncid = OpenNetCDF(filename, mywidth, myheight);
+  std::vector<double> lat;
+  if(myheight>1 && nc_inq_varid(ncid, "lat", &varid)==NC_NOERR)
+    lat = ReadCoordinate(ncid, filename, "lat", myheight);
+  CloseNetCDF(ncid, filename);
+
+  return lat.size()>1 && lat[1]<lat[0];
+}
 
-  for(int y=0;y<myheight;y++)
-  for(int x=0;x<mywidth; x++)
-    fin>>temp(x,y);
 
-  return temp;
+
+///Width and height of a grid file, without reading its cells (except for
+///ASCII grids, which have to be read whole).
+static void GridSize(const std::string &filename, int &width, int &height){
+  if(filename.substr(filename.size()-3)=="dem"){
+    const auto dem = LoadDEM<float>(filename);
+    width  = dem.width();
+    height = dem.height();
+  } else if(filename.substr(filename.size()-2)=="nc"){
+    CloseNetCDF(OpenNetCDF(filename, width, height), filename);
+  } else if(filename.substr(filename.size()-3)=="raw"){
+    const auto header = ReadRawHeader(filename);
+    width  = header.width;
+    height = header.height;
+  } else {
+    throw std::runtime_error("Unrecognized file extension!");
+  }
 }
 
 
 
+///Copies the cells within `window` out of `arr`.
 template<class T>
-rd::Array2D<T> LoadData(const std::string filename, const std::string datavar){
+rd::Array2D<T> CropToWindow(const rd::Array2D<T> &arr, const GridWindow &window, const std::string &filename){
+  const auto win = window.resolve(arr.width(), arr.height(), filename);
+  rd::Array2D<T> ret(win.width, win.height);
+  for(int y=0;y<win.height;y++)
+  for(int x=0;x<win.width; x++)
+    ret(x,y) = arr(win.x0+x, win.y0+y);
+  return ret;
+}
+
+
+
+template<class T>
+rd::Array2D<T> LoadData(const std::string filename, const std::string datavar, const GridWindow &window = GridWindow()){
   if(filename.substr(filename.size()-3)=="dem")
-    return LoadDEM<T>(filename);
+    //ASCII grids can't be read in part, so we read them whole and then crop
+    return window.whole() ? LoadDEM<T>(filename) : CropToWindow(LoadDEM<T>(filename), window, filename);
   else if(filename.substr(filename.size()-2)=="nc")
-    return LoadNetCDF<T>(filename, datavar);
+    return LoadNetCDF<T>(filename, datavar, window);
+  else if(filename.substr(filename.size()-3)=="raw")
+    return LoadRaw<T>(filename, window);
   else
     throw std::runtime_error("Unrecognized file extension!");
 }
@@ -160,6 +402,8 @@ void SaveAsNetCDF(const rd::Array2D<T> &arr, const std::string filename, const s
     dtype = NC_INT;
   else if(std::is_same<T, float>::value)
     dtype = NC_FLOAT;
+  else if(std::is_same<T, uint8_t>::value)
+    dtype = NC_UBYTE;
   else
     throw std::runtime_error("Unimplemented data type found when writing file '" + filename + "'!");
 
@@ -179,6 +423,9 @@ void SaveAsNetCDF(const rd::Array2D<T> &arr, const std::string filename, const s
   } else if(std::is_same<T, float>::value){
     if ((retval = nc_put_var_float(ncid, varid, (const float*)arr.data())))
       throw std::runtime_error("Failed to write data to file '" + filename + "'! Error: " + nc_strerror(retval));
+  } else if(std::is_same<T, uint8_t>::value){
+    if ((retval = nc_put_var_uchar(ncid, varid, (const unsigned char*)arr.data())))
+      throw std::runtime_error("Failed to write data to file '" + filename + "'! Error: " + nc_strerror(retval));
   }
 
   //Close the file. This frees up any internal netCDF resources associated with
@@ -0,0 +1,257 @@
+#ifndef _parallel_load_hpp_
+#define _parallel_load_hpp_
+
+#include "netcdf.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <richdem/common/timer.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace rd = richdem;
+
+//Loads a batch of input grids, several at a time.
+//
+//libnetcdf is not thread-safe, so concurrent reads within one process are not
+//possible. Instead, each file is read by a forked child process. Just before
+//a child starts, the parent opens its file to learn the size of the grid
+//(this touches only the file's metadata and is fast) and creates a shared
+//memory region of that size. The child reads its variable directly into the
+//region, and once it has succeeded the parent copies the region into the
+//destination array and releases it. The copy is a memcpy, which costs little
+//next to reading the file, and leaves every array owning its own cells, so
+//that the memory of an input is returned when its array is released and
+//arrays copied from it are independent of it.
+//
+//Only the queue's own children are waited for. If anything fails, or an
+//exception leaves runForked(), the children still running are killed and
+//reaped and the regions not yet copied are released.
+//
+//Files which are not NetCDF, or any batch run with a single job, are loaded in
+//this process with `LoadData()` exactly as they would be otherwise.
+//
+//Every file in the queue is read through the same window, so that only the
+//part of each grid covering the model's region is loaded.
+class LoadQueue {
+ public:
+  explicit LoadQueue(const GridWindow &window = GridWindow()) : window(window) {}
+
+  ///Adds a file to the batch. `target` is only written once `run()` is
+  ///called, so it must outlive the queue.
+  template<class T>
+  void add(const std::string &filename, const std::string &datavar, rd::Array2D<T> &target){
+    LoadJob job;
+    job.filename  = filename;
+    job.datavar   = datavar;
+    job.elem_size = sizeof(T);
+    job.load      = [&target,filename,datavar,this](){
+      target = LoadData<T>(filename, datavar, window);
+    };
+    job.store     = [&target](const int width, const int height, const void *const data){
+      const T *const cells = static_cast<const T*>(data);
+      target = rd::Array2D<T>(width, height);
+      std::copy(cells, cells+static_cast<size_t>(width)*height, target.data());
+    };
+    job.read      = [filename,datavar](const int ncid, const GridWindow &win, void *const data){
+      ReadNetCDF(ncid, filename, datavar, win, static_cast<T*>(data));
+    };
+    jobs.push_back(job);
+  }
+
+  ///Loads every file in the batch, with up to `max_jobs` files being read at
+  ///once, and prints the time taken for each.
+  void run(const int max_jobs){
+    rd::Timer timer_overall;
+    timer_overall.start();
+
+    if(max_jobs<=1){
+      for(auto &job: jobs){
+        rd::Timer timer;
+        timer.start();
+        job.load();
+        job.seconds = timer.stop();
+      }
+    } else {
+      runForked(max_jobs);
+    }
+
+    const double overall = timer_overall.stop();
+
+    for(const auto &job: jobs)
+      std::cerr<<"t Load "<<std::left<<std::setw(60)<<job.filename<<std::right\
+      <<" = "<<job.seconds<<" s"<<std::endl;
+    std::cerr<<"t Loaded "<<jobs.size()<<" files using "<<std::max(max_jobs,1)\
+    <<" jobs. Wall-time = "<<overall<<" s"<<std::endl;
+
+    jobs.clear();
+  }
+
+ private:
+  struct LoadJob {
+    std::string filename;
+    std::string datavar;
+    size_t      elem_size = 0;
+    double      seconds   = 0;
+    std::function<void()>                 load;
+    std::function<void(const int,const int,const void*)> store;
+    std::function<void(const int,const GridWindow&,void*)> read;
+    GridWindow  window;               //Window resolved against the file's grid
+    void       *shared    = nullptr;  //Region the child process reads into
+    size_t      bytes     = 0;
+    pid_t       pid       = -1;
+  };
+
+  //Written by a child process to report back to the parent
+  struct LoadStatus {
+    int    ok;
+    double seconds;
+    char   message[512];
+  };
+
+  GridWindow           window;
+  std::vector<LoadJob> jobs;
+
+  static bool isNetCDF(const std::string &filename){
+    return filename.size()>=2 && filename.substr(filename.size()-2)=="nc";
+  }
+
+  //Kills and reaps the children of runForked() which are still running, and
+  //releases the shared regions which have not been copied, however it ends
+  struct ForkedJobsGuard {
+    std::vector<LoadJob> &jobs;
+    void                 *status;
+    size_t                status_bytes;
+
+    ~ForkedJobsGuard(){
+      for(auto &job: jobs){
+        if(job.pid>0){
+          kill(job.pid, SIGKILL);
+          while(waitpid(job.pid, nullptr, 0)<0 && errno==EINTR){}
+          job.pid = -1;
+        }
+        if(job.shared!=nullptr){
+          munmap(job.shared, job.bytes);
+          job.shared = nullptr;
+        }
+      }
+      munmap(status, status_bytes);
+    }
+  };
+
+  //Opens the job's file to size its shared region, then starts a child to
+  //read the file into it
+  static void startChild(LoadJob &job, LoadStatus &st, const GridWindow &window){
+    int width, height;
+    CloseNetCDF(OpenNetCDF(job.filename, width, height), job.filename);
+    job.window = window.resolve(width, height, job.filename);
+    job.bytes  = static_cast<size_t>(job.window.width)*job.window.height*job.elem_size;
+    void *const shared = mmap(nullptr, job.bytes, PROT_READ|PROT_WRITE, \
+      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if(shared==MAP_FAILED)
+      throw std::runtime_error("Failed to allocate shared memory for '" + job.filename + "'!");
+    job.shared = shared;
+
+    job.pid = fork();
+    if(job.pid<0)
+      throw std::runtime_error("Failed to start a process to load '" + job.filename + "'!");
+    if(job.pid==0){
+      //Child: read the file into the shared region and exit without running
+      //any of the parent's destructors or flushing its buffers.
+      try {
+        rd::Timer timer;
+        timer.start();
+        const int ncid = OpenNetCDF(job.filename, width, height);
+        job.read(ncid, job.window, job.shared);
+        CloseNetCDF(ncid, job.filename);
+        st.seconds = timer.stop();
+        st.ok      = 1;
+      } catch (const std::exception &e) {
+        std::strncpy(st.message, e.what(), sizeof(st.message)-1);
+      }
+      _exit(st.ok ? 0 : 1);
+    }
+  }
+
+  void runForked(const int max_jobs){
+    //Shared status blocks, one per job
+    const size_t status_bytes = jobs.size()*sizeof(LoadStatus);
+    auto *const status = static_cast<LoadStatus*>(mmap(nullptr, status_bytes, \
+      PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0));
+    if(status==MAP_FAILED)
+      throw std::runtime_error("Failed to allocate shared memory for loading!");
+    std::memset(status, 0, status_bytes);
+    const ForkedJobsGuard guard{jobs, status, status_bytes};
+
+    //Anything that isn't NetCDF is loaded here
+    for(auto &job: jobs){
+      if(isNetCDF(job.filename))
+        continue;
+      rd::Timer timer;
+      timer.start();
+      job.load();
+      job.seconds = timer.stop();
+    }
+
+    std::string error;
+    int running = 0;
+    size_t next = 0;
+    while(true){
+      //Start children until we reach the job limit. No more are started once
+      //one has failed.
+      for(;next<jobs.size() && running<max_jobs && error.empty();next++){
+        if(!isNetCDF(jobs[next].filename))
+          continue;
+        startChild(jobs[next], status[next], window);
+        running++;
+      }
+      if(running==0)
+        break;
+
+      //Collect our finished children. Any other children of the process are
+      //left for their owners to reap.
+      bool reaped = false;
+      for(size_t j=0;j<jobs.size();j++){
+        auto &job = jobs[j];
+        if(job.pid<=0)
+          continue;
+        int wstatus = 0;
+        const pid_t pid = waitpid(job.pid, &wstatus, WNOHANG);
+        if(pid==0 || (pid<0 && errno==EINTR))
+          continue;
+        reaped  = true;
+        running--;
+        job.pid = -1;
+
+        const bool ok = pid>0 && WIFEXITED(wstatus) && WEXITSTATUS(wstatus)==0 && status[j].ok;
+        if(ok){
+          job.store(job.window.width, job.window.height, job.shared);
+          job.seconds = status[j].seconds;
+        } else if(error.empty()){
+          error = status[j].message[0]!='\0' ? status[j].message : \
+            "Failed to load '" + job.filename + "'!";
+        }
+        munmap(job.shared, job.bytes);
+        job.shared = nullptr;
+      }
+
+      //Loading a file takes far longer than this, so polling costs nothing
+      if(!reaped)
+        usleep(1000);
+    }
+
+    if(!error.empty())
+      throw std::runtime_error(error);
+  }
+};
+
+#endif
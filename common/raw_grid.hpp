@@ -0,0 +1,328 @@
+#ifndef _raw_grid_hpp_
+#define _raw_grid_hpp_
+
+#include "grid_window.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace rd = richdem;
+
+//Raw grids are a fixed-size header followed by the cells of the grid in
+//row-major order, exactly as they are laid out in an rd::Array2D. This lets
+//LoadRaw() map a file into memory and hand the mapping straight to an
+//Array2D, so that loading takes no time at all beyond the first touch of each
+//page. Files are written with `nc2raw`, and are native-endian: they are meant
+//as a fast local cache of the NetCDF inputs, not as an interchange format.
+const char     RAW_GRID_MAGIC[8]  = {'T','W','S','M','G','R','I','D'};
+const uint32_t RAW_GRID_VERSION   = 1;
+const uint32_t RAW_GRID_ENDIAN    = 0x01020304;
+//The payload starts here, which keeps it aligned for vector loads
+const uint64_t RAW_GRID_PAYLOAD   = 128;
+
+enum class RawGridType : uint32_t {
+  FLOAT32 = 1,
+  FLOAT64 = 2,
+  INT32   = 3,
+  INT16   = 4,
+  UINT8   = 5
+};
+
+template<class T> struct RawGridTypeOf;
+template<> struct RawGridTypeOf<float>   { static constexpr RawGridType value = RawGridType::FLOAT32; };
+template<> struct RawGridTypeOf<double>  { static constexpr RawGridType value = RawGridType::FLOAT64; };
+template<> struct RawGridTypeOf<int32_t> { static constexpr RawGridType value = RawGridType::INT32;   };
+template<> struct RawGridTypeOf<int16_t> { static constexpr RawGridType value = RawGridType::INT16;   };
+template<> struct RawGridTypeOf<uint8_t> { static constexpr RawGridType value = RawGridType::UINT8;   };
+
+//Bytes per cell of a grid stored as `type`, or 0 if the type is unknown
+static inline uint32_t RawGridTypeSize(const uint32_t type){
+  switch(static_cast<RawGridType>(type)){
+    case RawGridType::FLOAT32: return sizeof(float);
+    case RawGridType::FLOAT64: return sizeof(double);
+    case RawGridType::INT32:   return sizeof(int32_t);
+    case RawGridType::INT16:   return sizeof(int16_t);
+    case RawGridType::UINT8:   return sizeof(uint8_t);
+  }
+  return 0;
+}
+
+struct RawGridHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t endian;           //RAW_GRID_ENDIAN, as written by the creating machine
+  uint32_t type;             //A RawGridType
+  uint32_t elem_size;        //Bytes per cell
+  int32_t  width;
+  int32_t  height;
+  //Coordinates of the centre of cell (0,0) and the spacing between cells, in
+  //degrees. NaN if the source file had no coordinates.
+  double   lon0;
+  double   lat0;
+  double   dlon;
+  double   dlat;
+  uint64_t payload;          //Offset of the first cell from the start of the file
+};
+
+static_assert(sizeof(RawGridHeader)<=RAW_GRID_PAYLOAD, "RawGridHeader must fit before the payload!");
+static_assert(std::is_trivially_copyable<RawGridHeader>::value, "RawGridHeader must be trivially copyable!");
+
+
+
+///Writes `arr` as a raw grid.
+///
+///@param arr       Grid to write
+///@param filename  File to write to. It is written to a temporary file first,
+///                 then renamed into place.
+///@param lon0,lat0 Coordinates of the centre of cell (0,0), if known
+///@param dlon,dlat Spacing between cells, if known
+template<class T>
+void SaveAsRaw(
+  const rd::Array2D<T> &arr,
+  const std::string    &filename,
+  const double lon0 = std::numeric_limits<double>::quiet_NaN(),
+  const double lat0 = std::numeric_limits<double>::quiet_NaN(),
+  const double dlon = std::numeric_limits<double>::quiet_NaN(),
+  const double dlat = std::numeric_limits<double>::quiet_NaN()
+){
+  RawGridHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, RAW_GRID_MAGIC, sizeof(RAW_GRID_MAGIC));
+  header.version   = RAW_GRID_VERSION;
+  header.endian    = RAW_GRID_ENDIAN;
+  header.type      = static_cast<uint32_t>(RawGridTypeOf<T>::value);
+  header.elem_size = sizeof(T);
+  header.width     = arr.width();
+  header.height    = arr.height();
+  header.lon0      = lon0;
+  header.lat0      = lat0;
+  header.dlon      = dlon;
+  header.dlat      = dlat;
+  header.payload   = RAW_GRID_PAYLOAD;
+
+  const std::string tempname = filename + ".tmp";
+  FILE *fp = std::fopen(tempname.c_str(), "wb");
+  if(fp==nullptr)
+    throw std::runtime_error("Failed to create file '" + tempname + "'!");
+
+  char padding[RAW_GRID_PAYLOAD];
+  std::memset(padding, 0, sizeof(padding));
+  std::memcpy(padding, &header, sizeof(header));
+
+  const bool ok = std::fwrite(padding, 1, sizeof(padding), fp)==sizeof(padding) \
+    && std::fwrite(arr.data(), sizeof(T), arr.size(), fp)==arr.size();
+
+  //The data must reach the disk before the rename, or a crash could leave a
+  //complete-looking file with missing cells
+  const bool synced = ok && std::fflush(fp)==0 && fsync(fileno(fp))==0;
+
+  if(std::fclose(fp)!=0 || !synced){
+    std::remove(tempname.c_str());
+    throw std::runtime_error("Failed to write file '" + tempname + "'!");
+  }
+
+  if(std::rename(tempname.c_str(), filename.c_str())!=0)
+    throw std::runtime_error("Failed to move '" + tempname + "' into place!");
+}
+
+
+
+//Maps a raw grid into memory and checks its header. The mapping is private and
+//writable, so changes made to the grid by the model are copy-on-write and
+//never reach the file.
+static const RawGridHeader* MapRawGrid(const std::string &filename, size_t &length){
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if(fd==-1)
+    throw std::runtime_error("Failed to open file '" + filename + "'!");
+
+  struct stat sb;
+  if(fstat(fd, &sb)==-1){
+    close(fd);
+    throw std::runtime_error("Failed to get size of file '" + filename + "'!");
+  }
+  length = sb.st_size;
+
+  if(length<RAW_GRID_PAYLOAD){
+    close(fd);
+    throw std::runtime_error("File '" + filename + "' is not a raw grid!");
+  }
+
+  void *const mem = mmap(nullptr, length, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mem==MAP_FAILED)
+    throw std::runtime_error("Failed to map file '" + filename + "' into memory!");
+
+  const auto *const header = static_cast<const RawGridHeader*>(mem);
+
+  std::string error;
+  if(std::memcmp(header->magic, RAW_GRID_MAGIC, sizeof(RAW_GRID_MAGIC))!=0)
+    error = "File '" + filename + "' is not a raw grid!";
+  else if(header->version!=RAW_GRID_VERSION)
+    error = "Raw grid '" + filename + "' has an unsupported version!";
+  else if(header->endian!=RAW_GRID_ENDIAN)
+    error = "Raw grid '" + filename + "' was written on a machine of different endianness!";
+  else if(RawGridTypeSize(header->type)==0)
+    error = "Raw grid '" + filename + "' holds an unknown data type!";
+  else if(header->elem_size!=RawGridTypeSize(header->type))
+    error = "Raw grid '" + filename + "' is corrupt: its cell size does not match its data type!";
+  else if(header->width<=0 || header->height<=0 || header->payload<sizeof(RawGridHeader) \
+    || header->payload+static_cast<uint64_t>(header->width)*header->height*header->elem_size>length)
+    error = "Raw grid '" + filename + "' is truncated or corrupt!";
+
+  if(!error.empty()){
+    munmap(mem, length);
+    throw std::runtime_error(error);
+  }
+
+  return header;
+}
+
+
+
+///Reads the header of a raw grid.
+static RawGridHeader ReadRawHeader(const std::string &filename){
+  size_t length;
+  const auto *const mapped = MapRawGrid(filename, length);
+  const RawGridHeader header = *mapped;
+  munmap(const_cast<RawGridHeader*>(mapped), length);
+  return header;
+}
+
+
+
+///Converts a cell from the type a grid is stored as to the type it is loaded
+///as. Grids of uint8 are masks, so any non-zero value becomes 1. Values loaded
+///into other integer types are truncated and clamped to the type's range, so
+///that fill values such as -9999 or 9.97e36 don't overflow. Non-finite values
+///have no integer equivalent, so they become 0 (e.g. NaN ocean cells).
+template<class T, class Disk>
+static inline T ConvertGridValue(const Disk val){
+  if(!std::is_integral<T>::value)
+    return static_cast<T>(val);
+
+  //Every type a grid can be stored as is exactly representable as a double
+  const double v = static_cast<double>(val);
+  if(!std::isfinite(v))
+    return T(0);
+  if(std::is_same<T,uint8_t>::value)
+    return v!=0 ? T(1) : T(0);
+  if(v<=static_cast<double>(std::numeric_limits<T>::lowest()))
+    return std::numeric_limits<T>::lowest();
+  if(v>=static_cast<double>(std::numeric_limits<T>::max()))
+    return std::numeric_limits<T>::max();
+  return static_cast<T>(v);
+}
+
+
+
+//Copies the cells of `window` out of a grid stored as `Disk`, converting them
+//to `T` (see ConvertGridValue()).
+template<class Disk, class T>
+static void CopyRawCells(const Disk *const cells, const int grid_width, const GridWindow &window, rd::Array2D<T> &out){
+  for(int y=0;y<window.height;y++){
+    const Disk *const row = cells + static_cast<size_t>(window.y0+y)*grid_width + window.x0;
+    for(int x=0;x<window.width;x++)
+      out(x,y) = ConvertGridValue<T>(row[x]);
+  }
+}
+
+
+
+///Copies `grid` into an array which owns its cells. LoadRaw() may return an
+///array which points into a mapping of its file; an array which is initialised
+///from such a grid and then written to should be an OwnedCopy() of it, so that
+///the two never share cells.
+template<class T>
+rd::Array2D<T> OwnedCopy(const rd::Array2D<T> &grid){
+  rd::Array2D<T> ret(grid.width(), grid.height());
+  std::memcpy(ret.data(), grid.data(), grid.size()*sizeof(T));
+  return ret;
+}
+
+
+
+///Loads a raw grid. If the window spans whole rows of the grid (including the
+///default whole-grid window) the returned array points directly into a
+///private mapping of the file, so nothing is read or copied until cells are
+///touched. Such mappings are kept for the life of the process, since the
+///Array2D does not own its memory. Narrower windows, and grids stored as a
+///type other than `T`, are copied out of the mapping, which is then released.
+template<class T>
+rd::Array2D<T> LoadRaw(const std::string &filename, const GridWindow &window = GridWindow()){
+  size_t length;
+  const auto *const header = MapRawGrid(filename, length);
+  auto *const base = reinterpret_cast<uint8_t*>(const_cast<RawGridHeader*>(header));
+
+  const int grid_width = header->width;
+  GridWindow win;
+  try {
+    win = window.resolve(header->width, header->height, filename);
+  } catch (...) {
+    munmap(base, length);
+    throw;
+  }
+
+  //A grid of another type is converted into a new array
+  if(header->type!=static_cast<uint32_t>(RawGridTypeOf<T>::value)){
+    const void *const payload = base + header->payload;
+    rd::Array2D<T> ret(win.width, win.height);
+    //MapRawGrid() has checked that the type is known and matches elem_size
+    switch(static_cast<RawGridType>(header->type)){
+      case RawGridType::FLOAT32: CopyRawCells(static_cast<const float*>  (payload), grid_width, win, ret); break;
+      case RawGridType::FLOAT64: CopyRawCells(static_cast<const double*> (payload), grid_width, win, ret); break;
+      case RawGridType::INT32:   CopyRawCells(static_cast<const int32_t*>(payload), grid_width, win, ret); break;
+      case RawGridType::INT16:   CopyRawCells(static_cast<const int16_t*>(payload), grid_width, win, ret); break;
+      case RawGridType::UINT8:   CopyRawCells(static_cast<const uint8_t*>(payload), grid_width, win, ret); break;
+    }
+    munmap(base, length);
+    return ret;
+  }
+
+  T *const cells = reinterpret_cast<T*>(base + header->payload);
+
+  if(win.x0==0 && win.width==grid_width){
+    T *const first = cells + static_cast<size_t>(win.y0)*grid_width;
+    //Start reading the pages in the background
+    madvise(base, length, MADV_WILLNEED);
+    return rd::Array2D<T>(first, win.width, win.height);
+  }
+
+  rd::Array2D<T> ret(win.width, win.height);
+  for(int y=0;y<win.height;y++)
+    std::memcpy(&ret(0,y), cells + static_cast<size_t>(win.y0+y)*grid_width + win.x0, win.width*sizeof(T));
+
+  munmap(base, length);
+  return ret;
+}
+
+
+
+///Converts a latitude/longitude bounding box into a window of a raw grid,
+///using the coordinates stored in its header.
+static GridWindow RawWindowFromBounds(const std::string &filename, const double south, const double north, const double west, const double east){
+  const auto header = ReadRawHeader(filename);
+  if(std::isnan(header.lat0) || std::isnan(header.lon0) || std::isnan(header.dlat) || std::isnan(header.dlon))
+    throw std::runtime_error("Raw grid '" + filename + "' has no coordinates, so a bounding box can't be used with it!");
+
+  std::vector<double> lat(header.height);
+  std::vector<double> lon(header.width);
+  for(int y=0;y<header.height;y++)
+    lat[y] = header.lat0 + y*header.dlat;
+  for(int x=0;x<header.width;x++)
+    lon[x] = header.lon0 + x*header.dlon;
+
+  return WindowFromCoordinates(lat, lon, south, north, west, east, filename);
+}
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef _tile_cache_hpp_
+#define _tile_cache_hpp_
+
+#include "grid_window.hpp"
+#include "raw_grid.hpp"
+#include <richdem/common/Array2D.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace rd = richdem;
+
+///Counts of how a tiled grid's tiles were found, and of its disk traffic
+struct TileCacheStats {
+  uint64_t hits            = 0; ///< Tile was already in memory
+  uint64_t prefetch_hits   = 0; ///< Tile was being read in the background
+  uint64_t misses          = 0; ///< Tile had to be read while the caller waited
+  uint64_t bytes_read      = 0;
+  uint64_t bytes_written   = 0;
+  uint64_t peak_tiles      = 0; ///< Most tiles held in memory at once
+};
+
+
+
+///A raw grid (see raw_grid.hpp) which is read and written a tile at a time,
+///so that grids larger than memory can be worked on. At most `capacity`
+///tiles are held in memory; when another is needed the least recently used
+///one is dropped, and written back first if it was changed.
+///
+///Tiles are `tile_width` by `tile_height` cells, except at the right and top
+///edges of the grid, where they are cut short. Each is stored in memory in
+///row-major order. On disk the grid keeps the ordinary row-major layout of a
+///raw grid, so the files nc2raw writes can be used directly; a tile is read
+///with one pread() per row, or a single pread() if it spans whole rows.
+///
+///prefetch() starts reading a tile in the background, so that the disk can
+///work while the caller computes on tiles it already has.
+template<class T>
+class TiledRawGrid {
+ public:
+  ///@param filename    Raw grid holding cells of type T
+  ///@param tile_width  Width of a tile; -1 for the width of the grid
+  ///@param tile_height Height of a tile
+  ///@param capacity    Most tiles to hold in memory at once
+  ///@param writable    Whether tiles may be changed and written back
+  TiledRawGrid(
+    const std::string &filename,
+    const int          tile_width,
+    const int          tile_height,
+    const size_t       capacity,
+    const bool         writable
+  ) : filename(filename), capacity(std::max<size_t>(capacity,1)) {
+    const auto header = ReadRawHeader(filename);
+    if(header.type!=static_cast<uint32_t>(RawGridTypeOf<T>::value) || header.elem_size!=sizeof(T))
+      throw std::runtime_error("Raw grid '" + filename + "' does not hold the type expected!");
+    w       = header.width;
+    h       = header.height;
+    payload = header.payload;
+    tw      = (tile_width==-1) ? w : std::min(tile_width, w);
+    th      = std::min(tile_height, h);
+    if(tw<=0 || th<=0)
+      throw std::runtime_error("Tiles must be at least one cell in size!");
+    tiles_x = (w+tw-1)/tw;
+    tiles_y = (h+th-1)/th;
+
+    fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if(fd==-1)
+      throw std::runtime_error("Failed to open file '" + filename + "'!");
+  }
+
+  ~TiledRawGrid(){
+    //Background reads use the file, so they must finish before it is closed
+    for(auto &p: pending)
+      p.second.wait();
+    if(fd!=-1)
+      close(fd);
+  }
+
+  TiledRawGrid(const TiledRawGrid&)            = delete;
+  TiledRawGrid& operator=(const TiledRawGrid&) = delete;
+
+  int width()  const { return w; }
+  int height() const { return h; }
+  int tilesX() const { return tiles_x; }
+  int tilesY() const { return tiles_y; }
+
+  const std::string& file() const { return filename; }
+  TileCacheStats stats() const {
+    TileCacheStats ret = counts;
+    ret.bytes_read = bytes_read;
+    return ret;
+  }
+
+  ///Cells of the grid covered by a tile
+  GridWindow tileWindow(const int tx, const int ty) const {
+    GridWindow win;
+    win.x0     = tx*tw;
+    win.y0     = ty*th;
+    win.width  = std::min(tw, w-win.x0);
+    win.height = std::min(th, h-win.y0);
+    return win;
+  }
+
+  ///The cells of a tile, read from disk if they are not in memory. The
+  ///pointer is valid until another tile of this grid is requested.
+  const T* tile(const int tx, const int ty){
+    return fetch(tx, ty, true)->cells.data();
+  }
+
+  ///The cells of a tile, to be changed. The tile is written back to disk when
+  ///it is dropped from memory or flush() is called.
+  ///@param read  If false, the tile's current cells are not read, as the
+  ///             caller will overwrite all of them
+  T* mutableTile(const int tx, const int ty, const bool read=true){
+    auto *const t = fetch(tx, ty, read);
+    t->dirty = true;
+    return t->cells.data();
+  }
+
+  ///Starts reading a tile in the background, unless it is already in memory
+  ///or on its way
+  void prefetch(const int tx, const int ty){
+    if(tx<0 || ty<0 || tx>=tiles_x || ty>=tiles_y)
+      return;
+    const int64_t key = index(tx, ty);
+    if(lookup.count(key) || pending.count(key))
+      return;
+    const GridWindow win = tileWindow(tx, ty);
+    pending.emplace(key, std::async(std::launch::async, [this,win](){
+      return readCells(win);
+    }));
+  }
+
+  ///Writes every changed tile in memory back to disk
+  void flush(){
+    for(auto &t: tiles)
+      if(t.dirty){
+        writeCells(tileWindow(t.tx, t.ty), t.cells);
+        t.dirty = false;
+      }
+  }
+
+  ///Copies the cells of `window`, which may span several tiles, into `out`
+  ///starting at (out_x0,out_y0)
+  void readWindow(const GridWindow &window, rd::Array2D<T> &out, const int out_x0=0, const int out_y0=0){
+    const int tx0 = window.x0/tw, tx1 = (window.x0+window.width -1)/tw;
+    const int ty0 = window.y0/th, ty1 = (window.y0+window.height-1)/th;
+    for(int ty=ty0;ty<=ty1;ty++)
+    for(int tx=tx0;tx<=tx1;tx++){
+      const GridWindow tile_win = tileWindow(tx, ty);
+      const T *const cells = tile(tx, ty);
+      const int x0 = std::max(window.x0, tile_win.x0), x1 = std::min(window.x0+window.width,  tile_win.x0+tile_win.width);
+      const int y0 = std::max(window.y0, tile_win.y0), y1 = std::min(window.y0+window.height, tile_win.y0+tile_win.height);
+      for(int y=y0;y<y1;y++)
+      for(int x=x0;x<x1;x++)
+        out(out_x0+x-window.x0, out_y0+y-window.y0) = cells[static_cast<size_t>(y-tile_win.y0)*tile_win.width + (x-tile_win.x0)];
+    }
+  }
+
+ private:
+  struct Tile {
+    int            tx;
+    int            ty;
+    bool           dirty = false;
+    std::vector<T> cells;
+  };
+
+  int64_t index(const int tx, const int ty) const {
+    return static_cast<int64_t>(ty)*tiles_x+tx;
+  }
+
+  Tile* fetch(const int tx, const int ty, const bool read){
+    if(tx<0 || ty<0 || tx>=tiles_x || ty>=tiles_y)
+      throw std::runtime_error("Tile is outside the grid of '" + filename + "'!");
+    const int64_t key = index(tx, ty);
+
+    //Most recently used tiles are kept at the front of the list
+    const auto found = lookup.find(key);
+    if(found!=lookup.end()){
+      counts.hits++;
+      tiles.splice(tiles.begin(), tiles, found->second);
+      return &tiles.front();
+    }
+
+    while(tiles.size()>=capacity){
+      auto &victim = tiles.back();
+      if(victim.dirty)
+        writeCells(tileWindow(victim.tx, victim.ty), victim.cells);
+      lookup.erase(index(victim.tx, victim.ty));
+      tiles.pop_back();
+    }
+
+    Tile t;
+    t.tx = tx;
+    t.ty = ty;
+    const auto in_flight = pending.find(key);
+    if(in_flight!=pending.end()){
+      counts.prefetch_hits++;
+      t.cells = in_flight->second.get();
+      pending.erase(in_flight);
+    } else if(read){
+      counts.misses++;
+      t.cells = readCells(tileWindow(tx, ty));
+    } else {
+      const auto win = tileWindow(tx, ty);
+      t.cells.resize(static_cast<size_t>(win.width)*win.height);
+    }
+
+    tiles.push_front(std::move(t));
+    lookup[key] = tiles.begin();
+    counts.peak_tiles = std::max<uint64_t>(counts.peak_tiles, tiles.size());
+    return &tiles.front();
+  }
+
+  //Offset in the file of cell (x,y)
+  off_t offset(const int x, const int y) const {
+    return static_cast<off_t>(payload + (static_cast<uint64_t>(y)*w + x)*sizeof(T));
+  }
+
+  //Called from background threads, so this touches nothing but the file
+  std::vector<T> readCells(const GridWindow &win){
+    std::vector<T> cells(static_cast<size_t>(win.width)*win.height);
+    //A tile of whole rows is contiguous on disk
+    const int rows_per_read = (win.width==w) ? win.height : 1;
+    for(int y=0;y<win.height;y+=rows_per_read){
+      const size_t bytes = static_cast<size_t>(win.width)*rows_per_read*sizeof(T);
+      if(pread(fd, cells.data()+static_cast<size_t>(y)*win.width, bytes, offset(win.x0, win.y0+y))!=static_cast<ssize_t>(bytes))
+        throw std::runtime_error("Failed to read a tile of '" + filename + "'!");
+    }
+    bytes_read += cells.size()*sizeof(T);
+    return cells;
+  }
+
+  void writeCells(const GridWindow &win, const std::vector<T> &cells){
+    const int rows_per_write = (win.width==w) ? win.height : 1;
+    for(int y=0;y<win.height;y+=rows_per_write){
+      const size_t bytes = static_cast<size_t>(win.width)*rows_per_write*sizeof(T);
+      if(pwrite(fd, cells.data()+static_cast<size_t>(y)*win.width, bytes, offset(win.x0, win.y0+y))!=static_cast<ssize_t>(bytes))
+        throw std::runtime_error("Failed to write a tile of '" + filename + "'!");
+    }
+    counts.bytes_written += cells.size()*sizeof(T);
+  }
+
+  std::string filename;
+  size_t      capacity;
+  int         fd      = -1;
+  int         w       = 0;
+  int         h       = 0;
+  uint64_t    payload = 0;
+  int         tw      = 0;
+  int         th      = 0;
+  int         tiles_x = 0;
+  int         tiles_y = 0;
+
+  std::list<Tile>                                                 tiles;
+  std::unordered_map<int64_t, typename std::list<Tile>::iterator> lookup;
+  std::map<int64_t, std::future<std::vector<T>>>                 pending;
+  TileCacheStats                                                  counts;
+  std::atomic<uint64_t>                                           bytes_read{0};
+};
+
+#endif